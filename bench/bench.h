@@ -0,0 +1,22 @@
+#ifndef BENCH_H_3C6E1F0A92D4B7
+#define BENCH_H_3C6E1F0A92D4B7
+
+#include <stddef.h>
+
+// A benchmark runs its operation n times. It is called with growing n until it takes long
+// enough to time.
+typedef struct Bench {
+  const char* name;
+  void (*code)(size_t n);
+} Bench;
+
+// Restarts the clock, so that setup done before the loop isn't counted.
+void bench_start();
+// Sets the number of bytes each operation processes, so that a rate is reported too.
+void bench_bytes(size_t bytes);
+
+#define VLIB_BENCH_SET(name) Bench _vlib_benches_##name[]
+#define VLIB_BENCH(name) {#name, name}
+#define VLIB_BENCH_END {NULL, NULL}
+
+#endif /* BENCH_H_3C6E1F0A92D4B7 */
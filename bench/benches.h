@@ -0,0 +1,7 @@
+
+#ifndef BENCHES
+#error "benches.h should not be included directly"
+#endif
+
+BENCHES(rich);
+BENCHES(rpc);
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <vlib/time.h>
+#include <vlib/error.h>
+
+#include "bench.h"
+
+#define BENCHES(name) extern VLIB_BENCH_SET(name)
+#include "benches.h"
+#undef BENCHES
+
+static Time started;
+static size_t bytes_per_op;
+
+void bench_start() {
+  started = time_now_monotonic();
+}
+void bench_bytes(size_t bytes) {
+  bytes_per_op = bytes;
+}
+
+static void run(Bench* b) {
+  Duration elapsed;
+  size_t n = 1;
+  for (;;) {
+    bytes_per_op = 0;
+    bench_start();
+    b->code(n);
+    elapsed = time_diff(started, time_now_monotonic());
+    if (elapsed >= TIME_SECOND / 2 || n >= (size_t)1 << 30) break;
+    // Aim a little past the target, so that the next run is usually the last
+    size_t next = elapsed > 0 ? (double)n * TIME_SECOND * 0.6 / elapsed : n * 100;
+    n = next > n * 100 ? n * 100 : next > n ? next : n + 1;
+  }
+
+  double ns = (double)elapsed / n;
+  printf("  %-32s %10zu %12.0f ns/op", b->name, n, ns);
+  if (bytes_per_op) printf(" %10.1f MB/s", bytes_per_op * 1e3 / ns);
+  printf("\n");
+}
+
+static void run_set(const char* name, Bench benches[], const char* filter) {
+  printf("%s\n", name);
+  for (unsigned i = 0; benches[i].name; i++) {
+    if (filter && !strstr(benches[i].name, filter)) continue;
+    TRY {
+      run(&benches[i]);
+    } CATCH(err) {
+      printf("  %-32s FAILED: %s\n", benches[i].name, verr_msg(err));
+    } ETRY
+  }
+}
+
+// Runs every benchmark, or those whose name contains the first argument
+int main(int argc, char** argv) {
+  const char* filter = argc > 1 ? argv[1] : NULL;
+#define BENCHES(name) run_set(#name, _vlib_benches_##name, filter)
+#include "benches.h"
+#undef BENCHES
+  return 0;
+}
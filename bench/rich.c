@@ -0,0 +1,157 @@
+#include <stdlib.h>
+
+#include <vlib/io.h>
+#include <vlib/rich.h>
+#include <vlib/rich_json.h>
+#include <vlib/rich_schema.h>
+
+#include "bench.h"
+
+/* Documents */
+
+enum {
+  CHAIN_DEPTH = 64,
+  CHAINS = 16,
+  LEAVES = 8,
+  STRUCT_DEPTH = 32,
+};
+
+// Returns the document written by fn, encoded with a codec
+static Bytes encode(rich_Codec* codec, void (*fn)(rich_Sink* to)) {
+  Output* out = string_output_new(4096);
+  rich_Sink* sink = call(codec, new_sink, out);
+  fn(sink);
+  Bytes encoded, doc;
+  encoded.ptr = (void*)string_output_data(out, &encoded.size);
+  bytes_init(&doc, encoded.size);
+  bytes_copy(&doc, &encoded);
+  call(sink, close);
+  return doc;
+}
+
+// CHAINS arrays, each nested CHAIN_DEPTH deep with LEAVES integers at the bottom
+static void write_chains(rich_Sink* to) {
+  call(to, sink, RICH_ARRAY, NULL);
+  for (int c = 0; c < CHAINS; c++) {
+    for (int d = 0; d < CHAIN_DEPTH; d++) call(to, sink, RICH_ARRAY, NULL);
+    for (int64_t i = 0; i < LEAVES; i++) call(to, sink, RICH_INT, &i);
+    for (int d = 0; d < CHAIN_DEPTH; d++) call(to, sink, RICH_ENDARRAY, NULL);
+  }
+  call(to, sink, RICH_ENDARRAY, NULL);
+}
+static rich_Schema* chains_schema() {
+  rich_Schema* schema = rich_schema_int64;
+  for (int d = 0; d <= CHAIN_DEPTH; d++) schema = rich_schema_vector(schema);
+  return schema;
+}
+
+// Arrays nested as deeply as sources allow
+static void write_deep(rich_Sink* to) {
+  for (int d = 0; d < RICH_MAX_DEPTH; d++) call(to, sink, RICH_ARRAY, NULL);
+  for (int d = 0; d < RICH_MAX_DEPTH; d++) call(to, sink, RICH_ENDARRAY, NULL);
+}
+
+// Structs linked through pointers, STRUCT_DEPTH deep
+data(Level) {
+  int64_t   id;
+  Bytes     name;
+  Level*    next;
+};
+static void write_levels(rich_Sink* to) {
+  Bytes name = {.ptr = "level", .size = 5};
+  for (int64_t d = 0; d < STRUCT_DEPTH; d++) {
+    call(to, sink, RICH_MAP, NULL);
+    Bytes key = {.ptr = "id", .size = 2};
+    call(to, sink, RICH_KEY, &key);
+    call(to, sink, RICH_INT, &d);
+    key = (Bytes){.ptr = "name", .size = 4};
+    call(to, sink, RICH_KEY, &key);
+    call(to, sink, RICH_STRING, &name);
+    if (d + 1 < STRUCT_DEPTH) {
+      key = (Bytes){.ptr = "next", .size = 4};
+      call(to, sink, RICH_KEY, &key);
+    }
+  }
+  for (int d = 0; d < STRUCT_DEPTH; d++) call(to, sink, RICH_ENDMAP, NULL);
+}
+static rich_Schema* levels_schema() {
+  // The innermost level has no next field
+  rich_Schema* schema = NULL;
+  for (int d = 0; d < STRUCT_DEPTH; d++) {
+    rich_Schema* level = rich_schema_struct(sizeof(Level));
+    RICH_ADD_FIELD(level, Level, id, rich_schema_int64);
+    RICH_ADD_FIELD(level, Level, name, rich_schema_bytes);
+    if (schema) RICH_ADD_FIELD(level, Level, next, rich_schema_pointer(schema));
+    schema = level;
+  }
+  return schema;
+}
+
+/* Decoding */
+
+// Decodes doc n times into a value bound to schema, reusing the sink as a server would
+static void decode(rich_Codec* codec, void (*fn)(rich_Sink* to), rich_Schema* schema, size_t n) {
+  Bytes doc = encode(codec, fn);
+  void* value = calloc(1, call(schema, data_size));
+  rich_Sink* sink = rich_bind_sink(schema, value);
+  bench_bytes(doc.size);
+  bench_start();
+  for (size_t i = 0; i < n; i++) {
+    rich_Source* source = call(codec, new_source, memory_input_new(doc.ptr, doc.size));
+    call(source, read_value, sink);
+    call(source, close);
+  }
+  call(sink, close);
+  free(value);
+  bytes_close(&doc);
+}
+
+static void decode_chains_binary(size_t n) {
+  decode(rich_codec_binary, write_chains, chains_schema(), n);
+}
+static void decode_chains_json(size_t n) {
+  decode(rich_codec_json, write_chains, chains_schema(), n);
+}
+static void decode_deep_binary(size_t n) {
+  decode(rich_codec_binary, write_deep, rich_schema_discard, n);
+}
+static void decode_deep_json(size_t n) {
+  decode(rich_codec_json, write_deep, rich_schema_discard, n);
+}
+static void decode_levels_binary(size_t n) {
+  decode(rich_codec_binary, write_levels, levels_schema(), n);
+}
+static void decode_levels_json(size_t n) {
+  decode(rich_codec_json, write_levels, levels_schema(), n);
+}
+
+// The same struct chain through a compiled decoder, for comparison with the bound sink
+static void decode_levels_compiled(size_t n) {
+  rich_Schema* schema = levels_schema();
+  rich_Compiled* compiled = rich_schema_compile(schema);
+  Bytes doc = encode(rich_codec_binary, write_levels);
+  Level value = {};
+  call(schema, reset_value, &value);
+  bench_bytes(doc.size);
+  bench_start();
+  for (size_t i = 0; i < n; i++) {
+    Input* in = memory_input_new(doc.ptr, doc.size);
+    rich_compiled_decode_binary(compiled, in, &value);
+    call(in, close);
+  }
+  call(schema, close_value, &value);
+  rich_compiled_close(compiled);
+  call(schema, close);
+  bytes_close(&doc);
+}
+
+VLIB_BENCH_SET(rich) = {
+  VLIB_BENCH(decode_chains_binary),
+  VLIB_BENCH(decode_chains_json),
+  VLIB_BENCH(decode_deep_binary),
+  VLIB_BENCH(decode_deep_json),
+  VLIB_BENCH(decode_levels_binary),
+  VLIB_BENCH(decode_levels_json),
+  VLIB_BENCH(decode_levels_compiled),
+  VLIB_BENCH_END
+};
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <vlib/net.h>
+#include <vlib/rpc.h>
+#include <vlib/thread.h>
+
+#include "bench.h"
+
+/* Server */
+
+static void echo_method(void* udata, void* args, void* result) {
+  bytes_copy(result, args);
+}
+
+data(Server) {
+  BinaryRPC*      backend;
+  NetListener*    listener;
+  RPC_TCPServer   tcp[1];
+  thread_t        thread;
+  char            addr[32];
+};
+
+static void* serve_thread(void* server) {
+  verr_thread_init();
+  rpc_tcp_serve(server);
+  verr_thread_cleanup();
+  return NULL;
+}
+
+// Serves an echo method over TCP on a free local port
+static void server_start(Server* self) {
+  RPC* service = rpc_service_new(NULL, NULL);
+  rpc_add(service, "echo", echo_method, rich_schema_bytes, rich_schema_bytes);
+  self->backend = rpc_to_binary(service, rich_codec_binary);
+  self->listener = net_listen_tcp("127.0.0.1:0");
+  snprintf(self->addr, sizeof(self->addr), "127.0.0.1:%u", net_listener_port(self->listener));
+  rpc_tcp_init(self->tcp, self->listener, self->backend);
+  self->thread = thread_spawn(serve_thread, self->tcp);
+}
+static void server_stop(Server* self) {
+  rpc_tcp_stop(self->tcp);
+  thread_join(self->thread);
+  call(self->listener, close);
+  call(self->backend, close);
+}
+
+/* Calls */
+
+// Makes n blocking calls, one at a time, echoing size bytes
+static void blocking_calls(size_t size, size_t n) {
+  Server server[1];
+  server_start(server);
+  RPC_Client client[1];
+  rpc_init(client, rpc_from_binary(rpc_tcp_new(server->addr), rich_codec_binary));
+  int echo = rpc_register(client, "echo", rich_schema_bytes, rich_schema_bytes);
+  Bytes args, result = {};
+  bytes_init(&args, size);
+  memset(args.ptr, 'x', size);
+  args.size = size;
+
+  // The first call opens the connection
+  rpc_call(client, echo, &args, &result);
+  bench_bytes(size);
+  bench_start();
+  for (size_t i = 0; i < n; i++) {
+    rpc_call(client, echo, &args, &result);
+  }
+
+  rpc_close(client);
+  server_stop(server);
+  bytes_close(&args);
+  bytes_close(&result);
+}
+
+static void tcp_call_16(size_t n) {
+  blocking_calls(16, n);
+}
+static void tcp_call_4k(size_t n) {
+  blocking_calls(4 << 10, n);
+}
+static void tcp_call_256k(size_t n) {
+  blocking_calls(256 << 10, n);
+}
+
+// Makes n calls through an RPC_Channel, keeping up to `window` of them in flight
+static void channel_calls(size_t size, unsigned window, size_t n) {
+  Server server[1];
+  server_start(server);
+  NetConn* conn = net_connect_tcp(server->addr, NULL);
+  RPC_Channel* channel = rpc_channel_new(conn->input, conn->output, rich_codec_binary);
+  Bytes args;
+  bytes_init(&args, size);
+  memset(args.ptr, 'x', size);
+  args.size = size;
+  rich_Source* source = rich_bind_source(rich_schema_bytes, &args);
+  Bytes results[window];
+  rich_Sink* sinks[window];
+  RPC_Future* futures[window];
+  for (unsigned i = 0; i < window; i++) {
+    results[i] = (Bytes){};
+    sinks[i] = rich_bind_sink(rich_schema_bytes, &results[i]);
+  }
+
+  bench_bytes(size);
+  bench_start();
+  for (size_t i = 0; i < n; i++) {
+    unsigned slot = i % window;
+    if (i >= window) rpc_future_wait(futures[slot]);
+    futures[slot] = rpc_channel_start(channel, "echo", source, sinks[slot]);
+  }
+  for (size_t i = n > window ? n - window : 0; i < n; i++) {
+    rpc_future_wait(futures[i % window]);
+  }
+
+  call(rpc_channel_rpc(channel), close);
+  call(conn, close);
+  server_stop(server);
+  call(source, close);
+  for (unsigned i = 0; i < window; i++) {
+    call(sinks[i], close);
+    bytes_close(&results[i]);
+  }
+  bytes_close(&args);
+}
+
+static void channel_call_16(size_t n) {
+  channel_calls(16, 64, n);
+}
+static void channel_call_4k(size_t n) {
+  channel_calls(4 << 10, 64, n);
+}
+
+VLIB_BENCH_SET(rpc) = {
+  VLIB_BENCH(tcp_call_16),
+  VLIB_BENCH(tcp_call_4k),
+  VLIB_BENCH(tcp_call_256k),
+  VLIB_BENCH(channel_call_16),
+  VLIB_BENCH(channel_call_4k),
+  VLIB_BENCH_END
+};
@@ -0,0 +1,34 @@
+#ifndef VLIB_ARENA_H
+#define VLIB_ARENA_H
+
+#include <stddef.h>
+
+#include <vlib/std.h>
+
+// A region allocator. Memory is handed out from large blocks by bumping a pointer, and is only
+// ever freed all at once, by arena_reset or arena_close.
+typedef struct ArenaBlock ArenaBlock;
+
+data(Arena) {
+  ArenaBlock* blocks;     // most recent first
+  char*       ptr;        // free space in the current block
+  char*       end;
+  size_t      block_size;
+};
+
+void    arena_init(Arena* self, size_t block_size);
+void    arena_close(Arena* self);
+// Frees everything allocated from the arena. The largest block is kept, so an arena that is
+// reset between uses of a similar size stops allocating.
+void    arena_reset(Arena* self);
+
+// Returns memory aligned for any type. Raises VERR_NOMEM if the memory can't be allocated.
+void*   arena_alloc(Arena* self, size_t size);
+void*   arena_calloc(Arena* self, size_t size);
+// Grows an allocation. It is extended in place if it is the most recent one and there is room,
+// otherwise it is copied and the old memory stays unused until the arena is reset.
+void*   arena_realloc(Arena* self, void* ptr, size_t old_size, size_t new_size);
+// Copies size bytes from src, which may be NULL if size is 0.
+void*   arena_memdup(Arena* self, const void* src, size_t size);
+
+#endif
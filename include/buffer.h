@@ -11,7 +11,8 @@ data(Buffer) {
   size_t  size;
   size_t  read;
   size_t  write;
-  char    data[0];
+  bool    pooled;   // handed out by buffer_pool_get, so it counts against the pool budget
+  char    data[0] __attribute__((aligned(sizeof(void*))));
 };
 
 Buffer*   buffer_new(size_t cap);
@@ -32,5 +33,28 @@ void      buffer_flush(Buffer* self, Output* out);
 
 void      buffer_reset(Buffer* self);
 
+/* Buffer pool */
+
+// Pooled buffers come in power-of-two size classes. Each thread keeps a small cache of free
+// buffers in front of a global, locked pool.
+enum {
+  BUFFER_POOL_MIN = 512,
+  BUFFER_POOL_MAX = 1 << 20,
+};
+
+// Returns a buffer that can hold at least `cap` bytes (up to BUFFER_POOL_MAX), unless the pool
+// budget has been exceeded, in which case a BUFFER_POOL_MIN sized buffer is returned instead.
+Buffer*   buffer_pool_get(size_t cap);
+// Returns a buffer to the pool. Buffers that do not fit a size class are simply freed.
+void      buffer_pool_put(Buffer* buf);
+
+// Sets the number of bytes that buffers handed out by the pool may occupy before new buffers are
+// shrunk to the minimum size. Zero (the default) means no limit.
+void      buffer_pool_budget(size_t max_bytes);
+// Sets the maximum number of bytes kept in free buffers by the global pool.
+void      buffer_pool_limit(size_t max_bytes);
+// Frees all buffers in the global pool and the calling thread's cache.
+void      buffer_pool_trim();
+
 #endif /* BUFFER_H_692089ACEF85E3 */
 
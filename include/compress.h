@@ -0,0 +1,51 @@
+#ifndef VLIB_COMPRESS_H
+#define VLIB_COMPRESS_H
+
+#include <vlib/std.h>
+#include <vlib/io.h>
+
+/**
+ * Streaming compression adapters.
+ *
+ * Each *_output_new() function returns an Output that compresses data written to it and writes
+ * the result to `wrap`. Flushing the Output flushes the compressor, so that everything written
+ * so far can be decompressed by the other side; closing it finishes the stream and closes
+ * `wrap`. Each *_input_new() function returns an Input that decompresses data read from `wrap`.
+ *
+ * Individual writes are passed straight to the compressor, so wrap the Output with
+ * buf_output_new() when writing lots of small pieces.
+ *
+ * A dictionary may be passed as NULL. Otherwise it must stay valid until the stream is closed,
+ * and the same dictionary must be used on both sides.
+ */
+
+#ifdef VLIB_ENABLE_ZLIB
+
+// level is 0-9, or -1 for the default compression level.
+Output*   gzip_output_new(Output* wrap, int level);
+Input*    gzip_input_new(Input* wrap);
+
+// Same as gzip, but using the zlib format (which supports dictionaries).
+Output*   zlib_output_new(Output* wrap, int level, const Bytes* dict);
+Input*    zlib_input_new(Input* wrap, const Bytes* dict);
+
+#endif
+
+#ifdef VLIB_ENABLE_LZ4
+
+// Uses the LZ4 frame format. level is 0 for fast compression, or 3-12 for LZ4 HC. Dictionaries
+// need lz4 1.10 or newer; with older versions, passing one raises VERR_ARGUMENT.
+Output*   lz4_output_new(Output* wrap, int level, const Bytes* dict);
+Input*    lz4_input_new(Input* wrap, const Bytes* dict);
+
+#endif
+
+#ifdef VLIB_ENABLE_ZSTD
+
+// level is 1-22, or 0 for the default compression level.
+Output*   zstd_output_new(Output* wrap, int level, const Bytes* dict);
+Input*    zstd_input_new(Input* wrap, const Bytes* dict);
+
+#endif
+
+#endif
@@ -22,6 +22,8 @@ void  coroutine_close(Coroutine* self);
 // the state's user data. Returns a pointer to the user data.
 void* coroutine_push(Coroutine* self, co_State* state, size_t udata_size);
 void  coroutine_pop(Coroutine* self);
+// Returns the user data of the state on top of the stack, and sets `state` to that state.
+void* coroutine_top(Coroutine* self, co_State** state);
 
 void  coroutine_run(Coroutine* self, void* arg);
 
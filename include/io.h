@@ -7,6 +7,8 @@
 #include <string.h>
 #include <stdarg.h>
 
+#include <sys/uio.h>
+
 #include <vlib/std.h>
 #include <vlib/error.h>
 
@@ -62,6 +64,22 @@ int16_t     io_get_int16(Input* in);
 int32_t     io_get_int32(Input* in);
 int64_t     io_get_int64(Input* in);
 
+// Bulk versions of the above. Integers are big-endian, like the single integer functions, except
+// for the *_le variants which use little-endian byte order.
+void        io_put_int16_array(Output* out, const int16_t* src, size_t count);
+void        io_put_int32_array(Output* out, const int32_t* src, size_t count);
+void        io_put_int64_array(Output* out, const int64_t* src, size_t count);
+void        io_put_int16_array_le(Output* out, const int16_t* src, size_t count);
+void        io_put_int32_array_le(Output* out, const int32_t* src, size_t count);
+void        io_put_int64_array_le(Output* out, const int64_t* src, size_t count);
+
+void        io_get_int16_array(Input* in, int16_t* dst, size_t count);
+void        io_get_int32_array(Input* in, int32_t* dst, size_t count);
+void        io_get_int64_array(Input* in, int64_t* dst, size_t count);
+void        io_get_int16_array_le(Input* in, int16_t* dst, size_t count);
+void        io_get_int32_array_le(Input* in, int32_t* dst, size_t count);
+void        io_get_int64_array_le(Input* in, int64_t* dst, size_t count);
+
 /* Formatting */
 
 data(IOFormatter) {
@@ -80,17 +98,38 @@ void        io_vformat(IOFormatter* self, const char* fmt, va_list ap);
 
 Input*      buf_input_new(Input* wrap, size_t buffer_size);
 void        buf_input_reset(Input* self, Input* wrap);
+// Points *data at the buffered, unread data of a buffered input, reading more first if there is
+// none. *size is 0 at the end of the input. Returns false if `in` is any other kind of Input. Use
+// buf_input_skip to mark data as read; the data stays valid until then.
+bool        buf_input_window(Input* in, const char** data, size_t* size);
+void        buf_input_skip(Input* buf_input, size_t n);
 
 Output*     buf_output_new(Output* wrap, size_t buffer_size);
 void        buf_output_reset(Output* self, Output* wrap);
 
 Output*     string_output_new(size_t initcap);
+size_t      string_output_size(Output* string_output);
+// Returns the written data as one contiguous, null-terminated block, collapsing the internal pieces
+// if necessary. The terminating null byte is not included in size.
 const char* string_output_data(Output* string_output, size_t* size);
 void        string_output_rewind(Output* string_output, size_t new_offset);
+// Discards all written data. Allocated memory is kept and reused for subsequent writes.
 void        string_output_reset(Output* string_output);
 
+// Iterates through the written data in order, one contiguous segment at a time, without
+// collapsing anything. If callback returns false then iteration stops.
+void        string_output_segments(Output* string_output, bool (*callback)(const char* data, size_t size));
+// Fills in at most `max` iovecs (eg. for writev) and returns the total number of segments.
+size_t      string_output_iovec(Output* string_output, struct iovec* iov, size_t max);
+// Writes all data to another Output, segment by segment.
+void        string_output_copy(Output* string_output, Output* to);
+
 Input*      memory_input_new(const char* src, size_t sz);
 void        memory_input_reset(Input* memory_input, const char* src, size_t sz);
+// Points *data at the unread data of a memory input without copying it. Returns false if `in` is
+// any other kind of Input. Use memory_input_skip to mark data as read.
+bool        memory_input_remaining(Input* in, const char** data, size_t* size);
+void        memory_input_skip(Input* memory_input, size_t n);
 
 Output*     memory_output_new(void* dst, size_t sz);
 void        memory_output_reset(Output* memory_output, void* dst, size_t sz);
@@ -19,6 +19,10 @@ void net_register_errors() __attribute__((constructor));
 data(NetConn_Impl) {
   void  (*close)(void* self);
   void  (*set_timeout)(void* self, unsigned seconds);
+  // Writes all of the buffers, bypassing `output`, in as few system calls as possible
+  void  (*writev)(void* self, const struct iovec* iov, int count);
+  // Makes pending and future reads see EOF, and the peer see EOF, without freeing the connection
+  void  (*shutdown)(void* self);
 };
 
 data(NetConn) {
@@ -29,10 +33,14 @@ data(NetConn) {
 
 interface(NetListener) {
   NetConn*  (*accept)(void* self);
+  // Makes pending and future calls to accept raise VERR_NET
+  void      (*shutdown)(void* self);
   void      (*close)(void* self);
 };
 
+// Listens on addr (node:service). Service 0 picks a free port, which net_listener_port returns.
 NetListener*  net_listen_tcp(const char* addr);
+unsigned      net_listener_port(NetListener* tcp_listener);
 NetConn*      net_connect_tcp(const char* addr, const char* bind);
 
 #endif /* NET_H_FA4D5B9E6863EB */
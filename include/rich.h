@@ -24,12 +24,92 @@ typedef enum {
   RICH_ENDMAP,    // no data
 } rich_Atom;
 
+// Sources raise VERR_MALFORMED for data nested deeper than this, rather than letting hostile
+// input exhaust the stack
+enum { RICH_MAX_DEPTH = 1000 };
+
+// Element types of packed numeric arrays
+typedef enum {
+  RICH_PACKED_INT64,
+  RICH_PACKED_DOUBLE,
+  RICH_PACKED_INT32,
+  RICH_PACKED_UINT8,
+} rich_PackedType;
+
+static inline size_t rich_packed_size(rich_PackedType type) {
+  switch (type) {
+    case RICH_PACKED_INT32: return 4;
+    case RICH_PACKED_UINT8: return 1;
+    default:                return 8;
+  }
+}
+// Converts elements between packed types. Integers can be converted to any integer type, and
+// raise VERR_MALFORMED if they are out of range; doubles cannot be converted at all.
+void rich_packed_convert(rich_PackedType to_type, void* dst, rich_PackedType from_type, const void* src, size_t count);
+
+// A map key whose encodings are computed once, for keys that are written over and over (eg. the
+// field names of a struct schema).
+data(rich_Key) {
+  Bytes   name;
+  Bytes   json;     // quoted, escaped and followed by a colon
+  Bytes   binary;   // tagged and length-prefixed
+};
+
+// Refers to name without copying it.
+void rich_key_init(rich_Key* key, const Bytes* name);
+void rich_key_close(rich_Key* key);
+
 // Handles incoming rich data
 interface(rich_Sink) {
   void (*sink)(void* self, rich_Atom atom, void* atom_data);
   void (*close)(void* self);
+  // Optional. Equivalent to a RICH_KEY atom, but can write the key's precomputed encoding.
+  void (*sink_key)(void* self, const rich_Key* key);
+  // Optional. Equivalent to a whole array of numbers (RICH_ARRAY, a RICH_INT or RICH_FLOAT for
+  // each element and RICH_ENDARRAY), but can handle the elements all at once.
+  void (*sink_packed)(void* self, rich_PackedType type, const void* data, size_t count);
+  // Optional. Equivalent to a RICH_STRING atom, but the bytes stay valid and unchanged for as long
+  // as the source's input does (eg. the buffer of a memory input), so the sink can refer to them
+  // instead of copying them.
+  void (*sink_borrowed)(void* self, const Bytes* str);
+  // Optional. Sources may call it right after a RICH_KEY atom. If it returns true the sink has no
+  // use for the key's value, which the source can then skip without passing any of it on.
+  bool (*sink_skip)(void* self);
 };
 
+// Passes a packed array on as individual atoms.
+void rich_sink_packed_atoms(rich_Sink* sink, rich_PackedType type, const void* data, size_t count);
+// Passes the elements of a packed array on as atoms, followed by RICH_ENDARRAY.
+void rich_sink_packed_elements(rich_Sink* sink, rich_PackedType type, const void* data, size_t count);
+
+static inline void rich_sink_packed(rich_Sink* sink, rich_PackedType type, const void* data, size_t count) {
+  if (sink->_impl->sink_packed) {
+    call(sink, sink_packed, type, data, count);
+  } else {
+    rich_sink_packed_atoms(sink, type, data, count);
+  }
+}
+
+static inline void rich_sink_borrowed(rich_Sink* sink, const Bytes* str) {
+  if (sink->_impl->sink_borrowed) {
+    call(sink, sink_borrowed, str);
+  } else {
+    call(sink, sink, RICH_STRING, (void*)str);
+  }
+}
+
+static inline bool rich_sink_skip(rich_Sink* sink) {
+  return sink->_impl->sink_skip && call(sink, sink_skip);
+}
+
+static inline void rich_sink_key(rich_Sink* sink, const rich_Key* key) {
+  if (sink->_impl->sink_key) {
+    call(sink, sink_key, key);
+  } else {
+    call(sink, sink, RICH_KEY, (void*)&key->name);
+  }
+}
+
 // Reads rich data from some source and passes it to a rich_Sink
 interface(rich_Source) {
   void (*read_value)(void* self, rich_Sink* to);
@@ -45,6 +125,11 @@ interface(rich_Codec) {
 
 extern rich_Sink rich_debug_sink[1];
 
+// JSON sources read memory and buffered inputs (buf_input_new) only up to the end of each value.
+// Other inputs are read ahead in blocks, so the data after a value stays with the source for its
+// next read_value, and can't be read from the Input itself.
 extern rich_Codec rich_codec_json[1];
+// Compact binary encoding: tagged atoms with varint integers and length-prefixed strings
+extern rich_Codec rich_codec_binary[1];
 
 #endif /* RICH_H_E9E4E2E787721B */
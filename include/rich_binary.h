@@ -0,0 +1,53 @@
+#ifndef RICH_BINARY_H_71D3A0C85E2F49
+#define RICH_BINARY_H_71D3A0C85E2F49
+
+#include <vlib/rich.h>
+
+/**
+ * Wire format of rich_codec_binary
+ *
+ * Every atom starts with a single tag byte. Integers are followed by a zig-zag varint, floats
+ * by their 8-byte IEEE representation (big-endian, like io_put_int64), and strings and keys by
+ * a varint length and the raw bytes. Arrays and maps are written as start and end tags around
+ * their contents, since a sink does not know the number of elements up front.
+ *
+ * Packed numeric arrays are written as a tag, a byte holding the rich_PackedType, a varint
+ * element count and the elements in little-endian order.
+ */
+enum {
+  RICH_BTAG_NIL,
+  RICH_BTAG_FALSE,
+  RICH_BTAG_TRUE,
+  RICH_BTAG_INT,
+  RICH_BTAG_FLOAT,
+  RICH_BTAG_STRING,
+  RICH_BTAG_ARRAY,
+  RICH_BTAG_ENDARRAY,
+  RICH_BTAG_MAP,
+  RICH_BTAG_KEY,
+  RICH_BTAG_ENDMAP,
+  RICH_BTAG_PACKED,
+};
+
+// Inputs other than memory inputs can't tell how much data is left, so readers allocate for at
+// most this many bytes at a time and let a bogus length run into the end of the input.
+enum {
+  RICH_BINARY_CHUNK = 64 << 10,
+};
+
+// Reads the length and bytes of a string or key whose tag has been read. Raises VERR_EOF rather
+// than allocating for a length that runs past the end of the input.
+void    rich_binary_read_string(Input* in, Bytes* to);
+
+// Writes a packed array, including its tag.
+void    rich_binary_write_packed(Output* out, rich_PackedType type, const void* data, size_t count);
+// Reads the type and element count of a packed array whose tag has been read. Raises
+// VERR_MALFORMED for an unknown type or a count whose size in bytes overflows, and VERR_EOF for
+// a count larger than what is left of a memory input.
+size_t  rich_binary_read_packed_header(Input* in, rich_PackedType* type);
+// Reads the elements of a packed array into dst.
+void    rich_binary_read_packed_data(Input* in, rich_PackedType type, void* dst, size_t count);
+// Reads the elements of a packed array into a buffer that grows as they arrive.
+void    rich_binary_read_packed(Input* in, rich_PackedType type, size_t count, Bytes* to);
+
+#endif /* RICH_BINARY_H_71D3A0C85E2F49 */
@@ -0,0 +1,124 @@
+#ifndef RICH_JSON_H_4C1F0B7D2E9A36
+#define RICH_JSON_H_4C1F0B7D2E9A36
+
+#include <vlib/rich.h>
+#include <vlib/vector.h>
+#include <vlib/thread.h>
+
+/* Low-level output, for code that writes JSON without going through a rich_Sink */
+
+// Writes the decimal representation of i to buf, which must have room for 20 bytes.
+size_t            rich_json_format_int(char* buf, int64_t i);
+// Writes the shortest decimal that reads back as exactly the same float to buf, which must have
+// room for 32 bytes. NaN and infinities are not representable, and are written as null.
+size_t            rich_json_format_float(char* buf, double v);
+// Writes a quoted and escaped string.
+void              rich_json_write_string(Output* out, const Bytes* str);
+// Writes an array of numbers.
+void              rich_json_write_packed(Output* out, rich_PackedType type, const void* data, size_t count);
+
+/**
+ * Lazily parsed JSON documents
+ *
+ * rich_json_parse makes a single pass over a JSON document in memory and records the position of
+ * every value in a flat index (the "tape"). Values are only decoded when they are accessed, and
+ * whole subtrees can be skipped in constant time, which makes it cheap to pick a few fields out of
+ * a large document.
+ *
+ * The document refers to the source data, which must stay alive and unmodified until the document
+ * is closed.
+ */
+
+typedef struct rich_JSONDoc rich_JSONDoc;
+
+// Identifies a value within a document. Cursors are plain values and stay valid until the
+// document is closed.
+data(rich_JSONCursor) {
+  rich_JSONDoc* doc;
+  uint32_t      index;
+};
+
+// Indexes a JSON document. Raises VERR_MALFORMED if its structure is invalid or nested deeper than
+// RICH_MAX_DEPTH; numbers and strings are only checked when they are decoded.
+rich_JSONDoc*     rich_json_parse(const char* src, size_t size);
+void              rich_json_doc_close(rich_JSONDoc* doc);
+
+rich_JSONCursor   rich_json_root(rich_JSONDoc* doc);
+
+// Returns RICH_NIL, RICH_BOOL, RICH_INT, RICH_FLOAT, RICH_STRING, RICH_ARRAY or RICH_MAP.
+rich_Atom         rich_json_type(rich_JSONCursor c);
+
+// Returns the number of elements in an array or entries in a map.
+size_t            rich_json_length(rich_JSONCursor c);
+
+// Finds an entry in a map or an element of an array. Returns false if there is no such entry, or
+// if the value is not a map or an array respectively. Both take time linear in the position of the
+// entry, since the index only links each value to the next one; use rich_json_each to go through
+// all of them.
+bool              rich_json_find_key(rich_JSONCursor map, const char* key, rich_JSONCursor* result);
+bool              rich_json_find_bkey(rich_JSONCursor map, const Bytes* key, rich_JSONCursor* result);
+bool              rich_json_array_at(rich_JSONCursor array, size_t i, rich_JSONCursor* result);
+
+// Iterates through the elements of an array or the entries of a map, without decoding them. `key`
+// is NULL for arrays. If callback returns false then iteration stops.
+void              rich_json_each(rich_JSONCursor c, bool (*callback)(const Bytes* key, rich_JSONCursor value));
+
+// Decode scalar values. Raise VERR_MALFORMED if the value has a different type. The Bytes
+// returned by rich_json_get_string are only valid until the next call on the same document.
+bool              rich_json_get_bool(rich_JSONCursor c);
+int64_t           rich_json_get_int(rich_JSONCursor c);
+double            rich_json_get_float(rich_JSONCursor c);
+Bytes             rich_json_get_string(rich_JSONCursor c);
+
+// Decodes a value and everything inside it into a rich_Sink.
+void              rich_json_replay(rich_JSONCursor c, rich_Sink* to);
+
+/**
+ * Incremental parsing
+ *
+ * A rich_JSONParser is fed input in arbitrarily sized chunks as it arrives (eg. from a non-blocking
+ * socket) and passes atoms to its sink as soon as they are complete. Tokens that are split
+ * between chunks are resumed where they left off. Any number of top-level values can be fed,
+ * separated by whitespace.
+ */
+
+typedef struct rich_JSONParser rich_JSONParser;
+
+rich_JSONParser*  rich_json_parser_new(rich_Sink* to);
+// Closes the parser, but not its sink.
+void              rich_json_parser_close(rich_JSONParser* parser);
+
+// Parses a chunk of input and returns the number of top-level values that were completed by it.
+// Raises VERR_MALFORMED on invalid input, after which the parser must be reset.
+size_t            rich_json_parser_feed(rich_JSONParser* parser, const char* data, size_t size);
+// Signals the end of the input, which completes a trailing top-level number. Returns the number of
+// values completed, and raises VERR_EOF if the input ended in the middle of a value.
+size_t            rich_json_parser_finish(rich_JSONParser* parser);
+// Discards any partially parsed value.
+void              rich_json_parser_reset(rich_JSONParser* parser);
+
+/**
+ * Newline-delimited JSON
+ *
+ * A rich_NDJSONReader decodes data with one JSON value per line (eg. a memory-mapped file) on a
+ * pool of threads. The data is split into line-aligned chunks which are decoded in parallel, and
+ * the results are delivered in order.
+ */
+
+typedef struct rich_NDJSONReader rich_NDJSONReader;
+
+rich_NDJSONReader*  rich_ndjson_reader_new(unsigned threads, size_t chunk_size);
+void                rich_ndjson_reader_close(rich_NDJSONReader* reader);
+
+// Decodes every non-blank line in src and returns the number of values decoded.
+//
+// For each chunk, open_chunk is called on a pool thread to create the sink that the chunk's
+// values are read into. Once a chunk is decoded, chunk_done is called on the calling thread with
+// the same sink, in chunk order. If a chunk cannot be decoded, chunk_done is still called for
+// every chunk whose sink was opened, and the first error is raised afterwards with its message.
+// If chunk_done raises, no more chunks are started, the sinks that were not delivered are closed,
+// and its error is raised.
+size_t              rich_ndjson_decode(rich_NDJSONReader* reader, const char* src, size_t size,
+                      rich_Sink* (*open_chunk)(size_t chunk), void (*chunk_done)(size_t chunk, rich_Sink* sink));
+
+#endif /* RICH_JSON_H_4C1F0B7D2E9A36 */
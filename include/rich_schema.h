@@ -4,12 +4,15 @@
 #include <vlib/rich.h>
 #include <vlib/coroutine.h>
 #include <vlib/resource.h>
+#include <vlib/arena.h>
 
 interface(rich_Schema) {
   size_t  (*data_size)(void* self);
   void    (*dump_value)(void* self, void* value, rich_Sink* to);
   void    (*reset_value)(void* self, void* value);
   void    (*close_value)(void* self, void* value);
+  // Pushes the states that decode a value onto a bound sink's coroutine. Built-in schemas decode
+  // with the sink's own frame stack instead, and only use the coroutine to find the sink.
   void    (*push_state)(void* self, Coroutine* co, void* value);
   void    (*close)(void* self);
 };
@@ -27,27 +30,114 @@ data(rich_SchemaArg) {
 rich_Source*  rich_bind_source(rich_Schema* schema, void* from);
 void          rich_rebind_source(rich_Source* source, void* new_from);
 rich_Sink*    rich_bind_sink(rich_Schema* schema, void* to);
+// Decodes values with all of their memory (strings, vectors and pointer targets) allocated from
+// an arena. Each value is zeroed before decoding instead of being reset, and is never closed; its
+// memory is released by resetting the arena. Raises VERR_ARGUMENT when decoding into a hashtable
+// or autovector, whose entries are always allocated individually.
+rich_Sink*    rich_bind_sink_arena(rich_Schema* schema, void* to, Arena* arena);
 void          rich_rebind_sink(rich_Sink* sink, void* new_to);
 
 extern rich_Schema  rich_schema_bool[1];
 extern rich_Schema  rich_schema_int64[1];
 extern rich_Schema  rich_schema_double[1];
 extern rich_Schema  rich_schema_bytes[1];
+// Uses Bytes objects that point straight into the source's input where it allows that (the JSON
+// and binary sources do for memory inputs, except for JSON strings with escapes), so they are
+// only valid for as long as the input's memory. Other strings are copied, and a cap of 0 marks
+// Bytes that do not own their memory.
+extern rich_Schema  rich_schema_borrowed[1];
 
+// Accepts any value and keeps none of it. Sources that support skipping (such as the JSON
+// source) skip map values decoded with it without passing them on.
 extern rich_Schema  rich_schema_discard[1];
 
 rich_Schema*        rich_schema_pointer(rich_Schema* to);
 rich_Schema*        rich_schema_optional(rich_Schema* wrap);
 
 rich_Schema*        rich_schema_vector(rich_Schema* of);
+// Uses AutoVector objects, which manage the elements' resources. Can't be decoded into an arena.
+rich_Schema*        rich_schema_autovector(rich_Schema* of);
 
-// Uses Bytes objects as keys.
+// Uses Bytes objects as keys. Hashtables allocate every entry themselves, so they can't be decoded
+// into an arena, and rich_bind_sink_arena and rich_compiled_decode_binary_arena raise
+// VERR_ARGUMENT when they reach one.
 rich_Schema*        rich_schema_hashtable(rich_Schema* of);
 
+// Uses Vector objects holding the numbers themselves (int64_t, double, int32_t or uint8_t), which
+// are passed to and from sinks as whole packed arrays. Integers that do not fit the element type
+// are rejected. Does not need to be closed.
+rich_Schema*        rich_schema_packed(rich_PackedType type);
+
 rich_Schema*        rich_schema_struct(size_t struct_size);
 void                rich_add_field(rich_Schema* self, Bytes name, size_t offset, rich_Schema* field_type);
 void                rich_add_cfield(rich_Schema* self, const char* name, size_t offset, rich_Schema* field_type);
 
 #define RICH_ADD_FIELD(schema, type, field, subschema) rich_add_cfield((schema), #field, offsetof(type, field), subschema)
 
+/* Introspection */
+
+typedef enum {
+  RICH_SCHEMA_CUSTOM,     // not one of the built-in schemas
+  RICH_SCHEMA_BOOL,
+  RICH_SCHEMA_INT64,
+  RICH_SCHEMA_DOUBLE,
+  RICH_SCHEMA_BYTES,
+  RICH_SCHEMA_BORROWED,
+  RICH_SCHEMA_DISCARD,
+  RICH_SCHEMA_POINTER,
+  RICH_SCHEMA_OPTIONAL,
+  RICH_SCHEMA_VECTOR,
+  RICH_SCHEMA_AUTOVECTOR,
+  RICH_SCHEMA_HASHTABLE,
+  RICH_SCHEMA_STRUCT,
+  RICH_SCHEMA_PACKED,
+} rich_SchemaKind;
+
+// Identifies a built-in schema, looking through unclosable wrappers.
+rich_SchemaKind     rich_schema_kind(rich_Schema* schema);
+// Returns the schema wrapped by a pointer, optional, vector, autovector or hashtable schema.
+rich_Schema*        rich_schema_inner(rich_Schema* schema);
+rich_PackedType     rich_schema_packed_type(rich_Schema* packed);
+// Iterates through the fields of a struct schema in order. If callback returns false then
+// iteration stops.
+void                rich_schema_fields(rich_Schema* schema, bool (*callback)(const Bytes* name, size_t offset, rich_Schema* field_type));
+data(rich_Field) {
+  rich_Key      key;
+  size_t        offset;
+  rich_Schema*  schema;
+};
+// Returns the fields of a struct schema in declaration order. The table is only valid until
+// another field is added.
+const rich_Field*   rich_schema_field_table(rich_Schema* schema, size_t* count);
+// Returns the position of a struct schema's field in declaration order, or -1 if there is no such
+// field. Uses the same hashed index as decoding.
+int                 rich_schema_field_index(rich_Schema* schema, const Bytes* name);
+
+/**
+ * Compiled schemas
+ *
+ * A compiled schema encodes values straight from memory to the JSON or binary wire formats, and
+ * decodes the binary format straight into memory, without going through the rich atom stream. Only
+ * built-in schemas can be compiled.
+ *
+ * The encoders produce the same output as binding the schema to a source. The decoder resets the
+ * value first and, like a bound sink, raises VERR_MALFORMED for unknown fields and for missing
+ * fields that are not optional. It also accepts nil wherever the encoder can produce it.
+ */
+
+typedef struct rich_Compiled rich_Compiled;
+
+// Raises VERR_ARGUMENT if the schema contains a custom schema. The schema must stay open, and no
+// fields may be added to it, for as long as the compiled schema is used.
+rich_Compiled*      rich_schema_compile(rich_Schema* schema);
+void                rich_compiled_close(rich_Compiled* compiled);
+// A lenient decoder skips unknown fields, and missing fields keep their reset value.
+void                rich_compiled_set_lenient(rich_Compiled* compiled, bool lenient);
+
+void                rich_compiled_encode_json(rich_Compiled* compiled, void* value, Output* out);
+void                rich_compiled_encode_binary(rich_Compiled* compiled, void* value, Output* out);
+void                rich_compiled_decode_binary(rich_Compiled* compiled, Input* in, void* value);
+// Decodes into an arena, like a sink from rich_bind_sink_arena.
+void                rich_compiled_decode_binary_arena(rich_Compiled* compiled, Input* in, void* value, Arena* arena);
+
 #endif /* RICH_BIND_H_9AA13EB5361B53 */
@@ -0,0 +1,53 @@
+#ifndef RICH_VALUE_H_7A2D5C0E91B348
+#define RICH_VALUE_H_7A2D5C0E91B348
+
+#include <vlib/rich.h>
+
+/**
+ * Rich value trees
+ *
+ * A rich_ValueTree holds a whole value read from any rich_Source, for code that needs to look
+ * inside data without a schema for it. Trees are immutable once read, so they can be shared
+ * between threads: each owner calls rich_value_tree_acquire, and the tree is freed when the last
+ * one calls rich_value_tree_release.
+ *
+ * Every node takes 16 bytes and is allocated from the tree's arena. Strings of up to 14 bytes are
+ * stored in the node itself. Map entries are kept sorted by key, and large maps also get a hash
+ * index, so looking up a key never scans the map.
+ */
+
+typedef struct rich_ValueTree rich_ValueTree;
+typedef struct rich_Value rich_Value;
+
+// Reads one value. Maps with the same key more than once are rejected with VERR_MALFORMED. The
+// tree starts with a single owner.
+rich_ValueTree*     rich_value_read(rich_Source* from);
+void                rich_value_tree_acquire(rich_ValueTree* tree);
+void                rich_value_tree_release(rich_ValueTree* tree);
+
+const rich_Value*   rich_value_root(rich_ValueTree* tree);
+
+// Returns RICH_NIL, RICH_BOOL, RICH_INT, RICH_FLOAT, RICH_STRING, RICH_ARRAY or RICH_MAP.
+rich_Atom           rich_value_type(const rich_Value* v);
+
+// Return the value of scalars. Raise VERR_MALFORMED if the value has a different type. The Bytes
+// returned by rich_value_string refer to the tree's memory.
+bool                rich_value_bool(const rich_Value* v);
+int64_t             rich_value_int(const rich_Value* v);
+double              rich_value_float(const rich_Value* v);
+Bytes               rich_value_string(const rich_Value* v);
+
+// Returns the number of elements in an array or entries in a map, and 0 for anything else.
+size_t              rich_value_length(const rich_Value* v);
+// Return an element of an array, or NULL if there is no such element or v is not an array.
+const rich_Value*   rich_value_at(const rich_Value* v, size_t i);
+// Return the value of a map entry, or NULL if there is no such entry or v is not a map.
+const rich_Value*   rich_value_get(const rich_Value* v, const Bytes* key);
+const rich_Value*   rich_value_cget(const rich_Value* v, const char* key);
+// Returns the i'th entry of a map in key order, and fills in its key. v must be a map.
+const rich_Value*   rich_value_entry(const rich_Value* v, size_t i, Bytes* key);
+
+// Passes a value and everything inside it to a rich_Sink.
+void                rich_value_dump(const rich_Value* v, rich_Sink* to);
+
+#endif /* RICH_VALUE_H_7A2D5C0E91B348 */
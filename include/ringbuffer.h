@@ -0,0 +1,72 @@
+#ifndef VLIB_RINGBUFFER_H
+#define VLIB_RINGBUFFER_H
+
+#include <stddef.h>
+
+#include <vlib/std.h>
+#include <vlib/io.h>
+
+// A circular buffer whose memory is mapped twice, back to back. Because of this, readable and
+// writable regions are always contiguous in memory, even across the wrap point, and the buffer
+// can be refilled while unread data remains without moving anything.
+//
+// Offsets only ever increase; a byte's position in memory is its offset modulo the size.
+data(RingBuffer) {
+  size_t  size;     // capacity; a power of two multiple of the page size
+  size_t  tail;     // oldest byte that can still be ungot
+  size_t  read;
+  size_t  write;
+  size_t  history;  // number of consumed bytes to preserve when writing
+  char*   data;
+};
+
+// Creates a buffer of at least min_size bytes. Up to `history` consumed bytes are kept around
+// for ringbuffer_unget.
+void      ringbuffer_init(RingBuffer* self, size_t min_size, size_t history);
+void      ringbuffer_close(RingBuffer* self);
+
+static inline size_t ringbuffer_avail_read(RingBuffer* self) {
+  return self->write - self->read;
+}
+static inline size_t ringbuffer_avail_write(RingBuffer* self) {
+  size_t tail = self->tail;
+  if (self->read - tail > self->history) tail = self->read - self->history;
+  return self->size - (self->write - tail);
+}
+
+// Pointers to the contiguous readable/writable regions.
+static inline char* ringbuffer_read_ptr(RingBuffer* self) {
+  return self->data + (self->read & (self->size-1));
+}
+static inline char* ringbuffer_write_ptr(RingBuffer* self) {
+  return self->data + (self->write & (self->size-1));
+}
+
+// Marks n bytes as written (after filling ringbuffer_write_ptr) or consumed.
+void      ringbuffer_produce(RingBuffer* self, size_t n);
+void      ringbuffer_consume(RingBuffer* self, size_t n);
+
+// Moves the read offset back by n bytes. Raises VERR_STATE if the data is no longer available.
+void      ringbuffer_unget(RingBuffer* self, size_t n);
+
+size_t    ringbuffer_write(RingBuffer* self, const char* src, size_t n);
+size_t    ringbuffer_read(RingBuffer* self, char* dst, size_t n);
+
+// Reads as much as possible from `in` (with a single io_read) and returns the number of bytes read.
+size_t    ringbuffer_fill(RingBuffer* self, Input* in);
+void      ringbuffer_flush(RingBuffer* self, Output* out);
+
+void      ringbuffer_reset(RingBuffer* self);
+
+/* Ring input */
+
+// A buffered Input backed by a RingBuffer, supporting multi-byte lookahead and unget.
+Input*      ring_input_new(Input* wrap, size_t buffer_size, size_t history);
+
+// Returns a pointer to the next n bytes without consuming them, filling the buffer as necessary.
+// Returns NULL if the end of the input is reached first. n may not exceed the buffer size.
+const char* ring_input_peek(Input* ring_input, size_t n);
+// Ungets up to `history` bytes.
+void        ring_input_unget(Input* ring_input, size_t n);
+
+#endif
@@ -4,6 +4,8 @@
 #include <vlib/rich.h>
 #include <vlib/rich_schema.h>
 #include <vlib/hashtable.h>
+#include <vlib/thread.h>
+#include <vlib/net.h>
 
 interface(RPC) {
   void  (*call)(void* self, const char* method, rich_Source* args, rich_Sink* result);
@@ -37,6 +39,98 @@ int     rpc_register(RPC_Client* self, const char* method, rich_Schema* arg_sche
 
 void    rpc_call(RPC_Client* self, int method, void* arg, void* result);
 
+// A batch makes many calls in a single round trip, as one BinaryRPC call whose arguments hold the
+// encoded calls. Batches only work through clients made with rpc_from_binary, and servers made
+// with rpc_to_binary or rpc_service_worker.
+data(RPC_Batch) {
+  RPC_Client*   client;
+  Output*       calls;        // the calls added so far, encoded
+  Vector        results[1];   // where each call's result goes, and how it went
+  bool          committed;
+};
+
+#define RPC_BATCH_METHOD "rpc.batch"
+
+// Raises VERR_ARGUMENT if the client's backend was not made by rpc_from_binary.
+void      rpc_batch_begin(RPC_Batch* self, RPC_Client* client);
+void      rpc_batch_close(RPC_Batch* self);
+// Encodes a call straight away. Adding a call after a commit starts a new batch.
+void      rpc_batch_add(RPC_Batch* self, int method, void* arg, void* result);
+// Makes the calls, and decodes the results of the ones that succeeded. The server may run them in
+// any order, or in parallel. Returns the number of calls that failed, and only raises if the
+// batch as a whole failed.
+unsigned  rpc_batch_commit(RPC_Batch* self);
+// Returns the error raised by a call in the last commit, or 0 if it succeeded. If msg is not NULL,
+// it is pointed at the error message (or NULL), which lives as long as the batch.
+error_t   rpc_batch_error(RPC_Batch* self, unsigned call, const char** msg);
+
+/* Multiplexed RPC over byte streams */
+
+// An RPC_Channel sends calls over a connection (any pair of streams, eg. a socket) without
+// waiting for earlier ones: every call gets an id, any number of calls can be in flight, and
+// they finish in whatever order the server answers them. Channels can be used from any number of
+// threads at once. Results are decoded on the channel's own reader thread.
+typedef struct RPC_Channel RPC_Channel;
+typedef struct RPC_Future RPC_Future;
+
+// The largest frame (a call's method and arguments, or its result) that is read off a connection.
+// Larger ones raise VERR_MALFORMED, rather than allocating whatever size a peer claims.
+enum { RPC_MAX_FRAME = 64 << 20 };
+
+// Called on the reader thread once a call has finished. err is 0 if it succeeded, otherwise msg
+// describes the error (and may be NULL).
+typedef void (*RPCCallback)(void* udata, error_t err, const char* msg);
+
+// The channel owns both streams, which are buffered internally.
+RPC_Channel*  rpc_channel_new(Input* in, Output* out, rich_Codec* codec);
+// Makes blocking calls through the channel. Closing it closes the channel, after waiting for the
+// calls in flight.
+RPC*          rpc_channel_rpc(RPC_Channel* channel);
+
+// Start a call. `args` is encoded before returning, but `result` is only written on the reader
+// thread, and must stay alive until the call finishes. Raise the channel's error if the
+// connection has failed.
+RPC_Future*   rpc_channel_start(RPC_Channel* channel, const char* method, rich_Source* args, rich_Sink* result);
+// Like rpc_channel_start, but calls done on the reader thread when the call finishes. If the
+// connection fails while the call is being sent, done may get the error instead of the caller.
+void          rpc_channel_send(RPC_Channel* channel, const char* method, rich_Source* args, rich_Sink* result, RPCCallback done, void* udata);
+// Waits for a call to finish and frees the future. If the call failed, raises the server's error
+// (with its message) or the channel's.
+void          rpc_future_wait(RPC_Future* future);
+
+// Answers a channel's calls one at a time until the client closes its end, then closes both
+// streams. Errors raised by the backend are sent back with their code and message.
+void          rpc_serve_stream(Input* in, Output* out, BinaryRPC* backend);
+
+/* RPC over TCP */
+
+// Makes calls over a TCP connection to `addr` (node:service), using the framing of RPC_Channel
+// with one call in flight at a time. The connection is opened by the first call and reused by
+// later ones. If it fails, the call raises and the next call reconnects; calls are never retried.
+BinaryRPC*  rpc_tcp_new(const char* addr);
+
+// Answers calls on every connection accepted by a listener, including those from RPC_Channels.
+// Each connection gets its own thread, but only one call is made to the backend at a time.
+// Alternatively, calls are dispatched to a ThreadPool of rpc_service_worker, and run concurrently
+// (including calls in flight over the same connection). Either way, the responses on each
+// connection are sent in the order of its requests.
+data(RPC_TCPServer) {
+  NetListener*  listener;
+  BinaryRPC*    rpc;
+  ThreadPool*   pool;
+  bool          running;
+  Lock          _lock[1];
+  Vector        _sessions[1];
+};
+
+// The server does not own the listener, the backend or the pool.
+void        rpc_tcp_init(RPC_TCPServer* self, NetListener* listener, BinaryRPC* backend);
+void        rpc_tcp_init_pool(RPC_TCPServer* self, NetListener* listener, ThreadPool* pool);
+// Makes rpc_tcp_serve return, after closing every connection. May be called from any thread, and
+// even before rpc_tcp_serve.
+void        rpc_tcp_stop(RPC_TCPServer* self);
+void        rpc_tcp_serve(RPC_TCPServer* self);
+
 /* Server-side utilities */
 
 typedef void (*RPCMethod)(void* udata, void* args, void* result);
@@ -44,6 +138,24 @@ typedef void (*RPCMethod)(void* udata, void* args, void* result);
 RPC*    rpc_service_new(void* udata, void (*cleanup_handler)(void* udata));
 void    rpc_add(RPC* self, const char* method, RPCMethod handler, rich_Schema* arg_schema, rich_Schema* result_schema);
 
+// A call in its binary encoding, to be run by a ThreadPool whose worker is rpc_service_worker.
+data(RPC_Job) {
+  Bytes     method;               // null-terminated
+  Bytes     args;
+  Output*   result;               // a string output, filled in with the result or error message
+  error_t   status;               // set to 0 or the error raised by the call
+  void      (*done)(RPC_Job* job);  // called on the worker thread once the call has finished
+};
+
+// Runs RPC_Jobs against a service, so that its methods can be called from many threads at once.
+// Every thread decodes into its own copy of each method's arguments and result, so handlers only
+// need to be thread-safe with respect to udata. Methods must be added before the worker is made.
+// The worker does not own the service, which must outlive the pool.
+PoolWorker* rpc_service_worker(RPC* service, rich_Codec* codec);
+// Lets a worker spread the calls of each batch over the idle threads of its pool. Calls that find
+// no idle thread run on the batch's own thread.
+void        rpc_service_worker_parallel(PoolWorker* worker, ThreadPool* pool);
+
 /* RPC over ZeroMQ support */
 
 #ifdef VLIB_ENABLE_ZMQ
@@ -40,5 +40,64 @@ bool    varint_validate(Varint* v);
 // Encodes a varint to an output stream. Exactly v->len bytes will be written.
 void    varint_encode(Varint* v, Output* dst);
 
+/* Direct encoding and decoding */
+
+enum {
+  VARINT_MAX_LEN = 10,  // maximum encoded size of a 64-bit integer
+};
+
+static inline uint64_t varint_zigzag(int64_t i) {
+  return ((uint64_t)i << 1) ^ (uint64_t)(i >> 63);
+}
+static inline int64_t varint_unzigzag(uint64_t u) {
+  return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+// Writes an encoded integer to p, which must have room for VARINT_MAX_LEN bytes. Returns the
+// number of bytes written.
+size_t    varint_write_u64(char* p, uint64_t u);
+static inline size_t varint_write_i64(char* p, int64_t i) {
+  return varint_write_u64(p, varint_zigzag(i));
+}
+
+// Reads an encoded integer from *p and advances *p past it. Raises VERR_EOF if the data ends
+// before the integer does, or VERR_MALFORMED if it is longer than VARINT_MAX_LEN bytes.
+uint64_t  varint_read_u64(const char** p, const char* end);
+static inline int64_t varint_read_i64(const char** p, const char* end) {
+  return varint_unzigzag(varint_read_u64(p, end));
+}
+
+/* Bulk encoding and decoding */
+
+// Encodes `count` integers to dst, which must have room for count*VARINT_MAX_LEN bytes. Returns
+// the number of bytes written.
+size_t    varint_encode_u64_array(char* dst, const uint64_t* src, size_t count);
+size_t    varint_encode_i64_array(char* dst, const int64_t* src, size_t count);
+
+// Decodes `count` integers from src and returns the number of bytes read. Raises the same errors
+// as varint_read_u64.
+size_t    varint_decode_u64_array(uint64_t* dst, size_t count, const char* src, size_t sz);
+size_t    varint_decode_i64_array(int64_t* dst, size_t count, const char* src, size_t sz);
+
+/**
+ * Stream VByte
+ *
+ * A different encoding for arrays of 32-bit integers that stores the byte lengths of each group
+ * of four integers in a separate control byte, so that they can be decoded without branching on
+ * every byte (and with SSSE3 shuffles on CPUs that have them).
+ *
+ * The layout is (count+3)/4 control bytes followed by the data bytes.
+ */
+
+// Returns the maximum number of bytes needed to encode `count` integers.
+static inline size_t svb_max_size(size_t count) {
+  return (count+3)/4 + count*4;
+}
+
+// Encodes `count` integers into dst and returns the number of bytes written.
+size_t    svb_encode_u32(char* dst, const uint32_t* src, size_t count);
+// Decodes `count` integers and returns the number of bytes read. Raises VERR_EOF if sz is too small.
+size_t    svb_decode_u32(uint32_t* dst, size_t count, const char* src, size_t sz);
+
 #endif /* VARINT_H_EFE975ADE6C81F */
 
@@ -6,6 +6,7 @@
 
 #include <vlib/std.h>
 #include <vlib/resource.h>
+#include <vlib/arena.h>
 
 data(Vector) {
   size_t    size;   // number of elements
@@ -35,6 +36,15 @@ static inline void* vector_get(Vector* v, unsigned index) {
 
 /* Increments the vector's size and returns a pointer to the new last element. */
 void* vector_push(Vector* v);
+/* Increases the vector's size by count and returns a pointer to the first new element. Raises
+ * VERR_NOMEM if count is too large for the size of the vector's memory to be represented. */
+void* vector_extend(Vector* v, size_t count);
+
+/* Variants for vectors whose memory comes from an arena. Such a vector must only be grown with
+ * vector_push_arena, and is never closed: its memory is released with the arena. */
+void  vector_init_arena(Vector* v, size_t elemsz, size_t capacity, Arena* arena);
+void* vector_push_arena(Vector* v, Arena* arena);
+void* vector_extend_arena(Vector* v, size_t count, Arena* arena);
 
 #define vector_back(v) (vector_get((v), (v)->size-1))
 
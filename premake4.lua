@@ -4,6 +4,9 @@ solution 'vlib'
   features = {
     gdbm = {links = 'gdbm'},
     zmq = {links = 'zmq'},
+    zlib = {links = 'z'},
+    lz4 = {links = 'lz4'},
+    zstd = {links = 'zstd'},
   }
   dofile 'features.lua'
 
@@ -40,3 +43,10 @@ solution 'vlib'
     targetdir 'test'
     targetname 'run'
     files { 'test/*.c' }
+
+  project 'bench'
+    kind 'ConsoleApp'
+    links 'vlib'
+    targetdir 'bench'
+    targetname 'run'
+    files { 'bench/*.c', 'bench/*.h' }
@@ -0,0 +1,100 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <vlib/arena.h>
+#include <vlib/error.h>
+#include <vlib/util.h>
+
+#define ARENA_ALIGN 16
+
+struct ArenaBlock {
+  ArenaBlock* next;
+  size_t      size;
+  char        data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static inline size_t align(size_t sz) {
+  // Neither rounding up nor adding a block header may wrap around
+  if (sz > SIZE_MAX - sizeof(ArenaBlock) - ARENA_ALIGN) RAISE(NOMEM);
+  return (sz + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void arena_init(Arena* self, size_t block_size) {
+  self->blocks = NULL;
+  self->ptr = NULL;
+  self->end = NULL;
+  self->block_size = block_size;
+}
+void arena_close(Arena* self) {
+  ArenaBlock* b = self->blocks;
+  while (b) {
+    ArenaBlock* next = b->next;
+    free(b);
+    b = next;
+  }
+  self->blocks = NULL;
+  self->ptr = self->end = NULL;
+}
+void arena_reset(Arena* self) {
+  ArenaBlock* keep = NULL;
+  ArenaBlock* b = self->blocks;
+  while (b) {
+    ArenaBlock* next = b->next;
+    if (!keep || b->size > keep->size) {
+      if (keep) free(keep);
+      keep = b;
+    } else {
+      free(b);
+    }
+    b = next;
+  }
+  self->blocks = keep;
+  if (keep) {
+    keep->next = NULL;
+    self->ptr = keep->data;
+    self->end = keep->data + keep->size;
+  }
+}
+
+static void new_block(Arena* self, size_t require) {
+  size_t size = MAX(self->block_size, require);
+  ArenaBlock* b = malloc(sizeof(ArenaBlock) + size);
+  if (!b) RAISE(NOMEM);
+  b->size = size;
+  b->next = self->blocks;
+  self->blocks = b;
+  self->ptr = b->data;
+  self->end = b->data + size;
+}
+
+void* arena_alloc(Arena* self, size_t size) {
+  size = align(size);
+  if (size > (size_t)(self->end - self->ptr)) new_block(self, size);
+  void* p = self->ptr;
+  self->ptr += size;
+  return p;
+}
+void* arena_calloc(Arena* self, size_t size) {
+  void* p = arena_alloc(self, size);
+  memset(p, 0, size);
+  return p;
+}
+void* arena_realloc(Arena* self, void* ptr, size_t old_size, size_t new_size) {
+  if (!ptr) return arena_alloc(self, new_size);
+  if (new_size <= align(old_size)) return ptr;
+  if ((char*)ptr + align(old_size) == self->ptr && (char*)ptr + align(new_size) <= self->end) {
+    self->ptr = (char*)ptr + align(new_size);
+    return ptr;
+  }
+  void* p = arena_alloc(self, new_size);
+  memcpy(p, ptr, old_size);
+  return p;
+}
+void* arena_memdup(Arena* self, const void* src, size_t size) {
+  void* p = arena_alloc(self, size);
+  // Empty sources may be NULL
+  if (size) memcpy(p, src, size);
+  return p;
+}
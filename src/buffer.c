@@ -1,6 +1,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <vlib/buffer.h>
 #include <vlib/util.h>
@@ -8,9 +9,11 @@
 
 Buffer* buffer_new(size_t cap) {
   Buffer* self = malloc(sizeof(Buffer) + cap);
+  if (!self) RAISE(NOMEM);
   self->size = cap;
   self->read = 0;
   self->write = 0;
+  self->pooled = false;
   return self;
 }
 void buffer_free(Buffer* self) {
@@ -32,10 +35,16 @@ size_t buffer_read(Buffer* self, char* dst, size_t n) {
 }
 
 void buffer_fill(Buffer* self, Input* in) {
-  self->read = 0;
-  int64_t r = io_read(in, self->data, self->size);
+  // Move unread data to the front, along with the last byte read so that it can still be ungot
+  size_t keep = self->read ? self->read - 1 : 0;
+  if (keep) {
+    memmove(self->data, self->data + keep, self->write - keep);
+    self->read -= keep;
+    self->write -= keep;
+  }
+  int64_t r = io_read(in, self->data + self->write, self->size - self->write);
   if (r < 0) verr_raise(VERR_EOF);
-  self->write = r;
+  self->write += r;
 }
 
 void buffer_flush(Buffer* self, Output* out) {
@@ -48,3 +57,147 @@ void buffer_reset(Buffer* self) {
   self->read = 0;
   self->write = 0;
 }
+
+/* Buffer pool */
+
+enum {
+  POOL_MIN_SHIFT  = 9,
+  POOL_MAX_SHIFT  = 20,
+  POOL_CLASSES    = POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1,
+  THREAD_CACHE    = 4,  // free buffers cached per thread and size class
+};
+
+// Free buffers are linked through their data area
+#define NEXT_FREE(buf) (*(Buffer**)(buf)->data)
+
+data(FreeList) {
+  Buffer*   first;
+  unsigned  count;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static FreeList pool[POOL_CLASSES];
+static size_t pool_bytes;
+static size_t pool_limit = 16 << 20;
+
+static size_t budget_limit;
+static size_t budget_used;
+
+static __thread FreeList cache[POOL_CLASSES];
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static inline int size_class(size_t cap) {
+  int c = 0;
+  while (((size_t)BUFFER_POOL_MIN << c) < cap) c++;
+  return c;
+}
+static inline int exact_class(size_t size) {
+  if (size < BUFFER_POOL_MIN || size > BUFFER_POOL_MAX || (size & (size-1))) return -1;
+  return size_class(size);
+}
+
+static inline Buffer* pop_free(FreeList* list) {
+  Buffer* buf = list->first;
+  if (buf) {
+    list->first = NEXT_FREE(buf);
+    list->count--;
+  }
+  return buf;
+}
+static inline void push_free(FreeList* list, Buffer* buf) {
+  NEXT_FREE(buf) = list->first;
+  list->first = buf;
+  list->count++;
+}
+
+// Gives a buffer to the global pool, or frees it if the pool is full
+static void put_global(int c, Buffer* buf) {
+  pthread_mutex_lock(&pool_lock);
+  if (pool_bytes + buf->size <= pool_limit) {
+    push_free(&pool[c], buf);
+    pool_bytes += buf->size;
+    buf = NULL;
+  }
+  pthread_mutex_unlock(&pool_lock);
+  if (buf) buffer_free(buf);
+}
+
+// Moves a thread's cached buffers to the global pool when the thread exits
+static void flush_cache(void* _) {
+  for (int c = 0; c < POOL_CLASSES; c++) {
+    Buffer* buf;
+    while ((buf = pop_free(&cache[c]))) {
+      put_global(c, buf);
+    }
+  }
+}
+static void make_cache_key() {
+  pthread_key_create(&cache_key, flush_cache);
+}
+
+Buffer* buffer_pool_get(size_t cap) {
+  if (cap > BUFFER_POOL_MAX) cap = BUFFER_POOL_MAX;
+  size_t limit = __atomic_load_n(&budget_limit, __ATOMIC_RELAXED);
+  if (limit && __atomic_load_n(&budget_used, __ATOMIC_RELAXED) >= limit) cap = BUFFER_POOL_MIN;
+  int c = size_class(cap);
+  size_t size = (size_t)BUFFER_POOL_MIN << c;
+
+  Buffer* buf = pop_free(&cache[c]);
+  if (!buf) {
+    pthread_mutex_lock(&pool_lock);
+    buf = pop_free(&pool[c]);
+    if (buf) pool_bytes -= size;
+    pthread_mutex_unlock(&pool_lock);
+  }
+  if (!buf) buf = buffer_new(size);
+  __sync_fetch_and_add(&budget_used, size);
+  buf->pooled = true;
+  buffer_reset(buf);
+  return buf;
+}
+
+void buffer_pool_put(Buffer* buf) {
+  int c = exact_class(buf->size);
+  if (c < 0) {
+    buffer_free(buf);
+    return;
+  }
+  if (buf->pooled) {
+    __sync_fetch_and_sub(&budget_used, buf->size);
+    buf->pooled = false;
+  }
+
+  if (cache[c].count < THREAD_CACHE) {
+    if (cache[c].count == 0) {
+      // Make sure the cache is flushed when this thread exits
+      pthread_once(&cache_once, make_cache_key);
+      pthread_setspecific(cache_key, cache);
+    }
+    push_free(&cache[c], buf);
+    return;
+  }
+  put_global(c, buf);
+}
+
+void buffer_pool_budget(size_t max_bytes) {
+  __atomic_store_n(&budget_limit, max_bytes, __ATOMIC_RELAXED);
+}
+void buffer_pool_limit(size_t max_bytes) {
+  pthread_mutex_lock(&pool_lock);
+  pool_limit = max_bytes;
+  pthread_mutex_unlock(&pool_lock);
+}
+
+void buffer_pool_trim() {
+  Buffer* buf;
+  for (int c = 0; c < POOL_CLASSES; c++) {
+    while ((buf = pop_free(&cache[c]))) buffer_free(buf);
+  }
+  pthread_mutex_lock(&pool_lock);
+  for (int c = 0; c < POOL_CLASSES; c++) {
+    while ((buf = pop_free(&pool[c]))) buffer_free(buf);
+  }
+  pool_bytes = 0;
+  pthread_mutex_unlock(&pool_lock);
+}
@@ -2,20 +2,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <assert.h>
 
 #include <vlib/io.h>
 #include <vlib/buffer.h>
+#include <vlib/error.h>
+
+// Buffers are taken from the buffer pool when first needed. BufOutput hands its buffer back
+// whenever it is flushed, so idle streams don't pin any buffer memory.
 
 data(BufInput) {
   Input     base;
   Input*    in;
   Buffer*   buf;
+  size_t    bufsz;
 };
 
 data(BufOutput) {
   Output      base;
   Output*     out;
   Buffer*     buf;
+  size_t      bufsz;
 };
 
 /* Input */
@@ -26,37 +33,49 @@ Input* buf_input_new(Input* wrap, size_t buffer) {
   BufInput* self = malloc(sizeof(BufInput));
   self->base._impl = &buf_input_impl;
   self->in = wrap;
-  self->buf = buffer_new(buffer);
+  self->buf = NULL;
+  self->bufsz = buffer;
   return &self->base;
 }
 void buf_input_reset(Input* _self, Input* wrap) {
   BufInput* self = (BufInput*)_self;
-  buffer_reset(self->buf);
+  if (self->buf) {
+    buffer_pool_put(self->buf);
+    self->buf = NULL;
+  }
   self->in = wrap;
 }
 
+static inline size_t input_avail(BufInput* self) {
+  return self->buf ? buffer_avail_read(self->buf) : 0;
+}
+static void input_fill(BufInput* self) {
+  if (!self->buf) self->buf = buffer_pool_get(self->bufsz);
+  buffer_fill(self->buf, self->in);
+}
+
 static void buf_input_close(void* _self) {
   BufInput* self = _self;
-  buffer_free(self->buf);
+  if (self->buf) buffer_pool_put(self->buf);
   call(self->in, close);
   free(self);
 }
 static size_t buf_input_read(void* _self, char* dst, size_t n) {
   BufInput* self = _self;
-  if (buffer_avail_read(self->buf) == 0) {
-    buffer_fill(self->buf, self->in);
+  if (input_avail(self) == 0) {
+    input_fill(self);
   }
   return buffer_read(self->buf, dst, n);
 }
 static int buf_input_get(void* _self) {
   BufInput* self = _self;
-  if (!buffer_avail_read(self->buf)) {
-    buffer_fill(self->buf, self->in);
+  if (!input_avail(self)) {
+    input_fill(self);
     if (!buffer_avail_read(self->buf)) {
       return -1;
     }
   }
-  return self->buf->data[self->buf->read++];
+  return self->buf->data[self->buf->read++] & 0xFF;
 }
 static void buf_input_unget(void* _self) {
   BufInput* self = _self;
@@ -64,12 +83,28 @@ static void buf_input_unget(void* _self) {
 }
 static bool buf_input_eof(void* _self) {
   BufInput* self = _self;
-  if (buffer_avail_read(self->buf)) {
+  if (input_avail(self)) {
     return false;
   }
   return io_eof(self->in);
 }
 
+bool buf_input_window(Input* in, const char** data, size_t* size) {
+  if (in->_impl != &buf_input_impl) return false;
+  BufInput* self = (BufInput*)in;
+  if (input_avail(self) == 0) {
+    input_fill(self);
+  }
+  *data = self->buf->data + self->buf->read;
+  *size = buffer_avail_read(self->buf);
+  return true;
+}
+void buf_input_skip(Input* _self, size_t n) {
+  BufInput* self = (BufInput*)_self;
+  assert(n <= input_avail(self));
+  if (n) self->buf->read += n;
+}
+
 static Input_Impl buf_input_impl = {
   .read = buf_input_read,
   .get = buf_input_get,
@@ -86,42 +121,64 @@ Output* buf_output_new(Output* wrap, size_t buffer) {
   BufOutput* self = malloc(sizeof(BufOutput));
   self->base._impl = &buf_output_impl;
   self->out = wrap;
-  self->buf = buffer_new(buffer);
+  self->buf = NULL;
+  self->bufsz = buffer;
   return &self->base;
 }
 void buf_output_reset(Output* _self, Output* wrap) {
   BufOutput* self = (BufOutput*)_self;
-  buffer_reset(self->buf);
+  if (self->buf) {
+    buffer_pool_put(self->buf);
+    self->buf = NULL;
+  }
   self->out = wrap;
 }
 
+static inline Buffer* output_buffer(BufOutput* self) {
+  if (!self->buf) self->buf = buffer_pool_get(self->bufsz);
+  return self->buf;
+}
+static void output_release(BufOutput* self) {
+  if (self->buf) {
+    buffer_flush(self->buf, self->out);
+    buffer_pool_put(self->buf);
+    self->buf = NULL;
+  }
+}
+
 static void buf_output_write(void* _self, const char* src, size_t n) {
   BufOutput* self = _self;
-  if (buffer_avail_write(self->buf) >= n) {
-    buffer_write(self->buf, src, n);
+  Buffer* buf = output_buffer(self);
+  if (buffer_avail_write(buf) >= n) {
+    buffer_write(buf, src, n);
   } else {
-    buffer_flush(self->buf, self->out);
+    buffer_flush(buf, self->out);
     call(self->out, write, src, n);
   }
 }
 static void buf_output_put(void* _self, char ch) {
   BufOutput* self = _self;
-  if (buffer_avail_write(self->buf) == 0) {
-    buffer_flush(self->buf, self->out);
+  Buffer* buf = output_buffer(self);
+  if (buffer_avail_write(buf) == 0) {
+    buffer_flush(buf, self->out);
   }
-  self->buf->data[self->buf->write++] = ch;
+  buf->data[buf->write++] = ch;
 }
 static void buf_output_flush(void* _self) {
   BufOutput* self = _self;
-  buffer_flush(self->buf, self->out);
+  output_release(self);
   call(self->out, flush);
 }
 static void buf_output_close(void* _self) {
   BufOutput* self = _self;
-  buf_output_flush(self);
-  buffer_free(self->buf);
-  call(self->out, close);
-  free(self);
+  TRY {
+    buf_output_flush(self);
+  } FINALLY {
+    // Still set if the flush failed
+    if (self->buf) buffer_pool_put(self->buf);
+    call(self->out, close);
+    free(self);
+  } ETRY
 }
 
 static Output_Impl buf_output_impl = {
@@ -0,0 +1,482 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vlib/compress.h>
+#include <vlib/util.h>
+#include <vlib/error.h>
+
+enum {
+  CHUNK = 16 * 1024,
+};
+
+/* zlib / gzip */
+
+#ifdef VLIB_ENABLE_ZLIB
+
+#include <zlib.h>
+
+static void zlib_check(int r) {
+  switch (r) {
+    case Z_OK:
+    case Z_STREAM_END:
+    case Z_BUF_ERROR:
+      return;
+    case Z_MEM_ERROR:
+      RAISE(NOMEM);
+    case Z_DATA_ERROR:
+      RAISE(MALFORMED);
+    default:
+      RAISE(IO);
+  }
+}
+
+data(ZlibOutput) {
+  Output    base;
+  Output*   out;
+  z_stream  z[1];
+  char      buf[CHUNK];
+};
+static Output_Impl zlib_output_impl;
+
+static Output* deflate_new(Output* wrap, int level, int window_bits, const Bytes* dict) {
+  ZlibOutput* self = malloc(sizeof(ZlibOutput));
+  self->base._impl = &zlib_output_impl;
+  self->out = wrap;
+  memset(self->z, 0, sizeof(z_stream));
+  int r = deflateInit2(self->z, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+  if (r == Z_OK && dict) {
+    r = deflateSetDictionary(self->z, dict->ptr, dict->size);
+    if (r != Z_OK) deflateEnd(self->z);
+  }
+  if (r != Z_OK) {
+    free(self);
+    zlib_check(r);
+  }
+  return &self->base;
+}
+Output* gzip_output_new(Output* wrap, int level) {
+  return deflate_new(wrap, level, 15 + 16, NULL);
+}
+Output* zlib_output_new(Output* wrap, int level, const Bytes* dict) {
+  return deflate_new(wrap, level, 15, dict);
+}
+
+static void zlib_deflate(ZlibOutput* self, const char* src, size_t n, int flush) {
+  self->z->next_in = (Bytef*)src;
+  self->z->avail_in = n;
+  do {
+    self->z->next_out = (Bytef*)self->buf;
+    self->z->avail_out = CHUNK;
+    zlib_check(deflate(self->z, flush));
+    io_write(self->out, self->buf, CHUNK - self->z->avail_out);
+  } while (self->z->avail_out == 0 || self->z->avail_in > 0);
+}
+static void zlib_output_write(void* _self, const char* src, size_t n) {
+  zlib_deflate(_self, src, n, Z_NO_FLUSH);
+}
+static void zlib_output_flush(void* _self) {
+  ZlibOutput* self = _self;
+  zlib_deflate(self, NULL, 0, Z_SYNC_FLUSH);
+  io_flush(self->out);
+}
+static void zlib_output_close(void* _self) {
+  ZlibOutput* self = _self;
+  TRY {
+    zlib_deflate(self, NULL, 0, Z_FINISH);
+  } FINALLY {
+    deflateEnd(self->z);
+    call(self->out, close);
+    free(self);
+  } ETRY
+}
+static Output_Impl zlib_output_impl = {
+  .write = zlib_output_write,
+  .flush = zlib_output_flush,
+  .close = zlib_output_close,
+};
+
+data(ZlibInput) {
+  Input         base;
+  Input*        in;
+  z_stream      z[1];
+  const Bytes*  dict;
+  bool          finished;
+  char          buf[CHUNK];
+};
+static Input_Impl zlib_input_impl;
+
+static Input* inflate_new(Input* wrap, int window_bits, const Bytes* dict) {
+  ZlibInput* self = malloc(sizeof(ZlibInput));
+  self->base._impl = &zlib_input_impl;
+  self->in = wrap;
+  self->dict = dict;
+  self->finished = false;
+  memset(self->z, 0, sizeof(z_stream));
+  int r = inflateInit2(self->z, window_bits);
+  if (r != Z_OK) {
+    free(self);
+    zlib_check(r);
+  }
+  return &self->base;
+}
+Input* gzip_input_new(Input* wrap) {
+  return inflate_new(wrap, 15 + 16, NULL);
+}
+Input* zlib_input_new(Input* wrap, const Bytes* dict) {
+  return inflate_new(wrap, 15, dict);
+}
+
+static size_t zlib_input_read(void* _self, char* dst, size_t n) {
+  ZlibInput* self = _self;
+  self->z->next_out = (Bytef*)dst;
+  self->z->avail_out = n;
+  while (!self->finished && self->z->avail_out == n && n > 0) {
+    if (self->z->avail_in == 0) {
+      self->z->next_in = (Bytef*)self->buf;
+      self->z->avail_in = io_read(self->in, self->buf, CHUNK);
+      if (self->z->avail_in == 0) RAISE(EOF);
+    }
+    int r = inflate(self->z, Z_NO_FLUSH);
+    if (r == Z_NEED_DICT) {
+      if (!self->dict) RAISE(MALFORMED);
+      r = inflateSetDictionary(self->z, self->dict->ptr, self->dict->size);
+    }
+    zlib_check(r);
+    if (r == Z_STREAM_END) self->finished = true;
+  }
+  return n - self->z->avail_out;
+}
+static bool zlib_input_eof(void* _self) {
+  ZlibInput* self = _self;
+  return self->finished;
+}
+static void zlib_input_close(void* _self) {
+  ZlibInput* self = _self;
+  inflateEnd(self->z);
+  call(self->in, close);
+  free(self);
+}
+static Input_Impl zlib_input_impl = {
+  .read = zlib_input_read,
+  .eof = zlib_input_eof,
+  .close = zlib_input_close,
+};
+
+#endif
+
+/* LZ4 */
+
+#ifdef VLIB_ENABLE_LZ4
+
+#include <lz4.h>
+#include <lz4frame.h>
+
+// Dictionaries only became part of the LZ4 frame API exported by the shared library in 1.10
+#define LZ4_DICT (LZ4_VERSION_NUMBER >= 11000)
+
+static size_t lz4_check(size_t r, error_t err) {
+  if (LZ4F_isError(r)) verr_raisef(err, "lz4: %s", LZ4F_getErrorName(r));
+  return r;
+}
+
+data(LZ4Output) {
+  Output                base;
+  Output*               out;
+  LZ4F_cctx*            ctx;
+#if LZ4_DICT
+  LZ4F_CDict*           cdict;
+#endif
+  LZ4F_preferences_t    prefs;
+  size_t                bufsz;
+  char                  buf[];
+};
+static Output_Impl lz4_output_impl;
+
+Output* lz4_output_new(Output* wrap, int level, const Bytes* dict) {
+#if !LZ4_DICT
+  if (dict) verr_raisef(VERR_ARGUMENT, "lz4: dictionaries need lz4 1.10 or newer");
+#endif
+  LZ4F_preferences_t prefs;
+  memset(&prefs, 0, sizeof(prefs));
+  prefs.compressionLevel = level;
+  size_t bufsz = LZ4F_compressBound(CHUNK, &prefs);
+
+  LZ4Output* self = malloc(sizeof(LZ4Output) + bufsz);
+  self->base._impl = &lz4_output_impl;
+  self->out = wrap;
+  self->prefs = prefs;
+  self->bufsz = bufsz;
+#if LZ4_DICT
+  self->cdict = dict ? LZ4F_createCDict(dict->ptr, dict->size) : NULL;
+#endif
+  size_t r = LZ4F_createCompressionContext(&self->ctx, LZ4F_VERSION);
+  if (LZ4F_isError(r)) {
+#if LZ4_DICT
+    LZ4F_freeCDict(self->cdict);
+#endif
+    free(self);
+    lz4_check(r, VERR_NOMEM);
+  }
+
+  // Write the frame header
+#if LZ4_DICT
+  if (self->cdict) {
+    r = LZ4F_compressBegin_usingCDict(self->ctx, self->buf, bufsz, self->cdict, &self->prefs);
+  } else
+#endif
+  r = LZ4F_compressBegin(self->ctx, self->buf, bufsz, &self->prefs);
+  TRY {
+    io_write(wrap, self->buf, lz4_check(r, VERR_ARGUMENT));
+  } CATCH(err) {
+    LZ4F_freeCompressionContext(self->ctx);
+#if LZ4_DICT
+    LZ4F_freeCDict(self->cdict);
+#endif
+    free(self);
+    verr_reraise();
+  } ETRY
+  return &self->base;
+}
+static void lz4_output_write(void* _self, const char* src, size_t n) {
+  LZ4Output* self = _self;
+  while (n) {
+    size_t chunk = MIN(n, (size_t)CHUNK);
+    size_t r = LZ4F_compressUpdate(self->ctx, self->buf, self->bufsz, src, chunk, NULL);
+    io_write(self->out, self->buf, lz4_check(r, VERR_IO));
+    src += chunk;
+    n -= chunk;
+  }
+}
+static void lz4_output_flush(void* _self) {
+  LZ4Output* self = _self;
+  size_t r = LZ4F_flush(self->ctx, self->buf, self->bufsz, NULL);
+  io_write(self->out, self->buf, lz4_check(r, VERR_IO));
+  io_flush(self->out);
+}
+static void lz4_output_close(void* _self) {
+  LZ4Output* self = _self;
+  TRY {
+    size_t r = LZ4F_compressEnd(self->ctx, self->buf, self->bufsz, NULL);
+    io_write(self->out, self->buf, lz4_check(r, VERR_IO));
+  } FINALLY {
+    LZ4F_freeCompressionContext(self->ctx);
+#if LZ4_DICT
+    LZ4F_freeCDict(self->cdict);
+#endif
+    call(self->out, close);
+    free(self);
+  } ETRY
+}
+static Output_Impl lz4_output_impl = {
+  .write = lz4_output_write,
+  .flush = lz4_output_flush,
+  .close = lz4_output_close,
+};
+
+data(LZ4Input) {
+  Input         base;
+  Input*        in;
+  LZ4F_dctx*    ctx;
+  const Bytes*  dict;
+  bool          finished;
+  size_t        pos;
+  size_t        avail;
+  char          buf[CHUNK];
+};
+static Input_Impl lz4_input_impl;
+
+Input* lz4_input_new(Input* wrap, const Bytes* dict) {
+#if !LZ4_DICT
+  if (dict) verr_raisef(VERR_ARGUMENT, "lz4: dictionaries need lz4 1.10 or newer");
+#endif
+  LZ4Input* self = malloc(sizeof(LZ4Input));
+  self->base._impl = &lz4_input_impl;
+  self->in = wrap;
+  self->dict = dict;
+  self->finished = false;
+  self->pos = self->avail = 0;
+  size_t r = LZ4F_createDecompressionContext(&self->ctx, LZ4F_VERSION);
+  if (LZ4F_isError(r)) {
+    free(self);
+    lz4_check(r, VERR_NOMEM);
+  }
+  return &self->base;
+}
+static size_t lz4_input_read(void* _self, char* dst, size_t n) {
+  LZ4Input* self = _self;
+  size_t produced = 0;
+  while (!self->finished && produced == 0 && n > 0) {
+    if (self->pos == self->avail) {
+      self->pos = 0;
+      self->avail = io_read(self->in, self->buf, CHUNK);
+      if (self->avail == 0) RAISE(EOF);
+    }
+    size_t dstsz = n;
+    size_t srcsz = self->avail - self->pos;
+    size_t r;
+#if LZ4_DICT
+    if (self->dict) {
+      r = LZ4F_decompress_usingDict(self->ctx, dst, &dstsz, self->buf + self->pos, &srcsz,
+          self->dict->ptr, self->dict->size, NULL);
+    } else
+#endif
+    r = LZ4F_decompress(self->ctx, dst, &dstsz, self->buf + self->pos, &srcsz, NULL);
+    lz4_check(r, VERR_MALFORMED);
+    self->pos += srcsz;
+    produced = dstsz;
+    if (r == 0) self->finished = true;
+  }
+  return produced;
+}
+static bool lz4_input_eof(void* _self) {
+  LZ4Input* self = _self;
+  return self->finished;
+}
+static void lz4_input_close(void* _self) {
+  LZ4Input* self = _self;
+  LZ4F_freeDecompressionContext(self->ctx);
+  call(self->in, close);
+  free(self);
+}
+static Input_Impl lz4_input_impl = {
+  .read = lz4_input_read,
+  .eof = lz4_input_eof,
+  .close = lz4_input_close,
+};
+
+#endif
+
+/* Zstandard */
+
+#ifdef VLIB_ENABLE_ZSTD
+
+#include <zstd.h>
+
+static size_t zstd_check(size_t r, error_t err) {
+  if (ZSTD_isError(r)) verr_raisef(err, "zstd: %s", ZSTD_getErrorName(r));
+  return r;
+}
+
+data(ZstdOutput) {
+  Output      base;
+  Output*     out;
+  ZSTD_CCtx*  ctx;
+  char        buf[CHUNK];
+};
+static Output_Impl zstd_output_impl;
+
+Output* zstd_output_new(Output* wrap, int level, const Bytes* dict) {
+  ZstdOutput* self = malloc(sizeof(ZstdOutput));
+  self->base._impl = &zstd_output_impl;
+  self->out = wrap;
+  self->ctx = ZSTD_createCCtx();
+  if (!self->ctx) {
+    free(self);
+    RAISE(NOMEM);
+  }
+  size_t r = ZSTD_CCtx_setParameter(self->ctx, ZSTD_c_compressionLevel, level);
+  if (!ZSTD_isError(r) && dict) r = ZSTD_CCtx_loadDictionary(self->ctx, dict->ptr, dict->size);
+  if (ZSTD_isError(r)) {
+    ZSTD_freeCCtx(self->ctx);
+    free(self);
+    zstd_check(r, VERR_ARGUMENT);
+  }
+  return &self->base;
+}
+static void zstd_compress(ZstdOutput* self, const char* src, size_t n, ZSTD_EndDirective mode) {
+  ZSTD_inBuffer in = {src, n, 0};
+  size_t remaining;
+  do {
+    ZSTD_outBuffer out = {self->buf, CHUNK, 0};
+    remaining = zstd_check(ZSTD_compressStream2(self->ctx, &out, &in, mode), VERR_IO);
+    io_write(self->out, self->buf, out.pos);
+  } while (mode == ZSTD_e_continue ? in.pos < in.size : remaining > 0);
+}
+static void zstd_output_write(void* _self, const char* src, size_t n) {
+  zstd_compress(_self, src, n, ZSTD_e_continue);
+}
+static void zstd_output_flush(void* _self) {
+  ZstdOutput* self = _self;
+  zstd_compress(self, NULL, 0, ZSTD_e_flush);
+  io_flush(self->out);
+}
+static void zstd_output_close(void* _self) {
+  ZstdOutput* self = _self;
+  TRY {
+    zstd_compress(self, NULL, 0, ZSTD_e_end);
+  } FINALLY {
+    ZSTD_freeCCtx(self->ctx);
+    call(self->out, close);
+    free(self);
+  } ETRY
+}
+static Output_Impl zstd_output_impl = {
+  .write = zstd_output_write,
+  .flush = zstd_output_flush,
+  .close = zstd_output_close,
+};
+
+data(ZstdInput) {
+  Input           base;
+  Input*          in;
+  ZSTD_DCtx*      ctx;
+  ZSTD_inBuffer   src;
+  bool            finished;
+  char            buf[CHUNK];
+};
+static Input_Impl zstd_input_impl;
+
+Input* zstd_input_new(Input* wrap, const Bytes* dict) {
+  ZstdInput* self = malloc(sizeof(ZstdInput));
+  self->base._impl = &zstd_input_impl;
+  self->in = wrap;
+  self->src.src = self->buf;
+  self->src.size = self->src.pos = 0;
+  self->finished = false;
+  self->ctx = ZSTD_createDCtx();
+  if (!self->ctx) {
+    free(self);
+    RAISE(NOMEM);
+  }
+  if (dict) {
+    size_t r = ZSTD_DCtx_loadDictionary(self->ctx, dict->ptr, dict->size);
+    if (ZSTD_isError(r)) {
+      ZSTD_freeDCtx(self->ctx);
+      free(self);
+      zstd_check(r, VERR_ARGUMENT);
+    }
+  }
+  return &self->base;
+}
+static size_t zstd_input_read(void* _self, char* dst, size_t n) {
+  ZstdInput* self = _self;
+  ZSTD_outBuffer out = {dst, n, 0};
+  while (!self->finished && out.pos == 0 && n > 0) {
+    if (self->src.pos == self->src.size) {
+      self->src.pos = 0;
+      self->src.size = io_read(self->in, self->buf, CHUNK);
+      if (self->src.size == 0) RAISE(EOF);
+    }
+    size_t r = zstd_check(ZSTD_decompressStream(self->ctx, &out, &self->src), VERR_MALFORMED);
+    if (r == 0) self->finished = true;
+  }
+  return out.pos;
+}
+static bool zstd_input_eof(void* _self) {
+  ZstdInput* self = _self;
+  return self->finished;
+}
+static void zstd_input_close(void* _self) {
+  ZstdInput* self = _self;
+  ZSTD_freeDCtx(self->ctx);
+  call(self->in, close);
+  free(self);
+}
+static Input_Impl zstd_input_impl = {
+  .read = zstd_input_read,
+  .eof = zstd_input_eof,
+  .close = zstd_input_close,
+};
+
+#endif
@@ -30,6 +30,11 @@ void coroutine_pop(Coroutine* self) {
   if (frame->state->close) frame->state->close(frame->udata);
   bytestack_pop(self->stack);
 }
+void* coroutine_top(Coroutine* self, co_State** state) {
+  Frame* frame = bytestack_top(self->stack);
+  *state = frame->state;
+  return frame->udata;
+}
 
 void coroutine_run(Coroutine* self, void* arg) {
   Frame* frame = bytestack_top(self->stack);
@@ -159,8 +159,8 @@ error_t verr_system(int eno) {
 #ifdef DEBUG
 static __thread void* backtrace_buffer[32];
 static __thread int backtrace_size;
-static __thread char error_msg[512];
 #endif
+static __thread char error_msg[512];
 
 void verr_try(void (*action)(), void (*handle)(error_t error), void (*cleanup)()) {
   TryFrame* frame = vector_push(try_stack);
@@ -179,9 +179,15 @@ void verr_try(void (*action)(), void (*handle)(error_t error), void (*cleanup)()
       }
     }
   }
+  // Keep the message of an error passing through, in case the cleanup function clobbers it
+  const char* msg = current_msg;
   vector_pop(try_stack);
   if (cleanup) cleanup();
-  if (error) verr_raise(error);
+  if (error) {
+    current_error = error;
+    current_msg = msg;
+    verr_reraise();
+  }
 }
 
 void verr_raisef(error_t error, const char* fmt, ...) {
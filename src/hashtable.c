@@ -136,8 +136,10 @@ void hashtable_iter(Hashtable* ht, int (*callback)(void* key, void* data)) {
       next = &bucket->next;
       int r = callback(bucket->data, bucket->data + ht->keysz);
       if (r & HT_REMOVE) {
-        *bptr = *next;
+        *bptr = bucket->next;
         free(bucket);
+        ht->size--;
+        next = bptr;
       }
       if (r & HT_BREAK) {
         return;
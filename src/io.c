@@ -36,7 +36,7 @@ int io_get(Input* in) {
   }
   assert(in->_impl->read);
   char ch;
-  return call(in, read, &ch, 1) ? ch : -1;
+  return call(in, read, &ch, 1) ? ch & 0xFF : -1;
 }
 void io_unget(Input* in) {
   assert(in->_impl->unget);
@@ -110,23 +110,35 @@ void io_readall(Input* input, void* _dst, size_t n) {
   }
 }
 
+/* Fixed-width integers */
+
+// Conversion between host and big/little endian byte order
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TO_BE16(x) __builtin_bswap16(x)
+#define TO_BE32(x) __builtin_bswap32(x)
+#define TO_BE64(x) __builtin_bswap64(x)
+#define HOST_LE 1
+#else
+#define TO_BE16(x) (x)
+#define TO_BE32(x) (x)
+#define TO_BE64(x) (x)
+#define HOST_LE 0
+#endif
+
 void io_put_int8(Output* out, int8_t i) {
   io_put(out, (char)i);
 }
 void io_put_int16(Output* out, int16_t i) {
-  char bytes[] = {i >> 8, i};
-  io_write(out, bytes, 2);
+  uint16_t be = TO_BE16((uint16_t)i);
+  io_write(out, (char*)&be, 2);
 }
 void io_put_int32(Output* out, int32_t i) {
-  char bytes[] = {i >> 24, i >> 16, i >> 8, i};
-  io_write(out, bytes, 4);
+  uint32_t be = TO_BE32((uint32_t)i);
+  io_write(out, (char*)&be, 4);
 }
 void io_put_int64(Output* out, int64_t i) {
-  char bytes[] = {
-    i >> 56, i >> 48, i >> 40, i >> 32,
-    i >> 24, i >> 16, i >> 8, i
-  };
-  io_write(out, bytes, 8);
+  uint64_t be = TO_BE64((uint64_t)i);
+  io_write(out, (char*)&be, 8);
 }
 
 static inline uint64_t mustget(Input* in) {
@@ -139,49 +151,84 @@ int8_t  io_get_int8(Input* in) {
   return mustget(in);
 }
 int16_t io_get_int16(Input* in) {
-  uint64_t a = mustget(in);
-  uint64_t b = mustget(in);
-  return (a << 8) | b;
+  uint16_t be;
+  io_readall(in, &be, 2);
+  return TO_BE16(be);
 }
 int32_t io_get_int32(Input* in) {
-  uint64_t a = mustget(in);
-  uint64_t b = mustget(in);
-  uint64_t c = mustget(in);
-  uint64_t d = mustget(in);
-  return (a << 24) | (b << 16) | (c << 8) | d;
+  uint32_t be;
+  io_readall(in, &be, 4);
+  return TO_BE32(be);
 }
 int64_t io_get_int64(Input* in) {
-  uint64_t a = mustget(in);
-  uint64_t b = mustget(in);
-  uint64_t c = mustget(in);
-  uint64_t d = mustget(in);
-  uint64_t e = mustget(in);
-  uint64_t f = mustget(in);
-  uint64_t g = mustget(in);
-  uint64_t h = mustget(in);
-  return (a << 56) | (b << 48) | (c << 40) | (d << 32) | (e << 24) | (f << 16) | (g << 8) | h;
+  uint64_t be;
+  io_readall(in, &be, 8);
+  return TO_BE64(be);
 }
 
+/* Fixed-width integer arrays */
+
+enum {
+  SWAP_BLOCK = 4096,  // bytes byte-swapped at a time on the stack
+};
+
+// The swap loops are simple enough for the compiler to vectorize into byte shuffles.
+#define DEFINE_ARRAY_CODEC(bits) \
+  static void swap##bits(uint##bits##_t* dst, const uint##bits##_t* src, size_t count) { \
+    for (size_t i = 0; i < count; i++) dst[i] = __builtin_bswap##bits(src[i]); \
+  } \
+  static void put_swapped##bits(Output* out, const int##bits##_t* src, size_t count) { \
+    uint##bits##_t block[SWAP_BLOCK / sizeof(uint##bits##_t)]; \
+    const size_t per_block = sizeof(block) / sizeof(block[0]); \
+    while (count) { \
+      size_t n = MIN(count, per_block); \
+      swap##bits(block, (const uint##bits##_t*)src, n); \
+      io_write(out, (char*)block, n * sizeof(block[0])); \
+      src += n; \
+      count -= n; \
+    } \
+  } \
+  void io_put_int##bits##_array(Output* out, const int##bits##_t* src, size_t count) { \
+    if (HOST_LE) put_swapped##bits(out, src, count); \
+    else io_write(out, (const char*)src, count * sizeof(*src)); \
+  } \
+  void io_put_int##bits##_array_le(Output* out, const int##bits##_t* src, size_t count) { \
+    if (HOST_LE) io_write(out, (const char*)src, count * sizeof(*src)); \
+    else put_swapped##bits(out, src, count); \
+  } \
+  void io_get_int##bits##_array(Input* in, int##bits##_t* dst, size_t count) { \
+    io_readall(in, dst, count * sizeof(*dst)); \
+    if (HOST_LE) swap##bits((uint##bits##_t*)dst, (uint##bits##_t*)dst, count); \
+  } \
+  void io_get_int##bits##_array_le(Input* in, int##bits##_t* dst, size_t count) { \
+    io_readall(in, dst, count * sizeof(*dst)); \
+    if (!HOST_LE) swap##bits((uint##bits##_t*)dst, (uint##bits##_t*)dst, count); \
+  }
+
+DEFINE_ARRAY_CODEC(16)
+DEFINE_ARRAY_CODEC(32)
+DEFINE_ARRAY_CODEC(64)
+
 void io_put_varint(Output* out, int64_t i) {
-  VARINT_STACK(v, 10);
-  int_to_varint(i, v);
-  varint_encode(v, out);
+  io_put_uvarint(out, varint_zigzag(i));
 }
 void io_put_uvarint(Output* out, uint64_t u) {
-  VARINT_STACK(v, 10);
-  uint_to_varint(u, v);
-  varint_encode(v, out);
+  char buf[VARINT_MAX_LEN];
+  io_write(out, buf, varint_write_u64(buf, u));
 }
 
 int64_t io_get_varint(Input* in) {
-  VARINT_STACK(v, 10);
-  if (!varint_decode(v, in)) RAISE(MALFORMED);
-  return varint_to_int(v);
+  return varint_unzigzag(io_get_uvarint(in));
 }
 uint64_t io_get_uvarint(Input* in) {
-  VARINT_STACK(v, 10);
-  if (!varint_decode(v, in)) RAISE(MALFORMED);
-  return varint_to_uint(v);
+  uint64_t u = 0;
+  for (unsigned shift = 0; shift < 7*VARINT_MAX_LEN; shift += 7) {
+    uint64_t digit = mustget(in);
+    u |= (digit & 0x7F) << shift;
+    if ((digit & 0x80) == 0) return u;
+  }
+  RAISE(MALFORMED);
+  return 0;
 }
 
 /* Formatting */
@@ -223,6 +270,8 @@ void io_vformat(IOFormatter* self, const char* fmt, va_list ap) {
 
 /* StringOutput */
 
+// Pieces from first up to last hold the written data; every piece before last is full. Pieces
+// after last are spares left over from a reset or rewind, and are reused before allocating.
 data(Piece) {
   Piece*      next;
   size_t      size;
@@ -253,12 +302,16 @@ Output* string_output_new(size_t initcap) {
 }
 
 static void make_piece(StringOutput* self) {
-  size_t sz = self->last->size * 2;
-  Piece* newpiece = malloc(sizeof(Piece) + sz);
-  newpiece->size = sz;
-  newpiece->next = NULL;
+  Piece* newpiece = self->last->next;
+  if (!newpiece) {
+    size_t sz = self->last->size * 2;
+    newpiece = malloc(sizeof(Piece) + sz);
+    if (!newpiece) RAISE(NOMEM);
+    newpiece->size = sz;
+    newpiece->next = NULL;
+    self->last->next = newpiece;
+  }
   self->offset = 0;
-  self->last->next = newpiece;
   self->last = newpiece;
 }
 static void string_output_write(void* _self, const char* src, size_t n) {
@@ -284,35 +337,44 @@ static void string_output_put(void* _self, char ch) {
 
 static void string_output_flush(void* self) { }
 
-static void string_output_close(void* _self) {
-  StringOutput* self = _self;
-  Piece *p, *tmp;
-  for (p = self->first; p; p = tmp) {
+static void free_pieces(Piece* p) {
+  Piece* tmp;
+  for (; p; p = tmp) {
     tmp = p->next;
     free(p);
   }
+}
+static void string_output_close(void* _self) {
+  StringOutput* self = _self;
+  free_pieces(self->first);
   free(self);
 }
 
+size_t string_output_size(Output* _self) {
+  StringOutput* self = (StringOutput*)_self;
+  size_t total = self->offset;
+  for (Piece* p = self->first; p != self->last; p = p->next) {
+    total += p->size;
+  }
+  return total;
+}
+
 const char* string_output_data(Output* _self, size_t* store_size) {
   StringOutput* self = (StringOutput*)_self;
 
-  if (self->first->next) {
+  if (self->first != self->last || self->offset == self->first->size) {
 
-    /* Collapse pieces into one */
+    /* Collapse pieces into one, leaving room for a terminating null byte */
 
-    size_t total = 0;
-    for (Piece* p = self->first; p; p = p->next) {
-      total += p->size;
-    }
+    size_t total = string_output_size(_self);
+    Piece* bigone = malloc(sizeof(Piece) + total + 1);
+    if (!bigone) RAISE(NOMEM);
+    bigone->size = total + 1;
+    bigone->next = self->last->next;
 
-    Piece* bigone = malloc(sizeof(Piece) + total);
-    bigone->size = total;
-    bigone->next = NULL;
-    
     size_t offset = 0;
     Piece* tmp;
-    for (Piece* p = self->first; p->next; p = tmp) {
+    for (Piece* p = self->first; p != self->last; p = tmp) {
       tmp = p->next;
       memcpy(bigone->data + offset, p->data, p->size);
       offset += p->size;
@@ -328,30 +390,61 @@ const char* string_output_data(Output* _self, size_t* store_size) {
   }
 
   Piece* p = self->first;
+  p->data[self->offset] = 0;
   if (store_size) {
     *store_size = self->offset;
   }
   return p->data;
 }
 
-void string_output_reset(Output* _self) {
+void string_output_segments(Output* _self, bool (*callback)(const char* data, size_t size)) {
   StringOutput* self = (StringOutput*)_self;
+  for (Piece* p = self->first; p != self->last; p = p->next) {
+    if (!callback(p->data, p->size)) return;
+  }
+  if (self->offset) callback(self->last->data, self->offset);
+}
 
-  // Free all pieces except the last
-  Piece* tmp;
-  for (Piece* p = self->first; p != self->last; p = tmp) {
-    tmp = p->next;
-    free(p);
+size_t string_output_iovec(Output* _self, struct iovec* iov, size_t max) {
+  StringOutput* self = (StringOutput*)_self;
+  size_t n = 0;
+  for (Piece* p = self->first; ; p = p->next) {
+    size_t sz = (p == self->last) ? self->offset : p->size;
+    if (sz) {
+      if (n < max) {
+        iov[n].iov_base = p->data;
+        iov[n].iov_len = sz;
+      }
+      n++;
+    }
+    if (p == self->last) break;
+  }
+  return n;
+}
+
+void string_output_copy(Output* _self, Output* to) {
+  bool write_segment(const char* data, size_t size) {
+    io_write(to, data, size);
+    return true;
   }
+  string_output_segments(_self, write_segment);
+}
 
-  self->first = self->last;
+void string_output_reset(Output* _self) {
+  StringOutput* self = (StringOutput*)_self;
+  // Keep all pieces around as spares
+  self->last = self->first;
   self->offset = 0;
 }
 void string_output_rewind(Output* _self, size_t new_offset) {
   StringOutput* self = (StringOutput*)_self;
-  // Force collapsing all pieces into one
-  string_output_data(_self, NULL);
-  assert(new_offset <= self->offset);
+  // Find the piece containing new_offset; later pieces become spares
+  Piece* p;
+  for (p = self->first; p != self->last && new_offset > p->size; p = p->next) {
+    new_offset -= p->size;
+  }
+  assert(p != self->last || new_offset <= self->offset);
+  self->last = p;
   self->offset = new_offset;
 }
 
@@ -386,6 +479,19 @@ void memory_input_reset(Input* _self, const char* src, size_t sz) {
   self->offset = 0;
 }
 
+bool memory_input_remaining(Input* in, const char** data, size_t* size) {
+  if (in->_impl != &memory_input_impl) return false;
+  MemoryInput* self = (MemoryInput*)in;
+  *data = self->src + self->offset;
+  *size = self->size - self->offset;
+  return true;
+}
+void memory_input_skip(Input* _self, size_t n) {
+  MemoryInput* self = (MemoryInput*)_self;
+  assert(n <= self->size - self->offset);
+  self->offset += n;
+}
+
 static size_t memory_input_read(void* _self, char* dst, size_t n) {
   MemoryInput* self = _self;
   n = MIN(n, self->size - self->offset);
@@ -1,5 +1,6 @@
 
 #include <errno.h>
+#include <assert.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -94,6 +95,36 @@ static void tcp_set_timeout(void* _self, unsigned seconds) {
   if (setsockopt(self->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) verr_raise_system();
   if (setsockopt(self->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1) verr_raise_system();
 }
+static void tcp_writev(void* _self, const struct iovec* _iov, int count) {
+  TCPConn* self = _self;
+  struct iovec iov[count];
+  memcpy(iov, _iov, count * sizeof(struct iovec));
+  struct msghdr msg = {
+    .msg_iov = iov,
+    .msg_iovlen = count,
+  };
+  while (msg.msg_iovlen) {
+    ssize_t written = sendmsg(self->fd, &msg, MSG_NOSIGNAL);
+    if (written == -1) {
+      if (errno == EINTR) continue;
+      verr_raise(errno == EAGAIN ? VERR_TIMEOUT : verr_system(errno));
+    }
+    // Skip what was written, which is not negative from here on
+    while (msg.msg_iovlen && (size_t)written >= msg.msg_iov->iov_len) {
+      written -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (written) {
+      msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + written;
+      msg.msg_iov->iov_len -= written;
+    }
+  }
+}
+static void tcp_conn_shutdown(void* _self) {
+  TCPConn* self = _self;
+  shutdown(self->fd, SHUT_RDWR);
+}
 static void tcp_conn_close(void* _self) {
   TCPConn* self = _self;
   unclosable_input_close(self->base.input);
@@ -104,6 +135,8 @@ static void tcp_conn_close(void* _self) {
 static NetConn_Impl tcp_conn_impl = {
   .close = tcp_conn_close,
   .set_timeout = tcp_set_timeout,
+  .writev = tcp_writev,
+  .shutdown = tcp_conn_shutdown,
 };
 
 /* TCPListener */
@@ -150,16 +183,25 @@ Error:
   return NULL;
 }
 
+unsigned net_listener_port(NetListener* tcp_listener) {
+  assert(tcp_listener->_impl == &tcp_listener_impl);
+  TCPListener* self = (TCPListener*)tcp_listener;
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(self->socket, (struct sockaddr*)&addr, &len) == -1) verr_raise_system();
+  if (addr.ss_family == AF_INET6) return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+  return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+}
+
 static NetConn* tcp_accept(void* _self) {
   TCPListener* self = _self;
-  TCPConn* conn = malloc(sizeof(TCPConn));
 
   int client = accept(self->socket, NULL, NULL);
   if (client == -1) {
-    free(conn);
     switch (errno) {
     case ECONNABORTED:
     case EPROTO:
+    case EINVAL:  // shut down
       verr_raise(VERR_NET);
     default:
       verr_raise_system();
@@ -168,6 +210,10 @@ static NetConn* tcp_accept(void* _self) {
 
   return tcp_conn_new(client);
 }
+static void tcp_listener_shutdown(void* _self) {
+  TCPListener* self = _self;
+  shutdown(self->socket, SHUT_RD);
+}
 static void tcp_listener_close(void* _self) {
   TCPListener* self = _self;
   close(self->socket);
@@ -175,6 +221,7 @@ static void tcp_listener_close(void* _self) {
 }
 static NetListener_Impl tcp_listener_impl = {
   .accept = tcp_accept,
+  .shutdown = tcp_listener_shutdown,
   .close = tcp_listener_close,
 };
 
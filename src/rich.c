@@ -4,9 +4,103 @@
 #include <stdlib.h>
 
 #include <vlib/rich.h>
+#include <vlib/rich_json.h>
+#include <vlib/rich_binary.h>
 #include <vlib/hashtable.h>
+#include <vlib/varint.h>
 #include <vlib/util.h>
 
+/* Keys */
+
+static void copy_output(Bytes* to, Output* out) {
+  Bytes data;
+  data.ptr = (void*)string_output_data(out, &data.size);
+  bytes_init(to, data.size);
+  bytes_copy(to, &data);
+}
+
+void rich_key_init(rich_Key* key, const Bytes* name) {
+  key->name = *name;
+  Output* out = string_output_new(name->size + 16);
+
+  rich_json_write_string(out, name);
+  io_put(out, ':');
+  copy_output(&key->json, out);
+
+  string_output_reset(out);
+  char cbuf[1 + VARINT_MAX_LEN];
+  cbuf[0] = RICH_BTAG_KEY;
+  io_write(out, cbuf, 1 + varint_write_u64(cbuf + 1, name->size));
+  io_write(out, name->ptr, name->size);
+  copy_output(&key->binary, out);
+
+  call(out, close);
+}
+void rich_key_close(rich_Key* key) {
+  bytes_close(&key->json);
+  bytes_close(&key->binary);
+}
+
+/* Packed arrays */
+
+static int64_t load_int(rich_PackedType type, const void* src, size_t i) {
+  switch (type) {
+    case RICH_PACKED_INT32: return ((const int32_t*)src)[i];
+    case RICH_PACKED_UINT8: return ((const uint8_t*)src)[i];
+    default:                return ((const int64_t*)src)[i];
+  }
+}
+void rich_packed_convert(rich_PackedType to_type, void* dst, rich_PackedType from_type, const void* src, size_t count) {
+  if (to_type == from_type) {
+    memcpy(dst, src, count * rich_packed_size(to_type));
+    return;
+  }
+  if (to_type == RICH_PACKED_DOUBLE || from_type == RICH_PACKED_DOUBLE) RAISE(MALFORMED);
+  for (size_t i = 0; i < count; i++) {
+    int64_t value = load_int(from_type, src, i);
+    switch (to_type) {
+      case RICH_PACKED_INT32:
+        if (value < INT32_MIN || value > INT32_MAX) RAISE(MALFORMED);
+        ((int32_t*)dst)[i] = value;
+        break;
+      case RICH_PACKED_UINT8:
+        if (value < 0 || value > UINT8_MAX) RAISE(MALFORMED);
+        ((uint8_t*)dst)[i] = value;
+        break;
+      default:
+        ((int64_t*)dst)[i] = value;
+        break;
+    }
+  }
+}
+
+void rich_sink_packed_atoms(rich_Sink* sink, rich_PackedType type, const void* data, size_t count) {
+  call(sink, sink, RICH_ARRAY, NULL);
+  rich_sink_packed_elements(sink, type, data, count);
+}
+void rich_sink_packed_elements(rich_Sink* sink, rich_PackedType type, const void* data, size_t count) {
+  int64_t ival;
+  for (size_t i = 0; i < count; i++) {
+    switch (type) {
+      case RICH_PACKED_INT64:
+        call(sink, sink, RICH_INT, (int64_t*)data + i);
+        break;
+      case RICH_PACKED_DOUBLE:
+        call(sink, sink, RICH_FLOAT, (double*)data + i);
+        break;
+      case RICH_PACKED_INT32:
+        ival = ((int32_t*)data)[i];
+        call(sink, sink, RICH_INT, &ival);
+        break;
+      case RICH_PACKED_UINT8:
+        ival = ((uint8_t*)data)[i];
+        call(sink, sink, RICH_INT, &ival);
+        break;
+    }
+  }
+  call(sink, sink, RICH_ENDARRAY, NULL);
+}
+
 /* Debug sink */
 
 static void print_string(Bytes* str) {
@@ -0,0 +1,308 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vlib/rich_binary.h>
+#include <vlib/varint.h>
+#include <vlib/util.h>
+
+/* Strings */
+
+// Reads in chunks, growing the buffer as the data arrives, so that a bogus length runs into the
+// end of the input instead of making a huge allocation
+void rich_binary_read_string(Input* in, Bytes* to) {
+  uint64_t size = io_get_uvarint(in);
+  to->size = 0;
+  do {
+    size_t n = MIN(size - to->size, (uint64_t)RICH_BINARY_CHUNK);
+    bytes_grow(to, to->size + n);
+    io_readall(in, (char*)to->ptr + to->size, n);
+    to->size += n;
+  } while (to->size < size);
+}
+
+/* Packed arrays */
+
+void rich_binary_write_packed(Output* out, rich_PackedType type, const void* data, size_t count) {
+  char cbuf[2 + VARINT_MAX_LEN];
+  cbuf[0] = RICH_BTAG_PACKED;
+  cbuf[1] = type;
+  io_write(out, cbuf, 2 + varint_write_u64(cbuf + 2, count));
+  switch (type) {
+    case RICH_PACKED_INT64:
+    case RICH_PACKED_DOUBLE:
+      io_put_int64_array_le(out, data, count);
+      break;
+    case RICH_PACKED_INT32:
+      io_put_int32_array_le(out, data, count);
+      break;
+    case RICH_PACKED_UINT8:
+      io_write(out, data, count);
+      break;
+  }
+}
+size_t rich_binary_read_packed_header(Input* in, rich_PackedType* type) {
+  int t = io_get(in);
+  if (t == -1) RAISE(EOF);
+  if (t > RICH_PACKED_UINT8) RAISE(MALFORMED);
+  *type = t;
+  uint64_t count = io_get_uvarint(in);
+  // Check the count up front where we can, so that memory inputs fail before any allocation
+  if (count > SIZE_MAX / rich_packed_size(t)) RAISE(MALFORMED);
+  const char* data;
+  size_t avail;
+  if (memory_input_remaining(in, &data, &avail) && count * rich_packed_size(t) > avail) RAISE(EOF);
+  return count;
+}
+void rich_binary_read_packed_data(Input* in, rich_PackedType type, void* dst, size_t count) {
+  switch (type) {
+    case RICH_PACKED_INT64:
+    case RICH_PACKED_DOUBLE:
+      io_get_int64_array_le(in, dst, count);
+      break;
+    case RICH_PACKED_INT32:
+      io_get_int32_array_le(in, dst, count);
+      break;
+    case RICH_PACKED_UINT8:
+      io_readall(in, dst, count);
+      break;
+  }
+}
+void rich_binary_read_packed(Input* in, rich_PackedType type, size_t count, Bytes* to) {
+  size_t elemsz = rich_packed_size(type);
+  size_t chunk = RICH_BINARY_CHUNK / elemsz;
+  to->size = 0;
+  for (size_t done = 0; done < count;) {
+    size_t n = MIN(count - done, chunk);
+    bytes_grow(to, to->size + n * elemsz);
+    rich_binary_read_packed_data(in, type, (char*)to->ptr + to->size, n);
+    to->size += n * elemsz;
+    done += n;
+  }
+}
+
+/* BinarySource */
+
+data(BinarySource) {
+  rich_Source   base;
+  Input*        in;
+  Bytes         sval;
+  Bytes         packed;
+};
+static rich_Source_Impl source_impl;
+
+static rich_Source* binary_new_source(void* _self, Input* in) {
+  BinarySource* self = malloc(sizeof(BinarySource));
+  self->base._impl = &source_impl;
+  self->in = in;
+  bytes_init(&self->sval, 32);
+  bytes_init(&self->packed, 0);
+  return &self->base;
+}
+
+static void source_close(void* _self) {
+  BinarySource* self = _self;
+  call(self->in, close);
+  bytes_close(&self->sval);
+  bytes_close(&self->packed);
+  free(self);
+}
+
+static int read_tag(Input* in) {
+  int tag = io_get(in);
+  if (tag == -1) RAISE(EOF);
+  return tag;
+}
+static void read_string(BinarySource* self) {
+  rich_binary_read_string(self->in, &self->sval);
+}
+// Points str straight into a memory input. Returns false for other inputs.
+static bool borrow_string(BinarySource* self, Bytes* str) {
+  const char* data;
+  size_t avail;
+  if (!memory_input_remaining(self->in, &data, &avail)) return false;
+  uint64_t size = io_get_uvarint(self->in);
+  memory_input_remaining(self->in, &data, &avail);
+  if (size > avail) RAISE(EOF);
+  str->ptr = (void*)data;
+  str->size = size;
+  memory_input_skip(self->in, size);
+  return true;
+}
+static void read_tagged(BinarySource* self, int tag, rich_Sink* to, unsigned depth) {
+  Input* in = self->in;
+  bool bval;
+  int64_t ival;
+  double fval;
+  Bytes str;
+  switch (tag) {
+    case RICH_BTAG_NIL:
+      call(to, sink, RICH_NIL, NULL);
+      break;
+    case RICH_BTAG_FALSE:
+    case RICH_BTAG_TRUE:
+      bval = tag == RICH_BTAG_TRUE;
+      call(to, sink, RICH_BOOL, &bval);
+      break;
+    case RICH_BTAG_INT:
+      ival = io_get_varint(in);
+      call(to, sink, RICH_INT, &ival);
+      break;
+    case RICH_BTAG_FLOAT:
+      ival = io_get_int64(in);
+      memcpy(&fval, &ival, sizeof(fval));
+      call(to, sink, RICH_FLOAT, &fval);
+      break;
+    case RICH_BTAG_STRING:
+      if (to->_impl->sink_borrowed && borrow_string(self, &str)) {
+        call(to, sink_borrowed, &str);
+      } else {
+        read_string(self);
+        call(to, sink, RICH_STRING, &self->sval);
+      }
+      break;
+
+    case RICH_BTAG_ARRAY:
+      if (depth == RICH_MAX_DEPTH) RAISE(MALFORMED);
+      call(to, sink, RICH_ARRAY, NULL);
+      while ((tag = read_tag(in)) != RICH_BTAG_ENDARRAY) {
+        read_tagged(self, tag, to, depth + 1);
+      }
+      call(to, sink, RICH_ENDARRAY, NULL);
+      break;
+    case RICH_BTAG_MAP:
+      if (depth == RICH_MAX_DEPTH) RAISE(MALFORMED);
+      call(to, sink, RICH_MAP, NULL);
+      while ((tag = read_tag(in)) != RICH_BTAG_ENDMAP) {
+        if (tag != RICH_BTAG_KEY) RAISE(MALFORMED);
+        read_string(self);
+        call(to, sink, RICH_KEY, &self->sval);
+        read_tagged(self, read_tag(in), to, depth + 1);
+      }
+      call(to, sink, RICH_ENDMAP, NULL);
+      break;
+
+    case RICH_BTAG_PACKED: {
+      rich_PackedType type;
+      size_t count = rich_binary_read_packed_header(in, &type);
+      rich_binary_read_packed(in, type, count, &self->packed);
+      rich_sink_packed(to, type, self->packed.ptr, count);
+      break;
+    }
+
+    default:
+      RAISE(MALFORMED);
+  }
+}
+static void read_value(void* _self, rich_Sink* to) {
+  BinarySource* self = _self;
+  read_tagged(self, read_tag(self->in), to, 0);
+}
+
+static rich_Source_Impl source_impl = {
+  .read_value = read_value,
+  .close = source_close,
+};
+
+/* BinarySink */
+
+data(BinarySink) {
+  rich_Sink   base;
+  Output*     out;
+};
+static rich_Sink_Impl sink_impl;
+
+static rich_Sink* binary_new_sink(void* _self, Output* out) {
+  BinarySink* self = malloc(sizeof(BinarySink));
+  self->base._impl = &sink_impl;
+  self->out = out;
+  return &self->base;
+}
+static void sink_close(void* _self) {
+  BinarySink* self = _self;
+  call(self->out, close);
+  free(self);
+}
+
+static void write_string(Output* out, char tag, Bytes* str) {
+  char cbuf[1 + VARINT_MAX_LEN];
+  cbuf[0] = tag;
+  size_t n = 1 + varint_write_u64(cbuf + 1, str->size);
+  io_write(out, cbuf, n);
+  io_write(out, str->ptr, str->size);
+}
+static void sink_sink(void* _self, rich_Atom atom, void* data) {
+  BinarySink* self = _self;
+  Output* out = self->out;
+
+  char cbuf[1 + VARINT_MAX_LEN];
+  size_t n;
+  int64_t bits;
+  switch (atom) {
+    case RICH_NIL:
+      io_put(out, RICH_BTAG_NIL);
+      break;
+    case RICH_BOOL:
+      io_put(out, *(bool*)data ? RICH_BTAG_TRUE : RICH_BTAG_FALSE);
+      break;
+    case RICH_INT:
+      cbuf[0] = RICH_BTAG_INT;
+      n = 1 + varint_write_i64(cbuf + 1, *(int64_t*)data);
+      io_write(out, cbuf, n);
+      break;
+    case RICH_FLOAT:
+      io_put(out, RICH_BTAG_FLOAT);
+      memcpy(&bits, data, sizeof(bits));
+      io_put_int64(out, bits);
+      break;
+    case RICH_STRING:
+      write_string(out, RICH_BTAG_STRING, data);
+      break;
+    case RICH_ARRAY:
+      io_put(out, RICH_BTAG_ARRAY);
+      break;
+    case RICH_ENDARRAY:
+      io_put(out, RICH_BTAG_ENDARRAY);
+      break;
+    case RICH_MAP:
+      io_put(out, RICH_BTAG_MAP);
+      break;
+    case RICH_KEY:
+      write_string(out, RICH_BTAG_KEY, data);
+      break;
+    case RICH_ENDMAP:
+      io_put(out, RICH_BTAG_ENDMAP);
+      break;
+
+    default:
+      RAISE(ARGUMENT);
+  }
+}
+
+static void sink_key(void* _self, const rich_Key* key) {
+  BinarySink* self = _self;
+  io_write(self->out, key->binary.ptr, key->binary.size);
+}
+
+static void sink_packed(void* _self, rich_PackedType type, const void* data, size_t count) {
+  BinarySink* self = _self;
+  rich_binary_write_packed(self->out, type, data, count);
+}
+
+static rich_Sink_Impl sink_impl = {
+  .sink = sink_sink,
+  .close = sink_close,
+  .sink_key = sink_key,
+  .sink_packed = sink_packed,
+};
+
+/* BinaryCodec */
+
+static rich_Codec_Impl binary_codec_impl = {
+  .new_sink = binary_new_sink,
+  .new_source = binary_new_source,
+  .close = null_close,
+};
+rich_Codec rich_codec_binary[1] = {{
+  ._impl = &binary_codec_impl,
+}};
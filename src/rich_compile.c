@@ -0,0 +1,678 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vlib/rich_schema.h>
+#include <vlib/rich_json.h>
+#include <vlib/rich_binary.h>
+#include <vlib/hashtable.h>
+#include <vlib/bitset.h>
+#include <vlib/varint.h>
+#include <vlib/util.h>
+
+/**
+ * A compiled schema is a flat array of instructions. The fields of a struct (including nested
+ * structs) follow it inline, with their offsets relative to the outermost value. Pointers and
+ * containers refer to a separate program for the value they contain, which is run with that
+ * value as its base.
+ */
+
+typedef struct Program Program;
+
+data(Op) {
+  rich_SchemaKind kind;
+  bool            optional;   // accepts nil when decoding
+  size_t          offset;     // offset of the value from the program's base
+  uint32_t        next;       // index after this instruction and its fields
+  uint32_t        count;      // number of fields of a struct
+  uint32_t*       fields;     // the index of each field of a struct, in declaration order
+  Program*        sub;        // pointers and containers
+  rich_Schema*    schema;     // the schema of the value
+
+  const rich_Key* key;        // only set for struct fields
+};
+
+struct Program {
+  Vector          ops[1];
+};
+
+struct rich_Compiled {
+  rich_Schema*    schema;
+  Program*        root;
+  bool            lenient;
+};
+
+/* Compilation */
+
+static Program* compile_program(rich_Schema* schema);
+
+static void close_program(Program* prog) {
+  for (unsigned i = 0; i < prog->ops->size; i++) {
+    Op* op = vector_get(prog->ops, i);
+    if (op->sub) close_program(op->sub);
+    free(op->fields);
+  }
+  vector_close(prog->ops);
+  free(prog);
+}
+
+static uint32_t compile_op(Program* prog, rich_Schema* schema, size_t offset) {
+  // Optional schemas share their value's memory, so they only set a flag
+  bool optional = false;
+  while (rich_schema_kind(schema) == RICH_SCHEMA_OPTIONAL) {
+    optional = true;
+    schema = rich_schema_inner(schema);
+  }
+
+  uint32_t index = prog->ops->size;
+  Op* op = vector_push(prog->ops);
+  memset(op, 0, sizeof(Op));
+  op->kind = rich_schema_kind(schema);
+  op->optional = optional;
+  op->offset = offset;
+  op->schema = schema;
+
+  switch (op->kind) {
+    case RICH_SCHEMA_CUSTOM:
+      RAISE(ARGUMENT);
+
+    case RICH_SCHEMA_POINTER:
+    case RICH_SCHEMA_VECTOR:
+    case RICH_SCHEMA_AUTOVECTOR:
+    case RICH_SCHEMA_HASHTABLE:
+      op->sub = compile_program(rich_schema_inner(schema));
+      break;
+
+    case RICH_SCHEMA_STRUCT: {
+      size_t count;
+      const rich_Field* table = rich_schema_field_table(schema, &count);
+      uint32_t* fields = malloc(count * sizeof(uint32_t));
+      op->count = count;
+      op->fields = fields;
+      for (size_t i = 0; i < count; i++) {
+        fields[i] = compile_op(prog, table[i].schema, offset + table[i].offset);
+        // Field keys are encoded once, by the schema
+        ((Op*)vector_get(prog->ops, fields[i]))->key = &table[i].key;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  ((Op*)vector_get(prog->ops, index))->next = prog->ops->size;
+  return index;
+}
+
+static Program* compile_program(rich_Schema* schema) {
+  Program* prog = malloc(sizeof(Program));
+  vector_init(prog->ops, sizeof(Op), 4);
+  TRY {
+    compile_op(prog, schema, 0);
+  } CATCH(err) {
+    close_program(prog);
+    verr_reraise();
+  } ETRY
+  return prog;
+}
+
+rich_Compiled* rich_schema_compile(rich_Schema* schema) {
+  Program* root = compile_program(schema);
+  rich_Compiled* self = malloc(sizeof(rich_Compiled));
+  self->schema = schema;
+  self->root = root;
+  self->lenient = false;
+  return self;
+}
+
+void rich_compiled_set_lenient(rich_Compiled* self, bool lenient) {
+  self->lenient = lenient;
+}
+
+void rich_compiled_close(rich_Compiled* self) {
+  close_program(self->root);
+  free(self);
+}
+
+static inline Op* op_at(Program* prog, uint32_t index) {
+  return vector_get(prog->ops, index);
+}
+
+/* JSON encoding */
+
+static void encode_json(Program* prog, uint32_t index, char* base, Output* out) {
+  Op* op = op_at(prog, index);
+  char* value = base + op->offset;
+  char cbuf[32];
+  size_t n;
+
+  switch (op->kind) {
+    case RICH_SCHEMA_BOOL:
+      if (*(bool*)value) {
+        io_writelit(out, "true");
+      } else {
+        io_writelit(out, "false");
+      }
+      break;
+    case RICH_SCHEMA_INT64:
+      n = rich_json_format_int(cbuf, *(int64_t*)value);
+      io_write(out, cbuf, n);
+      break;
+    case RICH_SCHEMA_DOUBLE:
+      n = rich_json_format_float(cbuf, *(double*)value);
+      io_write(out, cbuf, n);
+      break;
+    case RICH_SCHEMA_BYTES:
+    case RICH_SCHEMA_BORROWED:
+      if (((Bytes*)value)->ptr) {
+        rich_json_write_string(out, (Bytes*)value);
+      } else {
+        io_writelit(out, "null");
+      }
+      break;
+    case RICH_SCHEMA_DISCARD:
+      io_writelit(out, "null");
+      break;
+
+    case RICH_SCHEMA_POINTER:
+      if (*(void**)value) {
+        encode_json(op->sub, 0, *(void**)value, out);
+      } else {
+        io_writelit(out, "null");
+      }
+      break;
+
+    case RICH_SCHEMA_VECTOR: {
+      Vector* v = (Vector*)value;
+      if (!v->_data) {
+        io_writelit(out, "null");
+        break;
+      }
+      io_put(out, '[');
+      for (unsigned i = 0; i < v->size; i++) {
+        if (i) io_put(out, ',');
+        encode_json(op->sub, 0, vector_get(v, i), out);
+      }
+      io_put(out, ']');
+      break;
+    }
+    case RICH_SCHEMA_PACKED: {
+      Vector* v = (Vector*)value;
+      if (v->_data) {
+        rich_json_write_packed(out, rich_schema_packed_type(op->schema), v->_data, v->size);
+      } else {
+        io_writelit(out, "null");
+      }
+      break;
+    }
+    case RICH_SCHEMA_AUTOVECTOR: {
+      AutoVector* v = (AutoVector*)value;
+      if (!v->manager || !v->v->_data) {
+        io_writelit(out, "null");
+        break;
+      }
+      io_put(out, '[');
+      for (unsigned i = 0; i < v->v->size; i++) {
+        if (i) io_put(out, ',');
+        encode_json(op->sub, 0, vector_get(v->v, i), out);
+      }
+      io_put(out, ']');
+      break;
+    }
+    case RICH_SCHEMA_HASHTABLE: {
+      Hashtable* ht = (Hashtable*)value;
+      if (!ht->_buckets) {
+        io_writelit(out, "null");
+        break;
+      }
+      io_put(out, '{');
+      bool first = true;
+      int encode_entry(void* key, void* entry) {
+        if (!first) io_put(out, ',');
+        first = false;
+        rich_json_write_string(out, key);
+        io_put(out, ':');
+        encode_json(op->sub, 0, entry, out);
+        return HT_CONTINUE;
+      }
+      hashtable_iter(ht, encode_entry);
+      io_put(out, '}');
+      break;
+    }
+
+    case RICH_SCHEMA_STRUCT:
+      io_put(out, '{');
+      for (uint32_t i = index + 1; i < op->next; i = op_at(prog, i)->next) {
+        Op* field = op_at(prog, i);
+        if (i != index + 1) io_put(out, ',');
+        io_write(out, field->key->json.ptr, field->key->json.size);
+        encode_json(prog, i, base, out);
+      }
+      io_put(out, '}');
+      break;
+
+    default:
+      RAISE(ARGUMENT);
+  }
+}
+
+void rich_compiled_encode_json(rich_Compiled* self, void* value, Output* out) {
+  encode_json(self->root, 0, value, out);
+}
+
+/* Binary encoding */
+
+static void put_tagged_string(Output* out, char tag, const Bytes* str) {
+  char cbuf[1 + VARINT_MAX_LEN];
+  cbuf[0] = tag;
+  size_t n = 1 + varint_write_u64(cbuf + 1, str->size);
+  io_write(out, cbuf, n);
+  io_write(out, str->ptr, str->size);
+}
+
+static void encode_binary(Program* prog, uint32_t index, char* base, Output* out) {
+  Op* op = op_at(prog, index);
+  char* value = base + op->offset;
+  char cbuf[1 + VARINT_MAX_LEN];
+  int64_t bits;
+
+  switch (op->kind) {
+    case RICH_SCHEMA_BOOL:
+      io_put(out, *(bool*)value ? RICH_BTAG_TRUE : RICH_BTAG_FALSE);
+      break;
+    case RICH_SCHEMA_INT64:
+      cbuf[0] = RICH_BTAG_INT;
+      io_write(out, cbuf, 1 + varint_write_i64(cbuf + 1, *(int64_t*)value));
+      break;
+    case RICH_SCHEMA_DOUBLE:
+      io_put(out, RICH_BTAG_FLOAT);
+      memcpy(&bits, value, sizeof(bits));
+      io_put_int64(out, bits);
+      break;
+    case RICH_SCHEMA_BYTES:
+    case RICH_SCHEMA_BORROWED:
+      if (((Bytes*)value)->ptr) {
+        put_tagged_string(out, RICH_BTAG_STRING, (Bytes*)value);
+      } else {
+        io_put(out, RICH_BTAG_NIL);
+      }
+      break;
+    case RICH_SCHEMA_DISCARD:
+      io_put(out, RICH_BTAG_NIL);
+      break;
+
+    case RICH_SCHEMA_POINTER:
+      if (*(void**)value) {
+        encode_binary(op->sub, 0, *(void**)value, out);
+      } else {
+        io_put(out, RICH_BTAG_NIL);
+      }
+      break;
+
+    case RICH_SCHEMA_VECTOR: {
+      Vector* v = (Vector*)value;
+      if (!v->_data) {
+        io_put(out, RICH_BTAG_NIL);
+        break;
+      }
+      io_put(out, RICH_BTAG_ARRAY);
+      for (unsigned i = 0; i < v->size; i++) {
+        encode_binary(op->sub, 0, vector_get(v, i), out);
+      }
+      io_put(out, RICH_BTAG_ENDARRAY);
+      break;
+    }
+    case RICH_SCHEMA_PACKED: {
+      Vector* v = (Vector*)value;
+      if (v->_data) {
+        rich_binary_write_packed(out, rich_schema_packed_type(op->schema), v->_data, v->size);
+      } else {
+        io_put(out, RICH_BTAG_NIL);
+      }
+      break;
+    }
+    case RICH_SCHEMA_AUTOVECTOR: {
+      AutoVector* v = (AutoVector*)value;
+      if (!v->manager || !v->v->_data) {
+        io_put(out, RICH_BTAG_NIL);
+        break;
+      }
+      io_put(out, RICH_BTAG_ARRAY);
+      for (unsigned i = 0; i < v->v->size; i++) {
+        encode_binary(op->sub, 0, vector_get(v->v, i), out);
+      }
+      io_put(out, RICH_BTAG_ENDARRAY);
+      break;
+    }
+    case RICH_SCHEMA_HASHTABLE: {
+      Hashtable* ht = (Hashtable*)value;
+      if (!ht->_buckets) {
+        io_put(out, RICH_BTAG_NIL);
+        break;
+      }
+      io_put(out, RICH_BTAG_MAP);
+      int encode_entry(void* key, void* entry) {
+        put_tagged_string(out, RICH_BTAG_KEY, key);
+        encode_binary(op->sub, 0, entry, out);
+        return HT_CONTINUE;
+      }
+      hashtable_iter(ht, encode_entry);
+      io_put(out, RICH_BTAG_ENDMAP);
+      break;
+    }
+
+    case RICH_SCHEMA_STRUCT:
+      io_put(out, RICH_BTAG_MAP);
+      for (uint32_t i = index + 1; i < op->next; i = op_at(prog, i)->next) {
+        Op* field = op_at(prog, i);
+        io_write(out, field->key->binary.ptr, field->key->binary.size);
+        encode_binary(prog, i, base, out);
+      }
+      io_put(out, RICH_BTAG_ENDMAP);
+      break;
+
+    default:
+      RAISE(ARGUMENT);
+  }
+}
+
+void rich_compiled_encode_binary(rich_Compiled* self, void* value, Output* out) {
+  encode_binary(self->root, 0, value, out);
+}
+
+/* Binary decoding */
+
+static inline bool name_equals(const Bytes* a, const Bytes* b) {
+  return a->size == b->size && memcmp(a->ptr, b->ptr, a->size) == 0;
+}
+
+data(Decoder) {
+  Input*  in;
+  Arena*  arena;  // NULL to allocate with malloc
+  Bytes   key;
+  bool    lenient;
+};
+
+static int read_tag(Input* in) {
+  int tag = io_get(in);
+  if (tag == -1) RAISE(EOF);
+  return tag;
+}
+// Skips the rest of a value whose tag has been read
+static void skip_value(Decoder* d, int tag, unsigned depth) {
+  switch (tag) {
+    case RICH_BTAG_NIL:
+    case RICH_BTAG_FALSE:
+    case RICH_BTAG_TRUE:
+      break;
+    case RICH_BTAG_INT:
+      io_get_uvarint(d->in);
+      break;
+    case RICH_BTAG_FLOAT:
+      io_get_int64(d->in);
+      break;
+    case RICH_BTAG_STRING:
+      rich_binary_read_string(d->in, &d->key);
+      break;
+    case RICH_BTAG_ARRAY:
+      if (depth == RICH_MAX_DEPTH) RAISE(MALFORMED);
+      while ((tag = read_tag(d->in)) != RICH_BTAG_ENDARRAY) skip_value(d, tag, depth + 1);
+      break;
+    case RICH_BTAG_MAP:
+      if (depth == RICH_MAX_DEPTH) RAISE(MALFORMED);
+      while ((tag = read_tag(d->in)) != RICH_BTAG_ENDMAP) {
+        if (tag != RICH_BTAG_KEY) RAISE(MALFORMED);
+        rich_binary_read_string(d->in, &d->key);
+        skip_value(d, read_tag(d->in), depth + 1);
+      }
+      break;
+    case RICH_BTAG_PACKED: {
+      rich_PackedType type;
+      size_t count = rich_binary_read_packed_header(d->in, &type);
+      rich_binary_read_packed(d->in, type, count, &d->key);
+      break;
+    }
+    default:
+      RAISE(MALFORMED);
+  }
+}
+
+static void decode_binary(Decoder* d, Program* prog, uint32_t index, char* base, int tag) {
+  Op* op = op_at(prog, index);
+  char* value = base + op->offset;
+  Input* in = d->in;
+
+  if (tag == RICH_BTAG_NIL) {
+    // Leave the reset value
+    switch (op->kind) {
+      case RICH_SCHEMA_BYTES:
+      case RICH_SCHEMA_BORROWED:
+      case RICH_SCHEMA_DISCARD:
+      case RICH_SCHEMA_POINTER:
+      case RICH_SCHEMA_VECTOR:
+      case RICH_SCHEMA_AUTOVECTOR:
+      case RICH_SCHEMA_HASHTABLE:
+      case RICH_SCHEMA_PACKED:
+        return;
+      default:
+        if (op->optional) return;
+        RAISE(MALFORMED);
+    }
+  }
+
+  switch (op->kind) {
+    case RICH_SCHEMA_BOOL:
+      if (tag != RICH_BTAG_TRUE && tag != RICH_BTAG_FALSE) RAISE(MALFORMED);
+      *(bool*)value = tag == RICH_BTAG_TRUE;
+      break;
+    case RICH_SCHEMA_INT64:
+      if (tag != RICH_BTAG_INT) RAISE(MALFORMED);
+      *(int64_t*)value = io_get_varint(in);
+      break;
+    case RICH_SCHEMA_DOUBLE: {
+      if (tag != RICH_BTAG_FLOAT) RAISE(MALFORMED);
+      int64_t bits = io_get_int64(in);
+      memcpy(value, &bits, sizeof(bits));
+      break;
+    }
+    case RICH_SCHEMA_BYTES: {
+      if (tag != RICH_BTAG_STRING) RAISE(MALFORMED);
+      Bytes* b = (Bytes*)value;
+      if (d->arena) {
+        // Read the whole string before allocating from the arena, which can't give memory back
+        rich_binary_read_string(in, &d->key);
+        b->size = b->cap = d->key.size;
+        b->ptr = arena_memdup(d->arena, d->key.ptr, b->size);
+      } else {
+        rich_binary_read_string(in, b);
+      }
+      break;
+    }
+    case RICH_SCHEMA_BORROWED: {
+      if (tag != RICH_BTAG_STRING) RAISE(MALFORMED);
+      Bytes* b = (Bytes*)value;
+      if (b->cap) free(b->ptr);
+      b->ptr = NULL;
+      b->cap = 0;
+      const char* data;
+      size_t avail;
+      if (memory_input_remaining(in, &data, &avail)) {
+        // Point into the input instead of copying
+        uint64_t size = io_get_uvarint(in);
+        memory_input_remaining(in, &data, &avail);
+        if (size > avail) RAISE(EOF);
+        b->size = size;
+        b->ptr = (void*)data;
+        memory_input_skip(in, b->size);
+        break;
+      }
+      // Read the whole string before allocating, like the bytes schema
+      rich_binary_read_string(in, &d->key);
+      b->size = d->key.size;
+      if (d->arena) {
+        b->ptr = arena_memdup(d->arena, d->key.ptr, b->size);
+      } else {
+        b->cap = MAX(b->size, 1);
+        b->ptr = malloc(b->cap);
+        memcpy(b->ptr, d->key.ptr, b->size);
+      }
+      break;
+    }
+    case RICH_SCHEMA_DISCARD:
+      skip_value(d, tag, 0);
+      break;
+
+    case RICH_SCHEMA_POINTER:
+      if (!*(void**)value) {
+        // Only values decoded into an arena start out without a target
+        assert(d->arena);
+        *(void**)value = arena_calloc(d->arena, call(rich_schema_inner(op->schema), data_size));
+      }
+      decode_binary(d, op->sub, 0, *(void**)value, tag);
+      break;
+
+    case RICH_SCHEMA_VECTOR: {
+      if (tag != RICH_BTAG_ARRAY) RAISE(MALFORMED);
+      Vector* v = (Vector*)value;
+      rich_Schema* of = rich_schema_inner(op->schema);
+      if (d->arena) vector_init_arena(v, call(of, data_size), 4, d->arena);
+      while ((tag = read_tag(in)) != RICH_BTAG_ENDARRAY) {
+        void* elem = d->arena ? vector_push_arena(v, d->arena) : vector_push(v);
+        memset(elem, 0, v->elemsz);
+        if (!d->arena) call(of, reset_value, elem);
+        decode_binary(d, op->sub, 0, elem, tag);
+      }
+      break;
+    }
+    case RICH_SCHEMA_PACKED: {
+      rich_PackedType to_type = rich_schema_packed_type(op->schema);
+      Vector* v = (Vector*)value;
+      if (d->arena) vector_init_arena(v, rich_packed_size(to_type), 4, d->arena);
+      if (tag == RICH_BTAG_PACKED) {
+        rich_PackedType type;
+        size_t count = rich_binary_read_packed_header(in, &type);
+        size_t chunk = RICH_BINARY_CHUNK / rich_packed_size(type);
+        // Grow the vector as the elements arrive, in case the count is bogus
+        for (size_t done = 0; done < count;) {
+          size_t n = MIN(count - done, chunk);
+          void* dst = d->arena ? vector_extend_arena(v, n, d->arena) : vector_extend(v, n);
+          if (type == to_type) {
+            // Straight into the vector
+            rich_binary_read_packed_data(in, type, dst, n);
+          } else {
+            bytes_grow(&d->key, n * rich_packed_size(type));
+            rich_binary_read_packed_data(in, type, d->key.ptr, n);
+            rich_packed_convert(to_type, dst, type, d->key.ptr, n);
+          }
+          done += n;
+        }
+        break;
+      }
+      if (tag != RICH_BTAG_ARRAY) RAISE(MALFORMED);
+      while ((tag = read_tag(in)) != RICH_BTAG_ENDARRAY) {
+        int64_t elem;
+        if (tag == RICH_BTAG_INT) {
+          elem = io_get_varint(in);
+        } else if (tag == RICH_BTAG_FLOAT) {
+          elem = io_get_int64(in);
+        } else {
+          RAISE(MALFORMED);
+        }
+        void* dst = d->arena ? vector_push_arena(v, d->arena) : vector_push(v);
+        rich_packed_convert(to_type, dst, tag == RICH_BTAG_INT ? RICH_PACKED_INT64 : RICH_PACKED_DOUBLE, &elem, 1);
+      }
+      break;
+    }
+    case RICH_SCHEMA_AUTOVECTOR: {
+      if (tag != RICH_BTAG_ARRAY) RAISE(MALFORMED);
+      if (d->arena) RAISE(ARGUMENT);
+      AutoVector* v = (AutoVector*)value;
+      while ((tag = read_tag(in)) != RICH_BTAG_ENDARRAY) {
+        decode_binary(d, op->sub, 0, autovector_push(v), tag);
+      }
+      break;
+    }
+    case RICH_SCHEMA_HASHTABLE: {
+      if (tag != RICH_BTAG_MAP) RAISE(MALFORMED);
+      if (d->arena) RAISE(ARGUMENT);
+      Hashtable* ht = (Hashtable*)value;
+      rich_Schema* of = rich_schema_inner(op->schema);
+      while ((tag = read_tag(in)) != RICH_BTAG_ENDMAP) {
+        if (tag != RICH_BTAG_KEY) RAISE(MALFORMED);
+        Bytes key = {.ptr = NULL};
+        rich_binary_read_string(in, &key);
+        void* entry = hashtable_insert(ht, &key);
+        memset(entry, 0, ht->elemsz);
+        call(of, reset_value, entry);
+        decode_binary(d, op->sub, 0, entry, read_tag(in));
+      }
+      break;
+    }
+
+    case RICH_SCHEMA_STRUCT: {
+      if (tag != RICH_BTAG_MAP) RAISE(MALFORMED);
+      uint64_t words[bitset_size(op->count) / sizeof(uint64_t)];
+      Bitset* read = (Bitset*)words;
+      bitset_init(read, op->count);
+      uint32_t next = 0;  // the field expected to come next
+      while ((tag = read_tag(in)) != RICH_BTAG_ENDMAP) {
+        if (tag != RICH_BTAG_KEY) RAISE(MALFORMED);
+        rich_binary_read_string(in, &d->key);
+        int field = -1;
+        if (next < op->count && name_equals(&op_at(prog, op->fields[next])->key->name, &d->key)) {
+          field = next;
+        } else {
+          field = rich_schema_field_index(op->schema, &d->key);
+        }
+        if (field >= 0) {
+          next = field + 1;
+          bitset_set(read, field, true);
+          decode_binary(d, prog, op->fields[field], base, read_tag(in));
+        } else if (d->lenient) {
+          skip_value(d, read_tag(in), 0);
+        } else {
+          RAISE(MALFORMED);
+        }
+      }
+      if (d->lenient) break;
+      // Like a bound sink, only optional and discarded fields may be missing
+      for (uint32_t field = 0; field < op->count; field++) {
+        Op* f = op_at(prog, op->fields[field]);
+        if (!bitset_get(read, field) && !f->optional && f->kind != RICH_SCHEMA_DISCARD) {
+          RAISE(MALFORMED);
+        }
+      }
+      break;
+    }
+
+    default:
+      RAISE(ARGUMENT);
+  }
+}
+
+static void decode_root(rich_Compiled* self, Input* in, void* value, Arena* arena) {
+  Decoder d = {
+    .in = in,
+    .lenient = self->lenient,
+    .arena = arena,
+  };
+  bytes_init(&d.key, 32);
+  if (arena) {
+    memset(value, 0, call(self->schema, data_size));
+  } else {
+    call(self->schema, reset_value, value);
+  }
+  TRY {
+    decode_binary(&d, self->root, 0, value, read_tag(in));
+  } FINALLY {
+    bytes_close(&d.key);
+  } ETRY
+}
+
+void rich_compiled_decode_binary(rich_Compiled* self, Input* in, void* value) {
+  decode_root(self, in, value, NULL);
+}
+void rich_compiled_decode_binary_arena(rich_Compiled* self, Input* in, void* value, Arena* arena) {
+  decode_root(self, in, value, arena);
+}
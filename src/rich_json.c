@@ -5,16 +5,39 @@
 #include <ctype.h>
 #include <math.h>
 
-#include <vlib/rich.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <vlib/rich_json.h>
 #include <vlib/util.h>
 
 /* JSONSource */
 
+enum {
+  SOURCE_BLOCK = 4096,  // read size for inputs other than memory inputs
+};
+
+/**
+ * The source parses directly from a window of contiguous input. For memory inputs the window is
+ * the unread data itself, so nothing is copied and string atoms point straight into it. Buffered
+ * inputs are parsed in place in their buffer, and only the data up to the end of a value is
+ * marked as read. Other inputs are read into a block buffer, and any data after the end of a value
+ * is kept for the next call to read_value.
+ */
 data(JSONSource) {
   rich_Source   base;
   Input*        in;
-  Output*       buf;
-  Bytes         sval;
+  const char*   p;
+  const char*   end;
+  bool          direct;   // window belongs to a memory input
+  bool          buffered; // window is a buffered input's buffer, starting at `window`
+  const char*   window;
+  char*         block;
+  Bytes         sval;     // the last string read, which may point into the window
+  Bytes         str;      // decoded strings that could not be used in place
+  Bytes         tok;      // numbers split across blocks
+  Bytes         packed;   // elements of a packed array
 };
 static rich_Source_Impl source_impl;
 
@@ -22,203 +45,518 @@ static rich_Source* json_new_source(void* _self, Input* in) {
   JSONSource* self = malloc(sizeof(JSONSource));
   self->base._impl = &source_impl;
   self->in = in;
-  self->buf = string_output_new(32);
+  self->p = self->end = NULL;
+  self->block = NULL;
+  bytes_init(&self->str, 32);
+  bytes_init(&self->tok, 32);
+  bytes_init(&self->packed, 0);
   return &self->base;
 }
 
 static void source_close(void* _self) {
   JSONSource* self = _self;
   call(self->in, close);
-  call(self->buf, close);
+  free(self->block);
+  bytes_close(&self->str);
+  bytes_close(&self->tok);
+  bytes_close(&self->packed);
   free(self);
 }
 
-static void read_value(void* _self, rich_Sink* to);
-static int skip_whitespace(Input* in) {
-  int ch;
-  do {
-    ch = io_get(in);
-  } while (ch != -1 && isspace(ch));
-  return ch;
+// Refills the window once it has been used up. Returns false at the end of the input.
+static bool refill(JSONSource* self) {
+  if (self->direct) return false;
+  size_t n;
+  if (self->buffered) {
+    buf_input_skip(self->in, self->end - self->window);
+    buf_input_window(self->in, &self->window, &n);
+    self->p = self->window;
+  } else {
+    if (!self->block) self->block = malloc(SOURCE_BLOCK);
+    n = io_read(self->in, self->block, SOURCE_BLOCK);
+    self->p = self->block;
+  }
+  self->end = self->p + n;
+  return n > 0;
+}
+static inline int next_char(JSONSource* self) {
+  if (self->p == self->end && !refill(self)) return -1;
+  return *self->p++ & 0xFF;
+}
+
+static void append(Bytes* b, const char* src, size_t n) {
+  bytes_grow(b, b->size + n);
+  memcpy((char*)b->ptr + b->size, src, n);
+  b->size += n;
+}
+
+// Character classes
+enum {
+  CC_SPACE = 1,
+  CC_NUMBER = 2,
+  CC_WORD = 4,      // letters of true, false and null
+  CC_STRUCT = 8,    // quotes and brackets, which are all that skipping a value looks at
+};
+static const uint8_t char_class[256] = {
+  [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\n'] = CC_SPACE,
+  ['\v'] = CC_SPACE, ['\f'] = CC_SPACE, ['\r'] = CC_SPACE,
+  ['a'] = CC_WORD, ['f'] = CC_WORD, ['l'] = CC_WORD, ['n'] = CC_WORD,
+  ['r'] = CC_WORD, ['s'] = CC_WORD, ['t'] = CC_WORD, ['u'] = CC_WORD,
+  ['0' ... '9'] = CC_NUMBER, ['+'] = CC_NUMBER, ['-'] = CC_NUMBER,
+  ['.'] = CC_NUMBER, ['e'] = CC_NUMBER | CC_WORD, ['E'] = CC_NUMBER,
+  ['"'] = CC_STRUCT, ['['] = CC_STRUCT, [']'] = CC_STRUCT, ['{'] = CC_STRUCT, ['}'] = CC_STRUCT,
+};
+
+static void read_value(JSONSource* self, rich_Sink* to, unsigned depth);
+static int skip_whitespace(JSONSource* self) {
+  for (;;) {
+    const char* p = self->p;
+    const char* end = self->end;
+    while (p < end && (char_class[*p & 0xFF] & CC_SPACE)) p++;
+    if (p < end) {
+      self->p = p + 1;
+      return *p & 0xFF;
+    }
+    self->p = p;
+    if (!refill(self)) return -1;
+  }
 }
-static void read_primitive(Input* in, const char* rest) {
+static void read_primitive(JSONSource* self, const char* rest) {
   for (unsigned i = 0; rest[i]; i++) {
-    int ch = io_get(in);
+    int ch = next_char(self);
     if (ch != rest[i]) RAISE(MALFORMED);
   }
 }
-static void read_number(Input* in, int ch, rich_Sink* to) {
-  bool floating = false;
+
+// Returns the first quote or backslash in [p, end), or end.
+static const char* scan_string(const char* p, const char* end) {
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#endif
+  while (p < end && *p != '"' && *p != '\\') p++;
+  return p;
+}
+
+static const double exact_powers[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// The value of a number atom
+typedef union {
+  int64_t i;
+  double  f;
+} Number;
+
+// Parses a number into `value` and returns RICH_INT or RICH_FLOAT.
+static rich_Atom parse_number(JSONSource* self, const char* s, const char* end, Number* value) {
+  const char* start = s;
   bool negative = false;
+  bool floating = false;
+  bool truncated = false;
 
-  int64_t integral = 0;
-  double decimal = 0;
+  uint64_t mantissa = 0;
+  int digits = 0;
   int exponent = 0;
 
-  if (ch == '-') {
-    negative = true;
-    ch = io_get(in);
-  } else if (ch == '+') {
-    ch = io_get(in);
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = *s == '-';
+    s++;
   }
 
-  // Integral part
-  if (!isdigit(ch)) RAISE(MALFORMED);
+  // Up to 19 significant digits always fit in the mantissa
+  if (s == end || !isdigit(*s)) RAISE(MALFORMED);
   do {
-    integral = integral*10 + (ch - '0');
-    ch = io_get(in);
-  } while (isdigit(ch));
+    int d = *s++ - '0';
+    if (digits < 19) {
+      mantissa = mantissa*10 + d;
+      if (mantissa) digits++;
+    } else {
+      exponent++;
+      truncated |= d != 0;
+    }
+  } while (s < end && isdigit(*s));
 
   // Decimal part
-  if (ch == '.') {
+  if (s < end && *s == '.') {
     floating = true;
-    ch = io_get(in);
-    if (!isdigit(ch)) RAISE(MALFORMED);
-    double power = 0.1;
+    s++;
+    if (s == end || !isdigit(*s)) RAISE(MALFORMED);
     do {
-      decimal += (ch - '0') * power;
-      power /= 10;
-      ch = io_get(in);
-    } while (isdigit(ch));
+      int d = *s++ - '0';
+      if (digits < 19) {
+        mantissa = mantissa*10 + d;
+        if (mantissa) digits++;
+        exponent--;
+      } else {
+        truncated |= d != 0;
+      }
+    } while (s < end && isdigit(*s));
   }
 
   // Exponent part
-  if (ch == 'e' || ch == 'E') {
+  if (s < end && (*s == 'e' || *s == 'E')) {
     floating = true;
+    s++;
     bool negexp = false;
-    ch = io_get(in);
-    if (ch == '-') {
-      negexp = true;
-      ch = io_get(in);
-    } else if (ch == '+') {
-      ch = io_get(in);
+    if (s < end && (*s == '-' || *s == '+')) {
+      negexp = *s == '-';
+      s++;
     }
-    if (!isdigit(ch)) RAISE(MALFORMED);
+    if (s == end || !isdigit(*s)) RAISE(MALFORMED);
+    int e = 0;
     do {
-      exponent = exponent*10 + (ch - '0');
-      ch = io_get(in);
-    } while (isdigit(ch));
-    if (negexp) exponent = -exponent;
+      if (e < 100000) e = e*10 + (*s - '0');
+      s++;
+    } while (s < end && isdigit(*s));
+    exponent += negexp ? -e : e;
   }
 
-  io_unget(in);
+  if (s != end) RAISE(MALFORMED);
+
+  if (!floating && !truncated && exponent == 0 && mantissa <= (uint64_t)INT64_MAX + negative) {
+    value->i = negative ? (int64_t)(0 - mantissa) : (int64_t)mantissa;
+    return RICH_INT;
+  }
 
-  if (floating) {
-    double value = (double)integral + decimal;
-    if (negative) value = -value;
-    if (exponent) value = value * pow(10, exponent);
-    call(to, sink, RICH_FLOAT, &value);
+  if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+    // Both the mantissa and the power of ten are exact, so a single operation rounds correctly
+    double f = (double)mantissa;
+    f = exponent < 0 ? f / exact_powers[-exponent] : f * exact_powers[exponent];
+    value->f = negative ? -f : f;
   } else {
-    if (negative) integral = -integral;
-    call(to, sink, RICH_INT, &integral);
+    // Rare: leave the correctly rounded slow path to strtod
+    Bytes* tok = &self->tok;
+    if (tok->ptr != start) {
+      tok->size = 0;
+      append(tok, start, end - start);
+    }
+    tok->size = end - start;
+    append(tok, "", 1);
+    value->f = strtod(tok->ptr, NULL);
+  }
+  return RICH_FLOAT;
+}
+static rich_Atom read_number(JSONSource* self, Number* value) {
+  const char* start = self->p;
+  const char* q = start;
+  while (q < self->end && (char_class[*q & 0xFF] & CC_NUMBER)) q++;
+  if (q < self->end || self->direct) {
+    self->p = q;
+    return parse_number(self, start, q, value);
   }
 
+  // The number continues past the current block
+  Bytes* tok = &self->tok;
+  tok->size = 0;
+  append(tok, start, q - start);
+  self->p = q;
+  while (refill(self)) {
+    for (q = self->p; q < self->end && (char_class[*q & 0xFF] & CC_NUMBER); q++);
+    append(tok, self->p, q - self->p);
+    self->p = q;
+    if (q < self->end) break;
+  }
+  return parse_number(self, tok->ptr, (char*)tok->ptr + tok->size, value);
+}
+
+static void put_utf8(Bytes* b, uint32_t c) {
+  char cbuf[4];
+  size_t n;
+  if (c < 0x80) {
+    cbuf[0] = c;
+    n = 1;
+  } else if (c < 0x800) {
+    cbuf[0] = 0xC0 | (c >> 6);
+    cbuf[1] = 0x80 | (c & 0x3F);
+    n = 2;
+  } else if (c < 0x10000) {
+    cbuf[0] = 0xE0 | (c >> 12);
+    cbuf[1] = 0x80 | ((c >> 6) & 0x3F);
+    cbuf[2] = 0x80 | (c & 0x3F);
+    n = 3;
+  } else {
+    cbuf[0] = 0xF0 | (c >> 18);
+    cbuf[1] = 0x80 | ((c >> 12) & 0x3F);
+    cbuf[2] = 0x80 | ((c >> 6) & 0x3F);
+    cbuf[3] = 0x80 | (c & 0x3F);
+    n = 4;
+  }
+  append(b, cbuf, n);
+}
+static uint32_t read_hex4(JSONSource* self) {
+  uint32_t c = 0;
+  for (int i = 0; i < 4; i++) {
+    int ch = next_char(self);
+    if (ch >= '0' && ch <= '9') c = c*16 + (ch - '0');
+    else if (ch >= 'a' && ch <= 'f') c = c*16 + (ch - 'a' + 10);
+    else if (ch >= 'A' && ch <= 'F') c = c*16 + (ch - 'A' + 10);
+    else RAISE(MALFORMED);
+  }
+  return c;
+}
+static void read_escape(JSONSource* self, Bytes* b) {
+  int ch = next_char(self);
+  uint32_t c;
+  switch (ch) {
+    case '\\':
+    case '/':
+    case '"':
+      break;
+    case 'b':
+      ch = '\b';
+      break;
+    case 'f':
+      ch = '\f';
+      break;
+    case 'n':
+      ch = '\n';
+      break;
+    case 'r':
+      ch = '\r';
+      break;
+    case 't':
+      ch = '\t';
+      break;
+    case 'u':
+      c = read_hex4(self);
+      if (c >= 0xD800 && c < 0xDC00) {
+        // Surrogate pair
+        if (next_char(self) != '\\' || next_char(self) != 'u') RAISE(MALFORMED);
+        uint32_t low = read_hex4(self);
+        if (low < 0xDC00 || low >= 0xE000) RAISE(MALFORMED);
+        c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+      } else if (c >= 0xDC00 && c < 0xE000) {
+        RAISE(MALFORMED);
+      }
+      put_utf8(b, c);
+      return;
+    case -1:
+      RAISE(EOF);
+    default:
+      RAISE(MALFORMED);
+  }
+  char cch = ch;
+  append(b, &cch, 1);
 }
-static void read_string(JSONSource* self) {
-  Input* in = self->in;
-  string_output_reset(self->buf);
+// Returns true if the string is used in place.
+static bool read_string(JSONSource* self) {
+  const char* q = scan_string(self->p, self->end);
+  if (q < self->end && *q == '"') {
+    // No escapes: use the string in place
+    self->sval.ptr = (void*)self->p;
+    self->sval.size = q - self->p;
+    self->p = q + 1;
+    return true;
+  }
+
+  Bytes* b = &self->str;
+  b->size = 0;
   for (;;) {
-    int ch = io_get(in);
+    append(b, self->p, q - self->p);
+    self->p = q;
+    int ch = next_char(self);
     if (ch == '"') {
       break;
+    } else if (ch == '\\') {
+      read_escape(self, b);
     } else if (ch == -1) {
       RAISE(EOF);
+    } else {
+      // Refilled a new block; the character is part of the string
+      self->p--;
     }
-    if (ch == '\\') {
-      ch = io_get(in);
-      switch (ch) {
-        case '\\':
-        case '/':
-        case '"':
-          break;
-        case 'b':
-          ch = '\b';
-          break;
-        case 'f':
-          ch = '\f';
-          break;
-        case 'n':
-          ch = '\n';
-          break;
-        case 'r':
-          ch = '\r';
-          break;
-        case 't':
-          ch = '\t';
-          break;
-        case 'u':
-          // Not supported yet; I'm not sure how to handle unicode characters etc
-          RAISE(MALFORMED);
-        default:
-          RAISE(MALFORMED);
-      }
+    q = scan_string(self->p, self->end);
+  }
+  self->sval.ptr = b->ptr;
+  self->sval.size = b->size;
+  return false;
+}
+
+// Skips the rest of a string whose opening quote has been read
+static void skip_string(JSONSource* self) {
+  for (;;) {
+    self->p = scan_string(self->p, self->end);
+    int ch = next_char(self);
+    if (ch == '"') {
+      return;
+    } else if (ch == '\\') {
+      if (next_char(self) == -1) RAISE(EOF);
+    } else if (ch == -1) {
+      RAISE(EOF);
+    } else {
+      // Refilled a new block; the character is part of the string
+      self->p--;
     }
-    io_put(self->buf, ch);
   }
-  io_put(self->buf, 0);
-  self->sval.ptr = (char*)string_output_data(self->buf, &self->sval.size);
-  self->sval.size--; // Don't count the NULL-character
 }
-static void read_array(JSONSource* self, rich_Sink* to) {
-  Input* in = self->in;
-  call(to, sink, RICH_ARRAY, NULL);
-  bool first = true;
+// Skips the rest of an array or map whose opening bracket has been read, by matching brackets
+static void skip_container(JSONSource* self) {
+  unsigned depth = 1;
+  while (depth) {
+    const char* p = self->p;
+    while (p < self->end && !(char_class[*p & 0xFF] & CC_STRUCT)) p++;
+    self->p = p;
+    switch (next_char(self)) {
+      case -1:
+        RAISE(EOF);
+      case '"':
+        skip_string(self);
+        break;
+      case '[':
+      case '{':
+        depth++;
+        break;
+      case ']':
+      case '}':
+        depth--;
+        break;
+      default:
+        // Refilled a new block, and skipped its first character
+        break;
+    }
+  }
+}
+// Skips a value without passing anything on. Only quotes and brackets are looked at, so the
+// contents of the value are not checked.
+static void skip_value(JSONSource* self) {
+  int ch = skip_whitespace(self);
+  if (ch == '"') {
+    skip_string(self);
+  } else if (ch == '[' || ch == '{') {
+    skip_container(self);
+  } else if (ch == -1) {
+    RAISE(EOF);
+  } else if (char_class[ch] & (CC_NUMBER | CC_WORD)) {
+    for (;;) {
+      const char* p = self->p;
+      while (p < self->end && (char_class[*p & 0xFF] & (CC_NUMBER | CC_WORD))) p++;
+      self->p = p;
+      if (p < self->end || !refill(self)) break;
+    }
+  } else {
+    RAISE(MALFORMED);
+  }
+}
+
+static void read_elements(JSONSource* self, rich_Sink* to, bool first, unsigned depth) {
   for (;;) {
-    int ch = skip_whitespace(in);
+    int ch = skip_whitespace(self);
     if (ch == ']') break;
     if (first) {
       first = false;
-      io_unget(in);
+      self->p--;
     } else if (ch != ',') {
       RAISE(MALFORMED);
     }
-    read_value(self, to);
+    read_value(self, to, depth + 1);
   }
   call(to, sink, RICH_ENDARRAY, NULL);
 }
-static void read_map(JSONSource* self, rich_Sink* to) {
-  Input* in = self->in;
+// Reads an array whose elements are all integers or all floats as a single packed array. If
+// anything else turns up, the elements read so far are passed on as atoms and the rest of the
+// array is read as usual.
+static void read_packed(JSONSource* self, rich_Sink* to, unsigned depth) {
+  Bytes* run = &self->packed;
+  run->size = 0;
+  rich_Atom type = RICH_NIL;
+  size_t count = 0;
+  for (;;) {
+    int ch = skip_whitespace(self);
+    if (ch == ']') break;
+    if (count > 0) {
+      if (ch != ',') RAISE(MALFORMED);
+      ch = skip_whitespace(self);
+    }
+    if (ch == -1) RAISE(EOF);
+
+    Number value;
+    rich_Atom atom = RICH_NIL;
+    self->p--;
+    if (isdigit(ch) || ch == '-' || ch == '+') atom = read_number(self, &value);
+    if (atom == RICH_NIL || (count > 0 && atom != type)) {
+      call(to, sink, RICH_ARRAY, NULL);
+      for (size_t i = 0; i < count; i++) call(to, sink, type, (Number*)run->ptr + i);
+      if (atom == RICH_NIL) {
+        read_value(self, to, depth + 1);
+      } else {
+        call(to, sink, atom, &value);
+      }
+      read_elements(self, to, false, depth);
+      return;
+    }
+    type = atom;
+    append(run, (char*)&value, sizeof(value));
+    count++;
+  }
+
+  if (count == 0) {
+    call(to, sink, RICH_ARRAY, NULL);
+    call(to, sink, RICH_ENDARRAY, NULL);
+  } else {
+    call(to, sink_packed, type == RICH_INT ? RICH_PACKED_INT64 : RICH_PACKED_DOUBLE, run->ptr, count);
+  }
+}
+static void read_array(JSONSource* self, rich_Sink* to, unsigned depth) {
+  if (to->_impl->sink_packed) {
+    read_packed(self, to, depth);
+    return;
+  }
+  call(to, sink, RICH_ARRAY, NULL);
+  read_elements(self, to, true, depth);
+}
+static void read_map(JSONSource* self, rich_Sink* to, unsigned depth) {
   call(to, sink, RICH_MAP, NULL);
   bool first = true;
   for (;;) {
-    int ch = skip_whitespace(in);
+    int ch = skip_whitespace(self);
     if (ch == '}') break;
     if (first) {
       first = false;
     } else {
       if (ch != ',') RAISE(MALFORMED);
-      ch = skip_whitespace(in);
+      ch = skip_whitespace(self);
     }
     if (ch != '"') RAISE(MALFORMED);
     read_string(self);
     call(to, sink, RICH_KEY, &self->sval);
-    ch = skip_whitespace(in);
+    ch = skip_whitespace(self);
     if (ch != ':') RAISE(MALFORMED);
-    read_value(self, to);
+    if (rich_sink_skip(to)) {
+      skip_value(self);
+    } else {
+      read_value(self, to, depth + 1);
+    }
   }
   call(to, sink, RICH_ENDMAP, NULL);
 }
 
-static void read_value(void* _self, rich_Sink* to) {
-  JSONSource* self = _self;
-  Input* in = self->in;
-  int ch = skip_whitespace(in);
+static void read_value(JSONSource* self, rich_Sink* to, unsigned depth) {
+  int ch = skip_whitespace(self);
   bool bval;
+  Number num;
+  rich_Atom atom;
   switch (ch) {
     case -1:
       RAISE(EOF);
 
     case 'n':
-      read_primitive(in, "ull");
+      read_primitive(self, "ull");
       call(to, sink, RICH_NIL, NULL);
       break;
     case 't':
-      read_primitive(in, "rue");
+      read_primitive(self, "rue");
       bval = true;
       call(to, sink, RICH_BOOL, &bval);
       break;
     case 'f':
-      read_primitive(in, "alse");
+      read_primitive(self, "alse");
       bval = false;
       call(to, sink, RICH_BOOL, &bval);
       break;
@@ -226,19 +564,27 @@ static void read_value(void* _self, rich_Sink* to) {
     case '0': case '1': case '2': case '3': case '4':
     case '5': case '6': case '7': case '8': case '9':
     case '+': case '-':
-      read_number(in, ch, to);
+      self->p--;
+      atom = read_number(self, &num);
+      call(to, sink, atom, &num);
       break;
 
     case '"':
-      read_string(self);
-      call(to, sink, RICH_STRING, &self->sval);
+      // Strings in a memory input's buffer stay valid, so sinks can borrow them
+      if (read_string(self) && self->direct) {
+        rich_sink_borrowed(to, &self->sval);
+      } else {
+        call(to, sink, RICH_STRING, &self->sval);
+      }
       break;
 
     case '[':
-      read_array(self, to);
+      if (depth == RICH_MAX_DEPTH) RAISE(MALFORMED);
+      read_array(self, to, depth);
       break;
     case '{':
-      read_map(self, to);
+      if (depth == RICH_MAX_DEPTH) RAISE(MALFORMED);
+      read_map(self, to, depth);
       break;
 
     default:
@@ -246,72 +592,378 @@ static void read_value(void* _self, rich_Sink* to) {
   }
 }
 
+static void source_read_value(void* _self, rich_Sink* to) {
+  JSONSource* self = _self;
+  const char* start;
+  size_t size;
+  self->direct = memory_input_remaining(self->in, &start, &size);
+  self->buffered = !self->direct && buf_input_window(self->in, &start, &size);
+  if (self->direct || self->buffered) {
+    self->p = self->window = start;
+    self->end = start + size;
+  }
+  read_value(self, to, 0);
+  if (self->direct) {
+    memory_input_skip(self->in, self->p - start);
+  } else if (self->buffered) {
+    buf_input_skip(self->in, self->p - self->window);
+  }
+}
+
 static rich_Source_Impl source_impl = {
-  .read_value = read_value,
+  .read_value = source_read_value,
   .close = source_close,
 };
 
 /* JSONSink */
 
+// Container states kept on the sink's stack, one byte per nesting level
+enum {
+  IN_ARRAY_FIRST,
+  IN_ARRAY,
+  IN_MAP_FIRST,
+  IN_MAP,
+  IN_MAP_VALUE,
+};
+
 data(JSONSink) {
   rich_Sink   base;
   Output*     out;
-  Coroutine   co[1];
+  Bytes       stack;
 };
 static rich_Sink_Impl json_sink_impl;
 
-data(SinkArg) {
-  Output*     out;
-  rich_Atom   atom;
-  void*       data;
-};
-
-static co_State root_state;
-static co_State value_state;
-static co_State array_state;
-static co_State map_state;
-
 static rich_Sink* json_new_sink(void* _self, Output* out) {
   JSONSink* self = malloc(sizeof(JSONSink));
   self->base._impl = &json_sink_impl;
   self->out = out;
-  coroutine_init(self->co);
-  coroutine_push(self->co, &root_state, 0);
+  bytes_init(&self->stack, 16);
   return &self->base;
 }
-static void json_sink_sink(void* _self, rich_Atom atom, void* atom_data) {
-  JSONSink* self = _self;
-  SinkArg arg = {
-    .out = self->out,
-    .atom = atom,
-    .data = atom_data,
-  };
-  coroutine_run(self->co, &arg);
-}
 static void json_sink_close(void* _self) {
   JSONSink* self = _self;
-  coroutine_close(self->co);
+  bytes_close(&self->stack);
   call(self->out, close);
   free(self);
 }
-static rich_Sink_Impl json_sink_impl = {
-  .sink = json_sink_sink,
-  .close = json_sink_close,
+
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+size_t rich_json_format_int(char* buf, int64_t i) {
+  char tmp[20];
+  char* p = tmp + sizeof(tmp);
+  uint64_t u = i < 0 ? 0 - (uint64_t)i : (uint64_t)i;
+  while (u >= 100) {
+    unsigned pair = (u % 100) * 2;
+    u /= 100;
+    *--p = digit_pairs[pair + 1];
+    *--p = digit_pairs[pair];
+  }
+  if (u >= 10) {
+    *--p = digit_pairs[u*2 + 1];
+    *--p = digit_pairs[u*2];
+  } else {
+    *--p = '0' + u;
+  }
+  if (i < 0) *--p = '-';
+  size_t n = tmp + sizeof(tmp) - p;
+  memcpy(buf, p, n);
+  return n;
+}
+
+// Shortest round-trip formatting, using Grisu3 (Florian Loitsch, "Printing Floating-Point Numbers
+// Quickly and Accurately with Integers"). A double and the boundaries of its rounding interval
+// are scaled by a cached power of ten into 64-bit fixed point numbers, and digits are generated
+// until they fall inside the interval. Grisu3 knows when the imprecision of the scaling leaves
+// it unsure that its digits are the shortest correct ones, which happens for about 0.5% of
+// doubles; those take a slow path through snprintf and strtod.
+
+// A floating point number f * 2^e with a 64-bit significand
+data(DiyFp) {
+  uint64_t  f;
+  int       e;
 };
 
-static void root_run(void* _self, Coroutine* co, void* arg) {
-  // Delegate to a value sink
-  coroutine_push(co, &value_state, 0);
-  coroutine_run(co, arg);
+// Normalized 10^k for k = -348, -340, ..., 340
+static const struct {
+  uint64_t  f;
+  int16_t   e;
+} cached_powers[] = {
+  {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193}, {0x8b16fb203055ac76ULL, -1166},
+  {0xcf42894a5dce35eaULL, -1140}, {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+  {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034}, {0xbe5691ef416bd60cULL, -1007},
+  {0x8dd01fad907ffc3cULL,  -980}, {0xd3515c2831559a83ULL,  -954}, {0x9d71ac8fada6c9b5ULL,  -927},
+  {0xea9c227723ee8bcbULL,  -901}, {0xaecc49914078536dULL,  -874}, {0x823c12795db6ce57ULL,  -847},
+  {0xc21094364dfb5637ULL,  -821}, {0x9096ea6f3848984fULL,  -794}, {0xd77485cb25823ac7ULL,  -768},
+  {0xa086cfcd97bf97f4ULL,  -741}, {0xef340a98172aace5ULL,  -715}, {0xb23867fb2a35b28eULL,  -688},
+  {0x84c8d4dfd2c63f3bULL,  -661}, {0xc5dd44271ad3cdbaULL,  -635}, {0x936b9fcebb25c996ULL,  -608},
+  {0xdbac6c247d62a584ULL,  -582}, {0xa3ab66580d5fdaf6ULL,  -555}, {0xf3e2f893dec3f126ULL,  -529},
+  {0xb5b5ada8aaff80b8ULL,  -502}, {0x87625f056c7c4a8bULL,  -475}, {0xc9bcff6034c13053ULL,  -449},
+  {0x964e858c91ba2655ULL,  -422}, {0xdff9772470297ebdULL,  -396}, {0xa6dfbd9fb8e5b88fULL,  -369},
+  {0xf8a95fcf88747d94ULL,  -343}, {0xb94470938fa89bcfULL,  -316}, {0x8a08f0f8bf0f156bULL,  -289},
+  {0xcdb02555653131b6ULL,  -263}, {0x993fe2c6d07b7facULL,  -236}, {0xe45c10c42a2b3b06ULL,  -210},
+  {0xaa242499697392d3ULL,  -183}, {0xfd87b5f28300ca0eULL,  -157}, {0xbce5086492111aebULL,  -130},
+  {0x8cbccc096f5088ccULL,  -103}, {0xd1b71758e219652cULL,   -77}, {0x9c40000000000000ULL,   -50},
+  {0xe8d4a51000000000ULL,   -24}, {0xad78ebc5ac620000ULL,     3}, {0x813f3978f8940984ULL,    30},
+  {0xc097ce7bc90715b3ULL,    56}, {0x8f7e32ce7bea5c70ULL,    83}, {0xd5d238a4abe98068ULL,   109},
+  {0x9f4f2726179a2245ULL,   136}, {0xed63a231d4c4fb27ULL,   162}, {0xb0de65388cc8ada8ULL,   189},
+  {0x83c7088e1aab65dbULL,   216}, {0xc45d1df942711d9aULL,   242}, {0x924d692ca61be758ULL,   269},
+  {0xda01ee641a708deaULL,   295}, {0xa26da3999aef774aULL,   322}, {0xf209787bb47d6b85ULL,   348},
+  {0xb454e4a179dd1877ULL,   375}, {0x865b86925b9bc5c2ULL,   402}, {0xc83553c5c8965d3dULL,   428},
+  {0x952ab45cfa97a0b3ULL,   455}, {0xde469fbd99a05fe3ULL,   481}, {0xa59bc234db398c25ULL,   508},
+  {0xf6c69a72a3989f5cULL,   534}, {0xb7dcbf5354e9beceULL,   561}, {0x88fcf317f22241e2ULL,   588},
+  {0xcc20ce9bd35c78a5ULL,   614}, {0x98165af37b2153dfULL,   641}, {0xe2a0b5dc971f303aULL,   667},
+  {0xa8d9d1535ce3b396ULL,   694}, {0xfb9b7cd9a4a7443cULL,   720}, {0xbb764c4ca7a44410ULL,   747},
+  {0x8bab8eefb6409c1aULL,   774}, {0xd01fef10a657842cULL,   800}, {0x9b10a4e5e9913129ULL,   827},
+  {0xe7109bfba19c0c9dULL,   853}, {0xac2820d9623bf429ULL,   880}, {0x80444b5e7aa7cf85ULL,   907},
+  {0xbf21e44003acdd2dULL,   933}, {0x8e679c2f5e44ff8fULL,   960}, {0xd433179d9c8cb841ULL,   986},
+  {0x9e19db92b4e31ba9ULL,  1013}, {0xeb96bf6ebadf77d9ULL,  1039}, {0xaf87023b9bf0ee6bULL,  1066},
+};
+
+static const uint64_t pow10_u64[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+  1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+// Multiplies two DiyFps, rounding the 128-bit product to its upper 64 bits
+static DiyFp diyfp_mul(DiyFp a, DiyFp b) {
+  uint64_t a_hi = a.f >> 32, a_lo = a.f & 0xFFFFFFFF;
+  uint64_t b_hi = b.f >> 32, b_lo = b.f & 0xFFFFFFFF;
+  uint64_t hh = a_hi * b_hi, hl = a_hi * b_lo, lh = a_lo * b_hi, ll = a_lo * b_lo;
+  uint64_t mid = (ll >> 32) + (hl & 0xFFFFFFFF) + (lh & 0xFFFFFFFF) + (1ULL << 31);
+  return (DiyFp){hh + (hl >> 32) + (lh >> 32) + (mid >> 32), a.e + b.e + 64};
+}
+static DiyFp diyfp_normalize(DiyFp x) {
+  int shift = __builtin_clzll(x.f);
+  return (DiyFp){x.f << shift, x.e - shift};
 }
-static co_State root_state = {
-  .run = root_run,
+
+// Rounds the last digit towards w, and checks that the result is the closest to w and safely
+// inside the interval. All arguments are scaled by 10^-kappa, and unit is the possible error.
+static bool grisu_round_weed(char* digits, int len, uint64_t distance_too_high_w, uint64_t unsafe_interval,
+                             uint64_t rest, uint64_t ten_kappa, uint64_t unit) {
+  uint64_t small_distance = distance_too_high_w - unit;
+  uint64_t big_distance = distance_too_high_w + unit;
+  while (rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+         (rest + ten_kappa < small_distance ||
+          small_distance - rest >= rest + ten_kappa - small_distance)) {
+    digits[len - 1]--;
+    rest += ten_kappa;
+  }
+  // Another digit might also be closer if w is somewhere within the error
+  if (rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+      (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance)) {
+    return false;
+  }
+  return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+// Generates the shortest digits between low and high (which share w's exponent) that are closest
+// to w. The value is digits * 10^kappa. Returns false if they can't be vouched for.
+static bool grisu_digits(DiyFp low, DiyFp w, DiyFp high, char* digits, int* len, int* kappa) {
+  uint64_t unit = 1;
+  uint64_t too_low = low.f - unit;
+  uint64_t too_high = high.f + unit;
+  uint64_t unsafe_interval = too_high - too_low;
+  int shift = -w.e;
+  uint64_t one = 1ULL << shift;
+  uint32_t integrals = too_high >> shift;
+  uint64_t fractionals = too_high & (one - 1);
+
+  // Integral digits, of which there are at least one since too_high is normalized
+  int k = 1;
+  while (k < 10 && integrals >= pow10_u64[k]) k++;
+  uint32_t divisor = pow10_u64[k - 1];
+  *len = 0;
+  while (k > 0) {
+    digits[(*len)++] = '0' + integrals / divisor;
+    integrals %= divisor;
+    k--;
+    uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+    if (rest < unsafe_interval) {
+      *kappa = k;
+      return grisu_round_weed(digits, *len, too_high - w.f, unsafe_interval, rest,
+                              (uint64_t)divisor << shift, unit);
+    }
+    divisor /= 10;
+  }
+
+  // Fractional digits, where the error grows along with the digits
+  for (;;) {
+    fractionals *= 10;
+    unit *= 10;
+    unsafe_interval *= 10;
+    digits[(*len)++] = '0' + (fractionals >> shift);
+    fractionals &= one - 1;
+    k--;
+    if (fractionals < unsafe_interval) {
+      *kappa = k;
+      return grisu_round_weed(digits, *len, (too_high - w.f) * unit, unsafe_interval, fractionals,
+                              one, unit);
+    }
+  }
+}
+
+// Writes the shortest digits of a positive, finite double that read back as the same value, and
+// returns how many there are. The value is digits * 10^k.
+static int shortest_digits(double v, char* digits, int* k) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  int biased_e = (bits >> 52) & 0x7FF;
+  uint64_t significand = bits & ((1ULL << 52) - 1);
+  DiyFp x = biased_e ? (DiyFp){significand | (1ULL << 52), biased_e - 1075} : (DiyFp){significand, -1074};
+
+  // The boundaries halfway to the neighbouring doubles, which are closer together below powers of
+  // two (apart from the smallest normal)
+  DiyFp w = diyfp_normalize(x);
+  DiyFp plus = diyfp_normalize((DiyFp){(x.f << 1) + 1, x.e - 1});
+  DiyFp minus = (significand == 0 && biased_e > 1) ? (DiyFp){(x.f << 2) - 1, x.e - 2}
+                                                    : (DiyFp){(x.f << 1) - 1, x.e - 1};
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  // Pick the power of ten that scales w to a binary exponent between -60 and -32
+  double dk = (-61 - w.e) * 0.30102999566398114 + 347;
+  int ki = (int)dk;
+  if (dk - ki > 0) ki++;
+  unsigned index = (ki >> 3) + 1;
+  int mk = -348 + (int)index * 8;
+  DiyFp c = {cached_powers[index].f, cached_powers[index].e};
+
+  int len, kappa;
+  if (grisu_digits(diyfp_mul(minus, c), diyfp_mul(w, c), diyfp_mul(plus, c), digits, &len, &kappa)) {
+    *k = kappa - mk;
+    return len;
+  }
+
+  // The slow path: find the fewest significant digits that read back correctly
+  char cbuf[32];
+  int lo = 1, hi = 17;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    snprintf(cbuf, sizeof(cbuf), "%.*e", mid - 1, v);
+    if (strtod(cbuf, NULL) == v) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  snprintf(cbuf, sizeof(cbuf), "%.*e", lo - 1, v);
+  const char* p = cbuf;
+  for (len = 0; *p != 'e'; p++) {
+    if (*p != '.') digits[len++] = *p;
+  }
+  *k = atoi(p + 1) - (len - 1);
+  return len;
+}
+
+// Finite values get the shortest digits that read back as the same double, in exponent notation
+// below 1e-4 and from 1e15 up. Integral values get a ".0" suffix so that they are decoded as
+// floats again.
+size_t rich_json_format_float(char* buf, double v) {
+  if (!isfinite(v)) {
+    memcpy(buf, "null", 4);
+    return 4;
+  }
+  if (fabs(v) < 1e15 && v == (double)(int64_t)v) {
+    size_t n = 0;
+    if (signbit(v)) buf[n++] = '-';
+    n += rich_json_format_int(buf + n, (int64_t)fabs(v));
+    memcpy(buf + n, ".0", 2);
+    return n + 2;
+  }
+
+  char* p = buf;
+  if (v < 0) {
+    *p++ = '-';
+    v = -v;
+  }
+  char digits[24];
+  int k;
+  int len = shortest_digits(v, digits, &k);
+  int exp10 = len + k - 1;  // exponent of the first digit
+
+  if (exp10 < -4 || exp10 >= 15) {
+    *p++ = digits[0];
+    if (len > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, len - 1);
+      p += len - 1;
+    }
+    *p++ = 'e';
+    *p++ = exp10 < 0 ? '-' : '+';
+    unsigned e = abs(exp10);
+    if (e >= 100) *p++ = '0' + e / 100;
+    *p++ = '0' + e / 10 % 10;
+    *p++ = '0' + e % 10;
+  } else if (exp10 < 0) {
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -exp10 - 1);
+    p += -exp10 - 1;
+    memcpy(p, digits, len);
+    p += len;
+  } else {
+    // Non-integral values below 1e15 have digits after the point
+    memcpy(p, digits, exp10 + 1);
+    p += exp10 + 1;
+    *p++ = '.';
+    memcpy(p, digits + exp10 + 1, len - exp10 - 1);
+    p += len - exp10 - 1;
+  }
+  return p - buf;
+}
+
+static const bool needs_escape[256] = {
+  [0 ... 0x1F] = true, ['"'] = true, ['\\'] = true, ['/'] = true, [0x7F] = true,
 };
 
-static void encode_string(Output* out, Bytes* str) {
+// Returns the first byte in [p, end) that must be escaped, or end.
+static const char* scan_plain(const char* p, const char* end) {
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i del = _mm_set1_epi8(0x7F);
+  const __m128i ctrl_max = _mm_set1_epi8(0x1F);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i hits = _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl_max), v);
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, quote));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, backslash));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, slash));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, del));
+    int mask = _mm_movemask_epi8(hits);
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#endif
+  while (p < end && !needs_escape[*p & 0xFF]) p++;
+  return p;
+}
+
+void rich_json_write_string(Output* out, const Bytes* str) {
+  const char* p = str->ptr;
+  const char* end = p + str->size;
   io_put(out, '"');
-  for (unsigned i = 0; i < str->size; i++) {
-    char ch = ((char*)str->ptr)[i];
+  for (;;) {
+    // Write runs of characters that don't need escaping in one go
+    const char* q = scan_plain(p, end);
+    io_write(out, p, q - p);
+    if (q == end) break;
+    char ch = *q;
+    p = q + 1;
     switch (ch) {
       case '/':
       case '\\':
@@ -335,118 +987,161 @@ static void encode_string(Output* out, Bytes* str) {
         io_writelit(out, "\\t");
         break;
 
-      default:
-        if (isprint(ch)) {
-          io_put(out, ch);
-        } else {
-          char cbuf[20];
-          snprintf(cbuf, sizeof(cbuf), "\\u00%02x", ch);
-          io_write(out, cbuf, 6);
-        }
+      default: {
+        static const char hex[] = "0123456789abcdef";
+        char cbuf[6] = {'\\', 'u', '0', '0', hex[(ch >> 4) & 0xF], hex[ch & 0xF]};
+        io_write(out, cbuf, 6);
+      }
     }
   }
   io_put(out, '"');
 }
-static void value_run(void* udata, Coroutine* co, void* _arg) {
-  coroutine_pop(co);
 
-  SinkArg* arg = _arg;
-  Output* out = arg->out;
+static void write_numbers(Output* out, rich_PackedType type, const void* data, size_t count) {
+  char cbuf[32];
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0) io_put(out, ',');
+    switch (type) {
+      case RICH_PACKED_INT64:
+        n = rich_json_format_int(cbuf, ((const int64_t*)data)[i]);
+        break;
+      case RICH_PACKED_DOUBLE:
+        n = rich_json_format_float(cbuf, ((const double*)data)[i]);
+        break;
+      case RICH_PACKED_INT32:
+        n = rich_json_format_int(cbuf, ((const int32_t*)data)[i]);
+        break;
+      case RICH_PACKED_UINT8:
+        n = rich_json_format_int(cbuf, ((const uint8_t*)data)[i]);
+        break;
+    }
+    io_write(out, cbuf, n);
+  }
+}
+void rich_json_write_packed(Output* out, rich_PackedType type, const void* data, size_t count) {
+  io_put(out, '[');
+  write_numbers(out, type, data, count);
+  io_put(out, ']');
+}
 
-  char cbuf[100];
-  int n;
-  switch (arg->atom) {
+static void write_value(JSONSink* self, rich_Atom atom, void* data) {
+  Output* out = self->out;
+
+  char cbuf[32];
+  size_t n;
+  switch (atom) {
 
     case RICH_NIL:
       io_writelit(out, "null");
       break;
     case RICH_BOOL:
-      if (*(bool*)arg->data) {
+      if (*(bool*)data) {
         io_writelit(out, "true");
       } else {
         io_writelit(out, "false");
       }
       break;
     case RICH_INT:
-      n = snprintf(cbuf, sizeof(cbuf), "%ld", *(int64_t*)arg->data);
+      n = rich_json_format_int(cbuf, *(int64_t*)data);
       io_write(out, cbuf, n);
       break;
     case RICH_FLOAT:
-      n = snprintf(cbuf, sizeof(cbuf), "%lg", *(double*)arg->data);
+      n = rich_json_format_float(cbuf, *(double*)data);
       io_write(out, cbuf, n);
       break;
     case RICH_STRING:
-      encode_string(out, arg->data);
+      rich_json_write_string(out, data);
       break;
 
     case RICH_ARRAY:
       io_put(out, '[');
-      *(bool*)coroutine_push(co, &array_state, sizeof(bool)) = false;
+      bytes_grow(&self->stack, self->stack.size + 1);
+      ((char*)self->stack.ptr)[self->stack.size++] = IN_ARRAY_FIRST;
       break;
     case RICH_MAP:
       io_put(out, '{');
-      *(bool*)coroutine_push(co, &map_state, sizeof(bool)) = false;
+      bytes_grow(&self->stack, self->stack.size + 1);
+      ((char*)self->stack.ptr)[self->stack.size++] = IN_MAP_FIRST;
       break;
 
     default:
       RAISE(MALFORMED);
   }
 }
-static co_State value_state = {
-  .run = value_run,
-};
 
-static void array_run(void* udata, Coroutine* co, void* _arg) {
-  SinkArg* arg = _arg;
-  Output* out = arg->out;
-  if (arg->atom == RICH_ENDARRAY) {
-    io_put(out, ']');
-    coroutine_pop(co);
-    return;
-  }
+static void json_sink_sink(void* _self, rich_Atom atom, void* atom_data) {
+  JSONSink* self = _self;
+  Output* out = self->out;
 
-  // Print comma between elements
-  bool* comma = udata;
-  if (*comma) {
-    io_put(out, ',');
-  } else {
-    *comma = true;
+  // Any number of values can be written at the top level
+  if (self->stack.size == 0) {
+    write_value(self, atom, atom_data);
+    return;
   }
 
-  // Delegate to the value sink
-  coroutine_push(co, &value_state, 0);
-  coroutine_run(co, arg);
-}
-static co_State array_state = {
-  .run = array_run,
-};
-
-static void map_run(void* udata, Coroutine* co, void* _arg) {
-  SinkArg* arg = _arg;
-  Output* out = arg->out;
-  if (arg->atom == RICH_ENDMAP) {
-    io_put(out, '}');
-    coroutine_pop(co);
-    return;
-  } else if (arg->atom == RICH_KEY) {
+  char* top = (char*)self->stack.ptr + self->stack.size - 1;
+  switch (*top) {
+    case IN_ARRAY_FIRST:
+    case IN_ARRAY:
+      if (atom == RICH_ENDARRAY) {
+        io_put(out, ']');
+        self->stack.size--;
+        return;
+      }
+      // Print comma between elements
+      if (*top == IN_ARRAY) {
+        io_put(out, ',');
+      } else {
+        *top = IN_ARRAY;
+      }
+      write_value(self, atom, atom_data);
+      break;
 
-    // Print comma between elements
-    bool* comma = udata;
-    if (*comma) {
-      io_put(out, ',');
-    } else {
-      *comma = true;
-    }
+    case IN_MAP_FIRST:
+    case IN_MAP:
+      if (atom == RICH_ENDMAP) {
+        io_put(out, '}');
+        self->stack.size--;
+        return;
+      }
+      if (atom != RICH_KEY) RAISE(MALFORMED);
+      if (*top == IN_MAP) io_put(out, ',');
+      *top = IN_MAP_VALUE;
+      rich_json_write_string(out, atom_data);
+      io_put(out, ':');
+      break;
 
-    encode_string(out, arg->data);
-    io_put(out, ':');
-  } else {
-    coroutine_push(co, &value_state, 0);
-    coroutine_run(co, arg);
+    case IN_MAP_VALUE:
+      *top = IN_MAP;
+      write_value(self, atom, atom_data);
+      break;
   }
 }
-static co_State map_state = {
-  .run = map_run,
+static void json_sink_key(void* _self, const rich_Key* key) {
+  JSONSink* self = _self;
+  if (self->stack.size == 0) RAISE(MALFORMED);
+  char* top = (char*)self->stack.ptr + self->stack.size - 1;
+  if (*top == IN_MAP) {
+    io_put(self->out, ',');
+  } else if (*top != IN_MAP_FIRST) {
+    RAISE(MALFORMED);
+  }
+  *top = IN_MAP_VALUE;
+  io_write(self->out, key->json.ptr, key->json.size);
+}
+static void json_sink_packed(void* _self, rich_PackedType type, const void* data, size_t count) {
+  JSONSink* self = _self;
+  // The array's own atoms take care of the separator before it
+  json_sink_sink(self, RICH_ARRAY, NULL);
+  write_numbers(self->out, type, data, count);
+  json_sink_sink(self, RICH_ENDARRAY, NULL);
+}
+static rich_Sink_Impl json_sink_impl = {
+  .sink = json_sink_sink,
+  .close = json_sink_close,
+  .sink_key = json_sink_key,
+  .sink_packed = json_sink_packed,
 };
 
 /* JSONCodec */
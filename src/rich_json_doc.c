@@ -0,0 +1,395 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <vlib/rich_json.h>
+#include <vlib/util.h>
+
+enum {
+  TAPE_NIL,
+  TAPE_TRUE,
+  TAPE_FALSE,
+  TAPE_INT,
+  TAPE_FLOAT,
+  TAPE_STRING,
+  TAPE_ARRAY,
+  TAPE_MAP,
+  TAPE_KEY,
+};
+
+// Map entries are stored as a TAPE_KEY entry followed by the value.
+data(TapeEntry) {
+  uint8_t   type;
+  bool      escaped;  // strings and keys that contain escape sequences
+  uint32_t  start;    // offset of the first byte of the value in the source
+  uint32_t  end;      // offset after the last byte
+  uint32_t  next;     // tape index after this value and everything inside it
+  uint32_t  count;    // number of elements in arrays and maps
+};
+
+struct rich_JSONDoc {
+  const char*   src;
+  Vector        tape[1];
+
+  // Used to decode values, created on first use
+  Input*        in;
+  rich_Source*  source;
+};
+
+/* Indexing */
+
+data(Indexer) {
+  const char*   src;
+  const char*   p;
+  const char*   end;
+  Vector*       tape;
+  unsigned      depth;
+};
+
+static uint32_t add_entry(Indexer* ix, uint8_t type) {
+  uint32_t index = ix->tape->size;
+  TapeEntry* e = vector_push(ix->tape);
+  e->type = type;
+  e->escaped = false;
+  e->start = ix->p - ix->src;
+  e->next = index + 1;
+  e->count = 0;
+  return index;
+}
+static void end_entry(Indexer* ix, uint32_t index) {
+  TapeEntry* e = vector_get(ix->tape, index);
+  e->end = ix->p - ix->src;
+  e->next = ix->tape->size;
+}
+
+static void skip_whitespace(Indexer* ix) {
+  while (ix->p < ix->end && isspace(*ix->p)) ix->p++;
+}
+static void expect(Indexer* ix, char ch) {
+  if (ix->p == ix->end || *ix->p != ch) RAISE(MALFORMED);
+  ix->p++;
+}
+
+static void index_string(Indexer* ix, uint8_t type) {
+  uint32_t index = add_entry(ix, type);
+  bool escaped = false;
+  expect(ix, '"');
+  for (;;) {
+    if (ix->p == ix->end) RAISE(MALFORMED);
+    char ch = *ix->p++;
+    if (ch == '"') break;
+    if (ch == '\\') {
+      escaped = true;
+      if (ix->p == ix->end) RAISE(MALFORMED);
+      ix->p++;
+    }
+  }
+  end_entry(ix, index);
+  ((TapeEntry*)vector_get(ix->tape, index))->escaped = escaped;
+}
+static void index_literal(Indexer* ix, uint8_t type, const char* lit) {
+  uint32_t index = add_entry(ix, type);
+  size_t n = strlen(lit);
+  if ((size_t)(ix->end - ix->p) < n || memcmp(ix->p, lit, n) != 0) RAISE(MALFORMED);
+  ix->p += n;
+  end_entry(ix, index);
+}
+static void index_number(Indexer* ix) {
+  uint32_t index = add_entry(ix, TAPE_INT);
+  bool floating = false;
+  for (; ix->p < ix->end; ix->p++) {
+    char ch = *ix->p;
+    if (ch == '.' || ch == 'e' || ch == 'E') {
+      floating = true;
+    } else if (!isdigit(ch) && ch != '-' && ch != '+') {
+      break;
+    }
+  }
+  end_entry(ix, index);
+  if (floating) ((TapeEntry*)vector_get(ix->tape, index))->type = TAPE_FLOAT;
+}
+
+static void index_value(Indexer* ix);
+static void index_container(Indexer* ix, uint8_t type, char close) {
+  if (ix->depth == RICH_MAX_DEPTH) RAISE(MALFORMED);
+  ix->depth++;
+  uint32_t index = add_entry(ix, type);
+  uint32_t count = 0;
+  ix->p++;
+  skip_whitespace(ix);
+  if (ix->p < ix->end && *ix->p == close) {
+    ix->p++;
+  } else {
+    for (;;) {
+      if (type == TAPE_MAP) {
+        skip_whitespace(ix);
+        index_string(ix, TAPE_KEY);
+        skip_whitespace(ix);
+        expect(ix, ':');
+      }
+      index_value(ix);
+      count++;
+      skip_whitespace(ix);
+      if (ix->p < ix->end && *ix->p == ',') {
+        ix->p++;
+      } else {
+        expect(ix, close);
+        break;
+      }
+    }
+  }
+  end_entry(ix, index);
+  ((TapeEntry*)vector_get(ix->tape, index))->count = count;
+  ix->depth--;
+}
+
+static void index_value(Indexer* ix) {
+  skip_whitespace(ix);
+  if (ix->p == ix->end) RAISE(MALFORMED);
+  switch (*ix->p) {
+    case 'n':
+      index_literal(ix, TAPE_NIL, "null");
+      break;
+    case 't':
+      index_literal(ix, TAPE_TRUE, "true");
+      break;
+    case 'f':
+      index_literal(ix, TAPE_FALSE, "false");
+      break;
+
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+    case '+': case '-':
+      index_number(ix);
+      break;
+
+    case '"':
+      index_string(ix, TAPE_STRING);
+      break;
+    case '[':
+      index_container(ix, TAPE_ARRAY, ']');
+      break;
+    case '{':
+      index_container(ix, TAPE_MAP, '}');
+      break;
+
+    default:
+      RAISE(MALFORMED);
+  }
+}
+
+rich_JSONDoc* rich_json_parse(const char* src, size_t size) {
+  if (size > UINT32_MAX) RAISE(ARGUMENT);
+  rich_JSONDoc* self = malloc(sizeof(rich_JSONDoc));
+  self->src = src;
+  self->in = NULL;
+  self->source = NULL;
+  // Roughly one entry for every 8 bytes of typical JSON
+  vector_init(self->tape, sizeof(TapeEntry), size/8 + 4);
+
+  Indexer ix = {
+    .src = src,
+    .p = src,
+    .end = src + size,
+    .tape = self->tape,
+    .depth = 0,
+  };
+  TRY {
+    index_value(&ix);
+    skip_whitespace(&ix);
+    if (ix.p != ix.end) RAISE(MALFORMED);
+  } CATCH(err) {
+    rich_json_doc_close(self);
+    verr_reraise();
+  } ETRY
+  return self;
+}
+
+void rich_json_doc_close(rich_JSONDoc* self) {
+  vector_close(self->tape);
+  if (self->source) call(self->source, close);
+  free(self);
+}
+
+/* Navigation */
+
+static inline TapeEntry* entry(rich_JSONCursor c) {
+  return vector_get(c.doc->tape, c.index);
+}
+
+rich_JSONCursor rich_json_root(rich_JSONDoc* doc) {
+  return (rich_JSONCursor){.doc = doc, .index = 0};
+}
+
+rich_Atom rich_json_type(rich_JSONCursor c) {
+  static const rich_Atom atoms[] = {
+    [TAPE_NIL] = RICH_NIL,
+    [TAPE_TRUE] = RICH_BOOL,
+    [TAPE_FALSE] = RICH_BOOL,
+    [TAPE_INT] = RICH_INT,
+    [TAPE_FLOAT] = RICH_FLOAT,
+    [TAPE_STRING] = RICH_STRING,
+    [TAPE_ARRAY] = RICH_ARRAY,
+    [TAPE_MAP] = RICH_MAP,
+    [TAPE_KEY] = RICH_STRING,
+  };
+  return atoms[entry(c)->type];
+}
+
+size_t rich_json_length(rich_JSONCursor c) {
+  return entry(c)->count;
+}
+
+static bool key_equals(rich_JSONCursor key, const Bytes* str) {
+  TapeEntry* e = entry(key);
+  if (e->escaped) {
+    Bytes decoded = rich_json_get_string(key);
+    return bytes_compare(&decoded, str) == 0;
+  }
+  size_t size = e->end - e->start - 2;
+  return size == str->size && memcmp(key.doc->src + e->start + 1, str->ptr, size) == 0;
+}
+
+bool rich_json_find_bkey(rich_JSONCursor map, const Bytes* key, rich_JSONCursor* result) {
+  TapeEntry* e = entry(map);
+  if (e->type != TAPE_MAP) return false;
+  rich_JSONCursor c = {.doc = map.doc, .index = map.index + 1};
+  for (uint32_t i = 0; i < e->count; i++) {
+    if (key_equals(c, key)) {
+      result->doc = map.doc;
+      result->index = c.index + 1;
+      return true;
+    }
+    // Skip the key and the whole value
+    c.index = ((TapeEntry*)vector_get(map.doc->tape, c.index + 1))->next;
+  }
+  return false;
+}
+bool rich_json_find_key(rich_JSONCursor map, const char* key, rich_JSONCursor* result) {
+  Bytes str = {
+    .ptr = (void*)key,
+    .size = strlen(key),
+  };
+  return rich_json_find_bkey(map, &str, result);
+}
+
+bool rich_json_array_at(rich_JSONCursor array, size_t i, rich_JSONCursor* result) {
+  TapeEntry* e = entry(array);
+  if (e->type != TAPE_ARRAY || i >= e->count) return false;
+  // Elements are only linked to the next one, so this walks past the first i
+  rich_JSONCursor c = {.doc = array.doc, .index = array.index + 1};
+  while (i--) c.index = entry(c)->next;
+  *result = c;
+  return true;
+}
+
+void rich_json_each(rich_JSONCursor c, bool (*callback)(const Bytes* key, rich_JSONCursor value)) {
+  TapeEntry* e = entry(c);
+  if (e->type != TAPE_ARRAY && e->type != TAPE_MAP) return;
+  uint32_t count = e->count;
+  rich_JSONCursor it = {.doc = c.doc, .index = c.index + 1};
+  for (uint32_t i = 0; i < count; i++) {
+    if (e->type == TAPE_MAP) {
+      Bytes key = rich_json_get_string(it);
+      it.index++;
+      if (!callback(&key, it)) break;
+    } else {
+      if (!callback(NULL, it)) break;
+    }
+    it.index = entry(it)->next;
+  }
+}
+
+/* Decoding */
+
+void rich_json_replay(rich_JSONCursor c, rich_Sink* to) {
+  rich_JSONDoc* doc = c.doc;
+  if (!doc->source) {
+    doc->in = memory_input_new(NULL, 0);
+    doc->source = call(rich_codec_json, new_source, doc->in);
+  }
+  TapeEntry* e = entry(c);
+  memory_input_reset(doc->in, doc->src + e->start, e->end - e->start);
+  call(doc->source, read_value, to);
+}
+
+// Keeps the last scalar it receives
+data(ScalarSink) {
+  rich_Sink   base;
+  rich_Atom   atom;
+  union {
+    bool      bval;
+    int64_t   ival;
+    double    fval;
+    Bytes     sval;
+  };
+};
+static void scalar_sink(void* _self, rich_Atom atom, void* data) {
+  ScalarSink* self = _self;
+  self->atom = atom;
+  switch (atom) {
+    case RICH_BOOL:
+      self->bval = *(bool*)data;
+      break;
+    case RICH_INT:
+      self->ival = *(int64_t*)data;
+      break;
+    case RICH_FLOAT:
+      self->fval = *(double*)data;
+      break;
+    case RICH_STRING:
+      // Stays valid until the document's source reads another value
+      self->sval = *(Bytes*)data;
+      break;
+    default:
+      RAISE(MALFORMED);
+  }
+}
+static rich_Sink_Impl scalar_sink_impl = {
+  .sink = scalar_sink,
+  .close = null_close,
+};
+
+static ScalarSink decode_scalar(rich_JSONCursor c) {
+  ScalarSink sink = {
+    .base._impl = &scalar_sink_impl,
+  };
+  rich_json_replay(c, &sink.base);
+  return sink;
+}
+
+bool rich_json_get_bool(rich_JSONCursor c) {
+  switch (entry(c)->type) {
+    case TAPE_TRUE:
+      return true;
+    case TAPE_FALSE:
+      return false;
+  }
+  RAISE(MALFORMED);
+  return false;
+}
+int64_t rich_json_get_int(rich_JSONCursor c) {
+  if (entry(c)->type != TAPE_INT) RAISE(MALFORMED);
+  ScalarSink s = decode_scalar(c);
+  // Integers too large for int64 are decoded as floats
+  if (s.atom != RICH_INT) RAISE(MALFORMED);
+  return s.ival;
+}
+double rich_json_get_float(rich_JSONCursor c) {
+  uint8_t type = entry(c)->type;
+  if (type != TAPE_INT && type != TAPE_FLOAT) RAISE(MALFORMED);
+  ScalarSink s = decode_scalar(c);
+  return s.atom == RICH_INT ? s.ival : s.fval;
+}
+Bytes rich_json_get_string(rich_JSONCursor c) {
+  TapeEntry* e = entry(c);
+  if (e->type != TAPE_STRING && e->type != TAPE_KEY) RAISE(MALFORMED);
+  if (!e->escaped) {
+    return (Bytes){
+      .ptr = (void*)(c.doc->src + e->start + 1),
+      .size = e->end - e->start - 2,
+    };
+  }
+  return decode_scalar(c).sval;
+}
@@ -0,0 +1,297 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <vlib/rich_json.h>
+#include <vlib/util.h>
+
+typedef enum {
+  // Between tokens
+  S_VALUE,        // expecting a value
+  S_ARRAY_FIRST,  // expecting a value or ']'
+  S_MAP_FIRST,    // expecting a key or '}'
+  S_KEY,          // expecting a key
+  S_COLON,        // expecting ':'
+  S_AFTER_VALUE,  // expecting ',' or the end of the container
+
+  // Inside a token
+  S_STRING,
+  S_ESCAPE,
+  S_NUMBER,
+  S_LITERAL,
+} ParserState;
+
+// Passes completed tokens on to the parser's sink. Strings point into the parser's buffers, so
+// they are never passed on as borrowed.
+data(TokenSink) {
+  rich_Sink   base;
+  rich_Sink*  to;
+};
+
+struct rich_JSONParser {
+  rich_Sink*    to;
+  ParserState   state;
+  Bytes         stack;    // '[' or '{' for each open container
+  size_t        done;     // number of top-level values completed
+
+  bool          key;      // whether the current string is a key
+  Bytes         tok;      // part of the current token from previous chunks
+  const char*   literal;
+  rich_Atom     literal_atom;
+  bool          literal_value;
+
+  // Used to decode completed strings and numbers, created on first use
+  Input*        in;
+  rich_Source*  source;
+  TokenSink     key_sink;
+  TokenSink     value_sink;
+};
+
+static void key_sink(void* _self, rich_Atom atom, void* data) {
+  TokenSink* self = _self;
+  call(self->to, sink, RICH_KEY, data);
+}
+static rich_Sink_Impl key_sink_impl = {
+  .sink = key_sink,
+  .close = null_close,
+};
+static void value_sink(void* _self, rich_Atom atom, void* data) {
+  TokenSink* self = _self;
+  call(self->to, sink, atom, data);
+}
+static rich_Sink_Impl value_sink_impl = {
+  .sink = value_sink,
+  .close = null_close,
+};
+
+rich_JSONParser* rich_json_parser_new(rich_Sink* to) {
+  rich_JSONParser* self = malloc(sizeof(rich_JSONParser));
+  self->to = to;
+  bytes_init(&self->stack, 16);
+  bytes_init(&self->tok, 64);
+  self->in = NULL;
+  self->source = NULL;
+  self->key_sink.base._impl = &key_sink_impl;
+  self->key_sink.to = to;
+  self->value_sink.base._impl = &value_sink_impl;
+  self->value_sink.to = to;
+  rich_json_parser_reset(self);
+  return self;
+}
+void rich_json_parser_close(rich_JSONParser* self) {
+  bytes_close(&self->stack);
+  bytes_close(&self->tok);
+  if (self->source) call(self->source, close);
+  free(self);
+}
+void rich_json_parser_reset(rich_JSONParser* self) {
+  self->state = S_VALUE;
+  self->stack.size = 0;
+  self->tok.size = 0;
+  self->done = 0;
+}
+
+static void append(Bytes* b, const char* src, size_t n) {
+  bytes_grow(b, b->size + n);
+  memcpy((char*)b->ptr + b->size, src, n);
+  b->size += n;
+}
+
+static void value_done(rich_JSONParser* self) {
+  if (self->stack.size == 0) {
+    self->done++;
+    self->state = S_VALUE;
+  } else {
+    self->state = S_AFTER_VALUE;
+  }
+}
+
+// Decodes a complete string or number token with the regular JSON source. The token is
+// [start, end) of the current chunk, preceded by anything saved from earlier chunks.
+static void finish_token(rich_JSONParser* self, const char* start, const char* end) {
+  if (self->tok.size) {
+    append(&self->tok, start, end - start);
+    start = self->tok.ptr;
+    end = start + self->tok.size;
+  }
+  if (!self->source) {
+    self->in = memory_input_new(NULL, 0);
+    self->source = call(rich_codec_json, new_source, self->in);
+  }
+  memory_input_reset(self->in, start, end - start);
+  if (self->key) {
+    call(self->source, read_value, &self->key_sink.base);
+    self->state = S_COLON;
+  } else {
+    call(self->source, read_value, &self->value_sink.base);
+    value_done(self);
+  }
+  self->tok.size = 0;
+}
+
+static void open_container(rich_JSONParser* self, char type) {
+  bytes_grow(&self->stack, self->stack.size + 1);
+  ((char*)self->stack.ptr)[self->stack.size++] = type;
+  call(self->to, sink, type == '[' ? RICH_ARRAY : RICH_MAP, NULL);
+  self->state = type == '[' ? S_ARRAY_FIRST : S_MAP_FIRST;
+}
+static void close_container(rich_JSONParser* self, char type) {
+  self->stack.size--;
+  call(self->to, sink, type == '[' ? RICH_ENDARRAY : RICH_ENDMAP, NULL);
+  value_done(self);
+}
+
+static void start_literal(rich_JSONParser* self, char ch) {
+  switch (ch) {
+    case 'n':
+      self->literal = "ull";
+      self->literal_atom = RICH_NIL;
+      break;
+    case 't':
+      self->literal = "rue";
+      self->literal_atom = RICH_BOOL;
+      self->literal_value = true;
+      break;
+    case 'f':
+      self->literal = "alse";
+      self->literal_atom = RICH_BOOL;
+      self->literal_value = false;
+      break;
+  }
+  self->state = S_LITERAL;
+}
+
+size_t rich_json_parser_feed(rich_JSONParser* self, const char* data, size_t size) {
+  const char* p = data;
+  const char* end = data + size;
+  const char* tok = data;   // start of the current token within this chunk
+  size_t done = self->done;
+
+  while (p < end) {
+    char ch = *p;
+    switch (self->state) {
+
+      case S_STRING:
+        while (p < end && *p != '"' && *p != '\\') p++;
+        if (p == end) break;
+        if (*p++ == '\\') {
+          self->state = S_ESCAPE;
+        } else {
+          finish_token(self, tok, p);
+        }
+        break;
+      case S_ESCAPE:
+        // Escape sequences are checked when the string is decoded
+        p++;
+        self->state = S_STRING;
+        break;
+      case S_NUMBER:
+        while (p < end && (isdigit(*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E')) p++;
+        if (p < end) finish_token(self, tok, p);
+        break;
+      case S_LITERAL:
+        if (ch != *self->literal) RAISE(MALFORMED);
+        p++;
+        if (!*++self->literal) {
+          call(self->to, sink, self->literal_atom, &self->literal_value);
+          value_done(self);
+        }
+        break;
+
+      default:
+        if (isspace(ch)) {
+          p++;
+          break;
+        }
+        switch (self->state) {
+          case S_ARRAY_FIRST:
+            if (ch == ']') {
+              p++;
+              close_container(self, '[');
+              break;
+            }
+            // fall through
+          case S_VALUE:
+            self->key = false;
+            tok = p;
+            switch (ch) {
+              case '[':
+              case '{':
+                p++;
+                open_container(self, ch);
+                break;
+              case '"':
+                p++;
+                self->state = S_STRING;
+                break;
+              case '0': case '1': case '2': case '3': case '4':
+              case '5': case '6': case '7': case '8': case '9':
+              case '+': case '-':
+                self->state = S_NUMBER;
+                break;
+              case 'n':
+              case 't':
+              case 'f':
+                p++;
+                start_literal(self, ch);
+                break;
+              default:
+                RAISE(MALFORMED);
+            }
+            break;
+
+          case S_MAP_FIRST:
+            if (ch == '}') {
+              p++;
+              close_container(self, '{');
+              break;
+            }
+            // fall through
+          case S_KEY:
+            if (ch != '"') RAISE(MALFORMED);
+            self->key = true;
+            tok = p++;
+            self->state = S_STRING;
+            break;
+
+          case S_COLON:
+            if (ch != ':') RAISE(MALFORMED);
+            p++;
+            self->state = S_VALUE;
+            break;
+
+          case S_AFTER_VALUE: {
+            char top = ((char*)self->stack.ptr)[self->stack.size-1];
+            p++;
+            if (ch == ',') {
+              self->state = top == '[' ? S_VALUE : S_KEY;
+            } else if ((ch == ']' && top == '[') || (ch == '}' && top == '{')) {
+              close_container(self, top);
+            } else {
+              RAISE(MALFORMED);
+            }
+            break;
+          }
+
+          default:
+            break;
+        }
+    }
+  }
+
+  // Keep the unfinished part of a string or number for the next chunk
+  if (self->state == S_STRING || self->state == S_ESCAPE || self->state == S_NUMBER) {
+    append(&self->tok, tok, end - tok);
+  }
+  return self->done - done;
+}
+
+size_t rich_json_parser_finish(rich_JSONParser* self) {
+  size_t done = self->done;
+  if (self->state == S_NUMBER) {
+    finish_token(self, self->tok.ptr, self->tok.ptr);
+  }
+  if (self->state != S_VALUE || self->stack.size) RAISE(EOF);
+  return self->done - done;
+}
@@ -0,0 +1,202 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+
+#include <vlib/rich_json.h>
+#include <vlib/util.h>
+
+data(Chunk) {
+  rich_NDJSONReader*  reader;
+  size_t              index;
+  const char*         data;
+  size_t              size;
+  rich_Sink*          (*open_chunk)(size_t chunk);
+
+  // Set by the worker
+  rich_Sink*          sink;     // NULL if open_chunk raised
+  size_t              lines;
+  error_t             err;
+  char                msg[256];
+  bool                done;
+};
+
+struct rich_NDJSONReader {
+  PoolWorker  worker;
+  ThreadPool  pool[1];
+  Cond        cond[1];  // signalled whenever a chunk is done
+  size_t      chunk_size;
+};
+
+/* Worker */
+
+// Each thread has its own JSON source
+data(DecodeEnv) {
+  Input*        in;
+  rich_Source*  source;
+};
+
+static size_t decode_env_size(void* _self) {
+  return sizeof(DecodeEnv);
+}
+static void decode_init_env(void* _self, void* _env) {
+  DecodeEnv* env = _env;
+  env->in = memory_input_new(NULL, 0);
+  env->source = call(rich_codec_json, new_source, env->in);
+}
+static void decode_close_env(void* _self, void* _env) {
+  DecodeEnv* env = _env;
+  call(env->source, close);
+}
+
+static void decode_lines(DecodeEnv* env, Chunk* c) {
+  const char* p = c->data;
+  const char* end = p + c->size;
+  while (p < end) {
+    const char* eol = memchr(p, '\n', end - p);
+    if (!eol) eol = end;
+    while (p < eol && isspace(*p)) p++;
+    if (p < eol) {
+      memory_input_reset(env->in, p, eol - p);
+      call(env->source, read_value, c->sink);
+      // Only whitespace may follow the value
+      const char* rest;
+      size_t n;
+      memory_input_remaining(env->in, &rest, &n);
+      while (n && isspace(*rest)) rest++, n--;
+      if (n) RAISE(MALFORMED);
+      c->lines++;
+    }
+    p = eol + 1;
+  }
+}
+static void decode_work(void* _self, void* _env, void* job) {
+  DecodeEnv* env = _env;
+  Chunk* c = job;
+  TRY {
+    c->sink = c->open_chunk(c->index);
+    decode_lines(env, c);
+  } CATCH(err) {
+    c->err = err;
+    // The message belongs to this thread, so copy it for the caller
+    const char* msg = verr_current_msg();
+    snprintf(c->msg, sizeof(c->msg), "%s", msg ? msg : "");
+  } ETRY
+
+  Cond* cond = c->reader->cond;
+  thread_lock(cond);
+  c->done = true;
+  thread_broadcast(cond);
+  thread_unlock(cond);
+}
+
+static PoolWorker_Impl decode_worker_impl = {
+  .env_size = decode_env_size,
+  .init_env = decode_init_env,
+  .close_env = decode_close_env,
+  .work = decode_work,
+  .close = null_close,
+};
+
+/* Reader */
+
+rich_NDJSONReader* rich_ndjson_reader_new(unsigned threads, size_t chunk_size) {
+  rich_NDJSONReader* self = malloc(sizeof(rich_NDJSONReader));
+  self->worker._impl = &decode_worker_impl;
+  self->chunk_size = chunk_size;
+  thread_cond_init(self->cond);
+  threadpool_init(self->pool, poolmanager_new_basic(threads, threads, threads), &self->worker);
+  return self;
+}
+void rich_ndjson_reader_close(rich_NDJSONReader* self) {
+  threadpool_close(self->pool);
+  thread_cond_close(self->cond);
+  free(self);
+}
+
+size_t rich_ndjson_decode(rich_NDJSONReader* self, const char* src, size_t size,
+    rich_Sink* (*open_chunk)(size_t chunk), void (*chunk_done)(size_t chunk, rich_Sink* sink)) {
+
+  Vector chunks[1];
+  vector_init(chunks, sizeof(Chunk*), 16);
+  size_t delivered = 0;
+  size_t lines = 0;
+  error_t err = 0;
+  char msg[256] = "";
+
+  // Waits for a chunk, unless wait is false. Returns whether it is done.
+  bool chunk_wait(Chunk* c, bool wait) {
+    thread_lock(self->cond);
+    while (wait && !c->done) thread_wait(self->cond, -1);
+    bool done = c->done;
+    thread_unlock(self->cond);
+    return done;
+  }
+  // Passes the next chunk to chunk_done. Returns false if it isn't done and wait is false.
+  bool deliver_next(bool wait) {
+    Chunk* c = *(Chunk**)vector_get(chunks, delivered);
+    if (!chunk_wait(c, wait)) return false;
+
+    if (c->err && !err) {
+      err = c->err;
+      memcpy(msg, c->msg, sizeof(msg));
+    }
+    lines += c->lines;
+    delivered++;
+    if (c->sink) chunk_done(c->index, c->sink);
+    return true;
+  }
+
+  TRY {
+    size_t pos = 0;
+    while (pos < size) {
+      // Extend each chunk to the end of a line
+      size_t end = pos + self->chunk_size;
+      if (end >= size) {
+        end = size;
+      } else {
+        const char* eol = memchr(src + end, '\n', size - end);
+        end = eol ? (size_t)(eol - src) + 1 : size;
+      }
+
+      Chunk* c = malloc(sizeof(Chunk));
+      *c = (Chunk){
+        .reader = self,
+        .index = chunks->size,
+        .data = src + pos,
+        .size = end - pos,
+        .open_chunk = open_chunk,
+      };
+      *(Chunk**)vector_push(chunks) = c;
+      if (!threadpool_dispatch(self->pool, c, -1)) {
+        // No thread to take it, so decode it here
+        DecodeEnv env;
+        decode_init_env(self, &env);
+        decode_work(self, &env, c);
+        decode_close_env(self, &env);
+      }
+      pos = end;
+
+      while (delivered < chunks->size && deliver_next(false));
+    }
+    while (delivered < chunks->size) deliver_next(true);
+  } FINALLY {
+    // If chunk_done raised, the chunks still in flight have to finish before they are freed, and
+    // their sinks are closed instead of delivered
+    for (size_t i = 0; i < chunks->size; i++) {
+      Chunk* c = *(Chunk**)vector_get(chunks, i);
+      if (i >= delivered) {
+        chunk_wait(c, true);
+        if (c->sink) call(c->sink, close);
+      }
+      free(c);
+    }
+    vector_close(chunks);
+  } ETRY
+  if (err) {
+    if (*msg) verr_raisef(err, "%s", msg);
+    verr_raise(err);
+  }
+  return lines;
+}
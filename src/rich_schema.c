@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
 
 #include <vlib/rich_schema.h>
 #include <vlib/hashtable.h>
@@ -43,57 +44,98 @@ static rich_Source_Impl bound_source_impl = {
   .close = bound_source_close,
 };
 
+/**
+ * A bound sink decodes built-in schemas without coroutine states. It keeps a flat stack of
+ * frames, one for each value being decoded, and a single switch passes each atom to the top
+ * frame (see "Decoding" below). Custom schemas still push co_States onto the sink's coroutine,
+ * and a FRAME_CUSTOM frame hands atoms over to them until they are done.
+ */
+
+// Frame kinds, one per built-in schema that needs state. Pointers and unclosable wrappers are
+// looked through when a frame is pushed, and have none.
+enum {
+  FRAME_BOOL,
+  FRAME_INT64,
+  FRAME_DOUBLE,
+  FRAME_BYTES,
+  FRAME_BORROWED,
+  FRAME_DISCARD,
+  FRAME_OPTIONAL,   // replaced by a frame for the wrapped schema unless the value is nil
+  FRAME_VECTOR,
+  FRAME_AUTOVECTOR,
+  FRAME_HASHTABLE,
+  FRAME_STRUCT,
+  FRAME_PACKED,
+  FRAME_CUSTOM,     // the value's states are on the coroutine
+};
+
+data(Frame) {
+  uint8_t       kind;
+  bool          started;        // the first atom has arrived
+  rich_Schema*  schema;         // for FRAME_OPTIONAL, the wrapped schema
+  void*         value;
+  union {
+    unsigned    level;          // discard: nesting depth
+    unsigned    next_field;     // struct: the field expected to come next
+    size_t      height;         // custom: height of the coroutine below the value's states
+  };
+  size_t        read;           // struct: offset of the bitset of fields read in `bits`
+};
+
 data(BoundSink) {
   rich_Sink     base;
   rich_Schema*  schema;
   void*         to;
-  Coroutine     co[1];
+  Arena*        arena;
+  Vector        frames[1];
+  Bytes         bits;           // bitsets of the struct frames
+  Coroutine     co[1];          // states of custom schemas
+  bool          borrowing;      // the current atom came from sink_borrowed
+  bool          failed;         // an atom raised, leaving the frames of a value that can't finish
 };
 static rich_Sink_Impl bound_sink_impl;
 
-static co_State sink_root_state;
-
 rich_Sink* rich_bind_sink(rich_Schema* schema, void* to) {
+  return rich_bind_sink_arena(schema, to, NULL);
+}
+rich_Sink* rich_bind_sink_arena(rich_Schema* schema, void* to, Arena* arena) {
   BoundSink* self = malloc(sizeof(BoundSink));
   self->base._impl = &bound_sink_impl;
   self->schema = schema;
   self->to = to;
+  self->arena = arena;
+  self->borrowing = false;
+  self->failed = false;
+  vector_init(self->frames, sizeof(Frame), 16);
+  bytes_init(&self->bits, 64);
   coroutine_init(self->co);
-  *(BoundSink**)coroutine_push(self->co, &sink_root_state, sizeof(BoundSink*)) = self;
   return &self->base;
 }
 void rich_rebind_sink(rich_Sink* _self, void* to) {
   BoundSink* self = (BoundSink*)_self;
   self->to = to;
 }
-static void bound_sink_sink(void* _self, rich_Atom atom, void* atom_data) {
-  BoundSink* self = _self;
-  rich_SchemaArg arg = {
-    .atom = atom,
-    .data = atom_data,
-  };
-  coroutine_run(self->co, &arg);
-}
 static void bound_sink_close(void* _self) {
   BoundSink* self = _self;
   coroutine_close(self->co);
-  call(self->schema, close_value, self->to);
+  vector_close(self->frames);
+  bytes_close(&self->bits);
+  if (!self->arena) call(self->schema, close_value, self->to);
   call(self->schema, close);
   free(self);
 }
+// Defined with the decoding driver
+static void bound_sink_sink(void* _self, rich_Atom atom, void* atom_data);
+static void bound_sink_packed(void* _self, rich_PackedType type, const void* data, size_t count);
+static void bound_sink_borrowed(void* _self, const Bytes* str);
+static bool bound_sink_skip(void* _self);
+static void builtin_push_state(void* self, Coroutine* co, void* value);
 static rich_Sink_Impl bound_sink_impl = {
   .sink = bound_sink_sink,
   .close = bound_sink_close,
-};
-
-static void root_state_run(void* udata, Coroutine* co, void* arg) {
-  BoundSink* self = *(BoundSink**)udata;
-  call(self->schema, reset_value, self->to);
-  call(self->schema, push_state, co, self->to);
-  coroutine_run(self->co, arg);
-}
-static co_State sink_root_state = {
-  .run = root_state_run,
+  .sink_packed = bound_sink_packed,
+  .sink_borrowed = bound_sink_borrowed,
+  .sink_skip = bound_sink_skip,
 };
 
 /* Resource manager */
@@ -169,23 +211,18 @@ static void unclosable_close_value(void* _self, void* value) {
   UnclosableSchema* self = _self;
   call(self->wrap, close_value, value);
 }
-static void unclosable_push_state(void* _self, Coroutine* co, void* value) {
-  UnclosableSchema* self = _self;
-  call(self->wrap, push_state, co, value);
-}
 static rich_Schema_Impl unclosable_impl = {
   .data_size = unclosable_data_size,
   .dump_value = unclosable_dump_value,
   .close_value = unclosable_close_value,
   .reset_value = unclosable_reset_value,
   .close_value = unclosable_close_value,
-  .push_state = unclosable_push_state,
+  .push_state = builtin_push_state,
   .close = null_close,
 };
 
 /* Bool */
 
-static co_State bool_state;
 static size_t bool_data_size(void* _self) {
   return sizeof(bool);
 }
@@ -195,26 +232,13 @@ static void bool_dump_value(void* _self, void* _value, rich_Sink* to) {
 static void bool_reset_value(void* _self, void* _value) {
   *(bool*)_value = false;
 }
-static void bool_push_state(void* _self, Coroutine* co, void* value) {
-  *(void**)coroutine_push(co, &bool_state, sizeof(void*)) = value;
-}
 
-static void bool_sink_run(void* udata, Coroutine* co, void* _arg) {
-  rich_SchemaArg* arg = _arg;
-  if (arg->atom != RICH_BOOL) RAISE(MALFORMED);
-  bool* value = *(void**)udata;
-  *value = *(bool*)arg->data;
-  coroutine_pop(co);
-}
-static co_State bool_state = {
-  .run = bool_sink_run,
-};
 static rich_Schema_Impl bool_impl = {
   .data_size = bool_data_size,
   .dump_value = bool_dump_value,
   .reset_value = bool_reset_value,
   .close_value = null_close_value,
-  .push_state = bool_push_state,
+  .push_state = builtin_push_state,
   .close = null_close,
 };
 rich_Schema rich_schema_bool[1] = {{
@@ -223,7 +247,6 @@ rich_Schema rich_schema_bool[1] = {{
 
 /* Int64 */
 
-static co_State int64_state;
 static size_t int64_data_size(void* _self) {
   return sizeof(int64_t);
 }
@@ -233,26 +256,13 @@ static void int64_dump_value(void* _self, void* _value, rich_Sink* to) {
 static void int64_reset_value(void* _self, void* _value) {
   *(int64_t*)_value = 0;
 }
-static void int64_push_state(void* _self, Coroutine* co, void* value) {
-  *(void**)coroutine_push(co, &int64_state, sizeof(void*)) = value;
-}
 
-static void int64_sink_run(void* udata, Coroutine* co, void* _arg) {
-  rich_SchemaArg* arg = _arg;
-  if (arg->atom != RICH_INT) RAISE(MALFORMED);
-  int64_t* value = *(void**)udata;
-  *value = *(int64_t*)arg->data;
-  coroutine_pop(co);
-}
-static co_State int64_state = {
-  .run = int64_sink_run,
-};
 static rich_Schema_Impl int64_impl = {
   .data_size = int64_data_size,
   .dump_value = int64_dump_value,
   .reset_value = int64_reset_value,
   .close_value = null_close_value,
-  .push_state = int64_push_state,
+  .push_state = builtin_push_state,
   .close = null_close,
 };
 rich_Schema rich_schema_int64[1] = {{
@@ -261,7 +271,6 @@ rich_Schema rich_schema_int64[1] = {{
 
 /* Double */
 
-static co_State double_state;
 static size_t double_data_size(void* _self) {
   return sizeof(double);
 }
@@ -271,26 +280,13 @@ static void double_dump_value(void* _self, void* _value, rich_Sink* to) {
 static void double_reset_value(void* _self, void* _value) {
   *(double*)_value = 0;
 }
-static void double_push_state(void* _self, Coroutine* co, void* value) {
-  *(void**)coroutine_push(co, &double_state, sizeof(void*)) = value;
-}
 
-static void double_sink_run(void* udata, Coroutine* co, void* _arg) {
-  rich_SchemaArg* arg = _arg;
-  if (arg->atom != RICH_FLOAT) RAISE(MALFORMED);
-  double* value = *(void**)udata;
-  *value = *(double*)arg->data;
-  coroutine_pop(co);
-}
-static co_State double_state = {
-  .run = double_sink_run,
-};
 static rich_Schema_Impl double_impl = {
   .data_size = double_data_size,
   .dump_value = double_dump_value,
   .reset_value = double_reset_value,
   .close_value = null_close_value,
-  .push_state = double_push_state,
+  .push_state = builtin_push_state,
   .close = null_close,
 };
 rich_Schema rich_schema_double[1] = {{
@@ -299,7 +295,6 @@ rich_Schema rich_schema_double[1] = {{
 
 /* Bytes */
 
-static co_State bytes_state;
 static size_t bytes_data_size(void* _self) {
   return sizeof(Bytes);
 }
@@ -322,49 +317,43 @@ static void bytes_close_value(void* _self, void* _value) {
     value->ptr = NULL;
   }
 }
-static void bytes_push_state(void* _self, Coroutine* co, void* value) {
-  *(void**)coroutine_push(co, &bytes_state, sizeof(void*)) = value;
-}
 
-static void bytes_sink_run(void* udata, Coroutine* co, void* _arg) {
-  rich_SchemaArg* arg = _arg;
-  if (arg->atom != RICH_STRING) {
-    RAISE(MALFORMED);
-  }
-  Bytes* value = *(void**)udata;
-  Bytes* src = arg->data;
-  if (!value->ptr) {
-    value->cap = src->size;
-    value->ptr = malloc(value->cap);
-  } else if (src->size > value->cap) {
-    value->cap = src->size;
-    value->ptr = realloc(value->ptr, value->cap);
-  }
-  value->size = src->size;
-  memcpy(value->ptr, src->ptr, value->size);
-  coroutine_pop(co);
-}
-static co_State bytes_state = {
-  .run = bytes_sink_run,
-};
 static rich_Schema_Impl bytes_impl = {
   .data_size = bytes_data_size,
   .dump_value = bytes_dump_value,
   .reset_value = bytes_reset_value,
   .close_value = bytes_close_value,
-  .push_state = bytes_push_state,
+  .push_state = builtin_push_state,
   .close = null_close,
 };
 rich_Schema rich_schema_bytes[1] = {{
   ._impl = &bytes_impl,
 }};
 
-/* Discard */
+/* Borrowed bytes */
+
+// A cap of 0 means the memory belongs to someone else (the source's input or an arena)
+static void borrowed_close_value(void* _self, void* _value) {
+  Bytes* value = _value;
+  if (value->cap) free(value->ptr);
+  value->ptr = NULL;
+  value->size = value->cap = 0;
+}
 
-data(DiscardData) {
-  unsigned  level;
+static rich_Schema_Impl borrowed_impl = {
+  .data_size = bytes_data_size,
+  .dump_value = bytes_dump_value,
+  .reset_value = borrowed_close_value,
+  .close_value = borrowed_close_value,
+  .push_state = builtin_push_state,
+  .close = null_close,
 };
-static co_State discard_state;
+rich_Schema rich_schema_borrowed[1] = {{
+  ._impl = &borrowed_impl,
+}};
+
+/* Discard */
+
 
 static size_t discard_data_size(void* _self) {
   return 0;
@@ -374,45 +363,18 @@ static void discard_dump_value(void* _self, void* value, rich_Sink* to) {
 }
 static void discard_reset_value(void* _self, void* value) {}
 static void discard_close_value(void* _self, void* value) {}
-static void discard_push_state(void* _self, Coroutine* co, void* value) {
-  DiscardData* data = coroutine_push(co, &discard_state, sizeof(DiscardData));
-  data->level = 0;
-}
 static rich_Schema_Impl discard_impl = {
   .data_size = discard_data_size,
   .dump_value = discard_dump_value,
   .reset_value = discard_reset_value,
   .close_value = discard_close_value,
-  .push_state = discard_push_state,
+  .push_state = builtin_push_state,
   .close = null_close,
 };
 rich_Schema rich_schema_discard[1] = {{
   ._impl = &discard_impl,
 }};
 
-static void discard_state_run(void* udata, Coroutine* co, void* _arg) {
-  DiscardData* data = udata;
-  rich_SchemaArg* arg = _arg;
-  switch (arg->atom) {
-    case RICH_ARRAY:
-    case RICH_MAP:
-      data->level++;
-      break;
-    case RICH_ENDARRAY:
-    case RICH_ENDMAP:
-      data->level--;
-      break;
-    default:
-      /* leave level unchanged */
-      break;
-  }
-  if (data->level == 0) {
-    coroutine_pop(co);
-  }
-}
-static co_State discard_state = {
-  .run = discard_state_run,
-};
 
 /* Pointer */
 
@@ -457,12 +419,6 @@ static void pointer_close_value(void* _self, void* value) {
     *ptr = NULL;
   }
 }
-static void pointer_push_state(void* _self, Coroutine* co, void* value) {
-  PointerSchema* self = _self;
-  void** ptr = value;
-  assert(*ptr);
-  call(self->of, push_state, co, *ptr);
-}
 static void pointer_close(void* _self) {
   PointerSchema* self = _self;
   call(self->of, close);
@@ -473,7 +429,7 @@ static rich_Schema_Impl pointer_impl = {
   .dump_value = pointer_dump_vaule,
   .reset_value = pointer_reset_value,
   .close_value = pointer_close_value,
-  .push_state = pointer_push_state,
+  .push_state = builtin_push_state,
   .close = pointer_close,
 };
 
@@ -485,11 +441,6 @@ data(OptionalSchema) {
 };
 static rich_Schema_Impl optional_impl;
 
-data(OptionalData) {
-  rich_Schema*  wrap;
-  void*         value;
-};
-static co_State optional_state;
 
 rich_Schema* rich_schema_optional(rich_Schema* wrap) {
   OptionalSchema* self = malloc(sizeof(OptionalSchema));
@@ -513,12 +464,6 @@ static void optional_close_value(void* _self, void* value) {
   OptionalSchema* self = _self;
   call(self->wrap, close_value, value);
 }
-static void optional_push_state(void* _self, Coroutine* co, void* value) {
-  OptionalSchema* self = _self;
-  OptionalData* data = coroutine_push(co, &optional_state, sizeof(OptionalData));
-  data->wrap = self->wrap;
-  data->value = value;
-}
 static void optional_close(void* _self) {
   OptionalSchema* self = _self;
   call(self->wrap, close);
@@ -529,21 +474,10 @@ static rich_Schema_Impl optional_impl = {
   .dump_value = optional_dump_value,
   .reset_value = optional_reset_value,
   .close_value = optional_close_value,
-  .push_state = optional_push_state,
+  .push_state = builtin_push_state,
   .close = optional_close,
 };
 
-static void optional_state_run(void* udata, Coroutine* co, void* _arg) {
-  OptionalData* data = udata;
-  rich_SchemaArg* arg = _arg;
-  if (arg->atom != RICH_NIL) {
-    call(data->wrap, push_state, co, data->value);
-    coroutine_run(co, arg);
-  }
-}
-static co_State optional_state = {
-  .run = optional_state_run,
-};
 
 /* Vector */
 
@@ -553,12 +487,6 @@ data(VectorSchema) {
 };
 static rich_Schema_Impl vector_impl;
 
-data(VectorData) {
-  rich_Schema*  of;
-  Vector*       v;
-  bool          first_atom;
-};
-static co_State vector_state;
 
 rich_Schema* rich_schema_vector(rich_Schema* of) {
   VectorSchema* self = malloc(sizeof(VectorSchema));
@@ -576,6 +504,7 @@ static void vector_dump_value(void* _self, void* _value, rich_Sink* to) {
     call(to, sink, RICH_NIL, NULL);
     return;
   }
+  call(to, sink, RICH_ARRAY, NULL);
   for (unsigned i = 0; i < v->size; i++) {
     call(self->of, dump_value, vector_get(v, i), to);
   }
@@ -603,13 +532,6 @@ static void vector_close_value(void* _self, void* _value) {
     vector_close(v);
   }
 }
-static void vector_push_state(void* _self, Coroutine* co, void* _value) {
-  VectorSchema* self = _self;
-  VectorData* data = coroutine_push(co, &vector_state, sizeof(VectorData));
-  data->of = self->of;
-  data->v = _value;
-  data->first_atom = true;
-}
 static void vector_schema_close(void* _self) {
   VectorSchema* self = _self;
   call(self->of, close);
@@ -620,33 +542,69 @@ static rich_Schema_Impl vector_impl = {
   .dump_value = vector_dump_value,
   .reset_value = vector_reset_value,
   .close_value = vector_close_value,
-  .push_state = vector_push_state,
+  .push_state = builtin_push_state,
   .close = vector_schema_close,
 };
 
-static void vector_state_run(void* udata, Coroutine* co, void* _arg) {
-  VectorData* data = udata;
-  rich_SchemaArg* arg = _arg;
-  if (data->first_atom) {
-    data->first_atom = false;
-    if (arg->atom != RICH_ARRAY) RAISE(MALFORMED);
+
+/* Packed */
+
+data(PackedSchema) {
+  rich_Schema     base;
+  rich_PackedType type;
+};
+static rich_Schema_Impl packed_impl;
+
+
+static PackedSchema packed_schemas[] = {
+  [RICH_PACKED_INT64] = {{&packed_impl}, RICH_PACKED_INT64},
+  [RICH_PACKED_DOUBLE] = {{&packed_impl}, RICH_PACKED_DOUBLE},
+  [RICH_PACKED_INT32] = {{&packed_impl}, RICH_PACKED_INT32},
+  [RICH_PACKED_UINT8] = {{&packed_impl}, RICH_PACKED_UINT8},
+};
+
+rich_Schema* rich_schema_packed(rich_PackedType type) {
+  return &packed_schemas[type].base;
+}
+static size_t packed_data_size(void* _self) {
+  return sizeof(Vector);
+}
+static void packed_dump_value(void* _self, void* _value, rich_Sink* to) {
+  PackedSchema* self = _self;
+  Vector* v = _value;
+  if (!v->_data) {
+    call(to, sink, RICH_NIL, NULL);
     return;
   }
-  if (arg->atom == RICH_ENDARRAY) {
-    coroutine_pop(co);
+  rich_sink_packed(to, self->type, v->_data, v->size);
+}
+static void packed_reset_value(void* _self, void* _value) {
+  PackedSchema* self = _self;
+  Vector* v = _value;
+  if (v->_data) {
+    vector_clear(v);
   } else {
-    // Delegate to sub schema
-    void* value = vector_push(data->v);
-    memset(value, 0, call(data->of, data_size));
-    call(data->of, reset_value, value);
-    call(data->of, push_state, co, value);
-    coroutine_run(co, arg);
+    vector_init(v, rich_packed_size(self->type), 4);
+  }
+}
+static void packed_close_value(void* _self, void* _value) {
+  Vector* v = _value;
+  if (v->_data) {
+    vector_close(v);
+    v->_data = NULL;
   }
 }
-static co_State vector_state = {
-  .run = vector_state_run,
+static rich_Schema_Impl packed_impl = {
+  .data_size = packed_data_size,
+  .dump_value = packed_dump_value,
+  .reset_value = packed_reset_value,
+  .close_value = packed_close_value,
+  .push_state = builtin_push_state,
+  .close = null_close,
 };
 
+
+
 /* AutoVector */
 
 data(AutoVectorSchema) {
@@ -655,12 +613,6 @@ data(AutoVectorSchema) {
 };
 static rich_Schema_Impl autovector_impl;
 
-data(AutoVectorData) {
-  rich_Schema*  of;
-  AutoVector*   v;
-  bool          first_atom;
-};
-static co_State autovector_state;
 
 rich_Schema* rich_schema_autovector(rich_Schema* of) {
   AutoVectorSchema* self = malloc(sizeof(AutoVectorSchema));
@@ -699,13 +651,6 @@ static void autovector_close_value(void* _self, void* value) {
   AutoVector* v = value;
   autovector_close(v);
 }
-static void autovector_push_state(void* _self, Coroutine* co, void* value) {
-  AutoVectorSchema* self = _self;
-  AutoVectorData* data = coroutine_push(co, &autovector_state, sizeof(AutoVectorData));
-  data->of = self->of;
-  data->v = value;
-  data->first_atom = true;
-}
 static void autovector_schema_close(void* _self) {
   AutoVectorSchema* self = _self;
   rich_schema_close(self->of);
@@ -716,30 +661,10 @@ static rich_Schema_Impl autovector_impl = {
   .dump_value = autovector_dump_value,
   .reset_value = autovector_reset_value,
   .close_value = autovector_close_value,
-  .push_state = autovector_push_state,
+  .push_state = builtin_push_state,
   .close = autovector_schema_close,
 };
 
-static void autovector_state_run(void* udata, Coroutine* co, void* _arg) {
-  AutoVectorData* data = udata;
-  rich_SchemaArg* arg = _arg;
-
-  if (data->first_atom) {
-    data->first_atom = false;
-    if (arg->atom != RICH_ARRAY) RAISE(MALFORMED);
-    return;
-  } else if (arg->atom == RICH_ENDARRAY) {
-    coroutine_pop(co);
-    return;
-  }
-
-  void* elem = autovector_push(data->v);
-  call(data->of, push_state, co, elem);
-  coroutine_run(co, arg);
-}
-static co_State autovector_state = {
-  .run = autovector_state_run,
-};
 
 /* Hashtable */
 
@@ -749,12 +674,6 @@ data(HashtableSchema) {
 };
 static rich_Schema_Impl hashtable_impl;
 
-data(HashtableData) {
-  rich_Schema*  of;
-  Hashtable*    ht;
-  Bytes         key[1];
-};
-static co_State hashtable_state;
 
 rich_Schema* rich_schema_hashtable(rich_Schema* of) {
   HashtableSchema* self = malloc(sizeof(HashtableSchema));
@@ -808,14 +727,6 @@ static void hashtable_close_value(void* _self, void* _value) {
     hashtable_close(ht);
   }
 }
-static void hashtable_push_state(void* _self, Coroutine* co, void* _value) {
-  HashtableSchema* self = _self;
-  Hashtable* ht = _value;
-  HashtableData* data = coroutine_push(co, &hashtable_state, sizeof(HashtableData));
-  data->of = self->of;
-  data->ht = ht;
-  bytes_init(data->key, 16);
-}
 static void hashtable_schema_close(void* _self) {
   HashtableSchema* self = _self;
   call(self->of, close);
@@ -826,40 +737,10 @@ static rich_Schema_Impl hashtable_impl = {
   .dump_value = hashtable_dump_value,
   .reset_value = hashtable_reset_value,
   .close_value = hashtable_close_value,
-  .push_state = hashtable_push_state,
+  .push_state = builtin_push_state,
   .close = hashtable_schema_close,
 };
 
-static void hashtable_state_run(void* udata, Coroutine* co, void* _arg) {
-  HashtableData* data = udata;
-  rich_SchemaArg* arg = _arg;
-  if (data->ht->size == 0) {
-    if (arg->atom != RICH_MAP) RAISE(MALFORMED);
-    return;
-  }
-  if (arg->atom == RICH_ENDMAP) {
-    coroutine_pop(co);
-  } else if (arg->atom == RICH_KEY) {
-    bytes_copy(data->key, arg->data);
-    // Delegate value to sub schema
-    Bytes copy = {.ptr = NULL};
-    bytes_copy(&copy, data->key);
-    void* value = hashtable_insert(data->ht, &copy);
-    memset(value, 0, data->ht->elemsz);
-    call(data->of, reset_value, value);
-    call(data->of, push_state, co, value);
-  } else {
-    RAISE(MALFORMED);
-  }
-}
-static void hashtable_state_close(void* udata) {
-  HashtableData* data = udata;
-  bytes_close(data->key);
-}
-static co_State hashtable_state = {
-  .run = hashtable_state_run,
-  .close = hashtable_state_close,
-};
 
 /* Structs */
 
@@ -867,28 +748,87 @@ data(StructSchema) {
   rich_Schema   base;
   size_t        data_size;
   Vector        fields[1];
+
+  // Open-addressed index of field names. Each slot holds a field index + 1, or 0 if empty.
+  uint16_t*     slots;
+  size_t        mask;
+  uint32_t      seed;
 };
 static rich_Schema_Impl struct_impl;
 
-data(Field) {
-  unsigned      index;
-  Bytes         name[1];
-  size_t        offset;
-  rich_Schema*  schema;
-};
+typedef rich_Field Field;
 
-data(StructData) {
-  Vector*       fields;
-  char*         data;
-  bool          first_field;
-  Bitset        read[];
-};
-static co_State struct_state;
+static inline unsigned field_index(StructSchema* self, Field* field) {
+  return field - (Field*)self->fields->_data;
+}
+
+
+/* Field lookup */
+
+// Number of seeds tried when the index is rebuilt, looking for one without collisions
+#define FIELD_SEED_TRIES 32
+
+static inline bool name_equals(const Bytes* a, const Bytes* b) {
+  return a->size == b->size && memcmp(a->ptr, b->ptr, a->size) == 0;
+}
 
-static Field* find_field(Vector* fields, Bytes* name) {
-  for (unsigned i = 0; i < fields->size; i++) {
-    Field* f = vector_get(fields, i);
-    if (bytes_compare(f->name, name) == 0) return f;
+static inline uint32_t hash_name(const Bytes* name, uint32_t seed) {
+  const unsigned char* p = name->ptr;
+  uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u) ^ name->size;
+  for (size_t i = 0; i < name->size; i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h ^ (h >> 16);
+}
+
+// Inserts field i into the index and returns the number of extra probes it took.
+static unsigned index_field(StructSchema* self, unsigned i) {
+  Field* field = vector_get(self->fields, i);
+  unsigned probes = 0;
+  size_t slot = hash_name(&field->key.name, self->seed) & self->mask;
+  while (self->slots[slot]) {
+    slot = (slot + 1) & self->mask;
+    probes++;
+  }
+  self->slots[slot] = i + 1;
+  return probes;
+}
+
+// Rebuilds the index with room for at least twice as many fields, using the seed that gives the
+// fewest collisions. Most field sets get a perfect hash, so a lookup is a single probe.
+static void rebuild_index(StructSchema* self) {
+  size_t cap = 8;
+  while (cap < self->fields->size * 2) cap *= 2;
+  free(self->slots);
+  self->slots = malloc(cap * sizeof(uint16_t));
+  self->mask = cap - 1;
+
+  uint32_t best_seed = 0;
+  unsigned best = UINT_MAX;
+  for (uint32_t seed = 0; seed < FIELD_SEED_TRIES && best; seed++) {
+    memset(self->slots, 0, cap * sizeof(uint16_t));
+    self->seed = seed;
+    unsigned collisions = 0;
+    for (unsigned i = 0; i < self->fields->size && collisions < best; i++) {
+      collisions += index_field(self, i);
+    }
+    if (collisions < best) {
+      best = collisions;
+      best_seed = seed;
+    }
+  }
+  if (self->seed != best_seed) {
+    memset(self->slots, 0, cap * sizeof(uint16_t));
+    self->seed = best_seed;
+    for (unsigned i = 0; i < self->fields->size; i++) index_field(self, i);
+  }
+}
+
+static Field* find_field(StructSchema* self, const Bytes* name) {
+  size_t slot = hash_name(name, self->seed) & self->mask;
+  for (unsigned i; (i = self->slots[slot]); slot = (slot + 1) & self->mask) {
+    Field* f = vector_get(self->fields, i - 1);
+    if (name_equals(&f->key.name, name)) return f;
   }
   return NULL;
 }
@@ -898,16 +838,24 @@ rich_Schema* rich_schema_struct(size_t data_size) {
   self->base._impl = &struct_impl;
   self->data_size = data_size;
   vector_init(self->fields, sizeof(Field), 4);
+  self->slots = NULL;
+  self->seed = 0;
+  rebuild_index(self);
   return &self->base;
 }
 void rich_add_field(rich_Schema* _self, Bytes name, size_t offset, rich_Schema* schema) {
   StructSchema* self = (StructSchema*)_self;
-  assert(find_field(self->fields, &name) == NULL);
+  assert(find_field(self, &name) == NULL);
+  assert(self->fields->size < UINT16_MAX);
   Field* field = vector_push(self->fields);
-  field->index = self->fields->size-1;
-  *field->name = name;
+  rich_key_init(&field->key, &name);
   field->offset = offset;
   field->schema = schema;
+  if (self->fields->size * 2 > self->mask + 1) {
+    rebuild_index(self);
+  } else {
+    index_field(self, self->fields->size - 1);
+  }
 }
 void rich_add_cfield(rich_Schema* self, const char* name, size_t offset, rich_Schema* schema) {
   Bytes bytes_name = {
@@ -926,7 +874,7 @@ static void struct_dump_value(void* _self, void* value, rich_Sink* to) {
   call(to, sink, RICH_MAP, NULL);
   for (unsigned i = 0; i < self->fields->size; i++) {
     Field* field = vector_get(self->fields, i);
-    call(to, sink, RICH_KEY, field->name);
+    rich_sink_key(to, &field->key);
     call(field->schema, dump_value, data + field->offset, to);
   }
   call(to, sink, RICH_ENDMAP, NULL);
@@ -947,22 +895,15 @@ static void struct_close_value(void* _self, void* value) {
     call(field->schema, close_value, data + field->offset);
   }
 }
-static void struct_push_state(void* _self, Coroutine* co, void* value) {
-  StructSchema* self = _self;
-  size_t sz = sizeof(StructData) + bitset_size(self->fields->size);
-  StructData* data = coroutine_push(co, &struct_state, sz);
-  data->fields = self->fields;
-  data->data = value;
-  data->first_field = true;
-  bitset_init(data->read, self->fields->size);
-}
 static void struct_close(void* _self) {
   StructSchema* self = _self;
   for (unsigned i = 0; i < self->fields->size; i++) {
     Field* field = vector_get(self->fields, i);
     call(field->schema, close);
+    rich_key_close(&field->key);
   }
   vector_close(self->fields);
+  free(self->slots);
   free(self);
 }
 static rich_Schema_Impl struct_impl = {
@@ -970,42 +911,508 @@ static rich_Schema_Impl struct_impl = {
   .dump_value = struct_dump_value,
   .reset_value = struct_reset_value,
   .close_value = struct_close_value,
-  .push_state = struct_push_state,
+  .push_state = builtin_push_state,
   .close = struct_close,
 };
 
-static void struct_state_run(void* udata, Coroutine* co, void* _arg) {
-  StructData* data = udata;
-  rich_SchemaArg* arg = _arg;
+/* Decoding */
 
-  if (data->first_field) {
-    data->first_field = false;
-    if (arg->atom != RICH_MAP) RAISE(MALFORMED);
-    return;
+// Pushes a bridge_state while a custom schema's states decode a built-in value
+data(Bridge) {
+  size_t  base;   // the number of frames below the value's frame
+};
+static co_State bridge_state;
+
+static inline BoundSink* coroutine_sink(Coroutine* co) {
+  return (BoundSink*)((char*)co - offsetof(BoundSink, co));
+}
+static inline Frame* top_frame(BoundSink* self) {
+  return vector_get(self->frames, self->frames->size - 1);
+}
+static inline Bitset* frame_read(BoundSink* self, Frame* frame) {
+  return (Bitset*)((char*)self->bits.ptr + frame->read);
+}
+
+static void push_frame(BoundSink* self, rich_Schema* schema, void* value) {
+  int kind;
+  for (;;) {
+    rich_Schema_Impl* impl = schema->_impl;
+    if (impl == &struct_impl) {
+      kind = FRAME_STRUCT;
+    } else if (impl == &int64_impl) {
+      kind = FRAME_INT64;
+    } else if (impl == &bytes_impl) {
+      kind = FRAME_BYTES;
+    } else if (impl == &borrowed_impl) {
+      kind = FRAME_BORROWED;
+    } else if (impl == &double_impl) {
+      kind = FRAME_DOUBLE;
+    } else if (impl == &bool_impl) {
+      kind = FRAME_BOOL;
+    } else if (impl == &vector_impl) {
+      kind = FRAME_VECTOR;
+    } else if (impl == &packed_impl) {
+      kind = FRAME_PACKED;
+    } else if (impl == &optional_impl) {
+      kind = FRAME_OPTIONAL;
+      schema = ((OptionalSchema*)schema)->wrap;
+    } else if (impl == &discard_impl) {
+      kind = FRAME_DISCARD;
+    } else if (impl == &autovector_impl || impl == &hashtable_impl) {
+      // The entries' resources are managed individually, so they cannot come from an arena
+      if (self->arena) RAISE(ARGUMENT);
+      kind = impl == &autovector_impl ? FRAME_AUTOVECTOR : FRAME_HASHTABLE;
+    } else if (impl == &unclosable_impl) {
+      schema = ((UnclosableSchema*)schema)->wrap;
+      continue;
+    } else if (impl == &pointer_impl) {
+      PointerSchema* ptr = (PointerSchema*)schema;
+      void** target = value;
+      if (*target == NULL) {
+        // Only values decoded into an arena start out without a target
+        assert(self->arena);
+        *target = arena_calloc(self->arena, call(ptr->of, data_size));
+      }
+      schema = ptr->of;
+      value = *target;
+      continue;
+    } else {
+      kind = FRAME_CUSTOM;
+    }
+    break;
+  }
+
+  Frame* frame = vector_push(self->frames);
+  frame->kind = kind;
+  frame->started = false;
+  frame->schema = schema;
+  frame->value = value;
+  switch (kind) {
+    case FRAME_DISCARD:
+      frame->level = 0;
+      break;
+    case FRAME_STRUCT: {
+      size_t nfields = ((StructSchema*)schema)->fields->size;
+      size_t size = bitset_size(nfields);
+      frame->next_field = 0;
+      frame->read = self->bits.size;
+      bytes_grow(&self->bits, self->bits.size + size);
+      self->bits.size += size;
+      bitset_init(frame_read(self, frame), nfields);
+      break;
+    }
+    case FRAME_CUSTOM:
+      frame->height = self->co->stack->size;
+      // This can push more frames, so the frame must not be used afterwards
+      call(schema, push_state, self->co, value);
+      break;
+  }
+}
+
+// Pops the top frame without finishing any custom states below it
+static void drop_frame(BoundSink* self) {
+  Frame* frame = top_frame(self);
+  if (frame->kind == FRAME_STRUCT) self->bits.size = frame->read;
+  self->frames->size--;
+}
+// Pops the top frame. If that finishes a value that a custom schema's state asked for, its bridge
+// is popped too, as is the custom frame once all of its states have popped themselves.
+static void pop_frame(BoundSink* self) {
+  drop_frame(self);
+  while (self->frames->size && top_frame(self)->kind == FRAME_CUSTOM) {
+    Frame* frame = top_frame(self);
+    if (self->co->stack->size > frame->height) {
+      co_State* state;
+      Bridge* bridge = coroutine_top(self->co, &state);
+      if (state != &bridge_state || bridge->base != self->frames->size) return;
+      coroutine_pop(self->co);
+      if (self->co->stack->size > frame->height) return;
+    }
+    drop_frame(self);
+  }
+}
+
+static void decode_bytes(BoundSink* self, Bytes* value, const Bytes* src) {
+  if (self->arena) {
+    value->ptr = arena_alloc(self->arena, src->size);
+    value->cap = src->size;
+  } else if (!value->ptr) {
+    value->cap = src->size;
+    value->ptr = malloc(value->cap);
+  } else if (src->size > value->cap) {
+    value->cap = src->size;
+    value->ptr = realloc(value->ptr, value->cap);
   }
+  value->size = src->size;
+  memcpy(value->ptr, src->ptr, value->size);
+}
 
-  if (arg->atom == RICH_ENDMAP) {
-    // Send NILs to all un-read fields
-    for (unsigned i = 0; i < data->fields->size; i++) {
-      if (bitset_get(data->read, i)) continue;
-      Field* field = vector_get(data->fields, i);
-      call(field->schema, push_state, co, data->data + field->offset);
-      rich_SchemaArg fakenil = {
-        .atom = RICH_NIL,
-      };
-      coroutine_run(co, &fakenil);
+// Refers to the source's bytes if they are borrowed, otherwise copies them
+static void decode_borrowed(BoundSink* self, Bytes* value, const Bytes* src) {
+  borrowed_close_value(NULL, value);
+  value->size = src->size;
+  if (self->borrowing) {
+    value->ptr = src->ptr;
+  } else if (self->arena) {
+    value->ptr = arena_memdup(self->arena, src->ptr, src->size);
+  } else {
+    value->cap = MAX(src->size, 1);
+    value->ptr = malloc(value->cap);
+    memcpy(value->ptr, src->ptr, src->size);
+  }
+}
+
+// Passes an atom to the top frame. A container that receives an element's first atom pushes a
+// frame for the element and goes around again to pass it the same atom.
+static void drive(BoundSink* self, rich_SchemaArg* arg) {
+  rich_Atom atom = arg->atom;
+  Arena* arena = self->arena;
+  for (;;) {
+    Frame* frame = top_frame(self);
+    bool first = !frame->started;
+    frame->started = true;
+
+    switch (frame->kind) {
+      case FRAME_BOOL:
+        if (atom != RICH_BOOL) RAISE(MALFORMED);
+        *(bool*)frame->value = *(bool*)arg->data;
+        pop_frame(self);
+        return;
+      case FRAME_INT64:
+        if (atom != RICH_INT) RAISE(MALFORMED);
+        *(int64_t*)frame->value = *(int64_t*)arg->data;
+        pop_frame(self);
+        return;
+      case FRAME_DOUBLE:
+        if (atom != RICH_FLOAT) RAISE(MALFORMED);
+        *(double*)frame->value = *(double*)arg->data;
+        pop_frame(self);
+        return;
+      case FRAME_BYTES:
+        if (atom != RICH_STRING) RAISE(MALFORMED);
+        decode_bytes(self, frame->value, arg->data);
+        pop_frame(self);
+        return;
+      case FRAME_BORROWED:
+        if (atom != RICH_STRING) RAISE(MALFORMED);
+        decode_borrowed(self, frame->value, arg->data);
+        pop_frame(self);
+        return;
+
+      case FRAME_DISCARD:
+        switch (atom) {
+          case RICH_ARRAY:
+          case RICH_MAP:
+            frame->level++;
+            break;
+          case RICH_ENDARRAY:
+          case RICH_ENDMAP:
+            frame->level--;
+            break;
+          default:
+            /* leave level unchanged */
+            break;
+        }
+        if (frame->level == 0) pop_frame(self);
+        return;
+
+      case FRAME_OPTIONAL: {
+        if (atom == RICH_NIL) {
+          pop_frame(self);
+          return;
+        }
+        rich_Schema* wrap = frame->schema;
+        void* value = frame->value;
+        drop_frame(self);
+        push_frame(self, wrap, value);
+        continue;
+      }
+
+      case FRAME_VECTOR: {
+        rich_Schema* of = ((VectorSchema*)frame->schema)->of;
+        Vector* v = frame->value;
+        if (first) {
+          if (atom != RICH_ARRAY) RAISE(MALFORMED);
+          if (arena) vector_init_arena(v, call(of, data_size), 4, arena);
+          return;
+        }
+        if (atom == RICH_ENDARRAY) {
+          pop_frame(self);
+          return;
+        }
+        void* elem = arena ? vector_push_arena(v, arena) : vector_push(v);
+        memset(elem, 0, v->elemsz);
+        if (!arena) call(of, reset_value, elem);
+        push_frame(self, of, elem);
+        continue;
+      }
+      case FRAME_AUTOVECTOR:
+        if (first) {
+          if (atom != RICH_ARRAY) RAISE(MALFORMED);
+          return;
+        }
+        if (atom == RICH_ENDARRAY) {
+          pop_frame(self);
+          return;
+        }
+        push_frame(self, ((AutoVectorSchema*)frame->schema)->of, autovector_push(frame->value));
+        continue;
+
+      case FRAME_HASHTABLE: {
+        if (first) {
+          if (atom != RICH_MAP) RAISE(MALFORMED);
+          return;
+        }
+        if (atom == RICH_ENDMAP) {
+          pop_frame(self);
+          return;
+        }
+        if (atom != RICH_KEY) RAISE(MALFORMED);
+        rich_Schema* of = ((HashtableSchema*)frame->schema)->of;
+        Hashtable* ht = frame->value;
+        Bytes key = {.ptr = NULL};
+        bytes_copy(&key, arg->data);
+        void* value = hashtable_insert(ht, &key);
+        memset(value, 0, ht->elemsz);
+        call(of, reset_value, value);
+        // The value's first atom comes next
+        push_frame(self, of, value);
+        return;
+      }
+
+      case FRAME_STRUCT: {
+        StructSchema* schema = (StructSchema*)frame->schema;
+        Vector* fields = schema->fields;
+        char* base = frame->value;
+        if (first) {
+          if (atom != RICH_MAP) RAISE(MALFORMED);
+          return;
+        }
+
+        if (atom == RICH_ENDMAP) {
+          // Pushing frames can move this one and its bitset, so work from copies
+          size_t index = self->frames->size - 1;
+          uint64_t words[bitset_size(fields->size) / sizeof(uint64_t)];
+          Bitset* read = (Bitset*)words;
+          memcpy(read, frame_read(self, frame), bitset_size(fields->size));
+
+          // Send NILs to all un-read fields
+          rich_SchemaArg fakenil = {
+            .atom = RICH_NIL,
+          };
+          for (unsigned i = 0; i < fields->size; i++) {
+            if (bitset_get(read, i)) continue;
+            Field* field = vector_get(fields, i);
+            push_frame(self, field->schema, base + field->offset);
+            drive(self, &fakenil);
+            if (self->frames->size != index + 1) RAISE(MALFORMED);
+          }
+          pop_frame(self);
+          return;
+        }
+
+        if (atom != RICH_KEY) RAISE(MALFORMED);
+        // Fields usually arrive in the order they were declared, which saves hashing the name
+        Field* field = NULL;
+        if (frame->next_field < fields->size) {
+          field = vector_get(fields, frame->next_field);
+          if (!name_equals(&field->key.name, arg->data)) field = NULL;
+        }
+        if (!field) field = find_field(schema, arg->data);
+        if (!field) RAISE(MALFORMED);
+        unsigned index = field_index(schema, field);
+        frame->next_field = index + 1;
+        bitset_set(frame_read(self, frame), index, true);
+        push_frame(self, field->schema, base + field->offset);
+        return;
+      }
+
+      case FRAME_PACKED: {
+        rich_PackedType type = ((PackedSchema*)frame->schema)->type;
+        Vector* v = frame->value;
+        if (first) {
+          if (atom != RICH_ARRAY) RAISE(MALFORMED);
+          if (arena) vector_init_arena(v, rich_packed_size(type), 4, arena);
+          return;
+        }
+        if (atom == RICH_ENDARRAY) {
+          pop_frame(self);
+          return;
+        }
+        if (atom != RICH_INT && atom != RICH_FLOAT) RAISE(MALFORMED);
+        void* elem = arena ? vector_push_arena(v, arena) : vector_push(v);
+        rich_packed_convert(type, elem, atom == RICH_INT ? RICH_PACKED_INT64 : RICH_PACKED_DOUBLE, arg->data, 1);
+        return;
+      }
+
+      case FRAME_CUSTOM: {
+        coroutine_run(self->co, arg);
+        // Pop the frame if the states are done, unless that already happened on the way
+        if (self->frames->size && top_frame(self)->kind == FRAME_CUSTOM &&
+            self->co->stack->size == top_frame(self)->height) {
+          pop_frame(self);
+        }
+        return;
+      }
     }
-    coroutine_pop(co);
+  }
+}
+
+// Throws away what is left of a value whose decoding raised, so that the sink can be reused
+static void recover(BoundSink* self) {
+  while (self->co->stack->size) coroutine_pop(self->co);
+  self->frames->size = 0;
+  self->bits.size = 0;
+  self->borrowing = false;
+  self->failed = false;
+}
+
+static void sink_atom(BoundSink* self, rich_Atom atom, void* atom_data, bool borrowing) {
+  // Cleared once the atom is done, so it stays set if anything below raises
+  if (self->failed) recover(self);
+  self->failed = true;
+  if (self->frames->size == 0) {
+    // Start a new value
+    if (self->arena) {
+      // Nothing is freed: the previous value's memory belongs to the arena
+      memset(self->to, 0, call(self->schema, data_size));
+    } else {
+      call(self->schema, reset_value, self->to);
+    }
+    push_frame(self, self->schema, self->to);
+  }
+  rich_SchemaArg arg = {
+    .atom = atom,
+    .data = atom_data,
+  };
+  self->borrowing = borrowing;
+  drive(self, &arg);
+  self->borrowing = false;
+  self->failed = false;
+}
+static void bound_sink_sink(void* _self, rich_Atom atom, void* atom_data) {
+  sink_atom(_self, atom, atom_data, false);
+}
+// Only borrowed-bytes frames make use of the string staying valid
+static void bound_sink_borrowed(void* _self, const Bytes* str) {
+  sink_atom(_self, RICH_STRING, (void*)str, true);
+}
+
+// Starts the array with a single atom. If that lands on a packed value, the elements are appended
+// all at once, converting between integer types; anything else gets them atom by atom.
+static void bound_sink_packed(void* _self, rich_PackedType type, const void* src, size_t count) {
+  BoundSink* self = _self;
+  bound_sink_sink(self, RICH_ARRAY, NULL);
+  if (self->frames->size == 0 || top_frame(self)->kind != FRAME_PACKED) {
+    rich_sink_packed_elements(_self, type, src, count);
     return;
   }
 
-  if (arg->atom != RICH_KEY) RAISE(MALFORMED);
-  Field* field = find_field(data->fields, arg->data);
-  if (!field) RAISE(MALFORMED);
+  Frame* frame = top_frame(self);
+  Vector* v = frame->value;
+  void* dst = self->arena ? vector_extend_arena(v, count, self->arena) : vector_extend(v, count);
+  rich_packed_convert(((PackedSchema*)frame->schema)->type, dst, type, src, count);
+  bound_sink_sink(self, RICH_ENDARRAY, NULL);
+}
+
+// Values decoded with rich_schema_discard (eg. struct fields that are not needed) do not have to
+// be passed on at all.
+static bool bound_sink_skip(void* _self) {
+  BoundSink* self = _self;
+  if (self->failed || self->frames->size == 0) return false;
+  Frame* frame = top_frame(self);
+  if (frame->kind != FRAME_DISCARD || frame->started) return false;
+  pop_frame(self);
+  return true;
+}
+
+// The push_state of every built-in schema. Built-in values are decoded by frames even when a
+// custom schema's state asks for them, with a bridge_state on the coroutine in the meantime.
+static void builtin_push_state(void* _self, Coroutine* co, void* value) {
+  BoundSink* sink = coroutine_sink(co);
+  Bridge* bridge = coroutine_push(co, &bridge_state, sizeof(Bridge));
+  bridge->base = sink->frames->size;
+  push_frame(sink, _self, value);
+}
+static void bridge_state_run(void* udata, Coroutine* co, void* arg) {
+  drive(coroutine_sink(co), arg);
+}
+static co_State bridge_state = {
+  .run = bridge_state_run,
+};
+
+/* Introspection */
+
+static rich_Schema* unwrap(rich_Schema* schema) {
+  while (schema->_impl == &unclosable_impl) {
+    schema = ((UnclosableSchema*)schema)->wrap;
+  }
+  return schema;
+}
+
+rich_SchemaKind rich_schema_kind(rich_Schema* schema) {
+  rich_Schema_Impl* impl = unwrap(schema)->_impl;
+  if (impl == &bool_impl) return RICH_SCHEMA_BOOL;
+  if (impl == &int64_impl) return RICH_SCHEMA_INT64;
+  if (impl == &double_impl) return RICH_SCHEMA_DOUBLE;
+  if (impl == &bytes_impl) return RICH_SCHEMA_BYTES;
+  if (impl == &borrowed_impl) return RICH_SCHEMA_BORROWED;
+  if (impl == &discard_impl) return RICH_SCHEMA_DISCARD;
+  if (impl == &pointer_impl) return RICH_SCHEMA_POINTER;
+  if (impl == &optional_impl) return RICH_SCHEMA_OPTIONAL;
+  if (impl == &vector_impl) return RICH_SCHEMA_VECTOR;
+  if (impl == &autovector_impl) return RICH_SCHEMA_AUTOVECTOR;
+  if (impl == &hashtable_impl) return RICH_SCHEMA_HASHTABLE;
+  if (impl == &struct_impl) return RICH_SCHEMA_STRUCT;
+  if (impl == &packed_impl) return RICH_SCHEMA_PACKED;
+  return RICH_SCHEMA_CUSTOM;
+}
+
+rich_Schema* rich_schema_inner(rich_Schema* schema) {
+  schema = unwrap(schema);
+  switch (rich_schema_kind(schema)) {
+    case RICH_SCHEMA_POINTER:
+      return ((PointerSchema*)schema)->of;
+    case RICH_SCHEMA_OPTIONAL:
+      return ((OptionalSchema*)schema)->wrap;
+    case RICH_SCHEMA_VECTOR:
+      return ((VectorSchema*)schema)->of;
+    case RICH_SCHEMA_AUTOVECTOR:
+      return ((AutoVectorSchema*)schema)->of;
+    case RICH_SCHEMA_HASHTABLE:
+      return ((HashtableSchema*)schema)->of;
+    default:
+      return NULL;
+  }
+}
+
+rich_PackedType rich_schema_packed_type(rich_Schema* schema) {
+  schema = unwrap(schema);
+  assert(schema->_impl == &packed_impl);
+  return ((PackedSchema*)schema)->type;
+}
+
+void rich_schema_fields(rich_Schema* schema, bool (*callback)(const Bytes* name, size_t offset, rich_Schema* field_type)) {
+  schema = unwrap(schema);
+  assert(schema->_impl == &struct_impl);
+  StructSchema* self = (StructSchema*)schema;
+  for (unsigned i = 0; i < self->fields->size; i++) {
+    Field* field = vector_get(self->fields, i);
+    if (!callback(&field->key.name, field->offset, field->schema)) break;
+  }
+}
+
+int rich_schema_field_index(rich_Schema* schema, const Bytes* name) {
+  schema = unwrap(schema);
+  assert(schema->_impl == &struct_impl);
+  Field* field = find_field((StructSchema*)schema, name);
+  return field ? (int)field_index((StructSchema*)schema, field) : -1;
+}
 
-  call(field->schema, push_state, co, data->data + field->offset);
-  bitset_set(data->read, field->index, true);
+const rich_Field* rich_schema_field_table(rich_Schema* schema, size_t* count) {
+  schema = unwrap(schema);
+  assert(schema->_impl == &struct_impl);
+  StructSchema* self = (StructSchema*)schema;
+  *count = self->fields->size;
+  return (rich_Field*)self->fields->_data;
 }
-static co_State struct_state = {
-  .run = struct_state_run,
-};
\ No newline at end of file
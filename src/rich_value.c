@@ -0,0 +1,376 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <vlib/rich_value.h>
+#include <vlib/arena.h>
+#include <vlib/vector.h>
+#include <vlib/util.h>
+
+// Strings of up to INLINE_MAX bytes are stored in the node, from its third byte onwards
+#define INLINE_MAX    14
+#define LONG_STRING   0xFF
+
+// Maps with more entries than this get a hash index; smaller ones are binary searched
+#define LINEAR_MAX    8
+
+struct rich_Value {
+  uint8_t             type;     // RICH_NIL, BOOL, INT, FLOAT, STRING, ARRAY or MAP
+  uint8_t             small;    // strings: the length of an inline string, or LONG_STRING
+  uint16_t            unused;
+  uint32_t            count;    // long strings: the length; arrays and maps: elements or entries
+  union {
+    bool              b;
+    int64_t           i;
+    double            f;
+    const char*       str;
+    const rich_Value* items;    // arrays: the elements; maps: keys and values, alternating
+  };
+};
+
+struct rich_ValueTree {
+  Arena         arena[1];
+  rich_Value    root;
+  int           refs;
+};
+
+static inline Bytes node_string(const rich_Value* v) {
+  Bytes b;
+  if (v->small == LONG_STRING) {
+    b.ptr = (void*)v->str;
+    b.size = v->count;
+  } else {
+    b.ptr = (char*)v + 2;
+    b.size = v->small;
+  }
+  b.cap = 0;
+  return b;
+}
+
+static inline uint32_t hash_key(const Bytes* key) {
+  const unsigned char* p = key->ptr;
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < key->size; i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h ^ (h >> 16);
+}
+
+// The hash index of a map follows its entries, with at least twice as many slots as entries.
+// Each slot holds an entry's position plus one, or 0 if it is empty.
+static inline size_t index_slots(size_t count) {
+  size_t slots = 16;
+  while (slots < 2 * count) slots *= 2;
+  return slots;
+}
+
+/* Reading */
+
+// A container whose contents are still arriving. Its elements, or its keys and values, are
+// collected at the end of the builder's nodes, from `start` onwards.
+data(Open) {
+  uint8_t   type;
+  size_t    start;
+};
+
+data(Builder) {
+  rich_Sink     base;
+  Arena*        arena;
+  Vector        nodes[1];
+  Vector        opens[1];
+  rich_Value*   root;
+  bool          done;
+};
+
+static void make_string(Builder* self, rich_Value* node, const Bytes* str) {
+  node->type = RICH_STRING;
+  if (str->size <= INLINE_MAX) {
+    node->small = str->size;
+    memcpy((char*)node + 2, str->ptr, str->size);
+  } else {
+    if (str->size > UINT32_MAX) RAISE(MALFORMED);
+    node->small = LONG_STRING;
+    node->count = str->size;
+    node->str = arena_memdup(self->arena, str->ptr, str->size);
+  }
+}
+
+static inline Open* top_open(Builder* self) {
+  return self->opens->size ? vector_back(self->opens) : NULL;
+}
+static inline rich_Value* contents(Builder* self, size_t start) {
+  return (rich_Value*)self->nodes->_data + start;
+}
+
+static void add_value(Builder* self, const rich_Value* node) {
+  if (self->done) RAISE(MALFORMED);
+  Open* open = top_open(self);
+  if (!open) {
+    *self->root = *node;
+    self->done = true;
+    return;
+  }
+  // Map values must follow a key
+  if (open->type == RICH_MAP && (self->nodes->size - open->start) % 2 == 0) RAISE(MALFORMED);
+  *(rich_Value*)vector_push(self->nodes) = *node;
+}
+
+static int compare_entries(const void* a, const void* b) {
+  Bytes ka = node_string(a);
+  Bytes kb = node_string(b);
+  return bytes_compare(&ka, &kb);
+}
+
+static void end_array(Builder* self, Open* open, rich_Value* node) {
+  size_t count = self->nodes->size - open->start;
+  if (count > UINT32_MAX) RAISE(MALFORMED);
+  node->type = RICH_ARRAY;
+  node->count = count;
+  node->items = arena_memdup(self->arena, contents(self, open->start), count * sizeof(rich_Value));
+}
+
+static void end_map(Builder* self, Open* open, rich_Value* node) {
+  size_t n = self->nodes->size - open->start;
+  if (n % 2) RAISE(MALFORMED);
+  size_t count = n / 2;
+  if (count > UINT32_MAX) RAISE(MALFORMED);
+  rich_Value* entries = contents(self, open->start);
+  qsort(entries, count, 2 * sizeof(rich_Value), compare_entries);
+  for (size_t i = 1; i < count; i++) {
+    if (compare_entries(&entries[2 * i - 2], &entries[2 * i]) == 0) RAISE(MALFORMED);
+  }
+
+  size_t slots = count > LINEAR_MAX ? index_slots(count) : 0;
+  rich_Value* items = arena_alloc(self->arena, n * sizeof(rich_Value) + slots * sizeof(uint32_t));
+  memcpy(items, entries, n * sizeof(rich_Value));
+  if (slots) {
+    uint32_t* index = (uint32_t*)(items + n);
+    memset(index, 0, slots * sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++) {
+      Bytes key = node_string(&items[2 * i]);
+      size_t h = hash_key(&key) & (slots - 1);
+      while (index[h]) h = (h + 1) & (slots - 1);
+      index[h] = i + 1;
+    }
+  }
+  node->type = RICH_MAP;
+  node->count = count;
+  node->items = items;
+}
+
+static void builder_sink(void* _self, rich_Atom atom, void* data) {
+  Builder* self = _self;
+  rich_Value node;
+  memset(&node, 0, sizeof(node));
+  Open* open;
+  switch (atom) {
+    case RICH_NIL:
+      node.type = RICH_NIL;
+      break;
+    case RICH_BOOL:
+      node.type = RICH_BOOL;
+      node.b = *(bool*)data;
+      break;
+    case RICH_INT:
+      node.type = RICH_INT;
+      node.i = *(int64_t*)data;
+      break;
+    case RICH_FLOAT:
+      node.type = RICH_FLOAT;
+      node.f = *(double*)data;
+      break;
+    case RICH_STRING:
+      make_string(self, &node, data);
+      break;
+
+    case RICH_ARRAY:
+    case RICH_MAP:
+      if (self->done) RAISE(MALFORMED);
+      open = vector_push(self->opens);
+      open->type = atom;
+      open->start = self->nodes->size;
+      return;
+    case RICH_KEY:
+      open = top_open(self);
+      if (!open || open->type != RICH_MAP || (self->nodes->size - open->start) % 2) RAISE(MALFORMED);
+      make_string(self, &node, data);
+      *(rich_Value*)vector_push(self->nodes) = node;
+      return;
+    case RICH_ENDARRAY:
+    case RICH_ENDMAP:
+      open = top_open(self);
+      if (!open || open->type != (atom == RICH_ENDARRAY ? RICH_ARRAY : RICH_MAP)) RAISE(MALFORMED);
+      if (atom == RICH_ENDARRAY) {
+        end_array(self, open, &node);
+      } else {
+        end_map(self, open, &node);
+      }
+      self->nodes->size = open->start;
+      self->opens->size--;
+      break;
+
+    default:
+      RAISE(MALFORMED);
+  }
+  add_value(self, &node);
+}
+
+static rich_Sink_Impl builder_impl = {
+  .sink = builder_sink,
+  .close = null_close,
+};
+
+rich_ValueTree* rich_value_read(rich_Source* from) {
+  rich_ValueTree* tree = malloc(sizeof(rich_ValueTree));
+  arena_init(tree->arena, 4096);
+  tree->refs = 1;
+
+  Builder b = {
+    .base._impl = &builder_impl,
+    .arena = tree->arena,
+    .root = &tree->root,
+    .done = false,
+  };
+  vector_init(b.nodes, sizeof(rich_Value), 64);
+  vector_init(b.opens, sizeof(Open), 8);
+  TRY {
+    call(from, read_value, &b.base);
+    if (!b.done) RAISE(EOF);
+  } CATCH(err) {
+    rich_value_tree_release(tree);
+    verr_reraise();
+  } FINALLY {
+    vector_close(b.nodes);
+    vector_close(b.opens);
+  } ETRY
+  return tree;
+}
+
+void rich_value_tree_acquire(rich_ValueTree* tree) {
+  __sync_fetch_and_add(&tree->refs, 1);
+}
+void rich_value_tree_release(rich_ValueTree* tree) {
+  if (__sync_sub_and_fetch(&tree->refs, 1) == 0) {
+    arena_close(tree->arena);
+    free(tree);
+  }
+}
+
+const rich_Value* rich_value_root(rich_ValueTree* tree) {
+  return &tree->root;
+}
+
+/* Access */
+
+rich_Atom rich_value_type(const rich_Value* v) {
+  return v->type;
+}
+
+bool rich_value_bool(const rich_Value* v) {
+  if (v->type != RICH_BOOL) RAISE(MALFORMED);
+  return v->b;
+}
+int64_t rich_value_int(const rich_Value* v) {
+  if (v->type != RICH_INT) RAISE(MALFORMED);
+  return v->i;
+}
+double rich_value_float(const rich_Value* v) {
+  if (v->type != RICH_FLOAT) RAISE(MALFORMED);
+  return v->f;
+}
+Bytes rich_value_string(const rich_Value* v) {
+  if (v->type != RICH_STRING) RAISE(MALFORMED);
+  return node_string(v);
+}
+
+size_t rich_value_length(const rich_Value* v) {
+  return v->type == RICH_ARRAY || v->type == RICH_MAP ? v->count : 0;
+}
+
+const rich_Value* rich_value_at(const rich_Value* v, size_t i) {
+  if (v->type != RICH_ARRAY || i >= v->count) return NULL;
+  return &v->items[i];
+}
+
+const rich_Value* rich_value_get(const rich_Value* v, const Bytes* key) {
+  if (v->type != RICH_MAP) return NULL;
+  const rich_Value* items = v->items;
+  if (v->count > LINEAR_MAX) {
+    const uint32_t* index = (const uint32_t*)(items + 2 * v->count);
+    size_t mask = index_slots(v->count) - 1;
+    for (size_t h = hash_key(key) & mask; index[h]; h = (h + 1) & mask) {
+      const rich_Value* entry = &items[2 * (index[h] - 1)];
+      Bytes name = node_string(entry);
+      if (bytes_compare(&name, key) == 0) return entry + 1;
+    }
+    return NULL;
+  }
+
+  size_t lo = 0, hi = v->count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    Bytes name = node_string(&items[2 * mid]);
+    int c = bytes_compare(&name, key);
+    if (c == 0) return &items[2 * mid + 1];
+    if (c < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+const rich_Value* rich_value_cget(const rich_Value* v, const char* key) {
+  Bytes b = {
+    .ptr = (void*)key,
+    .size = strlen(key),
+  };
+  return rich_value_get(v, &b);
+}
+
+const rich_Value* rich_value_entry(const rich_Value* v, size_t i, Bytes* key) {
+  assert(v->type == RICH_MAP && i < v->count);
+  *key = node_string(&v->items[2 * i]);
+  return &v->items[2 * i + 1];
+}
+
+/* Dumping */
+
+void rich_value_dump(const rich_Value* v, rich_Sink* to) {
+  Bytes str;
+  switch (v->type) {
+    case RICH_NIL:
+      call(to, sink, RICH_NIL, NULL);
+      break;
+    case RICH_BOOL:
+      call(to, sink, RICH_BOOL, (void*)&v->b);
+      break;
+    case RICH_INT:
+      call(to, sink, RICH_INT, (void*)&v->i);
+      break;
+    case RICH_FLOAT:
+      call(to, sink, RICH_FLOAT, (void*)&v->f);
+      break;
+    case RICH_STRING:
+      str = node_string(v);
+      call(to, sink, RICH_STRING, &str);
+      break;
+    case RICH_ARRAY:
+      call(to, sink, RICH_ARRAY, NULL);
+      for (size_t i = 0; i < v->count; i++) {
+        rich_value_dump(&v->items[i], to);
+      }
+      call(to, sink, RICH_ENDARRAY, NULL);
+      break;
+    case RICH_MAP:
+      call(to, sink, RICH_MAP, NULL);
+      for (size_t i = 0; i < v->count; i++) {
+        str = node_string(&v->items[2 * i]);
+        call(to, sink, RICH_KEY, &str);
+        rich_value_dump(&v->items[2 * i + 1], to);
+      }
+      call(to, sink, RICH_ENDMAP, NULL);
+      break;
+  }
+}
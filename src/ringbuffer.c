@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <vlib/ringbuffer.h>
+#include <vlib/util.h>
+#include <vlib/error.h>
+
+void ringbuffer_init(RingBuffer* self, size_t min_size, size_t history) {
+  size_t size = sysconf(_SC_PAGESIZE);
+  while (size < min_size) size *= 2;
+  assert(history < size);
+
+  int fd = memfd_create("vlib-ringbuffer", MFD_CLOEXEC);
+  if (fd == -1) verr_raise_system();
+  if (ftruncate(fd, size) == -1) goto Error;
+
+  // Reserve address space for both mappings, then map the same pages into each half
+  char* base = mmap(NULL, size*2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) goto Error;
+  if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+      mmap(base+size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    int eno = errno;
+    munmap(base, size*2);
+    close(fd);
+    verr_raise(verr_system(eno));
+  }
+  close(fd);
+
+  self->size = size;
+  self->history = history;
+  self->data = base;
+  ringbuffer_reset(self);
+  return;
+
+Error:;
+  int eno = errno;
+  close(fd);
+  verr_raise(verr_system(eno));
+}
+void ringbuffer_close(RingBuffer* self) {
+  munmap(self->data, self->size*2);
+}
+
+void ringbuffer_reset(RingBuffer* self) {
+  self->tail = 0;
+  self->read = 0;
+  self->write = 0;
+}
+
+void ringbuffer_produce(RingBuffer* self, size_t n) {
+  assert(n <= ringbuffer_avail_write(self));
+  if (self->read - self->tail > self->history) self->tail = self->read - self->history;
+  self->write += n;
+}
+void ringbuffer_consume(RingBuffer* self, size_t n) {
+  assert(n <= ringbuffer_avail_read(self));
+  self->read += n;
+}
+void ringbuffer_unget(RingBuffer* self, size_t n) {
+  if (n > self->read - self->tail) RAISE(STATE);
+  self->read -= n;
+}
+
+size_t ringbuffer_write(RingBuffer* self, const char* src, size_t n) {
+  n = MIN(n, ringbuffer_avail_write(self));
+  memcpy(ringbuffer_write_ptr(self), src, n);
+  ringbuffer_produce(self, n);
+  return n;
+}
+size_t ringbuffer_read(RingBuffer* self, char* dst, size_t n) {
+  n = MIN(n, ringbuffer_avail_read(self));
+  memcpy(dst, ringbuffer_read_ptr(self), n);
+  self->read += n;
+  return n;
+}
+
+size_t ringbuffer_fill(RingBuffer* self, Input* in) {
+  size_t avail = ringbuffer_avail_write(self);
+  if (avail == 0) return 0;
+  size_t r = io_read(in, ringbuffer_write_ptr(self), avail);
+  ringbuffer_produce(self, r);
+  return r;
+}
+void ringbuffer_flush(RingBuffer* self, Output* out) {
+  io_write(out, ringbuffer_read_ptr(self), ringbuffer_avail_read(self));
+  self->read = self->write;
+}
+
+/* RingInput */
+
+data(RingInput) {
+  Input       base;
+  Input*      in;
+  RingBuffer  buf[1];
+};
+static Input_Impl ring_input_impl;
+
+Input* ring_input_new(Input* wrap, size_t buffer_size, size_t history) {
+  RingInput* self = malloc(sizeof(RingInput));
+  TRY {
+    ringbuffer_init(self->buf, buffer_size, MAX(history, 1));
+  } CATCH(err) {
+    free(self);
+    verr_raise(err);
+  } ETRY
+  self->base._impl = &ring_input_impl;
+  self->in = wrap;
+  return &self->base;
+}
+
+const char* ring_input_peek(Input* _self, size_t n) {
+  RingInput* self = (RingInput*)_self;
+  if (n > self->buf->size - self->buf->history) RAISE(ARGUMENT);
+  while (ringbuffer_avail_read(self->buf) < n) {
+    if (ringbuffer_fill(self->buf, self->in) == 0) return NULL;
+  }
+  return ringbuffer_read_ptr(self->buf);
+}
+void ring_input_unget(Input* _self, size_t n) {
+  RingInput* self = (RingInput*)_self;
+  ringbuffer_unget(self->buf, n);
+}
+
+static size_t ring_input_read(void* _self, char* dst, size_t n) {
+  RingInput* self = _self;
+  if (ringbuffer_avail_read(self->buf) == 0) {
+    ringbuffer_fill(self->buf, self->in);
+  }
+  return ringbuffer_read(self->buf, dst, n);
+}
+static int ring_input_get(void* _self) {
+  RingInput* self = _self;
+  if (ringbuffer_avail_read(self->buf) == 0) {
+    if (ringbuffer_fill(self->buf, self->in) == 0) return -1;
+  }
+  int ch = *ringbuffer_read_ptr(self->buf) & 0xFF;
+  self->buf->read++;
+  return ch;
+}
+static void ring_input_unget1(void* _self) {
+  RingInput* self = _self;
+  ringbuffer_unget(self->buf, 1);
+}
+static bool ring_input_eof(void* _self) {
+  RingInput* self = _self;
+  if (ringbuffer_avail_read(self->buf)) return false;
+  return io_eof(self->in);
+}
+static void ring_input_close(void* _self) {
+  RingInput* self = _self;
+  ringbuffer_close(self->buf);
+  call(self->in, close);
+  free(self);
+}
+
+static Input_Impl ring_input_impl = {
+  .read = ring_input_read,
+  .get = ring_input_get,
+  .unget = ring_input_unget1,
+  .eof = ring_input_eof,
+  .close = ring_input_close,
+};
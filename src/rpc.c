@@ -8,6 +8,39 @@
 #include <vlib/io.h>
 #include <vlib/util.h>
 #include <vlib/logging.h>
+#include <vlib/varint.h>
+
+/* Batch encoding */
+
+// A batch's arguments are its calls, one after the other: uvarint method size, method (null-
+// terminated), uvarint arguments size, arguments. Its result holds the outcome of every call, in
+// the same order: uvarint status, uvarint size, then the result or the error message.
+
+static bool is_batch(Bytes method) {
+  return method.size == sizeof(RPC_BATCH_METHOD) && memcmp(method.ptr, RPC_BATCH_METHOD, method.size) == 0;
+}
+
+// Reads the next call of a batch, or returns false at its end
+static bool next_call(const char** p, const char* end, Bytes* method, Bytes* args) {
+  if (*p == end) return false;
+  method->size = varint_read_u64(p, end);
+  if (method->size > end - *p) RAISE(MALFORMED);
+  method->ptr = (void*)*p;
+  *p += method->size;
+  args->size = varint_read_u64(p, end);
+  if (args->size > end - *p) RAISE(MALFORMED);
+  args->ptr = (void*)*p;
+  *p += args->size;
+  // Batches do not nest
+  if (is_batch(*method)) RAISE(MALFORMED);
+  return true;
+}
+
+static void put_outcome(Output* out, error_t status, Output* data) {
+  io_put_uvarint(out, (uint32_t)status);
+  io_put_uvarint(out, string_output_size(data));
+  string_output_copy(data, out);
+}
 
 /* RPC <=> BinaryRPC mapping */
 
@@ -92,13 +125,19 @@ BinaryRPC* rpc_to_binary(RPC* backend, rich_Codec* codec) {
   self->codec = codec;
   self->arg_in = memory_input_new(NULL, 0);
   self->arg_source = call(codec, new_source, self->arg_in);
-  self->result_out = buf_output_new(NULL, 4096);
+  self->result_out = buf_output_new(&null_output, 4096);
   self->result_sink = call(codec, new_sink, self->result_out);
   return &self->base;
 }
 
+static void server_batch(ServerRPC* self, Bytes args, Output* result);
+
 static void server_call(void* _self, Bytes method, Bytes args, Output* result) {
   ServerRPC* self = _self;
+  if (is_batch(method)) {
+    server_batch(self, args, result);
+    return;
+  }
 
   // Check method string
   const char* methodstr = method.ptr;
@@ -107,8 +146,36 @@ static void server_call(void* _self, Bytes method, Bytes args, Output* result) {
 
   memory_input_reset(self->arg_in, args.ptr, args.size);
   buf_output_reset(self->result_out, result);
-  call(self->backend, call, methodstr, self->arg_source, self->result_sink);
-  io_flush(self->result_out);
+  TRY {
+    call(self->backend, call, methodstr, self->arg_source, self->result_sink);
+    io_flush(self->result_out);
+  } FINALLY {
+    // Don't hold on to the caller's output (closing the sink would close it)
+    buf_output_reset(self->result_out, &null_output);
+  } ETRY
+}
+// Makes the calls of a batch one after the other
+static void server_batch(ServerRPC* self, Bytes args, Output* result) {
+  Output* data = string_output_new(256);
+  const char* p = args.ptr;
+  const char* end = p + args.size;
+  TRY {
+    Bytes method, call_args;
+    while (next_call(&p, end, &method, &call_args)) {
+      error_t status = 0;
+      string_output_reset(data);
+      TRY {
+        server_call(self, method, call_args, data);
+      } CATCH(err) {
+        status = err;
+        string_output_reset(data);
+        if (verr_current_msg()) io_writec(data, verr_current_msg());
+      } ETRY
+      put_outcome(result, status, data);
+    }
+  } FINALLY {
+    call(data, close);
+  } ETRY
 }
 static void server_close(void* _self) {
   ServerRPC* self = _self;
@@ -163,11 +230,122 @@ void rpc_call(RPC_Client* self, int method, void* arg, void* result) {
   call(self->backend, call, m->name, m->arg_source, m->result_sink);
 }
 
+/* RPC_Batch */
+
+data(BatchResult) {
+  int       method;
+  void*     result;
+  error_t   err;
+  char*     msg;
+};
+
+void rpc_batch_begin(RPC_Batch* self, RPC_Client* client) {
+  if (client->backend->_impl != &client_impl) {
+    verr_raisef(VERR_ARGUMENT, "batches need an RPC made by rpc_from_binary");
+  }
+  self->client = client;
+  self->calls = string_output_new(1024);
+  vector_init(self->results, sizeof(BatchResult), 16);
+  self->committed = false;
+}
+static void clear_results(RPC_Batch* self) {
+  for (unsigned i = 0; i < self->results->size; i++) {
+    BatchResult* r = vector_get(self->results, i);
+    free(r->msg);
+  }
+  self->results->size = 0;
+}
+void rpc_batch_close(RPC_Batch* self) {
+  clear_results(self);
+  vector_close(self->results);
+  call(self->calls, close);
+}
+
+void rpc_batch_add(RPC_Batch* self, int method, void* arg, void* result) {
+  if (self->committed) {
+    clear_results(self);
+    string_output_reset(self->calls);
+    self->committed = false;
+  }
+  ClientRPC* rpc = (ClientRPC*)self->client->backend;
+  ClientMethod* m = vector_get(self->client->methods, method);
+
+  // Encode the arguments before adding anything, in case that fails
+  string_output_reset(rpc->argout);
+  rich_rebind_source(m->arg_source, arg);
+  call(m->arg_source, read_value, rpc->arg_sink);
+
+  size_t name_size = strlen(m->name) + 1; // include terminating null byte
+  io_put_uvarint(self->calls, name_size);
+  io_write(self->calls, m->name, name_size);
+  io_put_uvarint(self->calls, string_output_size(rpc->argout));
+  string_output_copy(rpc->argout, self->calls);
+
+  BatchResult* r = vector_push(self->results);
+  r->method = method;
+  r->result = result;
+  r->err = 0;
+  r->msg = NULL;
+}
+
+unsigned rpc_batch_commit(RPC_Batch* self) {
+  ClientRPC* rpc = (ClientRPC*)self->client->backend;
+  Bytes method = {
+    .ptr = RPC_BATCH_METHOD,
+    .size = sizeof(RPC_BATCH_METHOD),
+  };
+  Bytes args;
+  args.ptr = (void*)string_output_data(self->calls, &args.size);
+  string_output_reset(rpc->resultout);
+  call(rpc->backend, call, method, args, rpc->resultout);
+
+  size_t size;
+  const char* p = string_output_data(rpc->resultout, &size);
+  const char* end = p + size;
+  unsigned failed = 0;
+  for (unsigned i = 0; i < self->results->size; i++) {
+    BatchResult* r = vector_get(self->results, i);
+    if (p == end) RAISE(MALFORMED);
+    error_t status = (error_t)(uint32_t)varint_read_u64(&p, end);
+    uint64_t n = varint_read_u64(&p, end);
+    if (n > end - p) RAISE(MALFORMED);
+
+    free(r->msg);
+    r->msg = NULL;
+    r->err = status;
+    if (status) {
+      if (n) r->msg = strndup(p, n);
+    } else {
+      ClientMethod* m = vector_get(self->client->methods, r->method);
+      rich_rebind_sink(m->result_sink, r->result);
+      memory_input_reset(rpc->memin, p, n);
+      TRY {
+        call(rpc->result_source, read_value, m->result_sink);
+      } CATCH(err) {
+        r->err = err;
+        if (verr_current_msg()) r->msg = strdup(verr_current_msg());
+      } ETRY
+    }
+    if (r->err) failed++;
+    p += n;
+  }
+  if (p != end) RAISE(MALFORMED);
+  self->committed = true;
+  return failed;
+}
+
+error_t rpc_batch_error(RPC_Batch* self, unsigned call, const char** msg) {
+  BatchResult* r = vector_get(self->results, call);
+  if (msg) *msg = r->msg;
+  return r->err;
+}
+
 /* RPC_Service */
 
 data(ServiceMethod) {
   RPCMethod     func;
-  rich_Schema*  arg_schema;
+  unsigned      index;          // position of the method's buffers in a worker's environment
+  rich_Schema*  arg_schema;     // unclosable, so that workers can bind their own sinks and sources
   rich_Sink*    arg_sink;
   void*         arg_data;
   rich_Schema*  result_schema;
@@ -191,23 +369,29 @@ RPC* rpc_service_new(void* udata, void (*cleanup)(void*)) {
   hashtable_init(self->methods, hasher_fnv64str, equaler_str, sizeof(const char*), sizeof(ServiceMethod));
   return &self->base;
 }
+
+static void* new_value(rich_Schema* schema) {
+  size_t size = call(schema, data_size);
+  void* data = malloc(size);
+  memset(data, 0, size);
+  return data;
+}
+
 void rpc_add(RPC* _self, const char* method, RPCMethod func, rich_Schema* arg_schema, rich_Schema* result_schema) {
   RPC_Service* self = (RPC_Service*)_self;
   assert(hashtable_get(self->methods, &method) == NULL);
+  unsigned index = self->methods->size;
   ServiceMethod* m = hashtable_insert(self->methods, &method);
   m->func = func;
+  m->index = index;
 
-  m->arg_schema = arg_schema;
-  size_t argsz = call(arg_schema, data_size);
-  m->arg_data = malloc(argsz);
-  memset(m->arg_data, 0, argsz);
-  m->arg_sink = rich_bind_sink(arg_schema, m->arg_data);
+  m->arg_schema = rich_schema_unclosable(arg_schema);
+  m->arg_data = new_value(arg_schema);
+  m->arg_sink = rich_bind_sink(m->arg_schema, m->arg_data);
 
-  m->result_schema = result_schema;
-  size_t resultsz = call(result_schema, data_size);
-  m->result_data = malloc(resultsz);
-  memset(m->result_data, 0, resultsz);
-  m->result_source = rich_bind_source(result_schema, m->result_data);
+  m->result_schema = rich_schema_unclosable(result_schema);
+  m->result_data = new_value(result_schema);
+  m->result_source = rich_bind_source(m->result_schema, m->result_data);
 }
 
 static void service_call(void* _self, const char* method, rich_Source* arg, rich_Sink* result) {
@@ -228,9 +412,12 @@ static void service_close(void* _self) {
     call(method->result_source, close);
     call(method->result_schema, close_value, method->result_data);
     free(method->result_data);
+    rich_schema_close(method->arg_schema);
+    rich_schema_close(method->result_schema);
     return HT_CONTINUE;
   }
   hashtable_iter(self->methods, free_method);
+  hashtable_close(self->methods);
   if (self->cleanup) self->cleanup(self->udata);
   free(self);
 }
@@ -239,6 +426,205 @@ static RPC_Impl service_impl = {
   .close = service_close,
 };
 
+/* ServiceWorker */
+
+// Each worker thread decodes and encodes with its own codec sink and source, into its own copy of
+// every method's arguments and result.
+data(MethodEnv) {
+  rich_Sink*    arg_sink;
+  void*         arg_data;
+  rich_Source*  result_source;
+  void*         result_data;
+};
+
+data(ServiceEnv) {
+  Input*        arg_in;
+  rich_Source*  arg_source;
+  Output*       result_out;
+  rich_Sink*    result_sink;
+  MethodEnv     methods[];
+};
+
+data(ServiceWorker) {
+  PoolWorker    base;
+  RPC_Service*  service;
+  rich_Codec*   codec;
+  unsigned      nmethods;     // methods added later are not served
+  ThreadPool*   pool;         // where batches are spread, if not NULL
+};
+static PoolWorker_Impl service_worker_impl;
+
+PoolWorker* rpc_service_worker(RPC* service, rich_Codec* codec) {
+  assert(service->_impl == &service_impl);
+  ServiceWorker* self = malloc(sizeof(ServiceWorker));
+  self->base._impl = &service_worker_impl;
+  self->service = (RPC_Service*)service;
+  self->codec = codec;
+  self->nmethods = self->service->methods->size;
+  self->pool = NULL;
+  return &self->base;
+}
+void rpc_service_worker_parallel(PoolWorker* worker, ThreadPool* pool) {
+  assert(worker->_impl == &service_worker_impl);
+  ((ServiceWorker*)worker)->pool = pool;
+}
+
+static size_t service_env_size(void* _self) {
+  ServiceWorker* self = _self;
+  return sizeof(ServiceEnv) + self->nmethods * sizeof(MethodEnv);
+}
+static void service_init_env(void* _self, void* _env) {
+  ServiceWorker* self = _self;
+  ServiceEnv* env = _env;
+  env->arg_in = memory_input_new(NULL, 0);
+  env->arg_source = call(self->codec, new_source, env->arg_in);
+  env->result_out = buf_output_new(&null_output, 4096);
+  env->result_sink = call(self->codec, new_sink, env->result_out);
+  int init_method(void* _key, void* _data) {
+    ServiceMethod* m = _data;
+    if (m->index >= self->nmethods) return HT_CONTINUE;
+    MethodEnv* menv = &env->methods[m->index];
+    menv->arg_data = new_value(m->arg_schema);
+    menv->arg_sink = rich_bind_sink(m->arg_schema, menv->arg_data);
+    menv->result_data = new_value(m->result_schema);
+    menv->result_source = rich_bind_source(m->result_schema, menv->result_data);
+    return HT_CONTINUE;
+  }
+  hashtable_iter(self->service->methods, init_method);
+}
+static void service_close_env(void* _self, void* _env) {
+  ServiceWorker* self = _self;
+  ServiceEnv* env = _env;
+  int close_method(void* _key, void* _data) {
+    ServiceMethod* m = _data;
+    if (m->index >= self->nmethods) return HT_CONTINUE;
+    MethodEnv* menv = &env->methods[m->index];
+    call(menv->arg_sink, close);
+    free(menv->arg_data);
+    call(menv->result_source, close);
+    call(m->result_schema, close_value, menv->result_data);
+    free(menv->result_data);
+    return HT_CONTINUE;
+  }
+  hashtable_iter(self->service->methods, close_method);
+  call(env->arg_source, close);
+  call(env->result_sink, close);
+}
+
+static void run_call(ServiceWorker* self, ServiceEnv* env, RPC_Job* job) {
+  const char* method = job->method.ptr;
+  if (job->method.size < 1 || method[job->method.size-1] != 0) RAISE(MALFORMED);
+  ServiceMethod* m = hashtable_get(self->service->methods, &method);
+  if (!m || m->index >= self->nmethods) verr_raisef(VERR_ARGUMENT, "unknown method '%s'", method);
+  MethodEnv* menv = &env->methods[m->index];
+
+  memory_input_reset(env->arg_in, job->args.ptr, job->args.size);
+  call(env->arg_source, read_value, menv->arg_sink);
+  call(m->result_schema, reset_value, menv->result_data);
+  m->func(self->service->udata, menv->arg_data, menv->result_data);
+
+  buf_output_reset(env->result_out, job->result);
+  TRY {
+    call(menv->result_source, read_value, env->result_sink);
+    io_flush(env->result_out);
+  } FINALLY {
+    buf_output_reset(env->result_out, &null_output);
+  } ETRY
+}
+
+static void run_batch(ServiceWorker* self, ServiceEnv* env, RPC_Job* job);
+
+static void service_work(void* _self, void* _env, void* _job) {
+  ServiceWorker* self = _self;
+  ServiceEnv* env = _env;
+  RPC_Job* job = _job;
+  job->status = 0;
+  TRY {
+    if (is_batch(job->method)) {
+      run_batch(self, env, job);
+    } else {
+      run_call(self, env, job);
+    }
+  } CATCH(err) {
+    log_warnf(get_logger("vlib.rpc.service"), "RPC method error: %s", verr_current_str());
+    job->status = err;
+    string_output_reset(job->result);
+    if (verr_current_msg()) io_writec(job->result, verr_current_msg());
+  } ETRY
+  job->done(job);
+}
+
+// One call of a batch, run like any other job
+data(BatchCall) {
+  RPC_Job     base;
+  Cond*       cond;
+  unsigned*   remaining;
+};
+
+static void batch_call_done(RPC_Job* job) {
+  BatchCall* c = (BatchCall*)job;
+  thread_lock(c->cond);
+  if (--*c->remaining == 0) thread_signal(c->cond);
+  thread_unlock(c->cond);
+}
+
+// Makes the calls of a batch, on idle threads of the pool if there are any, or on this one
+static void run_batch(ServiceWorker* self, ServiceEnv* env, RPC_Job* job) {
+  Vector calls[1];
+  vector_init(calls, sizeof(BatchCall), 8);
+  Cond cond[1];
+  thread_cond_init(cond);
+  unsigned remaining = 0;
+  TRY {
+    // Read every call first, so that none are made if the batch is malformed
+    const char* p = job->args.ptr;
+    const char* end = p + job->args.size;
+    Bytes method, args;
+    while (next_call(&p, end, &method, &args)) {
+      BatchCall* c = vector_push(calls);
+      c->base.method = method;
+      c->base.args = args;
+      c->base.result = NULL;
+    }
+    for (unsigned i = 0; i < calls->size; i++) {
+      BatchCall* c = vector_get(calls, i);
+      c->base.result = string_output_new(256);
+      c->base.done = batch_call_done;
+      c->cond = cond;
+      c->remaining = &remaining;
+    }
+
+    remaining = calls->size;
+    for (unsigned i = 0; i < calls->size; i++) {
+      BatchCall* c = vector_get(calls, i);
+      if (!self->pool || !threadpool_dispatch(self->pool, c, 0)) service_work(self, env, c);
+    }
+    thread_lock(cond);
+    while (remaining) thread_wait(cond, -1);
+    thread_unlock(cond);
+
+    for (unsigned i = 0; i < calls->size; i++) {
+      BatchCall* c = vector_get(calls, i);
+      put_outcome(job->result, c->base.status, c->base.result);
+    }
+  } FINALLY {
+    for (unsigned i = 0; i < calls->size; i++) {
+      BatchCall* c = vector_get(calls, i);
+      if (c->base.result) call(c->base.result, close);
+    }
+    vector_close(calls);
+    thread_cond_close(cond);
+  } ETRY
+}
+
+static PoolWorker_Impl service_worker_impl = {
+  .env_size = service_env_size,
+  .init_env = service_init_env,
+  .close_env = service_close_env,
+  .work = service_work,
+  .close = free,
+};
+
 /* RPC over ZeroMQ */
 
 #ifdef VLIB_ENABLE_ZMQ
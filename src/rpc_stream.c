@@ -0,0 +1,737 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <vlib/rpc.h>
+#include <vlib/io.h>
+#include <vlib/varint.h>
+#include <vlib/thread.h>
+#include <vlib/util.h>
+#include <vlib/logging.h>
+#include <vlib/net.h>
+
+/**
+ * Framing
+ *
+ * Each frame is preceded by its size as a uvarint, and a frame of size 0 ends the conversation:
+ * the client sends one when it is closed, and the server answers with one of its own once every
+ * response has been written.
+ *
+ *   request:   uvarint id, uvarint method size, method (null-terminated), arguments
+ *   response:  uvarint id, uvarint status, result (status 0) or error message (status is an error_t)
+ *
+ * Responses carry the id of their request, and may come back in any order.
+ */
+
+// Reads a frame, or returns false at the end of the conversation.
+static bool read_frame(Input* in, Bytes* frame) {
+  uint64_t size = io_get_uvarint(in);
+  if (size == 0) return false;
+  if (size > RPC_MAX_FRAME) verr_raisef(VERR_MALFORMED, "RPC frame of %lu bytes is too large", size);
+  bytes_grow(frame, size);
+  io_readall(in, frame->ptr, size);
+  frame->size = size;
+  return true;
+}
+
+// Fills in the start of a frame: its size, then two integers. The rest of the frame is `more` bytes
+// long.
+#define HEADER_MAX (3 * VARINT_MAX_LEN)
+static size_t frame_header(char* header, uint64_t a, uint64_t b, size_t more) {
+  char fields[2 * VARINT_MAX_LEN];
+  size_t n = varint_write_u64(fields, a);
+  n += varint_write_u64(fields + n, b);
+  size_t size = varint_write_u64(header, n + more);
+  memcpy(header + size, fields, n);
+  return size + n;
+}
+
+// Writes a frame made of two integers, an optional string and the contents of body
+static void write_frame(Output* out, uint64_t a, uint64_t b, const Bytes* str, Output* body) {
+  char header[HEADER_MAX];
+  io_write(out, header, frame_header(header, a, b, (str ? str->size : 0) + string_output_size(body)));
+  if (str) io_write(out, str->ptr, str->size);
+  string_output_copy(body, out);
+}
+
+// Writes a frame in a single call to writev, with its payload taken from up to `count` iovecs
+// after the first (which is reserved for the header).
+static void send_frame(NetConn* conn, uint64_t a, uint64_t b, struct iovec* iov, int count) {
+  size_t more = 0;
+  for (int i = 1; i <= count; i++) {
+    more += iov[i].iov_len;
+  }
+  char header[HEADER_MAX];
+  iov[0].iov_base = header;
+  iov[0].iov_len = frame_header(header, a, b, more);
+  call(conn, writev, iov, count + 1);
+}
+
+static void write_end(Output* out) {
+  io_put(out, 0);
+  io_flush(out);
+}
+
+/* RPC_Channel */
+
+struct RPC_Future {
+  RPC_Channel*  channel;
+  uint64_t      id;
+  rich_Sink*    result;
+  RPCCallback   done;         // NULL for calls that are waited for
+  void*         udata;
+  bool          finished;
+  error_t       err;
+  char*         msg;
+};
+
+struct RPC_Channel {
+  RPC           base;
+  rich_Codec*   codec;
+  Input*        in;
+  Output*       out;
+  Lock          write_lock[1];
+  Cond          cond[1];      // guards everything below, and is signalled when calls finish
+  Hashtable     calls[1];     // id => RPC_Future*
+  uint64_t      next_id;
+  error_t       failed;       // set once responses can no longer arrive
+  thread_t      reader;
+};
+static RPC_Impl channel_impl;
+
+static void* reader_run(void* self);
+
+RPC_Channel* rpc_channel_new(Input* in, Output* out, rich_Codec* codec) {
+  RPC_Channel* self = malloc(sizeof(RPC_Channel));
+  self->base._impl = &channel_impl;
+  self->codec = codec;
+  self->in = buf_input_new(in, 4096);
+  self->out = buf_output_new(out, 4096);
+  thread_lock_init(self->write_lock);
+  thread_cond_init(self->cond);
+  hashtable_init(self->calls, hasher_fnv64, memcmp, sizeof(uint64_t), sizeof(RPC_Future*));
+  self->next_id = 1;
+  self->failed = 0;
+  self->reader = thread_spawn(reader_run, self);
+  return self;
+}
+RPC* rpc_channel_rpc(RPC_Channel* self) {
+  return &self->base;
+}
+
+// Returns false if the reader has already taken the call, to finish it
+static bool forget_call(RPC_Channel* self, uint64_t id) {
+  thread_lock(self->cond);
+  bool removed = hashtable_get(self->calls, &id) != NULL;
+  if (removed) hashtable_remove(self->calls, &id, NULL);
+  thread_unlock(self->cond);
+  return removed;
+}
+
+// Raises if the call could not be sent and the future is still the caller's. If writing fails
+// after the reader has taken the future, returns the write error instead: the reader finishes
+// the call with its own error.
+static error_t send_call(RPC_Channel* self, const char* method, rich_Source* args, RPC_Future* f) {
+  error_t lost = 0;
+  // Encode the arguments before taking any locks
+  Output* body = string_output_new(256);
+  rich_Sink* sink = call(self->codec, new_sink, body);
+  TRY {
+    call(args, read_value, sink);
+
+    // Once registered, the future may be finished (and freed) by the reader at any time
+    thread_lock(self->cond);
+    error_t failed = self->failed;
+    uint64_t id = 0;
+    if (!failed) {
+      id = f->id = self->next_id++;
+      *(RPC_Future**)hashtable_insert(self->calls, &id) = f;
+    }
+    thread_unlock(self->cond);
+    if (failed) verr_raise(failed);
+
+    Bytes method_bytes = {
+      .ptr = (void*)method,
+      .size = strlen(method) + 1, // include terminating null byte
+    };
+    thread_lock(self->write_lock);
+    TRY {
+      write_frame(self->out, id, method_bytes.size, &method_bytes, body);
+      io_flush(self->out);
+    } CATCH(err) {
+      if (forget_call(self, id)) verr_reraise();
+      lost = err;
+    } FINALLY {
+      thread_unlock(self->write_lock);
+    } ETRY
+  } FINALLY {
+    call(sink, close);
+  } ETRY
+  return lost;
+}
+
+static RPC_Future* new_future(RPC_Channel* self, rich_Sink* result, RPCCallback done, void* udata) {
+  RPC_Future* f = malloc(sizeof(RPC_Future));
+  f->channel = self;
+  f->result = result;
+  f->done = done;
+  f->udata = udata;
+  f->finished = false;
+  f->err = 0;
+  f->msg = NULL;
+  return f;
+}
+
+RPC_Future* rpc_channel_start(RPC_Channel* self, const char* method, rich_Source* args, rich_Sink* result) {
+  RPC_Future* f = new_future(self, result, NULL, NULL);
+  error_t lost = 0;
+  TRY {
+    lost = send_call(self, method, args, f);
+  } CATCH(err) {
+    free(f);
+    verr_reraise();
+  } ETRY
+  if (lost) {
+    // The reader finishes the call with the channel's error, which this raises
+    rpc_future_wait(f);
+    verr_raise(lost);
+  }
+  return f;
+}
+void rpc_channel_send(RPC_Channel* self, const char* method, rich_Source* args, rich_Sink* result, RPCCallback done, void* udata) {
+  RPC_Future* f = new_future(self, result, done, udata);
+  TRY {
+    // A call lost after the reader took it is reported to done, like any other failure
+    send_call(self, method, args, f);
+  } CATCH(err) {
+    free(f);
+    verr_reraise();
+  } ETRY
+}
+
+void rpc_future_wait(RPC_Future* f) {
+  RPC_Channel* self = f->channel;
+  thread_lock(self->cond);
+  while (!f->finished) thread_wait(self->cond, -1);
+  thread_unlock(self->cond);
+
+  error_t err = f->err;
+  char msg[512] = "";
+  if (f->msg) snprintf(msg, sizeof(msg), "%s", f->msg);
+  free(f->msg);
+  free(f);
+  if (err) {
+    if (msg[0]) verr_raisef(err, "%s", msg);
+    verr_raise(err);
+  }
+}
+
+static void finish_call(RPC_Future* f, error_t err, const char* msg) {
+  RPC_Channel* self = f->channel;
+  if (f->done) {
+    TRY {
+      f->done(f->udata, err, msg);
+    } CATCH(e) {
+      log_warnf(get_logger("vlib.rpc.stream"), "RPC callback error: %s", verr_current_str());
+    } ETRY
+    free(f);
+    return;
+  }
+  thread_lock(self->cond);
+  f->err = err;
+  f->msg = msg ? strdup(msg) : NULL;
+  f->finished = true;
+  thread_broadcast(self->cond);
+  thread_unlock(self->cond);
+}
+
+static void handle_response(RPC_Channel* self, Bytes* frame, Input* memin, rich_Source* source) {
+  const char* p = frame->ptr;
+  const char* end = p + frame->size;
+  uint64_t id = varint_read_u64(&p, end);
+  error_t status = (error_t)(uint32_t)varint_read_u64(&p, end);
+
+  thread_lock(self->cond);
+  RPC_Future** slot = hashtable_get(self->calls, &id);
+  RPC_Future* f = slot ? *slot : NULL;
+  if (f) hashtable_remove(self->calls, &id, NULL);
+  thread_unlock(self->cond);
+  if (!f) RAISE(MALFORMED);
+
+  if (status) {
+    char msg[512];
+    snprintf(msg, sizeof(msg), "%.*s", (int)MIN(end - p, (ptrdiff_t)sizeof(msg) - 1), p);
+    finish_call(f, status, msg);
+    return;
+  }
+  error_t err = 0;
+  char msg[512] = "";
+  memory_input_reset(memin, p, end - p);
+  TRY {
+    call(source, read_value, f->result);
+  } CATCH(e) {
+    err = e;
+    if (verr_current_msg()) snprintf(msg, sizeof(msg), "%s", verr_current_msg());
+  } ETRY
+  finish_call(f, err, msg[0] ? msg : NULL);
+}
+
+// Decodes responses as they arrive. Once the conversation ends, or the connection fails, all calls
+// still in flight fail.
+static void* reader_run(void* _self) {
+  verr_thread_init();
+  RPC_Channel* self = _self;
+  Bytes frame;
+  bytes_init(&frame, 256);
+  Input* memin = memory_input_new(NULL, 0);
+  rich_Source* source = call(self->codec, new_source, memin);
+
+  error_t failed = VERR_UNAVAILABLE;
+  TRY {
+    while (read_frame(self->in, &frame)) {
+      handle_response(self, &frame, memin, source);
+    }
+  } CATCH(err) {
+    failed = err;
+  } ETRY
+  call(source, close);
+  bytes_close(&frame);
+
+  Vector orphans[1];
+  vector_init(orphans, sizeof(RPC_Future*), 4);
+  int collect(void* key, void* value) {
+    *(RPC_Future**)vector_push(orphans) = *(RPC_Future**)value;
+    return HT_REMOVE;
+  }
+  thread_lock(self->cond);
+  self->failed = failed;
+  hashtable_iter(self->calls, collect);
+  thread_unlock(self->cond);
+  for (unsigned i = 0; i < orphans->size; i++) {
+    finish_call(*(RPC_Future**)vector_get(orphans, i), failed, "RPC connection closed");
+  }
+  vector_close(orphans);
+
+  verr_thread_cleanup();
+  return NULL;
+}
+
+static void channel_call(void* _self, const char* method, rich_Source* args, rich_Sink* result) {
+  rpc_future_wait(rpc_channel_start(_self, method, args, result));
+}
+
+// Waits for the calls in flight, by ending the conversation and letting the reader see the
+// server's end of it.
+static void channel_close(void* _self) {
+  RPC_Channel* self = _self;
+  thread_lock(self->write_lock);
+  TRY {
+    write_end(self->out);
+  } CATCH(err) {
+    // The reader will see that the connection failed
+  } FINALLY {
+    thread_unlock(self->write_lock);
+  } ETRY
+  thread_join(self->reader);
+
+  call(self->in, close);
+  TRY {
+    call(self->out, close);
+  } CATCH(err) {
+    // Only fails if the end couldn't be written, which the reader has reported to every call
+  } ETRY
+  call(self->codec, close);
+  hashtable_close(self->calls);
+  thread_cond_close(self->cond);
+  thread_lock_close(self->write_lock);
+  free(self);
+}
+
+static RPC_Impl channel_impl = {
+  .call = channel_call,
+  .close = channel_close,
+};
+
+/* Serving streams */
+
+// Splits a request frame into its parts, and returns its id
+static uint64_t parse_request(const Bytes* frame, Bytes* method, Bytes* args) {
+  const char* p = frame->ptr;
+  const char* end = p + frame->size;
+  uint64_t id = varint_read_u64(&p, end);
+  uint64_t method_size = varint_read_u64(&p, end);
+  if (method_size > end - p) RAISE(MALFORMED);
+  method->ptr = (void*)p;
+  method->size = method_size;
+  args->ptr = (void*)(p + method_size);
+  args->size = end - p - method_size;
+  return id;
+}
+
+// Answers a request frame. Fills in result with the result or error message, and returns the
+// status of the call. If lock is not NULL, the backend is called with it held.
+static error_t answer(BinaryRPC* backend, Lock* lock, const Bytes* frame, uint64_t* id, Output* result) {
+  Bytes method, args;
+  *id = parse_request(frame, &method, &args);
+
+  error_t status = 0;
+  string_output_reset(result);
+  if (lock) thread_lock(lock);
+  TRY {
+    call(backend, call, method, args, result);
+  } CATCH(err) {
+    log_warnf(get_logger("vlib.rpc.stream"), "RPC method error: %s", verr_current_str());
+    status = err;
+    string_output_reset(result);
+    if (verr_current_msg()) io_writec(result, verr_current_msg());
+  } FINALLY {
+    if (lock) thread_unlock(lock);
+  } ETRY
+  return status;
+}
+
+void rpc_serve_stream(Input* in, Output* out, BinaryRPC* backend) {
+  in = buf_input_new(in, 4096);
+  out = buf_output_new(out, 4096);
+  Bytes frame;
+  bytes_init(&frame, 256);
+  Output* result = string_output_new(512);
+  TRY {
+    for (;;) {
+      int ch = io_get(in);
+      if (ch == -1) break;
+      io_unget(in);
+      if (!read_frame(in, &frame)) {
+        write_end(out);
+        break;
+      }
+      uint64_t id;
+      error_t status = answer(backend, NULL, &frame, &id, result);
+      write_frame(out, id, (uint32_t)status, NULL, result);
+      io_flush(out);
+    }
+  } FINALLY {
+    call(result, close);
+    bytes_close(&frame);
+    call(in, close);
+    call(out, close);
+  } ETRY
+}
+
+/* RPC over TCP */
+
+// Calls are sent as request frames over a connection that is kept open between calls, and
+// reopened by the next call if anything goes wrong with it.
+data(TCPClient) {
+  BinaryRPC   base;
+  char*       addr;
+  NetConn*    conn;
+  Input*      in;
+  Bytes       frame;
+  uint64_t    next_id;
+};
+static BinaryRPC_Impl tcp_client_impl;
+
+BinaryRPC* rpc_tcp_new(const char* addr) {
+  TCPClient* self = malloc(sizeof(TCPClient));
+  self->base._impl = &tcp_client_impl;
+  self->addr = strdup(addr);
+  self->conn = NULL;
+  self->in = NULL;
+  bytes_init(&self->frame, 256);
+  self->next_id = 1;
+  return &self->base;
+}
+
+static void disconnect(TCPClient* self) {
+  if (self->conn) {
+    call(self->in, close);
+    call(self->conn, close);
+    self->conn = NULL;
+    self->in = NULL;
+  }
+}
+
+static void tcp_client_call(void* _self, Bytes method, Bytes args, Output* result) {
+  TCPClient* self = _self;
+  if (!self->conn) {
+    self->conn = net_connect_tcp(self->addr, NULL);
+    self->in = buf_input_new(self->conn->input, 4096);
+  }
+
+  uint64_t id = self->next_id++;
+  TRY {
+    struct iovec iov[3] = {
+      [1] = { .iov_base = method.ptr, .iov_len = method.size },
+      [2] = { .iov_base = args.ptr, .iov_len = args.size },
+    };
+    send_frame(self->conn, id, method.size, iov, 2);
+    if (!read_frame(self->in, &self->frame)) RAISE(UNAVAILABLE);
+  } CATCH(err) {
+    disconnect(self);
+    verr_reraise();
+  } ETRY
+
+  const char* p = self->frame.ptr;
+  const char* end = p + self->frame.size;
+  if (varint_read_u64(&p, end) != id) {
+    disconnect(self);
+    RAISE(MALFORMED);
+  }
+  error_t status = (error_t)(uint32_t)varint_read_u64(&p, end);
+  if (status) verr_raisef(status, "%.*s", (int)MIN(end - p, 511), p);
+  io_write(result, p, end - p);
+}
+static void tcp_client_close(void* _self) {
+  TCPClient* self = _self;
+  disconnect(self);
+  bytes_close(&self->frame);
+  free(self->addr);
+  free(self);
+}
+static BinaryRPC_Impl tcp_client_impl = {
+  .call = tcp_client_call,
+  .close = tcp_client_close,
+};
+
+/* RPC_TCPServer */
+
+data(Job);
+
+data(Session) {
+  RPC_TCPServer*  server;
+  NetConn*        conn;
+  thread_t        thread;
+  bool            done;       // set once the session has closed its connection
+  // With a pool, the calls in flight in the order they were made
+  Cond            cond[1];    // guards everything below, and is signalled when calls finish
+  Job*            head;
+  Job*            tail;
+  unsigned        pending;
+  bool            sending;    // set while a worker sends responses
+  bool            failed;     // set if a response could not be sent
+};
+
+// A call dispatched to the pool. It owns its request frame, which method and args point into.
+data(Job) {
+  RPC_Job   base;
+  Session*  session;
+  uint64_t  id;
+  Bytes     frame;
+  bool      finished;
+  Job*      next;
+};
+
+void rpc_tcp_init(RPC_TCPServer* self, NetListener* listener, BinaryRPC* backend) {
+  self->listener = listener;
+  self->rpc = backend;
+  self->pool = NULL;
+  self->running = true;
+}
+void rpc_tcp_init_pool(RPC_TCPServer* self, NetListener* listener, ThreadPool* pool) {
+  rpc_tcp_init(self, listener, NULL);
+  self->pool = pool;
+}
+void rpc_tcp_stop(RPC_TCPServer* self) {
+  self->running = false;
+  call(self->listener, shutdown);
+}
+
+static void send_response(NetConn* conn, uint64_t id, error_t status, Output* result) {
+  struct iovec iov[17];
+  int count = string_output_iovec(result, iov + 1, 16);
+  if (count > 16) {
+    size_t size;
+    iov[1].iov_base = (void*)string_output_data(result, &size);
+    iov[1].iov_len = size;
+    count = 1;
+  }
+  send_frame(conn, id, (uint32_t)status, iov, count);
+}
+
+// Sends the responses of the finished calls at the head of the queue. Runs on a worker thread,
+// and only one worker sends for a session at a time.
+static void job_done(RPC_Job* _job) {
+  Job* job = (Job*)_job;
+  Session* session = job->session;
+  thread_lock(session->cond);
+  job->finished = true;
+  if (session->sending) {
+    thread_unlock(session->cond);
+    return;
+  }
+  session->sending = true;
+  while (session->head && session->head->finished) {
+    Job* next = session->head;
+    session->head = next->next;
+    if (!session->head) session->tail = NULL;
+    bool failed = session->failed;
+    thread_unlock(session->cond);
+
+    if (!failed) {
+      TRY {
+        send_response(session->conn, next->id, next->base.status, next->base.result);
+      } CATCH(err) {
+        failed = true;
+        // Stop reading requests too
+        call(session->conn, shutdown);
+      } ETRY
+    }
+    call(next->base.result, close);
+    bytes_close(&next->frame);
+    free(next);
+
+    thread_lock(session->cond);
+    if (failed) session->failed = true;
+    session->pending--;
+  }
+  session->sending = false;
+  thread_broadcast(session->cond);
+  thread_unlock(session->cond);
+}
+
+// Queues a call and dispatches it to the pool. Takes over the frame's memory.
+static void dispatch_job(Session* session, Bytes* frame) {
+  Job* job = malloc(sizeof(Job));
+  job->frame = *frame;
+  bytes_init(frame, 256);
+  TRY {
+    job->id = parse_request(&job->frame, &job->base.method, &job->base.args);
+  } CATCH(err) {
+    bytes_close(&job->frame);
+    free(job);
+    verr_reraise();
+  } ETRY
+  job->base.result = string_output_new(256);
+  job->base.status = 0;
+  job->base.done = job_done;
+  job->session = session;
+  job->finished = false;
+  job->next = NULL;
+
+  thread_lock(session->cond);
+  if (session->tail) {
+    session->tail->next = job;
+  } else {
+    session->head = job;
+  }
+  session->tail = job;
+  session->pending++;
+  thread_unlock(session->cond);
+  threadpool_dispatch(session->server->pool, job, -1);
+}
+
+static void wait_for_jobs(Session* session) {
+  thread_lock(session->cond);
+  while (session->pending) thread_wait(session->cond, -1);
+  thread_unlock(session->cond);
+}
+
+// Answers the calls made over one connection, in order
+static void* session_run(void* _session) {
+  verr_thread_init();
+  Session* session = _session;
+  RPC_TCPServer* self = session->server;
+  NetConn* conn = session->conn;
+  Input* in = buf_input_new(conn->input, 4096);
+  Bytes frame;
+  bytes_init(&frame, 256);
+  Output* result = string_output_new(512);
+  TRY {
+    while (read_frame(in, &frame)) {
+      if (self->pool) {
+        dispatch_job(session, &frame);
+      } else {
+        uint64_t id;
+        error_t status = answer(self->rpc, self->_lock, &frame, &id, result);
+        send_response(conn, id, status, result);
+      }
+    }
+    // The client ended the conversation
+    wait_for_jobs(session);
+    if (session->failed) RAISE(IO);
+    char end = 0;
+    struct iovec iov = { .iov_base = &end, .iov_len = 1 };
+    call(conn, writev, &iov, 1);
+  } CATCH(err) {
+    // Clients may go away at any time
+    if (err != VERR_EOF && self->running) {
+      log_warnf(get_logger("vlib.rpc.tcp"), "RPC connection error: %s", verr_current_str());
+    }
+  } ETRY
+  wait_for_jobs(session);
+  call(result, close);
+  bytes_close(&frame);
+  call(in, close);
+
+  thread_lock(self->_lock);
+  call(conn, close);
+  session->done = true;
+  thread_unlock(self->_lock);
+  verr_thread_cleanup();
+  return NULL;
+}
+
+void rpc_tcp_serve(RPC_TCPServer* self) {
+  Vector* sessions = self->_sessions;
+  thread_lock_init(self->_lock);
+  vector_init(sessions, sizeof(Session*), 8);
+
+  // Joins the sessions that have finished, or all of them
+  void reap(bool all) {
+    unsigned kept = 0;
+    for (unsigned i = 0; i < sessions->size; i++) {
+      Session* session = *(Session**)vector_get(sessions, i);
+      thread_lock(self->_lock);
+      bool done = session->done;
+      thread_unlock(self->_lock);
+      if (done || all) {
+        thread_join(session->thread);
+        thread_cond_close(session->cond);
+        free(session);
+      } else {
+        *(Session**)vector_get(sessions, kept++) = session;
+      }
+    }
+    sessions->size = kept;
+  }
+
+  TRY {
+    while (self->running) {
+      NetConn* conn = NULL;
+      TRY {
+        conn = call(self->listener, accept);
+      } CATCH(err) {
+        // Aborted connections are not a problem, and stopping the server aborts accept
+        if (err != VERR_NET) verr_reraise();
+      } ETRY
+      reap(false);
+      if (!conn) continue;
+
+      Session* session = malloc(sizeof(Session));
+      session->server = self;
+      session->conn = conn;
+      session->done = false;
+      thread_cond_init(session->cond);
+      session->head = session->tail = NULL;
+      session->pending = 0;
+      session->sending = false;
+      session->failed = false;
+      *(Session**)vector_push(sessions) = session;
+      session->thread = thread_spawn(session_run, session);
+    }
+  } FINALLY {
+    // Make every session see the end of its connection
+    self->running = false;
+    thread_lock(self->_lock);
+    for (unsigned i = 0; i < sessions->size; i++) {
+      Session* session = *(Session**)vector_get(sessions, i);
+      if (!session->done) call(session->conn, shutdown);
+    }
+    thread_unlock(self->_lock);
+    reap(true);
+    vector_close(sessions);
+    thread_lock_close(self->_lock);
+  } ETRY
+}
@@ -1,5 +1,12 @@
 
 #include <assert.h>
+#include <string.h>
+
+// The Stream VByte decoder uses SSSE3 shuffles when the CPU has them, whatever the build flags
+#if defined(__x86_64__) || defined(__i386__)
+#define SVB_SSSE3
+#include <tmmintrin.h>
+#endif
 
 #include <vlib/varint.h>
 #include <vlib/error.h>
@@ -59,31 +66,26 @@ void int_to_varint(int64_t n, Varint* v) {
   }
 }
 
-static inline bool decode_with(Varint* v, uint8_t (*get)()) {
+bool varint_decode(Varint* v, Input* src) {
   v->len = 0;
   for (;;) {
-    uint8_t digit = get();
-    v->digits[v->len++] = digit;
-    if ((digit & 0x80) == 0) return true;
-    if (v->len == v->max) return false;
-  }
-}
-bool varint_decode(Varint* to, Input* src) {
-  uint8_t get() {
     int c = io_get(src);
     if (c == -1) RAISE(EOF);
     assert(c >= 0 && c < 256);
-    return c;
+    v->digits[v->len++] = c;
+    if ((c & 0x80) == 0) return true;
+    if (v->len == v->max) return false;
   }
-  return decode_with(to, get);
 }
-bool varint_decodestr(Varint* to, const char* str, size_t sz) {
-  size_t offset = 0;
-  uint8_t get() {
-    if (offset == sz) RAISE(EOF);
-    return (uint8_t)str[offset++];
+bool varint_decodestr(Varint* v, const char* str, size_t sz) {
+  v->len = 0;
+  for (;;) {
+    if (v->len == sz) RAISE(EOF);
+    uint8_t digit = str[v->len];
+    v->digits[v->len++] = digit;
+    if ((digit & 0x80) == 0) return true;
+    if (v->len == v->max) return false;
   }
-  return decode_with(to, get);
 }
 
 bool varint_validate(Varint* v) {
@@ -98,3 +100,180 @@ void varint_encode(Varint* v, Output* out) {
   assert(v->len > 0);
   io_write(out, v->data, v->len);
 }
+
+/* Direct encoding and decoding */
+
+size_t varint_write_u64(char* p, uint64_t u) {
+  uint8_t* dst = (uint8_t*)p;
+  size_t n = 0;
+  while (u >= 0x80) {
+    dst[n++] = (uint8_t)u | 0x80;
+    u >>= 7;
+  }
+  dst[n++] = (uint8_t)u;
+  return n;
+}
+
+static uint64_t read_slow(const char** p, const char* end) {
+  const uint8_t* src = (const uint8_t*)*p;
+  uint64_t u = 0;
+  for (unsigned shift = 0; shift < 7*VARINT_MAX_LEN; shift += 7) {
+    if (src == (const uint8_t*)end) RAISE(EOF);
+    uint8_t digit = *src++;
+    u |= (uint64_t)(digit & 0x7F) << shift;
+    if ((digit & 0x80) == 0) {
+      *p = (const char*)src;
+      return u;
+    }
+  }
+  RAISE(MALFORMED);
+  return 0;
+}
+
+// Decodes varints of up to 8 bytes by loading a whole word at once, finding the last digit with
+// a bit scan and then squeezing the 7-bit digits together.
+static inline uint64_t read_fast(const char** p, const char* end) {
+  if (end - *p < 8) return read_slow(p, end);
+  uint64_t word;
+  memcpy(&word, *p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  uint64_t stops = ~word & 0x8080808080808080UL;
+  if (!stops) return read_slow(p, end);
+  unsigned len = __builtin_ctzll(stops)/8 + 1;
+  if (len < 8) word &= (1UL << (len*8)) - 1;
+  word = ((word & 0x7F007F007F007F00UL) >> 1) | (word & 0x007F007F007F007FUL);
+  word = ((word & 0x3FFF00003FFF0000UL) >> 2) | (word & 0x00003FFF00003FFFUL);
+  word = ((word & 0x0FFFFFFF00000000UL) >> 4) | (word & 0x000000000FFFFFFFUL);
+  *p += len;
+  return word;
+}
+
+uint64_t varint_read_u64(const char** p, const char* end) {
+  return read_fast(p, end);
+}
+
+size_t varint_encode_u64_array(char* dst, const uint64_t* src, size_t count) {
+  char* p = dst;
+  for (size_t i = 0; i < count; i++) {
+    p += varint_write_u64(p, src[i]);
+  }
+  return p - dst;
+}
+size_t varint_encode_i64_array(char* dst, const int64_t* src, size_t count) {
+  char* p = dst;
+  for (size_t i = 0; i < count; i++) {
+    p += varint_write_u64(p, varint_zigzag(src[i]));
+  }
+  return p - dst;
+}
+
+size_t varint_decode_u64_array(uint64_t* dst, size_t count, const char* src, size_t sz) {
+  const char* p = src;
+  const char* end = src + sz;
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = read_fast(&p, end);
+  }
+  return p - src;
+}
+size_t varint_decode_i64_array(int64_t* dst, size_t count, const char* src, size_t sz) {
+  const char* p = src;
+  const char* end = src + sz;
+  for (size_t i = 0; i < count; i++) {
+    dst[i] = varint_unzigzag(read_fast(&p, end));
+  }
+  return p - src;
+}
+
+/* Stream VByte */
+
+// For every possible control byte: the total data length of its group, and the shuffle that
+// spreads the group's data bytes out into four 32-bit integers.
+static uint8_t svb_group_len[256];
+static uint8_t svb_shuffle[256][16];
+static bool svb_have_ssse3;
+
+static void svb_init() __attribute__((constructor));
+static void svb_init() {
+#ifdef SVB_SSSE3
+  __builtin_cpu_init();
+  svb_have_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+  for (unsigned ctrl = 0; ctrl < 256; ctrl++) {
+    unsigned offset = 0;
+    for (unsigned i = 0; i < 4; i++) {
+      unsigned len = ((ctrl >> (i*2)) & 3) + 1;
+      for (unsigned j = 0; j < 4; j++) {
+        svb_shuffle[ctrl][i*4 + j] = (j < len) ? offset + j : 0x80;
+      }
+      offset += len;
+    }
+    svb_group_len[ctrl] = offset;
+  }
+}
+
+static inline unsigned u32_len(uint32_t v) {
+  return (v < (1U << 8)) ? 1 : (v < (1U << 16)) ? 2 : (v < (1U << 24)) ? 3 : 4;
+}
+
+size_t svb_encode_u32(char* dst, const uint32_t* src, size_t count) {
+  uint8_t* ctrl = (uint8_t*)dst;
+  uint8_t* data = ctrl + (count+3)/4;
+  memset(ctrl, 0, (count+3)/4);
+  for (size_t i = 0; i < count; i++) {
+    uint32_t v = src[i];
+    unsigned len = u32_len(v);
+    ctrl[i/4] |= (len-1) << ((i%4)*2);
+    for (unsigned j = 0; j < len; j++) {
+      data[j] = v >> (j*8);
+    }
+    data += len;
+  }
+  return (char*)data - dst;
+}
+
+#ifdef SVB_SSSE3
+// Decodes whole groups while a full 16-byte load stays within bounds, and returns how many
+// integers were decoded
+__attribute__((target("ssse3")))
+static size_t svb_decode_ssse3(uint32_t* dst, size_t count, const uint8_t* ctrl,
+                               const uint8_t** _data, const uint8_t* end) {
+  const uint8_t* data = *_data;
+  size_t i = 0;
+  for (; i + 4 <= count && end - data >= 16; i += 4) {
+    uint8_t c = ctrl[i/4];
+    __m128i in = _mm_loadu_si128((const __m128i*)data);
+    __m128i shuffle = _mm_loadu_si128((const __m128i*)svb_shuffle[c]);
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(in, shuffle));
+    data += svb_group_len[c];
+  }
+  *_data = data;
+  return i;
+}
+#endif
+
+size_t svb_decode_u32(uint32_t* dst, size_t count, const char* src, size_t sz) {
+  size_t nctrl = (count+3)/4;
+  if (sz < nctrl) RAISE(EOF);
+  const uint8_t* ctrl = (const uint8_t*)src;
+  const uint8_t* data = ctrl + nctrl;
+  const uint8_t* end = (const uint8_t*)src + sz;
+  size_t i = 0;
+
+#ifdef SVB_SSSE3
+  if (svb_have_ssse3) i = svb_decode_ssse3(dst, count, ctrl, &data, end);
+#endif
+
+  for (; i < count; i++) {
+    unsigned len = ((ctrl[i/4] >> ((i%4)*2)) & 3) + 1;
+    if (end - data < len) RAISE(EOF);
+    uint32_t v = 0;
+    for (unsigned j = 0; j < len; j++) {
+      v |= (uint32_t)data[j] << (j*8);
+    }
+    dst[i] = v;
+    data += len;
+  }
+  return (const char*)data - src;
+}
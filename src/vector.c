@@ -1,10 +1,12 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
 #include <vlib/vector.h>
 #include <vlib/error.h>
+#include <vlib/util.h>
 
 void vector_init(Vector* v, size_t elemsz, size_t cap) {
   assert(cap > 0);
@@ -36,6 +38,43 @@ void* vector_push(Vector* v) {
   vector_grow(v, v->size+1);
   return v->_data + (v->size++ * v->elemsz);
 }
+// Raises VERR_NOMEM rather than letting the capacity calculations overflow
+static void check_extend(Vector* v, size_t count) {
+  if (count > SIZE_MAX / 2 / v->elemsz - v->size) RAISE(NOMEM);
+}
+void* vector_extend(Vector* v, size_t count) {
+  check_extend(v, count);
+  vector_grow(v, v->size + count);
+  void* first = v->_data + v->size * v->elemsz;
+  v->size += count;
+  return first;
+}
+
+void vector_init_arena(Vector* v, size_t elemsz, size_t cap, Arena* arena) {
+  assert(cap > 0);
+  v->size = 0;
+  v->elemsz = elemsz;
+  v->_cap = cap;
+  v->_data = arena_alloc(arena, elemsz * cap);
+}
+void* vector_push_arena(Vector* v, Arena* arena) {
+  if (v->size == v->_cap) {
+    v->_data = arena_realloc(arena, v->_data, v->_cap * v->elemsz, v->_cap * 2 * v->elemsz);
+    v->_cap *= 2;
+  }
+  return v->_data + (v->size++ * v->elemsz);
+}
+void* vector_extend_arena(Vector* v, size_t count, Arena* arena) {
+  check_extend(v, count);
+  if (v->size + count > v->_cap) {
+    size_t cap = MAX(v->_cap * 2, v->size + count);
+    v->_data = arena_realloc(arena, v->_data, v->_cap * v->elemsz, cap * v->elemsz);
+    v->_cap = cap;
+  }
+  void* first = v->_data + v->size * v->elemsz;
+  v->size += count;
+  return first;
+}
 
 void vector_pop(Vector* v) {
   assert(v->size > 0);
@@ -0,0 +1,89 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <vlib/test.h>
+#include <vlib/arena.h>
+#include <vlib/error.h>
+
+static int arena_basic() {
+  Arena a[1];
+  arena_init(a, 256);
+  char* p[64];
+  for (int i = 0; i < 64; i++) {
+    p[i] = arena_alloc(a, i + 1);
+    assertTrue(((uintptr_t)p[i] & 15) == 0);
+    memset(p[i], i, i + 1);
+  }
+  for (int i = 0; i < 64; i++) {
+    for (int j = 0; j <= i; j++) assertEqual(p[i][j], i);
+  }
+
+  // Larger than a block
+  char* big = arena_calloc(a, 1000);
+  for (int i = 0; i < 1000; i++) assertEqual(big[i], 0);
+
+  arena_reset(a);
+  // The largest block is kept
+  assertTrue(a->end - a->ptr >= 1000);
+  char* q = arena_memdup(a, "hello", 6);
+  assertTrue(strcmp(q, "hello") == 0);
+  arena_close(a);
+
+  // Nothing to copy, on an arena without a block yet
+  arena_init(a, 256);
+  arena_memdup(a, NULL, 0);
+  arena_close(a);
+  return 0;
+}
+
+static int arena_realloc_in_place() {
+  Arena a[1];
+  arena_init(a, 1024);
+  char* p = arena_alloc(a, 10);
+  memcpy(p, "0123456789", 10);
+  char* q = arena_realloc(a, p, 10, 100);
+  assertTrue(p == q);
+
+  // Not the last allocation, so it is copied
+  arena_alloc(a, 1);
+  char* r = arena_realloc(a, q, 100, 200);
+  assertTrue(r != q);
+  assertTrue(memcmp(r, "0123456789", 10) == 0);
+
+  // Doesn't fit in the block
+  char* s = arena_realloc(a, r, 200, 4096);
+  assertTrue(memcmp(s, "0123456789", 10) == 0);
+  arena_close(a);
+  return 0;
+}
+
+static int arena_alloc_huge() {
+  Arena a[1];
+  arena_init(a, 256);
+  arena_alloc(a, 1);
+  // Sizes that would wrap when aligned or when a block header is added
+  error_t alloc(size_t size) {
+    error_t err = 0;
+    TRY {
+      arena_alloc(a, size);
+    } CATCH(e) {
+      err = e;
+    } ETRY
+    return err;
+  }
+  assertEqual(alloc(SIZE_MAX - 3), VERR_NOMEM);
+  assertEqual(alloc(SIZE_MAX - 20), VERR_NOMEM);
+  char* p = arena_realloc(a, arena_alloc(a, 16), 16, 32);
+  assertTrue(p != NULL);
+  arena_close(a);
+  return 0;
+}
+
+VLIB_SUITE(arena) = {
+  VLIB_TEST(arena_basic),
+  VLIB_TEST(arena_realloc_in_place),
+  VLIB_TEST(arena_alloc_huge),
+  VLIB_END
+};
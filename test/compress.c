@@ -0,0 +1,176 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <vlib/test.h>
+#include <vlib/compress.h>
+
+#if defined(VLIB_ENABLE_ZLIB) || defined(VLIB_ENABLE_LZ4) || defined(VLIB_ENABLE_ZSTD)
+
+static const char* sample = "{\"name\":\"vaughan\",\"age\":20,\"interests\":[\"programming\",\"cats\"]}";
+
+// Compresses `sample` a few times (flushing in between) and checks that it decompresses again.
+static int roundtrip(Output* (*new_output)(Output*, const Bytes*), Input* (*new_input)(Input*, const Bytes*), const Bytes* dict) {
+  Output* strout = string_output_new(256);
+  Output* wrap = unclosable_output_new(strout);
+  Output* out = new_output(wrap, dict);
+  size_t len = strlen(sample);
+  for (int i = 0; i < 100; i++) {
+    io_write(out, sample, len);
+    if (i == 50) io_flush(out);
+  }
+  call(out, close);
+
+  size_t sz;
+  const char* data = string_output_data(strout, &sz);
+  assertTrue(sz < len * 100);
+
+  Input* in = new_input(memory_input_new(data, sz), dict);
+  char* cbuf = malloc(len);
+  for (int i = 0; i < 100; i++) {
+    io_readall(in, cbuf, len);
+    assertTrue(memcmp(cbuf, sample, len) == 0);
+  }
+  assertEqual(io_read(in, cbuf, len), 0);
+  assertTrue(io_eof(in));
+  free(cbuf);
+  call(in, close);
+  unclosable_output_close(wrap);
+  return 0;
+}
+
+// Reads a damaged stream to the end and returns the error it raises
+static error_t read_damaged(Input* (*new_input)(Input*, const Bytes*), const char* data, size_t sz) {
+  Input* in = new_input(memory_input_new(data, sz), NULL);
+  error_t err = 0;
+  TRY {
+    char cbuf[256];
+    while (!io_eof(in)) io_read(in, cbuf, sizeof(cbuf));
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  call(in, close);
+  return err;
+}
+static int damaged(Output* (*new_output)(Output*, const Bytes*), Input* (*new_input)(Input*, const Bytes*)) {
+  Output* strout = string_output_new(256);
+  Output* wrap = unclosable_output_new(strout);
+  Output* out = new_output(wrap, NULL);
+  for (int i = 0; i < 10; i++) io_write(out, sample, strlen(sample));
+  call(out, close);
+
+  size_t sz;
+  char* data = (char*)string_output_data(strout, &sz);
+  assertEqual(read_damaged(new_input, data, sz / 2), VERR_EOF);
+  data[0] ^= 0xFF;
+  assertEqual(read_damaged(new_input, data, sz), VERR_MALFORMED);
+  unclosable_output_close(wrap);
+  return 0;
+}
+
+static Bytes test_dict = {
+  .ptr = "\"name\":\"age\":\"interests\":programming",
+  .size = 35,
+};
+
+#endif
+
+#ifdef VLIB_ENABLE_ZLIB
+
+static Output* new_gzip_output(Output* wrap, const Bytes* dict) {
+  return gzip_output_new(wrap, -1);
+}
+static Input* new_gzip_input(Input* wrap, const Bytes* dict) {
+  return gzip_input_new(wrap);
+}
+static Output* new_zlib_output(Output* wrap, const Bytes* dict) {
+  return zlib_output_new(wrap, 9, dict);
+}
+static int compress_gzip() {
+  return roundtrip(new_gzip_output, new_gzip_input, NULL);
+}
+static int compress_zlib_dict() {
+  return roundtrip(new_zlib_output, zlib_input_new, &test_dict);
+}
+static int compress_zlib_damaged() {
+  return damaged(new_zlib_output, zlib_input_new);
+}
+
+#endif
+
+#ifdef VLIB_ENABLE_LZ4
+
+#include <lz4.h>
+
+static Output* new_lz4_output(Output* wrap, const Bytes* dict) {
+  return lz4_output_new(wrap, 0, dict);
+}
+static Output* new_lz4hc_output(Output* wrap, const Bytes* dict) {
+  return lz4_output_new(wrap, 9, dict);
+}
+static int compress_lz4() {
+  return roundtrip(new_lz4_output, lz4_input_new, NULL);
+}
+static int compress_lz4hc() {
+  return roundtrip(new_lz4hc_output, lz4_input_new, NULL);
+}
+static int compress_lz4_dict() {
+#if LZ4_VERSION_NUMBER >= 11000
+  return roundtrip(new_lz4_output, lz4_input_new, &test_dict);
+#else
+  // Older versions don't export the dictionary functions
+  Input* in = memory_input_new(NULL, 0);
+  error_t err = 0;
+  TRY {
+    lz4_input_new(in, &test_dict);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  call(in, close);
+  assertEqual(err, VERR_ARGUMENT);
+  return 0;
+#endif
+}
+static int compress_lz4_damaged() {
+  return damaged(new_lz4_output, lz4_input_new);
+}
+
+#endif
+
+#ifdef VLIB_ENABLE_ZSTD
+
+static Output* new_zstd_output(Output* wrap, const Bytes* dict) {
+  return zstd_output_new(wrap, 3, dict);
+}
+static int compress_zstd() {
+  return roundtrip(new_zstd_output, zstd_input_new, NULL);
+}
+static int compress_zstd_dict() {
+  return roundtrip(new_zstd_output, zstd_input_new, &test_dict);
+}
+static int compress_zstd_damaged() {
+  return damaged(new_zstd_output, zstd_input_new);
+}
+
+#endif
+
+VLIB_SUITE(compress) = {
+#ifdef VLIB_ENABLE_ZLIB
+  VLIB_TEST(compress_gzip),
+  VLIB_TEST(compress_zlib_dict),
+  VLIB_TEST(compress_zlib_damaged),
+#endif
+#ifdef VLIB_ENABLE_LZ4
+  VLIB_TEST(compress_lz4),
+  VLIB_TEST(compress_lz4hc),
+  VLIB_TEST(compress_lz4_dict),
+  VLIB_TEST(compress_lz4_damaged),
+#endif
+#ifdef VLIB_ENABLE_ZSTD
+  VLIB_TEST(compress_zstd),
+  VLIB_TEST(compress_zstd_dict),
+  VLIB_TEST(compress_zstd_damaged),
+#endif
+  VLIB_END,
+};
@@ -1,4 +1,6 @@
 
+#include <string.h>
+
 #include <vlib/test.h>
 #include <vlib/error.h>
 
@@ -17,8 +19,30 @@ static int error_catch() {
   assertEqual(cleanup, true);
   return 0;
 }
+static int error_finally_keeps_msg() {
+  error_t caught = 0;
+  const char* msg = NULL;
+  TRY {
+    TRY {
+      verr_raisef(1234, "lost %d", 42);
+    } FINALLY {
+      // A cleanup that raises and handles its own error
+      TRY {
+        verr_raise_msg(5678, "cleanup");
+      } CATCH(err) {
+      } ETRY
+    } ETRY
+  } CATCH(err) {
+    caught = err;
+    msg = verr_current_msg();
+  } ETRY
+  assertEqual(caught, 1234);
+  assertTrue(msg && strcmp(msg, "lost 42") == 0);
+  return 0;
+}
 
 VLIB_SUITE(error) = {
   VLIB_TEST(error_catch),
+  VLIB_TEST(error_finally_keeps_msg),
   VLIB_END,
 };
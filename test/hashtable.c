@@ -1,6 +1,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 #include <vlib/test.h>
 #include <vlib/hashtable.h>
@@ -62,7 +63,43 @@ static int hashtable_basic() {
   return 0;
 }
 
+static int hashtable_iter_remove() {
+  Hashtable h;
+  hinit(&h);
+  char key[16];
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "k%d", i);
+    hinsert(&h, key, i);
+  }
+
+  // Removing entries while iterating keeps the rest of each bucket chain
+  int visited = 0;
+  int remove_odd(void* _key, void* val) {
+    visited++;
+    if (*(int*)val % 2 == 0) return HT_CONTINUE;
+    free(*(char**)_key);
+    return HT_REMOVE;
+  }
+  hashtable_iter(&h, remove_odd);
+  assertEqual(visited, 100);
+  assertEqual(h.size, 50);
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "k%d", i);
+    const char* k = key;
+    int* val = hashtable_get(&h, &k);
+    if (i % 2) {
+      assertEqual(val, NULL);
+    } else {
+      assertTrue(val && *val == i);
+    }
+  }
+
+  hclose(&h);
+  return 0;
+}
+
 VLIB_SUITE(hashtable) = {
   VLIB_TEST(hashtable_basic),
+  VLIB_TEST(hashtable_iter_remove),
   VLIB_END,
 };
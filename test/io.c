@@ -4,6 +4,8 @@
 
 #include <vlib/test.h>
 #include <vlib/io.h>
+#include <vlib/buffer.h>
+#include <vlib/thread.h>
 
 static void write_cstr(Output* out, const char* str) {
   unsigned n = strlen(str);
@@ -57,6 +59,57 @@ static int string_io_reset() {
   call(out, close);
   return 0;
 }
+static int string_io_segments() {
+  Output* out = string_output_new(2);
+  write_cstr(out, "Hello World!");
+  assertEqual(string_output_size(out), 12);
+
+  Output* copy = string_output_new(64);
+  unsigned segments = 0;
+  bool count_segment(const char* data, size_t size) {
+    io_write(copy, data, size);
+    segments++;
+    return true;
+  }
+  string_output_segments(out, count_segment);
+  assertTrue(segments > 1);
+
+  struct iovec iov[16];
+  assertEqual(string_output_iovec(out, iov, 16), segments);
+  assertEqual(string_output_iovec(out, iov, 1), segments);
+  assertEqual(iov[0].iov_len, 2);
+
+  size_t sz;
+  const char* result = string_output_data(copy, &sz);
+  assertEqual(sz, 12);
+  assertTrue(memcmp(result, "Hello World!", 12) == 0);
+
+  call(copy, close);
+  call(out, close);
+  return 0;
+}
+static int string_io_rewind() {
+  Output* out = string_output_new(1);
+  write_cstr(out, "Hello 0xF345A00D");
+  string_output_rewind(out, 6);
+  write_cstr(out, "World!");
+  assertEqual(string_output_size(out), 12);
+
+  size_t sz;
+  const char* result = string_output_data(out, &sz);
+  assertEqual(sz, 12);
+  assertTrue(memcmp(result, "Hello World!", 12) == 0);
+
+  // Reuse pieces after a reset
+  string_output_reset(out);
+  write_cstr(out, "Hi");
+  result = string_output_data(out, &sz);
+  assertEqual(sz, 2);
+  assertTrue(memcmp(result, "Hi", 2) == 0);
+
+  call(out, close);
+  return 0;
+}
 static int memory_read() {
   char src[] = "hello\0WORLD";
   Input* in = memory_input_new(src, sizeof(src));
@@ -136,6 +189,105 @@ static int limited_input_unget() {
   return 0;
 }
 
+static int buffered_io() {
+  Output* strout = string_output_new(16);
+  Output* wrap = unclosable_output_new(strout);
+  Output* out = buf_output_new(wrap, 600);
+  write_cstr(out, "Hello ");
+  io_flush(out);
+  write_cstr(out, "World!");
+  call(out, close);
+
+  size_t sz;
+  const char* result = string_output_data(strout, &sz);
+  assertEqual(sz, 12);
+
+  Input* in = buf_input_new(memory_input_new(result, sz), 600);
+  char cbuf[12];
+  io_readall(in, cbuf, sizeof(cbuf));
+  assertTrue(memcmp(cbuf, "Hello World!", 12) == 0);
+  assertTrue(io_eof(in));
+  call(in, close);
+
+  // Bytes from 0x80 up are not confused with the end of the input
+  in = buf_input_new(memory_input_new("\xff\x80", 2), 600);
+  assertEqual(io_get(in), 0xFF);
+  assertEqual(io_get(in), 0x80);
+  assertEqual(io_get(in), -1);
+  call(in, close);
+
+  unclosable_output_close(wrap);
+  return 0;
+}
+// Fails every write, and records whether it was closed
+data(BrokenOutput) {
+  Output  base;
+  bool    closed;
+};
+static void broken_write(void* self, const char* src, size_t n) {
+  RAISE(IO);
+}
+static void broken_close(void* self) {
+  ((BrokenOutput*)self)->closed = true;
+}
+static Output_Impl broken_output_impl = {
+  .write = broken_write,
+  .close = broken_close,
+};
+static int buffered_close_fails() {
+  BrokenOutput broken = {.base._impl = &broken_output_impl};
+  Output* out = buf_output_new(&broken.base, 600);
+  write_cstr(out, "lost");
+  error_t err = 0;
+  TRY {
+    call(out, close);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  // The error is raised, and everything is still closed
+  assertEqual(err, VERR_IO);
+  assertTrue(broken.closed);
+  return 0;
+}
+
+static int buffer_pool() {
+  Buffer* a = buffer_pool_get(600);
+  assertEqual(a->size, 1024);
+  buffer_pool_put(a);
+  Buffer* b = buffer_pool_get(1000);
+  assertTrue(a == b);
+  assertEqual(buffer_avail_read(b), 0);
+
+  buffer_pool_budget(1);
+  Buffer* c = buffer_pool_get(4096);
+  assertEqual(c->size, BUFFER_POOL_MIN);
+  buffer_pool_budget(0);
+
+  buffer_pool_put(b);
+  buffer_pool_put(c);
+
+  // Buffers that did not come from the pool don't count against the budget
+  buffer_pool_put(buffer_new(2048));
+  buffer_pool_budget(1 << 20);
+  Buffer* d = buffer_pool_get(4096);
+  assertEqual(d->size, 4096);
+  buffer_pool_budget(0);
+  buffer_pool_put(d);
+  buffer_pool_trim();
+  return 0;
+}
+// Fills this thread's buffer cache, which is handed to the global pool when the thread exits
+static void* cache_buffers(void* _) {
+  Buffer* bufs[8];
+  for (int i = 0; i < 8; i++) bufs[i] = buffer_pool_get(BUFFER_POOL_MIN);
+  for (int i = 0; i < 8; i++) buffer_pool_put(bufs[i]);
+  return NULL;
+}
+static int buffer_pool_thread_exit() {
+  thread_join(thread_spawn(cache_buffers, NULL));
+  buffer_pool_trim();
+  return 0;
+}
 static int binary_io_utils() {
   Output* out = string_output_new(100);
 
@@ -157,6 +309,46 @@ static int binary_io_utils() {
   call(in, close);
   return 0;
 }
+static int binary_io_arrays() {
+  int64_t i64[1000];
+  int32_t i32[1000];
+  int16_t i16[1000];
+  for (int i = 0; i < 1000; i++) {
+    i64[i] = (int64_t)(0x0102030405060708UL * i);
+    i32[i] = (int32_t)(0x01020304U * i);
+    i16[i] = 0x0102 * i;
+  }
+
+  Output* out = string_output_new(100);
+  io_put_int64_array(out, i64, 1000);
+  io_put_int32_array(out, i32, 1000);
+  io_put_int16_array_le(out, i16, 1000);
+  io_put_int32(out, 0x7890ABCDL);
+
+  size_t sz;
+  const char* data = string_output_data(out, &sz);
+  assertEqual(sz, 1000 * 14 + 4);
+  // Same byte order as the single integer functions
+  assertEqual(data[8*1 + 7], 0x08);
+  assertEqual(data[8*1000 + 4*1 + 3], 0x04);
+  assertEqual(data[12000 + 2*1], 0x02);
+
+  Input* in = memory_input_new(data, sz);
+  int64_t r64[1000];
+  int32_t r32[1000];
+  int16_t r16[1000];
+  io_get_int64_array(in, r64, 1000);
+  io_get_int32_array(in, r32, 1000);
+  io_get_int16_array_le(in, r16, 1000);
+  assertTrue(memcmp(i64, r64, sizeof(i64)) == 0);
+  assertTrue(memcmp(i32, r32, sizeof(i32)) == 0);
+  assertTrue(memcmp(i16, r16, sizeof(i16)) == 0);
+  assertEqual(io_get_int32(in), 0x7890ABCDL);
+
+  call(out, close);
+  call(in, close);
+  return 0;
+}
 static int formatting() {
   Output* out = string_output_new(100);
 
@@ -180,12 +372,19 @@ VLIB_SUITE(io) = {
   VLIB_TEST(string_io_write),
   VLIB_TEST(string_io_put),
   VLIB_TEST(string_io_reset),
+  VLIB_TEST(string_io_segments),
+  VLIB_TEST(string_io_rewind),
   VLIB_TEST(memory_read),
   VLIB_TEST(memory_output),
   VLIB_TEST(memory_rewind),
   VLIB_TEST(limited_input),
   VLIB_TEST(limited_input_unget),
+  VLIB_TEST(buffered_io),
+  VLIB_TEST(buffered_close_fails),
+  VLIB_TEST(buffer_pool),
+  VLIB_TEST(buffer_pool_thread_exit),
   VLIB_TEST(binary_io_utils),
+  VLIB_TEST(binary_io_arrays),
   VLIB_TEST(formatting),
   VLIB_END,
 };
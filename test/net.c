@@ -0,0 +1,32 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vlib/test.h>
+#include <vlib/net.h>
+
+static int tcp_connections() {
+  NetListener* listener = net_listen_tcp("127.0.0.1:0");
+  char addr[32];
+  snprintf(addr, sizeof(addr), "127.0.0.1:%u", net_listener_port(listener));
+  for (int i = 0; i < 10; i++) {
+    // The connection completes in the listen backlog, before it is accepted
+    NetConn* client = net_connect_tcp(addr, NULL);
+    NetConn* server = call(listener, accept);
+    io_writelit(client->output, "ping");
+    call(client->output, flush);
+    char buf[4];
+    io_readall(server->input, buf, sizeof(buf));
+    assertTrue(memcmp(buf, "ping", 4) == 0);
+    call(server, close);
+    call(client, close);
+  }
+  call(listener, close);
+  return 0;
+}
+
+VLIB_SUITE(net) = {
+  VLIB_TEST(tcp_connections),
+  VLIB_END
+};
@@ -1,11 +1,16 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
 
 #include <vlib/test.h>
 #include <vlib/io.h>
 #include <vlib/rich.h>
 #include <vlib/rich_schema.h>
+#include <vlib/hashtable.h>
+#include <vlib/rich_json.h>
+#include <vlib/rich_value.h>
+#include <vlib/util.h>
 
 static void sink_key(rich_Sink* sink, const char* key) {
   Bytes str = {
@@ -25,6 +30,151 @@ static void sink_int(rich_Sink* sink, int64_t ival) {
   call(sink, sink, RICH_INT, &ival);
 }
 
+// Records atoms as text, with floats at full precision
+data(TextSink) {
+  rich_Sink base;
+  Output*   out;
+};
+static void text_printf(Output* out, const char* fmt, ...) {
+  char cbuf[64];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(cbuf, sizeof(cbuf), fmt, ap);
+  va_end(ap);
+  io_writec(out, cbuf);
+}
+static void text_sink_sink(void* _self, rich_Atom atom, void* data) {
+  TextSink* self = _self;
+  Bytes* str = data;
+  switch (atom) {
+    case RICH_NIL:      io_writelit(self->out, "nil "); break;
+    case RICH_BOOL:     text_printf(self->out, "%s ", *(bool*)data ? "true" : "false"); break;
+    case RICH_INT:      text_printf(self->out, "%ld ", *(int64_t*)data); break;
+    case RICH_FLOAT:    text_printf(self->out, "%.17g ", *(double*)data); break;
+    case RICH_STRING:   io_put(self->out, '"'); io_write(self->out, str->ptr, str->size); io_writelit(self->out, "\" "); break;
+    case RICH_ARRAY:    io_writelit(self->out, "[ "); break;
+    case RICH_ENDARRAY: io_writelit(self->out, "] "); break;
+    case RICH_MAP:      io_writelit(self->out, "{ "); break;
+    case RICH_KEY:      io_write(self->out, str->ptr, str->size); io_put(self->out, '='); break;
+    case RICH_ENDMAP:   io_writelit(self->out, "} "); break;
+  }
+}
+static rich_Sink_Impl text_sink_impl = {
+  .sink = text_sink_sink,
+  .close = null_close,
+};
+static bool read_text(rich_Source* source, const char* expect) {
+  TextSink sink = {
+    .base._impl = &text_sink_impl,
+    .out = string_output_new(256),
+  };
+  bool ok = false;
+  TRY {
+    call(source, read_value, &sink.base);
+    size_t size;
+    const char* text = string_output_data(sink.out, &size);
+    ok = size == strlen(expect) && memcmp(text, expect, size) == 0;
+    if (!ok) printf("got: %s\n", text);
+  } FINALLY {
+    call(sink.out, close);
+  } ETRY
+  return ok;
+}
+
+// Returns at most three bytes per read
+data(TrickleInput) {
+  Input       base;
+  Input*      in;
+};
+static size_t trickle_read(void* _self, char* dst, size_t n) {
+  TrickleInput* self = _self;
+  return io_read(self->in, dst, MIN(n, 3));
+}
+static void trickle_close(void* _self) {
+  TrickleInput* self = _self;
+  call(self->in, close);
+  free(self);
+}
+static Input_Impl trickle_impl = {
+  .read = trickle_read,
+  .close = trickle_close,
+};
+static Input* trickle_input_new(Input* in) {
+  TrickleInput* self = malloc(sizeof(TrickleInput));
+  self->base._impl = &trickle_impl;
+  self->in = in;
+  return &self->base;
+}
+
+static int json_decode() {
+  const char* json = "{\"a\": [1, -2, 3.25, 1e-3, 0.1, 123456789012345678901, -9223372036854775808,\n"
+    "  2.2250738585072014e-308], \"s\": \"x\\u00e9\\ud83d\\ude00\\\"y\", \"t\": true, \"n\": null} 42";
+  const char* expect = "{ a=[ 1 -2 3.25 0.001 0.10000000000000001 1.2345678901234568e+20 -9223372036854775808 "
+    "2.2250738585072014e-308 ] s=\"x\xc3\xa9\xf0\x9f\x98\x80\"y\" t=true n=nil } ";
+
+  // From memory, a few bytes at a time, and from a buffered input that is filled a few bytes at a
+  // time
+  for (int mode = 0; mode < 3; mode++) {
+    Input* in = memory_input_new(json, strlen(json));
+    if (mode >= 1) in = trickle_input_new(in);
+    if (mode == 2) in = buf_input_new(in, 512);
+    rich_Source* source = call(rich_codec_json, new_source, in);
+    assertTrue(read_text(source, expect));
+    assertTrue(read_text(source, "42 "));
+    error_t err = 0;
+    TRY {
+      read_text(source, "");
+    } CATCH(e) {
+      err = e;
+    } ETRY
+    assertEqual(err, VERR_EOF);
+    call(source, close);
+  }
+  return 0;
+}
+static int json_decode_leaves_rest() {
+  const char* data = "[1, \"two\"] {\"a\": 3}\nrest";
+  Input* in = buf_input_new(trickle_input_new(memory_input_new(data, strlen(data))), 512);
+  rich_Source* source = call(rich_codec_json, new_source, in);
+  assertTrue(read_text(source, "[ 1 \"two\" ] "));
+  assertTrue(read_text(source, "{ a=3 } "));
+
+  // A buffered input is only read up to the end of the last value
+  char rest[8];
+  size_t n = 0, r;
+  while ((r = io_read(in, rest + n, sizeof(rest) - n)) > 0) n += r;
+  assertEqual(n, 5);
+  assertTrue(memcmp(rest, "\nrest", 5) == 0);
+  call(source, close);
+  return 0;
+}
+
+static int json_decode_deep() {
+  // Arrays nested up to the limit, one level deeper, and far deeper than the stack could take
+  error_t read_nested(size_t depth) {
+    char* data = malloc(2 * depth);
+    memset(data, '[', depth);
+    memset(data + depth, ']', depth);
+    rich_Source* source = call(rich_codec_json, new_source, memory_input_new(data, 2 * depth));
+    char dummy;
+    rich_Sink* sink = rich_bind_sink(rich_schema_discard, &dummy);
+    error_t err = 0;
+    TRY {
+      call(source, read_value, sink);
+    } CATCH(e) {
+      err = e;
+    } ETRY
+    call(sink, close);
+    call(source, close);
+    free(data);
+    return err;
+  }
+  assertEqual(read_nested(RICH_MAX_DEPTH), 0);
+  assertEqual(read_nested(RICH_MAX_DEPTH + 1), VERR_MALFORMED);
+  assertEqual(read_nested(2000000), VERR_MALFORMED);
+  return 0;
+}
+
 static int json_encode() {
   Output* out = string_output_new(256);
   rich_Sink* sink = call(rich_codec_json, new_sink, out);
@@ -51,6 +201,427 @@ static int json_encode() {
   return 0;
 }
 
+static int json_encode_values() {
+  Output* out = string_output_new(256);
+  rich_Sink* sink = call(rich_codec_json, new_sink, out);
+  double floats[] = {0.1, 20, -0.0, 1e300, 1.0/3, 5e-324, NAN};
+  call(sink, sink, RICH_ARRAY, NULL);
+    for (unsigned i = 0; i < sizeof(floats)/sizeof(floats[0]); i++) {
+      call(sink, sink, RICH_FLOAT, &floats[i]);
+    }
+    sink_int(sink, INT64_MIN);
+    sink_int(sink, 1234567890);
+    sink_string(sink, "a/b \x01 caf\xc3\xa9");
+    call(sink, sink, RICH_MAP, NULL);
+      sink_key(sink, "x");
+      call(sink, sink, RICH_ARRAY, NULL);
+      call(sink, sink, RICH_ENDARRAY, NULL);
+      sink_key(sink, "y");
+      call(sink, sink, RICH_MAP, NULL);
+      call(sink, sink, RICH_ENDMAP, NULL);
+    call(sink, sink, RICH_ENDMAP, NULL);
+  call(sink, sink, RICH_ENDARRAY, NULL);
+
+  const char* expect = "[0.1,20.0,-0.0,1e+300,0.3333333333333333,5e-324,null,"
+    "-9223372036854775808,1234567890,\"a\\/b \\u0001 caf\xc3\xa9\",{\"x\":[],\"y\":{}}]";
+  size_t size;
+  const char* result = string_output_data(out, &size);
+  assertEqual(size, strlen(expect));
+  assertTrue(memcmp(expect, result, size) == 0);
+
+  // Floats read back exactly
+  Input* in = memory_input_new(result, size);
+  rich_Source* source = call(rich_codec_json, new_source, in);
+  assertTrue(read_text(source, "[ 0.10000000000000001 20 -0 1.0000000000000001e+300 0.33333333333333331 "
+    "4.9406564584124654e-324 nil -9223372036854775808 1234567890 \"a/b \x01 caf\xc3\xa9\" { x=[ ] y={ } } ] "));
+
+  call(source, close);
+  call(sink, close);
+  return 0;
+}
+
+static int json_doc() {
+  const char* json = "{\"skip\": {\"deep\": [1, [2, {\"x\": \"}\"}]]}, \"na\\u006de\": \"a\\tb\","
+    " \"list\": [10, 2.5, \"s\", null, true], \"n\": 12345678901234567890}";
+  rich_JSONDoc* doc = rich_json_parse(json, strlen(json));
+  rich_JSONCursor root = rich_json_root(doc), c, list;
+  assertEqual(rich_json_type(root), RICH_MAP);
+  assertEqual(rich_json_length(root), 4);
+
+  // Escaped keys and values are decoded
+  assertTrue(rich_json_find_key(root, "name", &c));
+  Bytes str = rich_json_get_string(c);
+  assertTrue(str.size == 3 && memcmp(str.ptr, "a\tb", 3) == 0);
+  // The key comes right before its value
+  rich_JSONCursor key = {.doc = doc, .index = c.index - 1};
+  assertEqual(rich_json_type(key), RICH_STRING);
+  str = rich_json_get_string(key);
+  assertTrue(str.size == 4 && memcmp(str.ptr, "name", 4) == 0);
+  assertFalse(rich_json_find_key(root, "deep", &c));
+
+  assertTrue(rich_json_find_key(root, "list", &list));
+  assertEqual(rich_json_length(list), 5);
+  assertTrue(rich_json_array_at(list, 0, &c));
+  assertEqual(rich_json_get_int(c), 10);
+  assertTrue(rich_json_array_at(list, 1, &c));
+  assertEqual(rich_json_get_float(c), 2.5);
+  assertTrue(rich_json_array_at(list, 4, &c));
+  assertEqual(rich_json_get_bool(c), true);
+  assertFalse(rich_json_array_at(list, 5, &c));
+
+  // Values of the wrong type
+  error_t err = 0;
+  TRY {
+    rich_json_get_int(c);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  assertTrue(rich_json_find_key(root, "n", &c));
+  assertEqual(rich_json_get_float(c), 12345678901234567890.0);
+
+  // Subtrees can be replayed into a sink
+  assertTrue(rich_json_find_key(root, "skip", &c));
+  Output* out = string_output_new(64);
+  rich_Sink* sink = call(rich_codec_json, new_sink, out);
+  rich_json_replay(c, sink);
+  size_t size;
+  const char* result = string_output_data(out, &size);
+  const char* expect = "{\"deep\":[1,[2,{\"x\":\"}\"}]]}";
+  assertEqual(size, strlen(expect));
+  assertTrue(memcmp(result, expect, size) == 0);
+  call(sink, close);
+
+  int count = 0;
+  bool each(const Bytes* key, rich_JSONCursor value) {
+    count++;
+    return memcmp(key->ptr, "list", 4) != 0;
+  }
+  rich_json_each(root, each);
+  assertEqual(count, 3);
+  rich_json_doc_close(doc);
+
+  const char* bad[] = {"[1,", "{\"a\" 1}", "[1] 2", "\"abc", "[nul]"};
+  for (unsigned i = 0; i < sizeof(bad)/sizeof(bad[0]); i++) {
+    err = 0;
+    TRY {
+      rich_json_doc_close(rich_json_parse(bad[i], strlen(bad[i])));
+    } CATCH(e) {
+      err = e;
+    } ETRY
+    assertEqual(err, VERR_MALFORMED);
+  }
+
+  // Nesting is limited
+  char deep[2*RICH_MAX_DEPTH + 2];
+  memset(deep, '[', RICH_MAX_DEPTH);
+  memset(deep + RICH_MAX_DEPTH, ']', RICH_MAX_DEPTH);
+  doc = rich_json_parse(deep, 2*RICH_MAX_DEPTH);
+  assertEqual(rich_json_length(rich_json_root(doc)), 1);
+  rich_json_doc_close(doc);
+  memset(deep, '[', RICH_MAX_DEPTH + 1);
+  memset(deep + RICH_MAX_DEPTH + 1, ']', RICH_MAX_DEPTH + 1);
+  err = 0;
+  TRY {
+    rich_json_doc_close(rich_json_parse(deep, sizeof(deep)));
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  return 0;
+}
+
+static int json_parser() {
+  const char* json = "{\"a\\\"b\": [1, -2.5e3, \"x\\u00e9y\", true, false, null, [], {}],\n"
+    " \"c\": {\"d\": \"\"}} [123] 42";
+  const char* expect = "{ a\"b=[ 1 -2500 \"x\xc3\xa9y\" true false nil [ ] { } ] c={ d=\"\" } } [ 123 ] 42 ";
+  size_t len = strlen(json);
+
+  // Split the input at every position, and also feed it one byte at a time
+  for (size_t split = 0; split <= len + 1; split++) {
+    TextSink sink = {
+      .base._impl = &text_sink_impl,
+      .out = string_output_new(256),
+    };
+    rich_JSONParser* parser = rich_json_parser_new(&sink.base);
+    size_t done = 0;
+    if (split <= len) {
+      done += rich_json_parser_feed(parser, json, split);
+      done += rich_json_parser_feed(parser, json + split, len - split);
+    } else {
+      for (size_t i = 0; i < len; i++) {
+        done += rich_json_parser_feed(parser, json + i, 1);
+      }
+    }
+    assertEqual(done, 2);
+    assertEqual(rich_json_parser_finish(parser), 1);
+
+    size_t size;
+    const char* text = string_output_data(sink.out, &size);
+    assertEqual(size, strlen(expect));
+    assertTrue(memcmp(text, expect, size) == 0);
+    rich_json_parser_close(parser);
+    call(sink.out, close);
+  }
+
+  // Incomplete and invalid input, which stop after the atoms before the error
+  TextSink sink = {
+    .base._impl = &text_sink_impl,
+    .out = string_output_new(256),
+  };
+  size_t size;
+  const char* text;
+  rich_JSONParser* parser = rich_json_parser_new(&sink.base);
+  error_t err = 0;
+  rich_json_parser_feed(parser, "[\"abc", 5);
+  TRY {
+    rich_json_parser_finish(parser);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_EOF);
+  text = string_output_data(sink.out, &size);
+  assertTrue(size == 2 && memcmp(text, "[ ", 2) == 0);
+
+  rich_json_parser_reset(parser);
+  string_output_reset(sink.out);
+  err = 0;
+  TRY {
+    rich_json_parser_feed(parser, "[1 2]", 5);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  text = string_output_data(sink.out, &size);
+  assertTrue(size == 4 && memcmp(text, "[ 1 ", 4) == 0);
+  rich_json_parser_close(parser);
+  call(sink.out, close);
+
+  // Strings are copied by a borrowing schema, since chunks and the parser's buffers are reused
+  Bytes str = {};
+  rich_Sink* bound = rich_bind_sink(rich_schema_borrowed, &str);
+  parser = rich_json_parser_new(bound);
+  char chunk[] = "\"hello\" \"wo";
+  rich_json_parser_feed(parser, chunk, 8);
+  memset(chunk, 'x', 8);
+  assertTrue(str.size == 5 && memcmp(str.ptr, "hello", 5) == 0);
+  rich_json_parser_feed(parser, chunk + 8, 3);
+  rich_json_parser_feed(parser, "rld\" ", 5);
+  rich_json_parser_feed(parser, "\"again\" ", 8);
+  assertTrue(str.size == 5 && memcmp(str.ptr, "again", 5) == 0);
+  rich_json_parser_close(parser);
+  call(bound, close);
+  return 0;
+}
+
+// Sums every integer it receives
+data(SumSink) {
+  rich_Sink base;
+  int64_t   sum;
+};
+static int sum_sinks_open;
+static void sum_sink_sink(void* _self, rich_Atom atom, void* data) {
+  SumSink* self = _self;
+  if (atom == RICH_INT) self->sum += *(int64_t*)data;
+}
+static void sum_sink_close(void* _self) {
+  __atomic_sub_fetch(&sum_sinks_open, 1, __ATOMIC_SEQ_CST);
+  free(_self);
+}
+static rich_Sink_Impl sum_sink_impl = {
+  .sink = sum_sink_sink,
+  .close = sum_sink_close,
+};
+
+static int json_ndjson() {
+  Output* out = string_output_new(4096);
+  int64_t expect_sum = 0;
+  for (int i = 0; i < 10000; i++) {
+    char line[64];
+    snprintf(line, sizeof(line), "{\"i\": %d, \"s\": \"line\"}\n", i);
+    io_writec(out, line);
+    if (i % 100 == 0) io_writelit(out, "  \n");
+    expect_sum += i;
+  }
+  size_t size;
+  const char* data = string_output_data(out, &size);
+
+  rich_NDJSONReader* reader = rich_ndjson_reader_new(4, 1000);
+  size_t next_chunk = 0;
+  int64_t sum = 0;
+  bool in_order = true;
+  size_t fail_chunk = SIZE_MAX, stop_chunk = SIZE_MAX;
+  rich_Sink* open_chunk(size_t chunk) {
+    if (chunk == fail_chunk) verr_raisef(VERR_STATE, "chunk %zu", chunk);
+    __atomic_add_fetch(&sum_sinks_open, 1, __ATOMIC_SEQ_CST);
+    SumSink* sink = malloc(sizeof(SumSink));
+    sink->base._impl = &sum_sink_impl;
+    sink->sum = 0;
+    return &sink->base;
+  }
+  void chunk_done(size_t chunk, rich_Sink* sink) {
+    if (chunk != next_chunk++) in_order = false;
+    sum += ((SumSink*)sink)->sum;
+    call(sink, close);
+    if (chunk == stop_chunk) RAISE(INTERRUPT);
+  }
+  assertEqual(rich_ndjson_decode(reader, data, size, open_chunk, chunk_done), 10000);
+  assertTrue(in_order);
+  assertTrue(next_chunk > 100);
+  assertEqual(sum, expect_sum);
+
+  // Errors are raised once every chunk is done
+  const char* bad = "1\n2\n3 4\n5\n";
+  next_chunk = 0;
+  error_t err = 0;
+  TRY {
+    rich_ndjson_decode(reader, bad, strlen(bad), open_chunk, chunk_done);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+
+  // A chunk whose sink can't be opened is not delivered, and its error keeps its message
+  next_chunk = 0;
+  fail_chunk = 3;
+  const char* msg = NULL;
+  err = 0;
+  TRY {
+    rich_ndjson_decode(reader, data, size, open_chunk, chunk_done);
+  } CATCH(e) {
+    err = e;
+    msg = verr_current_msg();
+  } ETRY
+  assertEqual(err, VERR_STATE);
+  assertTrue(msg && strcmp(msg, "chunk 3") == 0);
+  assertEqual(sum_sinks_open, 0);
+
+  // An error from chunk_done stops the decoding, and the other sinks are closed
+  next_chunk = 0;
+  fail_chunk = SIZE_MAX;
+  stop_chunk = 5;
+  err = 0;
+  TRY {
+    rich_ndjson_decode(reader, data, size, open_chunk, chunk_done);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_INTERRUPT);
+  assertEqual(next_chunk, 6);
+  assertEqual(sum_sinks_open, 0);
+
+  rich_ndjson_reader_close(reader);
+  call(out, close);
+  return 0;
+}
+
+static int binary_roundtrip() {
+  Output* out = string_output_new(256);
+  rich_Sink* sink = call(rich_codec_binary, new_sink, out);
+  bool bval = true;
+  double fval = -1.5e300;
+  call(sink, sink, RICH_MAP, NULL);
+    sink_key(sink, "name");
+    sink_string(sink, "Vaughan\tNewton\r\n");
+    sink_key(sink, "age");
+    sink_int(sink, -20);
+    sink_key(sink, "big");
+    sink_int(sink, INT64_MAX);
+    sink_key(sink, "ok");
+    call(sink, sink, RICH_BOOL, &bval);
+    sink_key(sink, "ratio");
+    call(sink, sink, RICH_FLOAT, &fval);
+    sink_key(sink, "interests");
+    call(sink, sink, RICH_ARRAY, NULL);
+      sink_string(sink, "");
+      call(sink, sink, RICH_NIL, NULL);
+      call(sink, sink, RICH_ARRAY, NULL);
+      call(sink, sink, RICH_ENDARRAY, NULL);
+    call(sink, sink, RICH_ENDARRAY, NULL);
+  call(sink, sink, RICH_ENDMAP, NULL);
+
+  size_t size;
+  const char* data = string_output_data(out, &size);
+  // The small integer takes a tag byte and a single varint byte
+  assertEqual(data[1 + 1 + 1 + 4 + 1 + 1 + 16 + 1 + 1 + 3], 3);
+  assertEqual(data[1 + 1 + 1 + 4 + 1 + 1 + 16 + 1 + 1 + 3 + 1], 39);
+
+  // Decode the binary data back into JSON
+  Input* in = memory_input_new(data, size);
+  rich_Source* source = call(rich_codec_binary, new_source, in);
+  Output* jout = string_output_new(256);
+  rich_Sink* jsink = call(rich_codec_json, new_sink, jout);
+  call(source, read_value, jsink);
+
+  const char* expect = "{\"name\":\"Vaughan\\tNewton\\r\\n\",\"age\":-20,\"big\":9223372036854775807,"
+    "\"ok\":true,\"ratio\":-1.5e+300,\"interests\":[\"\",null,[]]}";
+  size_t jsize;
+  const char* json = string_output_data(jout, &jsize);
+  assertEqual(jsize, strlen(expect));
+  assertTrue(memcmp(expect, json, jsize) == 0);
+
+  // There is nothing left to read
+  error_t err = 0;
+  TRY {
+    call(source, read_value, jsink);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_EOF);
+
+  call(source, close);
+  call(jsink, close);
+  call(sink, close);
+  return 0;
+}
+
+static error_t read_binary_from(Input* in) {
+  rich_Source* source = call(rich_codec_binary, new_source, in);
+  char dummy;
+  rich_Sink* sink = rich_bind_sink(rich_schema_discard, &dummy);
+  error_t err = 0;
+  TRY {
+    call(source, read_value, sink);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  call(sink, close);
+  call(source, close);
+  return err;
+}
+static error_t read_binary(const char* data, size_t size) {
+  return read_binary_from(memory_input_new(data, size));
+}
+static int binary_hostile() {
+  // A string (tag 5) claiming to be 2^56 bytes long
+  const char huge[] = "\x05\x80\x80\x80\x80\x80\x80\x80\x80\x01" "abc";
+  assertEqual(read_binary(huge, sizeof(huge) - 1), VERR_EOF);
+
+  // Arrays (tag 6, ended by tag 7) nested up to the limit, and then one level deeper
+  char deep[2 * RICH_MAX_DEPTH + 2];
+  memset(deep, 6, RICH_MAX_DEPTH);
+  memset(deep + RICH_MAX_DEPTH, 7, RICH_MAX_DEPTH);
+  assertEqual(read_binary(deep, 2 * RICH_MAX_DEPTH), 0);
+  memset(deep, 6, RICH_MAX_DEPTH + 1);
+  memset(deep + RICH_MAX_DEPTH + 1, 7, RICH_MAX_DEPTH + 1);
+  assertEqual(read_binary(deep, sizeof(deep)), VERR_MALFORMED);
+
+  // Packed arrays (tag 11) of int64 (type 0) whose size overflows, or which claim more elements
+  // than the input holds
+  const char overflow[] = "\x0b\x00\x80\x80\x80\x80\x80\x80\x80\x80\x40";
+  assertEqual(read_binary(overflow, sizeof(overflow) - 1), VERR_MALFORMED);
+  const char truncated[] = "\x0b\x00\x80\x80\x80\x80\x80\x80\x80\x80\x01\x01\x00\x00\x00\x00\x00\x00\x00";
+  assertEqual(read_binary(truncated, sizeof(truncated) - 1), VERR_EOF);
+
+  // Other inputs can't tell how much is left, so huge counts run into the end of the input: 2^60+1
+  // int64s, whose size doubled wraps around, and 2^64-1 bytes (type 3)
+  const char wraps[] = "\x0b\x00\x81\x80\x80\x80\x80\x80\x80\x80\x10\x01\x00\x00\x00\x00\x00\x00\x00";
+  assertEqual(read_binary_from(buf_input_new(memory_input_new(wraps, sizeof(wraps) - 1), 4)), VERR_EOF);
+  const char bytes[] = "\x0b\x03\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01" "abc";
+  assertEqual(read_binary_from(buf_input_new(memory_input_new(bytes, sizeof(bytes) - 1), 4)), VERR_EOF);
+  return 0;
+}
+
 data(Person) {
   Bytes   name;
   int64_t age;
@@ -115,6 +686,23 @@ static int struct_schema_decode() {
   assertTrue(bytes_compare(&interest, vector_get(p.interests, 0)) == 0);
   bytes_ccopy(&interest, "treason");
   assertTrue(bytes_compare(&interest, vector_get(p.interests, 1)) == 0);
+  call(source, close);
+
+  // The sink can be reused after a value fails to decode halfway through
+  const char* bad = "{\"age\":9,\"interests\":[\"mice\",7]}";
+  source = call(rich_codec_json, new_source, memory_input_new(bad, strlen(bad)));
+  error_t err = 0;
+  TRY {
+    call(source, read_value, sink);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  call(source, close);
+  source = call(rich_codec_json, new_source, memory_input_new(json, strlen(json)));
+  call(source, read_value, sink);
+  assertEqual(p.age, 8);
+  assertEqual(p.interests->size, 2);
 
   call(source, close);
   call(sink, close);
@@ -123,9 +711,941 @@ static int struct_schema_decode() {
   return 0;
 }
 
+// Nested structs with a missing field, vectors and hashtables through the generic path
+data(Squad) {
+  Person      lead;
+  int64_t     wins;
+  Hashtable   ranks[1];
+};
+static int nested_schema_roundtrip() {
+  rich_Schema* schema = rich_schema_struct(sizeof(Squad));
+  RICH_ADD_FIELD(schema, Squad, lead, person_schema());
+  RICH_ADD_FIELD(schema, Squad, wins, rich_schema_optional(rich_schema_int64));
+  RICH_ADD_FIELD(schema, Squad, ranks, rich_schema_hashtable(rich_schema_int64));
+  schema = rich_schema_unclosable(schema);
+
+  const char* json = "{\"ranks\":{\"a\":1},"
+    "\"lead\":{\"name\":\"seth\",\"interests\":[\"mice\"],\"age\":8,\"is_criminal\":true}}";
+  Input* in = memory_input_new(json, strlen(json));
+  rich_Source* source = call(rich_codec_json, new_source, in);
+  Squad squad = {};
+  rich_Sink* bound_sink = rich_bind_sink(schema, &squad);
+  call(source, read_value, bound_sink);
+  call(source, close);
+  assertEqual(squad.lead.age, 8);
+  assertEqual(squad.ranks->size, 1);
+
+  Output* out = string_output_new(256);
+  rich_Sink* sink = call(rich_codec_json, new_sink, out);
+  source = rich_bind_source(schema, &squad);
+  call(source, read_value, sink);
+  const char* expect = "{\"lead\":{\"name\":\"seth\",\"age\":8,\"is_criminal\":true,\"interests\":[\"mice\"]},"
+    "\"wins\":0,\"ranks\":{\"a\":1}}";
+  size_t size;
+  const char* result = string_output_data(out, &size);
+  assertEqual(size, strlen(expect));
+  assertTrue(memcmp(result, expect, size) == 0);
+  call(source, close);
+  call(sink, close);
+
+  call(bound_sink, close);
+  rich_schema_close(schema);
+  return 0;
+}
+
+static int struct_schema_keys() {
+  rich_Schema* s = rich_schema_struct(2 * sizeof(int64_t));
+  rich_add_cfield(s, "plain", 0, rich_schema_int64);
+  rich_add_cfield(s, "quo\"ted", sizeof(int64_t), rich_schema_int64);
+  rich_Schema* schema = rich_schema_unclosable(s);
+
+  size_t count;
+  const rich_Field* table = rich_schema_field_table(schema, &count);
+  assertEqual(count, 2);
+  assertEqual(table[1].offset, sizeof(int64_t));
+  assertEqual(table[1].key.json.size, 11);
+  assertTrue(memcmp(table[1].key.json.ptr, "\"quo\\\"ted\":", 11) == 0);
+  assertEqual(table[0].key.binary.size, 7);
+  assertTrue(memcmp(table[0].key.binary.ptr, "\x09\x05plain", 7) == 0);
+
+  int64_t value[2] = {1, -2};
+  rich_Source* source = rich_bind_source(schema, value);
+  // Sinks that take precomputed keys
+  Output* out = string_output_new(64);
+  rich_Sink* sink = call(rich_codec_json, new_sink, out);
+  call(source, read_value, sink);
+  call(source, read_value, sink);
+  size_t size;
+  const char* json = string_output_data(out, &size);
+  const char* expect = "{\"plain\":1,\"quo\\\"ted\":-2}{\"plain\":1,\"quo\\\"ted\":-2}";
+  assertEqual(size, strlen(expect));
+  assertTrue(memcmp(json, expect, size) == 0);
+  call(sink, close);
+  // And those that don't
+  assertTrue(read_text(source, "{ plain=1 quo\"ted=-2 } "));
+
+  call(source, close);
+  rich_schema_close(schema);
+  return 0;
+}
+
+static int struct_schema_wide() {
+  enum { N = 150 };
+  char names[N][8];
+  rich_Schema* wide = rich_schema_struct(N * sizeof(int64_t));
+  for (int i = 0; i < N; i++) {
+    snprintf(names[i], sizeof(names[i]), "f%d", i);
+    rich_add_cfield(wide, names[i], i * sizeof(int64_t), rich_schema_int64);
+  }
+  rich_Schema* schema = rich_schema_unclosable(wide);
+  for (int i = 0; i < N; i++) {
+    Bytes name = {.ptr = names[i], .size = strlen(names[i])};
+    assertEqual(rich_schema_field_index(schema, &name), i);
+  }
+  Bytes missing = {.ptr = "f150", .size = 4};
+  assertEqual(rich_schema_field_index(schema, &missing), -1);
+
+  // Decode the fields in order, then in a scrambled order
+  int64_t values[N];
+  rich_Sink* sink = rich_bind_sink(schema, values);
+  for (int pass = 0; pass < 2; pass++) {
+    call(sink, sink, RICH_MAP, NULL);
+    for (int j = 0; j < N; j++) {
+      int i = pass ? (j * 7) % N : j;
+      sink_key(sink, names[i]);
+      sink_int(sink, i * 3 + pass);
+    }
+    call(sink, sink, RICH_ENDMAP, NULL);
+    for (int i = 0; i < N; i++) {
+      assertEqual(values[i], i * 3 + pass);
+    }
+  }
+  call(sink, close);
+  rich_schema_close(schema);
+  return 0;
+}
+
+data(Team) {
+  Person      lead;
+  Person*     deputy;
+  double      score;
+  Hashtable   ranks[1];
+};
+static rich_Schema* team_schema() {
+  rich_Schema* s = rich_schema_struct(sizeof(Team));
+  RICH_ADD_FIELD(s, Team, lead, person_schema());
+  RICH_ADD_FIELD(s, Team, deputy, rich_schema_pointer(person_schema()));
+  RICH_ADD_FIELD(s, Team, score, rich_schema_double);
+  RICH_ADD_FIELD(s, Team, ranks, rich_schema_hashtable(rich_schema_int64));
+  return s;
+}
+
+static int compiled_schema() {
+  rich_Schema* schema = rich_schema_unclosable(team_schema());
+  rich_Compiled* compiled = rich_schema_compile(schema);
+
+  const char* json =
+    "{\"lead\":{\"name\":\"seth\",\"age\":8,\"is_criminal\":true,\"interests\":[\"mice\",\"tre\\\"ason\"]},"
+    "\"deputy\":{\"name\":\"vaughan\",\"age\":20,\"is_criminal\":false,\"interests\":[]},"
+    "\"score\":0.1,\"ranks\":{\"a\":1,\"b\":-2}}";
+  Input* in = memory_input_new(json, strlen(json));
+  rich_Source* json_source = call(rich_codec_json, new_source, in);
+  Team t = {};
+  rich_Sink* bound_sink = rich_bind_sink(schema, &t);
+  call(json_source, read_value, bound_sink);
+
+  // Encoders match the generic path
+  bool same_output(rich_Codec* codec, void (*encode)(rich_Compiled*, void*, Output*), void* value) {
+    Output* generic = string_output_new(256);
+    rich_Sink* sink = call(codec, new_sink, generic);
+    rich_Source* source = rich_bind_source(schema, value);
+    call(source, read_value, sink);
+    Output* direct = string_output_new(256);
+    encode(compiled, value, direct);
+    size_t gsize, dsize;
+    const char* gdata = string_output_data(generic, &gsize);
+    const char* ddata = string_output_data(direct, &dsize);
+    bool same = gsize == dsize && memcmp(gdata, ddata, gsize) == 0;
+    call(source, close);
+    call(sink, close);
+    call(direct, close);
+    return same;
+  }
+  assertTrue(same_output(rich_codec_json, rich_compiled_encode_json, &t));
+  assertTrue(same_output(rich_codec_binary, rich_compiled_encode_binary, &t));
+
+  // Decoding the binary encoding gives the same value back
+  Output* bin = string_output_new(256);
+  rich_compiled_encode_binary(compiled, &t, bin);
+  size_t binsz;
+  const char* bindata = string_output_data(bin, &binsz);
+  Team u = {};
+  Input* bin_in = memory_input_new(bindata, binsz);
+  rich_compiled_decode_binary(compiled, bin_in, &u);
+  call(bin_in, close);
+
+  assertEqual(u.lead.age, 8);
+  assertEqual(u.lead.is_criminal, true);
+  assertEqual(u.lead.interests->size, 2);
+  assertEqual(u.deputy->age, 20);
+  assertEqual(u.deputy->name.size, 7);
+  assertTrue(memcmp(u.deputy->name.ptr, "vaughan", 7) == 0);
+  assertEqual(u.deputy->interests->size, 0);
+  assertTrue(u.score == 0.1);
+  assertEqual(u.ranks->size, 2);
+  Bytes key = {.ptr = "b", .size = 1};
+  assertEqual(*(int64_t*)hashtable_get(u.ranks, &key), -2);
+  assertTrue(same_output(rich_codec_json, rich_compiled_encode_json, &u));
+
+  // Unknown fields are skipped by a lenient decoder
+  Output* extra = string_output_new(256);
+  rich_Sink* extra_sink = call(rich_codec_binary, new_sink, extra);
+  call(extra_sink, sink, RICH_MAP, NULL);
+  sink_key(extra_sink, "unknown");
+  call(extra_sink, sink, RICH_ARRAY, NULL);
+  sink_int(extra_sink, 1);
+  call(extra_sink, sink, RICH_ENDARRAY, NULL);
+  sink_key(extra_sink, "score");
+  double score = 2.5;
+  call(extra_sink, sink, RICH_FLOAT, &score);
+  call(extra_sink, sink, RICH_ENDMAP, NULL);
+  bindata = string_output_data(extra, &binsz);
+  bin_in = memory_input_new(bindata, binsz);
+  rich_compiled_set_lenient(compiled, true);
+  rich_compiled_decode_binary(compiled, bin_in, &u);
+  rich_compiled_set_lenient(compiled, false);
+  call(bin_in, close);
+  assertTrue(u.score == 2.5);
+
+  // Hostile input: an unknown field (a map, tag 8, with key "x", tag 9) holding arrays (tag 6)
+  // nested too deeply, and a key claiming to be 2^56 bytes long
+  bool decode_fails(const char* data, size_t size, error_t expect) {
+    bin_in = memory_input_new(data, size);
+    error_t err = 0;
+    TRY {
+      rich_compiled_decode_binary(compiled, bin_in, &u);
+    } CATCH(e) {
+      err = e;
+    } FINALLY {
+      call(bin_in, close);
+    } ETRY
+    return err == expect;
+  }
+  char deep[4 + RICH_MAX_DEPTH + 1] = "\x08\x09\x01x";
+  memset(deep + 4, 6, RICH_MAX_DEPTH + 1);
+  assertTrue(decode_fails(deep, sizeof(deep), VERR_MALFORMED));
+  const char huge[] = "\x08\x09\x80\x80\x80\x80\x80\x80\x80\x80\x01" "abc";
+  assertTrue(decode_fails(huge, sizeof(huge) - 1, VERR_EOF));
+
+  // Otherwise unknown and missing fields are malformed, as with a bound sink
+  assertTrue(decode_fails(bindata, binsz, VERR_MALFORMED));
+  const char only_score[] = "\x08\x09\x05score\x04\0\0\0\0\0\0\0\0\x0a";
+  assertTrue(decode_fails(only_score, sizeof(only_score) - 1, VERR_MALFORMED));
+  rich_compiled_set_lenient(compiled, true);
+  assertTrue(decode_fails(only_score, sizeof(only_score) - 1, 0));
+  rich_compiled_set_lenient(compiled, false);
+
+  call(extra_sink, close);
+  call(bin, close);
+  call(schema, close_value, &u);
+  call(bound_sink, close);
+  call(json_source, close);
+  rich_compiled_close(compiled);
+  rich_schema_close(schema);
+
+  // Custom schemas cannot be compiled
+  rich_Schema custom = {._impl = NULL};
+  rich_Schema* wrapper = rich_schema_vector(&custom);
+  bool raised = false;
+  TRY {
+    rich_schema_compile(wrapper);
+  } CATCH(err) {
+    raised = err == VERR_ARGUMENT;
+  } ETRY
+  assertTrue(raised);
+  // Closing the wrapper would close the custom schema too
+  free(wrapper);
+  return 0;
+}
+
+data(Crew) {
+  Person      captain;
+  Person*     mate;
+  Vector      members[1];
+};
+
+static int arena_decode() {
+  rich_Schema* schema = rich_schema_struct(sizeof(Crew));
+  RICH_ADD_FIELD(schema, Crew, captain, person_schema());
+  RICH_ADD_FIELD(schema, Crew, mate, rich_schema_pointer(person_schema()));
+  RICH_ADD_FIELD(schema, Crew, members, rich_schema_vector(person_schema()));
+  schema = rich_schema_unclosable(schema);
+  rich_Compiled* compiled = rich_schema_compile(schema);
+
+  const char* json =
+    "{\"captain\":{\"name\":\"seth\",\"age\":8,\"is_criminal\":true,\"interests\":[\"mice\",\"treason\"]},"
+    "\"mate\":{\"name\":\"vaughan\",\"age\":20,\"is_criminal\":false,\"interests\":[]},"
+    "\"members\":[{\"name\":\"a\",\"age\":1,\"is_criminal\":false,\"interests\":[\"x\",\"y\",\"z\",\"w\",\"v\"]},"
+    "{\"name\":\"b\",\"age\":2,\"is_criminal\":true,\"interests\":[]}]}";
+  bool encodes_as_json(Crew* c) {
+    Output* out = string_output_new(256);
+    rich_compiled_encode_json(compiled, c, out);
+    size_t size;
+    const char* data = string_output_data(out, &size);
+    bool same = size == strlen(json) && memcmp(data, json, size) == 0;
+    call(out, close);
+    return same;
+  }
+
+  Arena arena[1];
+  arena_init(arena, 128);
+  Crew c;
+  memset(&c, 0xff, sizeof(c));
+  rich_Sink* sink = rich_bind_sink_arena(schema, &c, arena);
+  for (int pass = 0; pass < 2; pass++) {
+    arena_reset(arena);
+    Input* in = memory_input_new(json, strlen(json));
+    rich_Source* source = call(rich_codec_json, new_source, in);
+    call(source, read_value, sink);
+    call(source, close);
+
+    assertEqual(c.captain.age, 8);
+    assertEqual(c.mate->age, 20);
+    assertEqual(c.members->size, 2);
+    Person* a = vector_get(c.members, 0);
+    assertEqual(a->interests->size, 5);
+    assertTrue(encodes_as_json(&c));
+  }
+  call(sink, close);
+
+  // The compiled decoder
+  Output* bin = string_output_new(256);
+  rich_compiled_encode_binary(compiled, &c, bin);
+  size_t binsz;
+  const char* bindata = string_output_data(bin, &binsz);
+  Crew d;
+  Input* in = memory_input_new(bindata, binsz);
+  rich_compiled_decode_binary_arena(compiled, in, &d, arena);
+  call(in, close);
+  assertTrue(encodes_as_json(&d));
+  call(bin, close);
+
+  // A string (tag 5) claiming to be 2^56 bytes long fails without allocating it from the arena
+  const char huge[] = "\x08\x09\x07" "captain\x08\x09\x04name\x05\x80\x80\x80\x80\x80\x80\x80\x80\x01" "abc";
+  in = memory_input_new(huge, sizeof(huge) - 1);
+  bool eof = false;
+  TRY {
+    rich_compiled_decode_binary_arena(compiled, in, &d, arena);
+  } CATCH(err) {
+    eof = err == VERR_EOF;
+  } FINALLY {
+    call(in, close);
+  } ETRY
+  assertTrue(eof);
+
+  // Hashtables can't be decoded into an arena
+  rich_Schema* ht = rich_schema_hashtable(rich_schema_int64);
+  Hashtable h;
+  sink = rich_bind_sink_arena(ht, &h, arena);
+  bool raised = false;
+  TRY {
+    call(sink, sink, RICH_MAP, NULL);
+  } CATCH(err) {
+    raised = err == VERR_ARGUMENT;
+  } ETRY
+  assertTrue(raised);
+  call(sink, close);
+
+  arena_close(arena);
+  rich_compiled_close(compiled);
+  rich_schema_close(schema);
+  return 0;
+}
+
+data(Series) {
+  Vector  samples[1];
+  Vector  weights[1];
+  Vector  pixels[1];
+};
+
+static int packed_schema() {
+  rich_Schema* schema = rich_schema_struct(sizeof(Series));
+  RICH_ADD_FIELD(schema, Series, samples, rich_schema_packed(RICH_PACKED_INT32));
+  RICH_ADD_FIELD(schema, Series, weights, rich_schema_packed(RICH_PACKED_DOUBLE));
+  RICH_ADD_FIELD(schema, Series, pixels, rich_schema_packed(RICH_PACKED_UINT8));
+  schema = rich_schema_unclosable(schema);
+  rich_Compiled* compiled = rich_schema_compile(schema);
+  assertEqual(rich_schema_kind(rich_schema_packed(RICH_PACKED_UINT8)), RICH_SCHEMA_PACKED);
+
+  const char* json = "{\"samples\":[1,-2,300000],\"weights\":[0.5,-1.5],\"pixels\":[0,255]}";
+  bool equals(Output* out, const void* expect, size_t expect_size) {
+    size_t size;
+    const char* data = string_output_data(out, &size);
+    return size == expect_size && memcmp(data, expect, size) == 0;
+  }
+  bool compiled_json_equals(Series* value) {
+    Output* out = string_output_new(256);
+    rich_compiled_encode_json(compiled, value, out);
+    bool same = equals(out, json, strlen(json));
+    call(out, close);
+    return same;
+  }
+
+  // Numbers arrive from the JSON source as whole arrays
+  Series s;
+  memset(&s, 0, sizeof(s));
+  Input* in = memory_input_new(json, strlen(json));
+  rich_Source* source = call(rich_codec_json, new_source, in);
+  rich_Sink* sink = rich_bind_sink(schema, &s);
+  call(source, read_value, sink);
+  call(source, close);
+  assertEqual(s.samples->size, 3);
+  assertEqual(*(int32_t*)vector_get(s.samples, 2), 300000);
+  assertEqual(*(double*)vector_get(s.weights, 1), -1.5);
+  assertEqual(*(uint8_t*)vector_get(s.pixels, 1), 255);
+
+  // The generic and compiled encoders agree
+  source = rich_bind_source(schema, &s);
+  Output* jout = string_output_new(256);
+  rich_Sink* jsink = call(rich_codec_json, new_sink, jout);
+  call(source, read_value, jsink);
+  assertTrue(equals(jout, json, strlen(json)));
+  call(jsink, close);
+  assertTrue(compiled_json_equals(&s));
+
+  Output* bin = string_output_new(256);
+  rich_compiled_encode_binary(compiled, &s, bin);
+  size_t binsz;
+  const char* bindata = string_output_data(bin, &binsz);
+  Output* bout = string_output_new(256);
+  rich_Sink* bsink = call(rich_codec_binary, new_sink, bout);
+  call(source, read_value, bsink);
+  assertTrue(equals(bout, bindata, binsz));
+  call(bsink, close);
+  call(source, close);
+
+  // Binary decoding, generically and compiled
+  in = memory_input_new(bindata, binsz);
+  source = call(rich_codec_binary, new_source, in);
+  call(source, read_value, sink);
+  call(source, close);
+  assertTrue(compiled_json_equals(&s));
+
+  Series t;
+  memset(&t, 0, sizeof(t));
+  in = memory_input_new(bindata, binsz);
+  rich_compiled_decode_binary(compiled, in, &t);
+  call(in, close);
+  assertTrue(compiled_json_equals(&t));
+
+  // A packed array (tag 11) of int32 (type 2) claiming more elements than there are
+  const char short_samples[] = "\x08\x09\x07samples\x0b\x02\x80\x80\x80\x80\x80\x80\x80\x80\x01\x01\x00\x00\x00";
+  error_t decode_compiled(Input* in) {
+    error_t err = 0;
+    TRY {
+      rich_compiled_decode_binary(compiled, in, &t);
+    } CATCH(e) {
+      err = e;
+    } FINALLY {
+      call(in, close);
+    } ETRY
+    return err;
+  }
+  assertEqual(decode_compiled(memory_input_new(short_samples, sizeof(short_samples) - 1)), VERR_EOF);
+  // Other inputs are read a chunk at a time: the same array, 2^60+1 int64s to convert, and 2^60+1
+  // int64s to skip
+  Input* buffered(const char* data, size_t size) {
+    return buf_input_new(memory_input_new(data, size), 4);
+  }
+  assertEqual(decode_compiled(buffered(short_samples, sizeof(short_samples) - 1)), VERR_EOF);
+  const char convert[] = "\x08\x09\x07samples\x0b\x00\x81\x80\x80\x80\x80\x80\x80\x80\x10\x01\x00\x00\x00";
+  assertEqual(decode_compiled(buffered(convert, sizeof(convert) - 1)), VERR_EOF);
+  const char skip[] = "\x08\x09\x01x\x0b\x00\x81\x80\x80\x80\x80\x80\x80\x80\x10\x01\x00\x00\x00";
+  rich_compiled_set_lenient(compiled, true);
+  assertEqual(decode_compiled(buffered(skip, sizeof(skip) - 1)), VERR_EOF);
+  rich_compiled_set_lenient(compiled, false);
+  call(schema, close_value, &t);
+  error_t err;
+
+  // Sinks without packed support get atoms
+  in = memory_input_new(bindata, binsz);
+  source = call(rich_codec_binary, new_source, in);
+  assertTrue(read_text(source, "{ samples=[ 1 -2 300000 ] weights=[ 0.5 -1.5 ] pixels=[ 0 255 ] } "));
+  call(source, close);
+  call(bin, close);
+
+  // Integers that do not fit are rejected
+  const char* bad = "{\"pixels\":[256]}";
+  in = memory_input_new(bad, strlen(bad));
+  source = call(rich_codec_json, new_source, in);
+  err = 0;
+  TRY {
+    call(source, read_value, sink);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  call(source, close);
+  call(sink, close);
+
+  // Arrays that are not all integers or all floats are read element by element
+  const char* mixed = "[[1,2],[1.5,2],[1,\"x\",[]],[]]";
+  in = memory_input_new(mixed, strlen(mixed));
+  source = call(rich_codec_json, new_source, in);
+  jout = string_output_new(256);
+  jsink = call(rich_codec_json, new_sink, jout);
+  call(source, read_value, jsink);
+  assertTrue(equals(jout, mixed, strlen(mixed)));
+  call(jsink, close);
+  call(source, close);
+
+  rich_compiled_close(compiled);
+  rich_schema_close(schema);
+  return 0;
+}
+
+// A custom schema for [a, b] pairs, whose state uses a built-in schema for each number
+data(Pair) {
+  int64_t a;
+  int64_t b;
+};
+data(PairState) {
+  Pair*     pair;
+  unsigned  n;
+  bool      started;
+};
+static co_State pair_state;
+static size_t pair_data_size(void* _self) {
+  return sizeof(Pair);
+}
+static void pair_dump_value(void* _self, void* value, rich_Sink* to) {
+  Pair* pair = value;
+  call(to, sink, RICH_ARRAY, NULL);
+  sink_int(to, pair->a);
+  sink_int(to, pair->b);
+  call(to, sink, RICH_ENDARRAY, NULL);
+}
+static void pair_reset_value(void* _self, void* value) {
+  memset(value, 0, sizeof(Pair));
+}
+static void pair_close_value(void* _self, void* value) {}
+static void pair_push_state(void* _self, Coroutine* co, void* value) {
+  PairState* data = coroutine_push(co, &pair_state, sizeof(PairState));
+  data->pair = value;
+  data->n = 0;
+  data->started = false;
+}
+static void pair_state_run(void* udata, Coroutine* co, void* _arg) {
+  PairState* data = udata;
+  rich_SchemaArg* arg = _arg;
+  if (!data->started) {
+    if (arg->atom != RICH_ARRAY) RAISE(MALFORMED);
+    data->started = true;
+    return;
+  }
+  if (arg->atom == RICH_ENDARRAY) {
+    if (data->n != 2) RAISE(MALFORMED);
+    coroutine_pop(co);
+    return;
+  }
+  if (data->n == 2) RAISE(MALFORMED);
+  int64_t* value = data->n++ == 0 ? &data->pair->a : &data->pair->b;
+  call(rich_schema_int64, push_state, co, value);
+  coroutine_run(co, arg);
+}
+static co_State pair_state = {
+  .run = pair_state_run,
+};
+static rich_Schema_Impl pair_impl = {
+  .data_size = pair_data_size,
+  .dump_value = pair_dump_value,
+  .reset_value = pair_reset_value,
+  .close_value = pair_close_value,
+  .push_state = pair_push_state,
+  .close = null_close,
+};
+static rich_Schema pair_schema[1] = {{
+  ._impl = &pair_impl,
+}};
+
+data(Route) {
+  Vector  legs[1];
+  int64_t id;
+};
+
+static int custom_schema() {
+  rich_Schema* schema = rich_schema_struct(sizeof(Route));
+  RICH_ADD_FIELD(schema, Route, legs, rich_schema_vector(pair_schema));
+  RICH_ADD_FIELD(schema, Route, id, rich_schema_optional(rich_schema_int64));
+  schema = rich_schema_unclosable(schema);
+
+  // Each value is read back as the first one; missing and nil optional fields stay zero
+  const char* json =
+    "{\"legs\":[[1,2],[3,4]],\"id\":7}"
+    "{\"id\":null,\"legs\":[]}"
+    "{\"legs\":[[5,6]]}";
+  const char* expect[] = {
+    "{\"legs\":[[1,2],[3,4]],\"id\":7}",
+    "{\"legs\":[],\"id\":0}",
+    "{\"legs\":[[5,6]],\"id\":0}",
+  };
+  Route r;
+  memset(&r, 0, sizeof(r));
+  Input* in = memory_input_new(json, strlen(json));
+  rich_Source* source = call(rich_codec_json, new_source, in);
+  rich_Sink* sink = rich_bind_sink(schema, &r);
+  rich_Source* route_source = rich_bind_source(schema, &r);
+  for (int i = 0; i < 3; i++) {
+    call(source, read_value, sink);
+    Output* out = string_output_new(64);
+    rich_Sink* jsink = call(rich_codec_json, new_sink, out);
+    call(route_source, read_value, jsink);
+    size_t size;
+    const char* data = string_output_data(out, &size);
+    assertEqual(size, strlen(expect[i]));
+    assertTrue(memcmp(data, expect[i], size) == 0);
+    call(jsink, close);
+  }
+  call(route_source, close);
+  call(source, close);
+
+  // The custom state's errors still come through
+  const char* bad = "{\"legs\":[[1,2,3]]}";
+  in = memory_input_new(bad, strlen(bad));
+  source = call(rich_codec_json, new_source, in);
+  error_t err = 0;
+  TRY {
+    call(source, read_value, sink);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  call(source, close);
+  call(sink, close);
+
+  rich_schema_close(schema);
+  return 0;
+}
+
+data(Message) {
+  Bytes   from;
+  Bytes   text;
+};
+
+static int borrowed_schema() {
+  rich_Schema* schema = rich_schema_struct(sizeof(Message));
+  RICH_ADD_FIELD(schema, Message, from, rich_schema_borrowed);
+  RICH_ADD_FIELD(schema, Message, text, rich_schema_borrowed);
+  schema = rich_schema_unclosable(schema);
+  rich_Compiled* compiled = rich_schema_compile(schema);
+
+  const char* json = "{\"from\":\"alice\",\"text\":\"say \\\"hi\\\"\"}";
+  size_t json_size = strlen(json);
+  bool inside(const Bytes* b, const char* buf, size_t size) {
+    return (char*)b->ptr >= buf && (char*)b->ptr + b->size <= buf + size;
+  }
+
+  // Strings without escapes point into the input; the rest are copied
+  Message m;
+  memset(&m, 0, sizeof(m));
+  Input* in = memory_input_new(json, json_size);
+  rich_Source* source = call(rich_codec_json, new_source, in);
+  rich_Sink* sink = rich_bind_sink(schema, &m);
+  call(source, read_value, sink);
+  call(source, close);
+  assertTrue(inside(&m.from, json, json_size));
+  assertEqual(m.from.cap, 0);
+  assertTrue(bytes_compare(&m.from, &(Bytes){.ptr = "alice", .size = 5}) == 0);
+  assertFalse(inside(&m.text, json, json_size));
+  assertTrue(m.text.cap > 0);
+  assertTrue(bytes_compare(&m.text, &(Bytes){.ptr = "say \"hi\"", .size = 8}) == 0);
+
+  // Binary strings can always be borrowed
+  Output* bin = string_output_new(64);
+  rich_compiled_encode_binary(compiled, &m, bin);
+  size_t binsz;
+  const char* bindata = string_output_data(bin, &binsz);
+  in = memory_input_new(bindata, binsz);
+  source = call(rich_codec_binary, new_source, in);
+  call(source, read_value, sink);
+  call(source, close);
+  assertTrue(inside(&m.from, bindata, binsz));
+  assertTrue(inside(&m.text, bindata, binsz));
+  assertTrue(bytes_compare(&m.text, &(Bytes){.ptr = "say \"hi\"", .size = 8}) == 0);
+
+  Message c;
+  memset(&c, 0, sizeof(c));
+  in = memory_input_new(bindata, binsz);
+  rich_compiled_decode_binary(compiled, in, &c);
+  call(in, close);
+  assertTrue(inside(&c.from, bindata, binsz));
+  assertTrue(bytes_compare(&c.from, &m.from) == 0);
+  assertTrue(bytes_compare(&c.text, &m.text) == 0);
+
+  // Other inputs are copied
+  Input* fin = limited_input_new(memory_input_new(bindata, binsz), binsz);
+  rich_compiled_decode_binary(compiled, fin, &c);
+  call(fin, close);
+  assertFalse(inside(&c.from, bindata, binsz));
+  assertTrue(bytes_compare(&c.from, &m.from) == 0);
+  call(schema, close_value, &c);
+  assertTrue(c.from.ptr == NULL);
+
+  // A length near SIZE_MAX on other inputs runs into the end of the input, with or without an arena
+  const char huge[] = "\x08\x09\x04from\x05\xfc\xff\xff\xff\xff\xff\xff\xff\xff\x01" "abc";
+  Arena arena[1];
+  arena_init(arena, 256);
+  error_t decode_huge(Arena* arena) {
+    fin = limited_input_new(memory_input_new(huge, sizeof(huge) - 1), sizeof(huge) - 1);
+    error_t err = 0;
+    TRY {
+      if (arena) {
+        rich_compiled_decode_binary_arena(compiled, fin, &c, arena);
+      } else {
+        rich_compiled_decode_binary(compiled, fin, &c);
+      }
+    } CATCH(e) {
+      err = e;
+    } FINALLY {
+      call(fin, close);
+    } ETRY
+    return err;
+  }
+  assertEqual(decode_huge(NULL), VERR_EOF);
+  call(schema, close_value, &c);
+  assertEqual(decode_huge(arena), VERR_EOF);
+  arena_close(arena);
+
+  call(sink, close);
+  call(bin, close);
+  rich_compiled_close(compiled);
+  rich_schema_close(schema);
+  return 0;
+}
+
+static int value_tree() {
+  bool json_equals(const rich_Value* v, const char* expect) {
+    Output* out = string_output_new(256);
+    rich_Sink* sink = call(rich_codec_json, new_sink, out);
+    rich_value_dump(v, sink);
+    size_t size;
+    const char* json = string_output_data(out, &size);
+    bool ok = size == strlen(expect) && memcmp(json, expect, size) == 0;
+    if (!ok) printf("got: %.*s\n", (int)size, json);
+    call(sink, close);
+    return ok;
+  }
+  rich_ValueTree* read_json(const char* json) {
+    Input* in = memory_input_new(json, strlen(json));
+    rich_Source* source = call(rich_codec_json, new_source, in);
+    rich_ValueTree* tree = NULL;
+    TRY {
+      tree = rich_value_read(source);
+    } FINALLY {
+      call(source, close);
+    } ETRY
+    return tree;
+  }
+
+  // Maps come out in key order
+  rich_ValueTree* tree = read_json("{\"route\":\"orders.eu-west.priority-high\",\"id\":7,"
+    "\"tags\":[\"a\",true,null,1.5,{}],\"body\":{\"z\":[],\"a\":-1}}");
+  const rich_Value* root = rich_value_root(tree);
+  assertEqual(rich_value_type(root), RICH_MAP);
+  assertEqual(rich_value_length(root), 4);
+  assertEqual(rich_value_int(rich_value_cget(root, "id")), 7);
+  Bytes route = rich_value_string(rich_value_cget(root, "route"));
+  assertEqual(route.size, 28);
+  assertTrue(memcmp(route.ptr, "orders.eu-west.priority-high", 28) == 0);
+  const rich_Value* tags = rich_value_cget(root, "tags");
+  assertEqual(rich_value_length(tags), 5);
+  assertTrue(rich_value_bool(rich_value_at(tags, 1)));
+  assertEqual(rich_value_float(rich_value_at(tags, 3)), 1.5);
+  assertTrue(rich_value_at(tags, 5) == NULL);
+  assertTrue(rich_value_cget(root, "missing") == NULL);
+  assertTrue(rich_value_cget(tags, "id") == NULL);
+  Bytes key;
+  assertEqual(rich_value_int(rich_value_entry(rich_value_cget(root, "body"), 0, &key)), -1);
+  assertEqual(key.size, 1);
+  assertTrue(json_equals(root, "{\"body\":{\"a\":-1,\"z\":[]},\"id\":7,"
+    "\"route\":\"orders.eu-west.priority-high\",\"tags\":[\"a\",true,null,1.5,{}]}"));
+
+  error_t err = 0;
+  TRY {
+    rich_value_int(root);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+
+  // Trees can be read from any source, and are freed by their last owner
+  rich_value_tree_acquire(tree);
+  rich_value_tree_release(tree);
+  Output* bin = string_output_new(256);
+  rich_Sink* bsink = call(rich_codec_binary, new_sink, bin);
+  rich_value_dump(root, bsink);
+  rich_value_tree_release(tree);
+  size_t binsz;
+  const char* bindata = string_output_data(bin, &binsz);
+  rich_Source* bsource = call(rich_codec_binary, new_source, memory_input_new(bindata, binsz));
+  tree = rich_value_read(bsource);
+  call(bsource, close);
+  call(bsink, close);
+  assertTrue(json_equals(rich_value_root(tree), "{\"body\":{\"a\":-1,\"z\":[]},\"id\":7,"
+    "\"route\":\"orders.eu-west.priority-high\",\"tags\":[\"a\",true,null,1.5,{}]}"));
+  rich_value_tree_release(tree);
+
+  // Large maps are looked up through their hash index
+  Output* out = string_output_new(1024);
+  io_put(out, '{');
+  for (int i = 0; i < 100; i++) {
+    char cbuf[64];
+    snprintf(cbuf, sizeof(cbuf), "%s\"field_%d\":%d", i ? "," : "", (i * 37) % 100, i);
+    io_writec(out, cbuf);
+  }
+  io_put(out, '}');
+  size_t size;
+  tree = read_json(string_output_data(out, &size));
+  call(out, close);
+  root = rich_value_root(tree);
+  assertEqual(rich_value_length(root), 100);
+  for (int i = 0; i < 100; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "field_%d", (i * 37) % 100);
+    const rich_Value* v = rich_value_cget(root, name);
+    assertTrue(v != NULL);
+    assertEqual(rich_value_int(v), i);
+  }
+  assertTrue(rich_value_cget(root, "field_100") == NULL);
+  rich_value_tree_release(tree);
+
+  // Duplicate keys are rejected
+  err = 0;
+  TRY {
+    read_json("{\"a\":1,\"b\":2,\"a\":3}");
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  return 0;
+}
+
+data(Summary) {
+  int64_t id;
+  Bytes   name;
+};
+
+static int projection() {
+  rich_Schema* schema = rich_schema_struct(sizeof(Summary));
+  RICH_ADD_FIELD(schema, Summary, id, rich_schema_int64);
+  rich_add_cfield(schema, "payload", 0, rich_schema_discard);
+  rich_add_cfield(schema, "count", 0, rich_schema_discard);
+  RICH_ADD_FIELD(schema, Summary, name, rich_schema_bytes);
+  rich_add_cfield(schema, "tags", 0, rich_schema_discard);
+  schema = rich_schema_unclosable(schema);
+
+  // Skipped values are only bracket-matched, so their contents are never decoded
+  const char* json = "{\"id\":5, \"payload\": {\"s\":\"}]\\\"[{\", \"deep\":[[[{\"x\":tru}]]]},"
+    "\"count\" : 12345,\"name\":\"widget\",\"tags\":[1 2 x]} 42";
+  for (int trickle = 0; trickle < 2; trickle++) {
+    Summary s;
+    memset(&s, 0, sizeof(s));
+    Input* in = memory_input_new(json, strlen(json));
+    if (trickle) in = trickle_input_new(in);
+    rich_Source* source = call(rich_codec_json, new_source, in);
+    rich_Sink* sink = rich_bind_sink(schema, &s);
+    call(source, read_value, sink);
+    assertEqual(s.id, 5);
+    assertEqual(s.name.size, 6);
+    assertTrue(memcmp(s.name.ptr, "widget", 6) == 0);
+    assertTrue(read_text(source, "42 "));
+    call(source, close);
+    call(sink, close);
+  }
+
+  // Sinks that do not skip values get all of it
+  Input* in = memory_input_new(json, strlen(json));
+  rich_Source* source = call(rich_codec_json, new_source, in);
+  error_t err = 0;
+  TRY {
+    read_text(source, "");
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  call(source, close);
+
+  rich_schema_close(schema);
+  return 0;
+}
+
+static int deep_nesting() {
+  enum { DEPTH = 500 };
+  rich_Schema* schema = rich_schema_int64;
+  for (int i = 0; i < DEPTH; i++) schema = rich_schema_vector(schema);
+  schema = rich_schema_unclosable(schema);
+
+  Output* out = string_output_new(2 * DEPTH + 8);
+  for (int i = 0; i < DEPTH; i++) io_put(out, '[');
+  io_writelit(out, "42");
+  for (int i = 0; i < DEPTH; i++) io_put(out, ']');
+  size_t size;
+  const char* json = string_output_data(out, &size);
+
+  Vector v = {};
+  Input* in = memory_input_new(json, size);
+  rich_Source* source = call(rich_codec_json, new_source, in);
+  rich_Sink* sink = rich_bind_sink(schema, &v);
+  call(source, read_value, sink);
+  call(source, close);
+
+  Vector* inner = &v;
+  for (int i = 1; i < DEPTH; i++) {
+    assertEqual(inner->size, 1);
+    inner = vector_get(inner, 0);
+  }
+  assertEqual(*(int64_t*)vector_get(inner, 0), 42);
+
+  Output* out2 = string_output_new(size);
+  rich_Sink* jsink = call(rich_codec_json, new_sink, out2);
+  source = rich_bind_source(schema, &v);
+  call(source, read_value, jsink);
+  size_t size2;
+  const char* json2 = string_output_data(out2, &size2);
+  assertEqual(size2, size);
+  assertTrue(memcmp(json, json2, size) == 0);
+
+  call(source, close);
+  call(jsink, close);
+  call(sink, close);
+  call(out, close);
+  rich_schema_close(schema);
+  return 0;
+}
+
 VLIB_SUITE(rich) = {
   VLIB_TEST(json_encode),
+  VLIB_TEST(json_decode),
+  VLIB_TEST(json_decode_leaves_rest),
+  VLIB_TEST(json_decode_deep),
+  VLIB_TEST(json_encode_values),
+  VLIB_TEST(json_doc),
+  VLIB_TEST(json_parser),
+  VLIB_TEST(json_ndjson),
+  VLIB_TEST(binary_roundtrip),
+  VLIB_TEST(binary_hostile),
   VLIB_TEST(struct_schema_encode),
   VLIB_TEST(struct_schema_decode),
+  VLIB_TEST(nested_schema_roundtrip),
+  VLIB_TEST(struct_schema_keys),
+  VLIB_TEST(struct_schema_wide),
+  VLIB_TEST(compiled_schema),
+  VLIB_TEST(arena_decode),
+  VLIB_TEST(packed_schema),
+  VLIB_TEST(custom_schema),
+  VLIB_TEST(deep_nesting),
+  VLIB_TEST(borrowed_schema),
+  VLIB_TEST(value_tree),
+  VLIB_TEST(projection),
   VLIB_END
 };
\ No newline at end of file
@@ -0,0 +1,65 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <vlib/test.h>
+#include <vlib/ringbuffer.h>
+
+static int ringbuffer_wrap() {
+  RingBuffer b[1];
+  ringbuffer_init(b, 1, 4);
+  size_t size = b->size;
+
+  // Move the offsets close to the end of the buffer
+  char* junk = malloc(size);
+  memset(junk, 'x', size);
+  assertEqual(ringbuffer_write(b, junk, size - 3), size - 3);
+  assertEqual(ringbuffer_read(b, junk, size - 3), size - 3);
+  free(junk);
+
+  // Data written across the wrap point is still contiguous
+  assertEqual(ringbuffer_write(b, "Hello World!", 12), 12);
+  assertEqual(ringbuffer_avail_read(b), 12);
+  assertTrue(memcmp(ringbuffer_read_ptr(b), "Hello World!", 12) == 0);
+
+  char cbuf[12];
+  assertEqual(ringbuffer_read(b, cbuf, 6), 6);
+  ringbuffer_unget(b, 4);
+  assertEqual(ringbuffer_read(b, cbuf, 8), 8);
+  assertTrue(memcmp(cbuf, "llo Worl", 8) == 0);
+
+  ringbuffer_close(b);
+  return 0;
+}
+
+static int ring_input() {
+  const char* src = "Bob is cool";
+  Input* in = ring_input_new(limited_input_new(memory_input_new(src, strlen(src)), 100), 1, 3);
+
+  const char* peek = ring_input_peek(in, 3);
+  assertTrue(peek && memcmp(peek, "Bob", 3) == 0);
+
+  char cbuf[7];
+  io_readall(in, cbuf, 7);
+  assertTrue(memcmp(cbuf, "Bob is ", 7) == 0);
+  ring_input_unget(in, 3);
+  assertEqual(io_get(in), 'i');
+  io_unget(in);
+  assertEqual(io_get(in), 'i');
+
+  assertTrue(ring_input_peek(in, 100) == NULL);
+  io_readall(in, cbuf, 6);
+  assertTrue(memcmp(cbuf, "s cool", 6) == 0);
+  assertEqual(io_get(in), -1);
+  assertTrue(io_eof(in));
+
+  call(in, close);
+  return 0;
+}
+
+VLIB_SUITE(ringbuffer) = {
+  VLIB_TEST(ringbuffer_wrap),
+  VLIB_TEST(ring_input),
+  VLIB_END,
+};
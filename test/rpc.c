@@ -0,0 +1,636 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <vlib/test.h>
+#include <vlib/rpc.h>
+#include <vlib/rich_binary.h>
+#include <vlib/thread.h>
+#include <vlib/varint.h>
+#include <vlib/net.h>
+
+data(AddArgs) {
+  int64_t a;
+  int64_t b;
+};
+
+static rich_Schema* add_schema() {
+  rich_Schema* schema = rich_schema_struct(sizeof(AddArgs));
+  RICH_ADD_FIELD(schema, AddArgs, a, rich_schema_int64);
+  RICH_ADD_FIELD(schema, AddArgs, b, rich_schema_int64);
+  return schema;
+}
+
+static void add_method(void* udata, void* _args, void* result) {
+  AddArgs* args = _args;
+  *(int64_t*)result = args->a + args->b;
+}
+static void fail_method(void* udata, void* args, void* result) {
+  verr_raisef(VERR_ACCESS, "no access to %ld", *(int64_t*)args);
+}
+
+static void echo_method(void* udata, void* args, void* result) {
+  bytes_copy(result, args);
+}
+
+static RPC* test_service() {
+  RPC* service = rpc_service_new(NULL, NULL);
+  rpc_add(service, "add", add_method, add_schema(), rich_schema_int64);
+  rpc_add(service, "fail", fail_method, rich_schema_int64, rich_schema_int64);
+  rpc_add(service, "echo", echo_method, rich_schema_bytes, rich_schema_bytes);
+  return service;
+}
+
+// Serves the test service on one end of a socket pair
+static void* serve_thread(void* _fd) {
+  verr_thread_init();
+  int fd = *(int*)_fd;
+  BinaryRPC* backend = rpc_to_binary(test_service(), rich_codec_binary);
+  rpc_serve_stream(fd_input_new(fd, true), fd_output_new(fd, false), backend);
+  call(backend, close);
+  verr_thread_cleanup();
+  return NULL;
+}
+
+// Answers three calls in reverse order, with the position of each call as its result
+static void* reverse_thread(void* _fd) {
+  verr_thread_init();
+  int fd = *(int*)_fd;
+  Input* in = fd_input_new(fd, true);
+  Output* out = fd_output_new(fd, false);
+  uint64_t ids[3];
+  for (int i = 0; i < 3; i++) {
+    char frame[256];
+    size_t size = io_get_uvarint(in);
+    io_readall(in, frame, size);
+    const char* p = frame;
+    ids[i] = varint_read_u64(&p, frame + size);
+  }
+  for (int i = 2; i >= 0; i--) {
+    char frame[32];
+    size_t n = varint_write_u64(frame, ids[i]);
+    frame[n++] = 0;
+    frame[n++] = RICH_BTAG_INT;
+    n += varint_write_i64(frame + n, i);
+    io_put_uvarint(out, n);
+    io_write(out, frame, n);
+  }
+  if (io_get_uvarint(in) == 0) io_put(out, 0);
+  call(in, close);
+  call(out, close);
+  verr_thread_cleanup();
+  return NULL;
+}
+
+// Answers the first call with a frame claiming to be 2^56 bytes long
+static void* huge_thread(void* _fd) {
+  verr_thread_init();
+  int fd = *(int*)_fd;
+  Input* in = fd_input_new(fd, true);
+  Output* out = fd_output_new(fd, false);
+  char frame[256];
+  size_t size = io_get_uvarint(in);
+  io_readall(in, frame, size);
+  io_writelit(out, "\x80\x80\x80\x80\x80\x80\x80\x80\x01");
+  while (io_get(in) != -1);
+  call(in, close);
+  call(out, close);
+  verr_thread_cleanup();
+  return NULL;
+}
+
+// Hangs up after the first call
+static void* hangup_thread(void* _fd) {
+  verr_thread_init();
+  int fd = *(int*)_fd;
+  Input* in = fd_input_new(fd, true);
+  char frame[256];
+  size_t size = io_get_uvarint(in);
+  io_readall(in, frame, size);
+  call(in, close);
+  verr_thread_cleanup();
+  return NULL;
+}
+
+static RPC_Channel* connect_to(void* (*server)(void*), int fds[2], thread_t* thread) {
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) verr_raise_system();
+  *thread = thread_spawn(server, &fds[1]);
+  return rpc_channel_new(fd_input_new(fds[0], true), fd_output_new(fds[0], false), rich_codec_binary);
+}
+
+static int channel_calls() {
+  int fds[2];
+  thread_t server;
+  RPC_Channel* channel = connect_to(serve_thread, fds, &server);
+  rich_Schema* schema = rich_schema_unclosable(add_schema());
+
+  // Many calls in flight at once
+  enum { N = 200 };
+  AddArgs args[N];
+  int64_t results[N];
+  rich_Sink* sinks[N];
+  RPC_Future* futures[N];
+  for (int i = 0; i < N; i++) {
+    args[i].a = i;
+    args[i].b = 2 * i;
+    rich_Source* source = rich_bind_source(schema, &args[i]);
+    sinks[i] = rich_bind_sink(rich_schema_int64, &results[i]);
+    futures[i] = rpc_channel_start(channel, "add", source, sinks[i]);
+    call(source, close);
+  }
+  for (int i = 0; i < N; i++) {
+    rpc_future_wait(futures[i]);
+    assertEqual(results[i], 3 * i);
+    call(sinks[i], close);
+  }
+
+  // Errors come back with their code and message
+  int64_t arg = 7, result;
+  rich_Source* source = rich_bind_source(rich_schema_int64, &arg);
+  rich_Sink* sink = rich_bind_sink(rich_schema_int64, &result);
+  error_t err = 0;
+  char msg[64] = "";
+  TRY {
+    rpc_future_wait(rpc_channel_start(channel, "fail", source, sink));
+  } CATCH(e) {
+    err = e;
+    snprintf(msg, sizeof(msg), "%s", verr_current_msg());
+  } ETRY
+  assertEqual(err, VERR_ACCESS);
+  assertTrue(strcmp(msg, "no access to 7") == 0);
+
+  // Frames of every size up to a few hundred bytes, including 255, whose length has a 0xFF byte
+  char text[400];
+  memset(text, 'x', sizeof(text));
+  Bytes in = {.ptr = text}, out = {};
+  rich_Source* echo_source = rich_bind_source(rich_schema_bytes, &in);
+  rich_Sink* echo_sink = rich_bind_sink(rich_schema_bytes, &out);
+  for (in.size = 0; in.size < sizeof(text); in.size++) {
+    rpc_future_wait(rpc_channel_start(channel, "echo", echo_source, echo_sink));
+    assertEqual(out.size, in.size);
+  }
+  call(echo_source, close);
+  call(echo_sink, close);
+  bytes_close(&out);
+
+  // Callbacks run as calls finish
+  int finished = 0;
+  error_t last_err = 0;
+  void done(void* udata, error_t err, const char* msg) {
+    __sync_fetch_and_add(&finished, 1);
+    if (err) last_err = err;
+  }
+  for (int i = 0; i < 10; i++) {
+    rich_Source* add_args = rich_bind_source(schema, &args[i]);
+    rpc_channel_send(channel, "add", add_args, sink, done, NULL);
+    call(add_args, close);
+  }
+  rpc_channel_send(channel, "missing", source, sink, done, NULL);
+
+  // Blocking calls through an RPC_Client; closing the client waits for the callbacks
+  RPC_Client client[1];
+  rpc_init(client, rpc_channel_rpc(channel));
+  int add = rpc_register(client, "add", schema, rich_schema_int64);
+  AddArgs a = {.a = 40, .b = 2};
+  rpc_call(client, add, &a, &result);
+  assertEqual(result, 42);
+  rpc_close(client);
+  assertEqual(finished, 11);
+  assertEqual(last_err, VERR_ARGUMENT);
+
+  thread_join(server);
+  call(source, close);
+  call(sink, close);
+  rich_schema_close(schema);
+  return 0;
+}
+
+static int channel_out_of_order() {
+  int fds[2];
+  thread_t server;
+  RPC_Channel* channel = connect_to(reverse_thread, fds, &server);
+
+  int order[3], count = 0;
+  int64_t results[3];
+  void done(void* udata, error_t err, const char* msg) {
+    order[count++] = (int64_t*)udata - results;
+  }
+  rich_Sink* sinks[3];
+  for (int i = 0; i < 3; i++) {
+    sinks[i] = rich_bind_sink(rich_schema_int64, &results[i]);
+    rich_Source* source = rich_bind_source(rich_schema_int64, &results[i]);
+    rpc_channel_send(channel, "any", source, sinks[i], done, &results[i]);
+    call(source, close);
+  }
+  call(rpc_channel_rpc(channel), close);
+  thread_join(server);
+
+  assertEqual(count, 3);
+  for (int i = 0; i < 3; i++) {
+    assertEqual(order[i], 2 - i);
+    assertEqual(results[i], i);
+    call(sinks[i], close);
+  }
+  return 0;
+}
+
+static int oversized_frames() {
+  // A request
+  const char huge[] = "\x80\x80\x80\x80\x80\x80\x80\x80\x01";
+  BinaryRPC* backend = rpc_to_binary(test_service(), rich_codec_binary);
+  error_t err = 0;
+  TRY {
+    rpc_serve_stream(memory_input_new(huge, sizeof(huge) - 1), string_output_new(64), backend);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  call(backend, close);
+
+  // A response
+  int fds[2];
+  thread_t server;
+  RPC_Channel* channel = connect_to(huge_thread, fds, &server);
+  int64_t result;
+  rich_Sink* sink = rich_bind_sink(rich_schema_int64, &result);
+  rich_Source* source = rich_bind_source(rich_schema_int64, &result);
+  err = 0;
+  TRY {
+    rpc_future_wait(rpc_channel_start(channel, "any", source, sink));
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  call(rpc_channel_rpc(channel), close);
+  thread_join(server);
+  call(source, close);
+  call(sink, close);
+  return 0;
+}
+
+static int channel_hangup() {
+  // Calls sent while the server hangs up race with the reader failing them. Each one must either
+  // raise or finish, never both.
+  void (*old)(int) = signal(SIGPIPE, SIG_IGN);
+  int fds[2];
+  thread_t server;
+  RPC_Channel* channel = connect_to(hangup_thread, fds, &server);
+  int64_t result;
+  rich_Sink* sink = rich_bind_sink(rich_schema_int64, &result);
+  rich_Source* source = rich_bind_source(rich_schema_int64, &result);
+  int sent = 0, finished = 0;
+  void done(void* udata, error_t err, const char* msg) {
+    __atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+  }
+  bool failed = false;
+  while (!failed && sent < 100000) {
+    TRY {
+      rpc_channel_send(channel, "any", source, sink, done, NULL);
+      sent++;
+    } CATCH(err) {
+      failed = true;
+    } ETRY
+  }
+  thread_join(server);
+  error_t err = 0;
+  TRY {
+    rpc_future_wait(rpc_channel_start(channel, "any", source, sink));
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  call(rpc_channel_rpc(channel), close);
+  signal(SIGPIPE, old);
+
+  assertTrue(failed);
+  assertTrue(err != 0);
+  assertEqual(finished, sent);
+  call(source, close);
+  call(sink, close);
+  return 0;
+}
+
+// Listens on a free port, and writes its address to addr
+static NetListener* listen_local(char addr[32]) {
+  NetListener* listener = net_listen_tcp("127.0.0.1:0");
+  snprintf(addr, 32, "127.0.0.1:%u", net_listener_port(listener));
+  return listener;
+}
+
+static void* tcp_serve_thread(void* server) {
+  verr_thread_init();
+  rpc_tcp_serve(server);
+  verr_thread_cleanup();
+  return NULL;
+}
+
+static int tcp_transport() {
+  BinaryRPC* backend = rpc_to_binary(test_service(), rich_codec_binary);
+  char addr[32];
+  NetListener* listener = listen_local(addr);
+  RPC_TCPServer server[1];
+  rpc_tcp_init(server, listener, backend);
+  thread_t thread = thread_spawn(tcp_serve_thread, server);
+
+  // Blocking calls, all over the same connection
+  rich_Schema* schema = rich_schema_unclosable(add_schema());
+  RPC_Client client[1];
+  rpc_init(client, rpc_from_binary(rpc_tcp_new(addr), rich_codec_binary));
+  int add = rpc_register(client, "add", schema, rich_schema_int64);
+  int fail = rpc_register(client, "fail", rich_schema_int64, rich_schema_int64);
+  for (int i = 0; i < 100; i++) {
+    AddArgs args = {.a = i, .b = 1000};
+    int64_t result;
+    rpc_call(client, add, &args, &result);
+    assertEqual(result, i + 1000);
+  }
+
+  // Errors keep their code and message, and the connection stays usable
+  int64_t arg = 3, result;
+  error_t err = 0;
+  char msg[64] = "";
+  TRY {
+    rpc_call(client, fail, &arg, &result);
+  } CATCH(e) {
+    err = e;
+    snprintf(msg, sizeof(msg), "%s", verr_current_msg());
+  } ETRY
+  assertEqual(err, VERR_ACCESS);
+  assertTrue(strcmp(msg, "no access to 3") == 0);
+  AddArgs args = {.a = 1, .b = 2};
+  rpc_call(client, add, &args, &result);
+  assertEqual(result, 3);
+
+  // So does a method after arguments it can't decode
+  int bad_add = rpc_register(client, "add", rich_schema_int64, rich_schema_int64);
+  err = 0;
+  TRY {
+    rpc_call(client, bad_add, &arg, &result);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  rpc_call(client, add, &args, &result);
+  assertEqual(result, 3);
+
+  // RPC_Channels can talk to the same server, at the same time
+  NetConn* conn = net_connect_tcp(addr, NULL);
+  RPC_Channel* channel = rpc_channel_new(conn->input, conn->output, rich_codec_binary);
+  int64_t results[10];
+  rich_Sink* sinks[10];
+  RPC_Future* futures[10];
+  for (int i = 0; i < 10; i++) {
+    args.a = i;
+    rich_Source* source = rich_bind_source(schema, &args);
+    sinks[i] = rich_bind_sink(rich_schema_int64, &results[i]);
+    futures[i] = rpc_channel_start(channel, "add", source, sinks[i]);
+    call(source, close);
+  }
+  rpc_call(client, add, &args, &result);
+  assertEqual(result, 11);
+  for (int i = 0; i < 10; i++) {
+    rpc_future_wait(futures[i]);
+    assertEqual(results[i], i + 2);
+    call(sinks[i], close);
+  }
+  call(rpc_channel_rpc(channel), close);
+  call(conn, close);
+
+  // Stopping the server closes the client's connection, and the client reconnects
+  rpc_tcp_stop(server);
+  thread_join(thread);
+  err = 0;
+  TRY {
+    rpc_call(client, add, &args, &result);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertTrue(err != 0);
+
+  call(listener, close);
+  listener = net_listen_tcp(addr);
+  rpc_tcp_init(server, listener, backend);
+  thread = thread_spawn(tcp_serve_thread, server);
+  rpc_call(client, add, &args, &result);
+  assertEqual(result, 11);
+
+  rpc_close(client);
+  rpc_tcp_stop(server);
+  thread_join(thread);
+  call(listener, close);
+  call(backend, close);
+  rich_schema_close(schema);
+  return 0;
+}
+
+// Sleeps for as many milliseconds as its argument, keeping track of how many calls overlap
+static int running_calls, max_running_calls;
+static void sleep_method(void* udata, void* args, void* result) {
+  int running = __sync_add_and_fetch(&running_calls, 1);
+  int max;
+  while ((max = max_running_calls) < running) {
+    __sync_bool_compare_and_swap(&max_running_calls, max, running);
+  }
+  usleep(*(int64_t*)args * 1000);
+  *(int64_t*)result = *(int64_t*)args;
+  __sync_sub_and_fetch(&running_calls, 1);
+}
+
+static int tcp_pool() {
+  RPC* service = test_service();
+  rpc_add(service, "sleep", sleep_method, rich_schema_int64, rich_schema_int64);
+  ThreadPool pool[1];
+  threadpool_init(pool, poolmanager_new_basic(4, 8, 8), rpc_service_worker(service, rich_codec_binary));
+  char addr[32];
+  NetListener* listener = listen_local(addr);
+  RPC_TCPServer server[1];
+  rpc_tcp_init_pool(server, listener, pool);
+  thread_t thread = thread_spawn(tcp_serve_thread, server);
+
+  // Calls over one connection run at the same time, but are answered in order
+  NetConn* conn = net_connect_tcp(addr, NULL);
+  RPC_Channel* channel = rpc_channel_new(conn->input, conn->output, rich_codec_binary);
+  enum { N = 6 };
+  int64_t args[N], results[N];
+  rich_Sink* sinks[N];
+  int order[N + 1], count = 0;
+  error_t errors[N + 1];
+  void done(void* udata, error_t err, const char* msg) {
+    errors[count] = err;
+    order[count++] = (intptr_t)udata;
+  }
+  for (int i = 0; i < N; i++) {
+    args[i] = (N - i) * 20;
+    rich_Source* source = rich_bind_source(rich_schema_int64, &args[i]);
+    sinks[i] = rich_bind_sink(rich_schema_int64, &results[i]);
+    rpc_channel_send(channel, "sleep", source, sinks[i], done, (void*)(intptr_t)i);
+    call(source, close);
+  }
+  int64_t arg = 5, result;
+  rich_Source* source = rich_bind_source(rich_schema_int64, &arg);
+  rich_Sink* sink = rich_bind_sink(rich_schema_int64, &result);
+  rpc_channel_send(channel, "fail", source, sink, done, (void*)(intptr_t)N);
+  call(rpc_channel_rpc(channel), close);
+  call(conn, close);
+
+  assertEqual(count, N + 1);
+  for (int i = 0; i < N; i++) {
+    assertEqual(order[i], i);
+    assertEqual(errors[i], 0);
+    assertEqual(results[i], args[i]);
+    call(sinks[i], close);
+  }
+  assertEqual(order[N], N);
+  assertEqual(errors[N], VERR_ACCESS);
+  assertTrue(max_running_calls > 1);
+
+  // Blocking clients work the same
+  RPC_Client client[1];
+  rpc_init(client, rpc_from_binary(rpc_tcp_new(addr), rich_codec_binary));
+  rich_Schema* schema = rich_schema_unclosable(add_schema());
+  int add = rpc_register(client, "add", schema, rich_schema_int64);
+  int bad_add = rpc_register(client, "add", rich_schema_int64, rich_schema_int64);
+  AddArgs add_args = {.a = 20, .b = 22};
+  for (int i = 0; i < 20; i++) {
+    // Each worker thread decodes with its own sinks, which must survive malformed arguments
+    error_t err = 0;
+    TRY {
+      rpc_call(client, bad_add, &arg, &result);
+    } CATCH(e) {
+      err = e;
+    } ETRY
+    assertEqual(err, VERR_MALFORMED);
+    rpc_call(client, add, &add_args, &result);
+    assertEqual(result, 42);
+  }
+  rpc_close(client);
+
+  rpc_tcp_stop(server);
+  thread_join(thread);
+  call(listener, close);
+  threadpool_close(pool);
+  call(service, close);
+  call(source, close);
+  call(sink, close);
+  rich_schema_close(schema);
+  return 0;
+}
+
+static int batches() {
+  RPC_Client client[1];
+  rpc_init(client, rpc_from_binary(rpc_to_binary(test_service(), rich_codec_binary), rich_codec_binary));
+  rich_Schema* schema = rich_schema_unclosable(add_schema());
+  int add = rpc_register(client, "add", schema, rich_schema_int64);
+  int fail = rpc_register(client, "fail", rich_schema_int64, rich_schema_int64);
+  int missing = rpc_register(client, "missing", rich_schema_int64, rich_schema_int64);
+
+  // Each call succeeds or fails on its own
+  enum { N = 20 };
+  AddArgs args[N];
+  int64_t results[N + 2];
+  RPC_Batch batch[1];
+  rpc_batch_begin(batch, client);
+  for (int i = 0; i < N; i++) {
+    args[i].a = i;
+    args[i].b = i * i;
+    rpc_batch_add(batch, add, &args[i], &results[i]);
+    if (i == 5) {
+      int64_t arg = 9;
+      rpc_batch_add(batch, fail, &arg, &results[N]);
+    }
+  }
+  rpc_batch_add(batch, missing, &args[0].a, &results[N + 1]);
+  assertEqual(rpc_batch_commit(batch), 2);
+
+  const char* msg;
+  for (int i = 0; i < N; i++) {
+    assertEqual(rpc_batch_error(batch, i < 6 ? i : i + 1, &msg), 0);
+    assertTrue(msg == NULL);
+    assertEqual(results[i], i + i * i);
+  }
+  assertEqual(rpc_batch_error(batch, 6, &msg), VERR_ACCESS);
+  assertTrue(strcmp(msg, "no access to 9") == 0);
+  assertEqual(rpc_batch_error(batch, N + 1, NULL), VERR_ARGUMENT);
+
+  // Adding after a commit starts over
+  rpc_batch_add(batch, add, &args[3], &results[0]);
+  assertEqual(rpc_batch_commit(batch), 0);
+  assertEqual(batch->results->size, 1);
+  assertEqual(results[0], 12);
+  rpc_batch_close(batch);
+  rpc_close(client);
+
+  // Batches need a binary backend
+  rpc_init(client, test_service());
+  error_t err = 0;
+  TRY {
+    rpc_batch_begin(batch, client);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_ARGUMENT);
+  rpc_close(client);
+  rich_schema_close(schema);
+  return 0;
+}
+
+static int batches_parallel() {
+  RPC* service = test_service();
+  rpc_add(service, "sleep", sleep_method, rich_schema_int64, rich_schema_int64);
+  ThreadPool pool[1];
+  PoolWorker* worker = rpc_service_worker(service, rich_codec_binary);
+  threadpool_init(pool, poolmanager_new_basic(4, 8, 8), worker);
+  rpc_service_worker_parallel(worker, pool);
+  char addr[32];
+  NetListener* listener = listen_local(addr);
+  RPC_TCPServer server[1];
+  rpc_tcp_init_pool(server, listener, pool);
+  thread_t thread = thread_spawn(tcp_serve_thread, server);
+
+  RPC_Client client[1];
+  rpc_init(client, rpc_from_binary(rpc_tcp_new(addr), rich_codec_binary));
+  int sleep = rpc_register(client, "sleep", rich_schema_int64, rich_schema_int64);
+  int fail = rpc_register(client, "fail", rich_schema_int64, rich_schema_int64);
+
+  enum { N = 6 };
+  int64_t args[N], results[N + 1];
+  RPC_Batch batch[1];
+  rpc_batch_begin(batch, client);
+  for (int i = 0; i < N; i++) {
+    args[i] = 50 + i;
+    rpc_batch_add(batch, sleep, &args[i], &results[i]);
+  }
+  rpc_batch_add(batch, fail, &args[0], &results[N]);
+  max_running_calls = 0;
+  assertEqual(rpc_batch_commit(batch), 1);
+  for (int i = 0; i < N; i++) {
+    assertEqual(rpc_batch_error(batch, i, NULL), 0);
+    assertEqual(results[i], args[i]);
+  }
+  assertEqual(rpc_batch_error(batch, N, NULL), VERR_ACCESS);
+  assertTrue(max_running_calls > 1);
+  rpc_batch_close(batch);
+  rpc_close(client);
+
+  rpc_tcp_stop(server);
+  thread_join(thread);
+  call(listener, close);
+  threadpool_close(pool);
+  call(service, close);
+  return 0;
+}
+
+VLIB_SUITE(rpc) = {
+  VLIB_TEST(channel_calls),
+  VLIB_TEST(channel_out_of_order),
+  VLIB_TEST(oversized_frames),
+  VLIB_TEST(channel_hangup),
+  VLIB_TEST(tcp_transport),
+  VLIB_TEST(tcp_pool),
+  VLIB_TEST(batches),
+  VLIB_TEST(batches_parallel),
+  VLIB_END
+};
@@ -8,9 +8,14 @@ SUITE(heap);
 SUITE(hashtable);
 SUITE(llist);
 SUITE(deque);
+SUITE(ringbuffer);
+SUITE(arena);
 
 SUITE(gqi);
 SUITE(io);
+SUITE(net);
+SUITE(compress);
 SUITE(error);
 SUITE(varint);
 SUITE(rich);
+SUITE(rpc);
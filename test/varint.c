@@ -1,6 +1,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include <vlib/test.h>
 #include <vlib/varint.h>
@@ -116,12 +117,134 @@ static int varint_fuzz() {
   return 0;
 }
 
+static int varint_direct() {
+  uint64_t tests[] = {0, 1, 127, 128, 16383, 16384, 1234567, 0xFFFFFFFFUL, 1UL << 55, 1UL << 56, UINT64_MAX};
+  char buf[VARINT_MAX_LEN + 8];
+  Varint* v = varint_new(VARINT_MAX_LEN);
+  for (unsigned i = 0; i < sizeof(tests)/sizeof(uint64_t); i++) {
+    // Must produce the same bytes as uint_to_varint
+    size_t n = varint_write_u64(buf, tests[i]);
+    uint_to_varint(tests[i], v);
+    assertEqual(n, v->len);
+    assertTrue(memcmp(buf, v->data, n) == 0);
+
+    // Decode both with and without padding after the varint (fast and slow paths)
+    const char* p = buf;
+    assertEqual(varint_read_u64(&p, buf + n), tests[i]);
+    assertEqual(p, buf + n);
+    p = buf;
+    assertEqual(varint_read_u64(&p, buf + sizeof(buf)), tests[i]);
+    assertEqual(p, buf + n);
+
+    int64_t s = (int64_t)tests[i];
+    n = varint_write_i64(buf, s);
+    p = buf;
+    assertEqual(varint_read_i64(&p, buf + n), s);
+  }
+  varint_free(v);
+
+  // Truncated and overlong varints
+  const char* p = "\x81\x82";
+  error_t err = 0;
+  TRY {
+    varint_read_u64(&p, p + 2);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_EOF);
+
+  memset(buf, 0x80, sizeof(buf));
+  p = buf;
+  err = 0;
+  TRY {
+    varint_read_u64(&p, buf + sizeof(buf));
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_MALFORMED);
+  return 0;
+}
+
+static int varint_bulk() {
+  RandomSource* rand = pseudo_random_new(0x1234567812345678);
+  enum { N = 1000 };
+  int64_t* numbers = malloc(N * sizeof(int64_t));
+  int64_t* decoded = malloc(N * sizeof(int64_t));
+  char* data = malloc(N * VARINT_MAX_LEN);
+
+  for (int test_case = 0; test_case < 20; test_case++) {
+    // Mix small and large numbers
+    for (unsigned i = 0; i < N; i++) {
+      int bits = rand_int(rand, 1, 62);
+      numbers[i] = rand_int(rand, -(1L << bits), 1L << bits);
+    }
+    size_t sz = varint_encode_i64_array(data, numbers, N);
+    assertEqual(varint_decode_i64_array(decoded, N, data, sz), sz);
+    assertTrue(memcmp(numbers, decoded, N * sizeof(int64_t)) == 0);
+
+    // Must be compatible with the stream functions
+    Input* in = memory_input_new(data, sz);
+    for (unsigned i = 0; i < N; i++) {
+      assertEqual(io_get_varint(in), numbers[i]);
+    }
+    assertTrue(io_eof(in));
+    call(in, close);
+  }
+
+  call(rand, close);
+  free(numbers);
+  free(decoded);
+  free(data);
+  return 0;
+}
+
+static int varint_streamvbyte() {
+  RandomSource* rand = pseudo_random_new(0x8765432187654321);
+  enum { N = 1003 };
+  uint32_t numbers[N], decoded[N];
+  char data[svb_max_size(N)];
+
+  for (unsigned i = 0; i < N; i++) {
+    int bits = rand_int(rand, 1, 32);
+    numbers[i] = (uint32_t)rand_int(rand, 0, (1L << bits) - 1);
+  }
+  size_t sz = svb_encode_u32(data, numbers, N);
+  assertTrue(sz <= svb_max_size(N));
+  assertEqual(svb_decode_u32(decoded, N, data, sz), sz);
+  assertTrue(memcmp(numbers, decoded, sizeof(numbers)) == 0);
+
+  error_t err = 0;
+  TRY {
+    svb_decode_u32(decoded, N, data, sz - 1);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_EOF);
+
+  // Short arrays of one-byte integers, where the last groups are too close to the end for a
+  // 16-byte load
+  uint32_t small[40];
+  for (unsigned i = 0; i < 40; i++) small[i] = i * 7;
+  for (unsigned n = 0; n <= 40; n++) {
+    size_t len = svb_encode_u32(data, small, n);
+    memset(decoded, 0, sizeof(decoded));
+    assertEqual(svb_decode_u32(decoded, n, data, len), len);
+    assertTrue(memcmp(small, decoded, n * sizeof(uint32_t)) == 0);
+  }
+
+  call(rand, close);
+  return 0;
+}
+
 VLIB_SUITE(varint) = {
   VLIB_TEST(varint_basic),
   VLIB_TEST(varint_signed),
   VLIB_TEST(varint_encoding),
   VLIB_TEST(varint_decoding),
   VLIB_TEST(varint_fuzz),
+  VLIB_TEST(varint_direct),
+  VLIB_TEST(varint_bulk),
+  VLIB_TEST(varint_streamvbyte),
   VLIB_END,
 };
 
@@ -1,6 +1,7 @@
 
 #include <vlib/test.h>
 #include <vlib/vector.h>
+#include <vlib/error.h>
 
 static int vector_basic() {
   Vector v;
@@ -21,7 +22,27 @@ static int vector_basic() {
   return 0;
 }
 
+static int vector_extend_overflow() {
+  Vector v;
+  vector_init(&v, sizeof(int64_t), 4);
+  int64_t* first = vector_extend(&v, 3);
+  first[2] = 1;
+  assertEqual(v.size, 3);
+
+  error_t err = 0;
+  TRY {
+    vector_extend(&v, SIZE_MAX / 8);
+  } CATCH(e) {
+    err = e;
+  } ETRY
+  assertEqual(err, VERR_NOMEM);
+  assertEqual(v.size, 3);
+  vector_close(&v);
+  return 0;
+}
+
 VLIB_SUITE(vector) = {
   VLIB_TEST(vector_basic),
+  VLIB_TEST(vector_extend_overflow),
   VLIB_END,
 };